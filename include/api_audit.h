@@ -0,0 +1,102 @@
+#ifndef API_AUDIT_H
+#define API_AUDIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Binary audit log, written next to access.log by ssh_log_event(). Events
+ * are collected into blocks of up to API_AUDIT_BLOCK bytes, each block
+ * deflated on its own:
+ *
+ *   audit.bin  "SPXAUD01", then per block:
+ *              u32 API_AUDIT_MARKER, u32 raw length, u32 deflated length,
+ *              u32 events, u64 first time, u64 last time, zlib stream
+ *   audit.idx  "SPXAUI01", then one API_AUDIT_ENTRY bytes entry per
+ *              block: u64 block offset, u64 first time, u64 last time,
+ *              u32 events, u32 event types (1 << type), API_AUDIT_BLOOM
+ *              bytes bloom filter of the users, client and server
+ *              addresses and sessions of the block
+ *
+ * An event is varint time since the first of its block (microseconds),
+ * u8 type, varint client port, varint server port and varint length
+ * prefixed client address, server address, user, route and message.
+ * Times are microseconds since the epoch, the rest big endian.
+ *
+ * A query reads the index and inflates only the blocks whose time range,
+ * types and bloom filter can match. A block is indexed once it is
+ * written, blocks a crash left unindexed are found by their markers.
+ * Blocks are written when full and by api_audit_flush(), which the proxy
+ * calls every second. samples/audit.c (taudit) runs the queries.
+ */
+#define API_AUDIT_FILE        "audit.bin"
+#define API_AUDIT_INDEX_FILE  "audit.idx"
+#define API_AUDIT_MAGIC       "SPXAUD01"
+#define API_AUDIT_INDEX_MAGIC "SPXAUI01"
+#define API_AUDIT_MARKER      0x41554442U // "AUDB"
+#define API_AUDIT_BLOCK       (64 * 1024)
+#define API_AUDIT_BLOOM       1024
+#define API_AUDIT_ENTRY       (32 + API_AUDIT_BLOOM)
+
+enum api_audit_type_e {
+	API_AUDIT_OTHER = 0,
+	API_AUDIT_SESSION,   // accepted, closed
+	API_AUDIT_AUTH,      // user authentication, server host key
+	API_AUDIT_ROUTE,
+	API_AUDIT_CHANNEL,   // opened, closed, inspection
+	API_AUDIT_SHELL,     // a command line
+	API_AUDIT_EXEC,
+	API_AUDIT_TRANSFER,  // sftp, scp
+	API_AUDIT_FORWARD,
+	API_AUDIT_DLP,
+	API_AUDIT_TYPES
+};
+
+typedef struct api_audit_event_struct {
+	uint64_t    time;    // microseconds since the epoch
+	int         type;
+	const char *cip;     // client
+	int         cport;
+	const char *sip;     // server
+	int         sport;
+	const char *user;
+	const char *route;
+	const char *message;
+} api_audit_event_t;
+
+typedef struct api_audit_filter_struct {
+	uint64_t    from;    // [from, to), 0 for no bound
+	uint64_t    to;
+	uint32_t    types;   // 1 << type, 0 for all
+	const char *user;    // NULL for any
+	const char *ip;      // client or server address
+	const char *session; // "cip:cport->sip:sport"
+} api_audit_filter_t;
+
+/* an event given to the callback is only valid during the call, a non
+ * zero return stops the query */
+typedef int (*api_audit_cb)(const api_audit_event_t *event, void *arg);
+
+API const char *api_audit_type_name(int type);
+API int  api_audit_type_parse(const char *name);
+
+/* append an event, the files are opened on the first one */
+API void api_audit_log(const api_audit_event_t *event);
+API void api_audit_flush(void);
+API void api_audit_close(void);
+
+/* the events of `fd` (audit.bin) matching `filter`, oldest first, using
+ * the index `index` (audit.idx, -1 for none), returns their number or -1 */
+API int  api_audit_query(int fd, int index, const api_audit_filter_t *filter, api_audit_cb cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! API_AUDIT_H */
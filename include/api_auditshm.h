@@ -0,0 +1,71 @@
+#ifndef API_AUDITSHM_H
+#define API_AUDITSHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "api.h"
+#include "api_audit.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Audit events for local consumers (a SIEM forwarder, a dashboard) in a
+ * shared memory ring. The proxy is the only writer, every event logged
+ * with ssh_log_event() goes to the next of API_AUDITSHM_SLOTS fixed slots
+ * and gets the next sequence number, the oldest one is overwritten.
+ * Consumers map the ring read only and keep their own position, so they
+ * read at their own pace and never slow the proxy down or make it wait:
+ *
+ *   header: "SPXSHM01", u32 slot size, u32 slots, u64 next sequence,
+ *           u32 closed (the proxy is gone, attach again)
+ *   slot:   u64 sequence + 1 (0 while written), u64 time, u16 type,
+ *           u16 client port, u16 server port, 5 x u16 string lengths,
+ *           client address, server address, user, route, message
+ *
+ * in host byte order. A slot is copied out and its sequence read again,
+ * a consumer overtaken by the writer counts the events it lost and goes
+ * on from the oldest one still there. Strings longer than a slot leaves
+ * them are cut.
+ *
+ * The ring is named after the listening port (API_AUDITSHM_NAME). A proxy
+ * taking the port over (see ssh_handoff.h) makes a new ring under the
+ * name, the old one is marked closed once its sessions have drained and
+ * its consumers then attach to the new one.
+ */
+#define API_AUDITSHM_NAME     "/ssh-proxy.%d.audit"
+#define API_AUDITSHM_MAGIC    "SPXSHM01"
+#define API_AUDITSHM_SLOT     1024
+#define API_AUDITSHM_SLOTS    16384        // 16MB
+
+/* the proxy side: create the ring `name`, 0 on success */
+API int  api_auditshm_create(const char *name);
+API void api_auditshm_publish(const api_audit_event_t *event);
+API void api_auditshm_destroy(void);
+
+/* the consumer side */
+typedef struct api_auditshm_reader_struct {
+	void      *ring;
+	size_t     size;
+	uint64_t   next;   // sequence of the next event to read
+	uint64_t   lost;   // events overwritten before they were read
+	char       slot[API_AUDITSHM_SLOT];
+	char       text[API_AUDITSHM_SLOT];
+} api_auditshm_reader_t;
+
+/* map the ring `name`, `oldest` starts at the oldest event still there
+ * instead of the next one, 0 on success */
+API int  api_auditshm_attach(api_auditshm_reader_t *reader, const char *name, int oldest);
+API void api_auditshm_detach(api_auditshm_reader_t *reader);
+
+/* 1 and the next event in `event` (valid until the next call), 0 if there
+ * is none yet, -1 if the proxy closed the ring; `*seq` is its sequence */
+API int  api_auditshm_read(api_auditshm_reader_t *reader, api_audit_event_t *event, uint64_t *seq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! API_AUDITSHM_H */
@@ -0,0 +1,94 @@
+#ifndef API_CAPTURE_H
+#define API_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "api.h"
+#include "api_transfer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Deduplicated capture files for sftp/scp transfers. The data goes to a
+ * writer thread, the event loop only copies it, which cuts it into
+ * content defined chunks (a gear rolling hash, API_CAPTURE_CHUNK_MIN to
+ * API_CAPTURE_CHUNK_MAX bytes, 16KB on average) and keeps each chunk once
+ * in the chunk store, deflated, under its SHA-256:
+ *
+ *   API_CAPTURE_STORE/hh/<the other 62 hex digits of the hash>
+ *
+ * The capture file itself is only the manifest of the transfer:
+ *
+ *   "SPXCAP02"
+ *   entry:  u64 raw offset, u32 raw length, 32 bytes SHA-256
+ *   ...
+ *
+ * Since the boundaries follow the content, the same file sent again, or
+ * again with a few changes, takes up the chunks it did not share only. A
+ * byte range is read back by a binary search of the entries, only the
+ * chunks it touches are inflated and each one is checked against its
+ * hash. An entry is appended once its chunk is in the store, so a capture
+ * cut short (a crash) loses the chunk being cut only. All numbers are big
+ * endian. samples/capture.c (tcapture) extracts them.
+ *
+ * The writer also hashes each transfer whole (SHA-256) and, as the
+ * capture is closed, adds it to the transfer index (see api_transfer.h).
+ * A capture a chunk cannot be written for (a full disk) is dropped: the
+ * rest of its data is discarded, the file removed and not indexed.
+ *
+ * Captures from before the store ("SPXCAP01") are runs of deflated frames
+ * with an index at the end and are still read back.
+ *
+ * The event loop never waits for the writer: past API_CAPTURE_QUEUE_MAX
+ * queued bytes api_capture_write() still queues the data but returns 1,
+ * the caller stops reading the connection it came from until
+ * api_capture_full() is 0 again.
+ *
+ * Without api_capture_start() the calls do the work themselves, as the
+ * tool does.
+ */
+#ifdef _WIN32
+#define API_CAPTURE_STORE     "/runtime/logs/proxy/chunks"
+#else
+#define API_CAPTURE_STORE     "/home/runtime/logs/proxy/chunks"
+#endif
+#define API_CAPTURE_MAGIC     "SPXCAP02"
+#define API_CAPTURE_ENTRY     44
+#define API_CAPTURE_FRAMES_MAGIC "SPXCAP01"
+#define API_CAPTURE_INDEX     "SPXCAPIX"
+#define API_CAPTURE_SUFFIX    ".cap"
+#define API_CAPTURE_CHUNK_MIN (4 * 1024)
+#define API_CAPTURE_CHUNK_MAX (64 * 1024)
+#define API_CAPTURE_LEVEL     1             // Z_BEST_SPEED
+#define API_CAPTURE_QUEUE_MAX (64 * 1024 * 1024) // writes report the queue full beyond it
+
+/* use the chunk store / transfer index at `dir`, before any capture is
+ * opened */
+API void api_capture_store(const char *dir);
+API void api_capture_index(const char *dir);
+
+API int  api_capture_start(void);
+API void api_capture_stop(void);
+
+/* a capture file for the transfer of `path` (direction is an
+ * api_transfer_direction_e), returns its descriptor or -1, as for a
+ * NULL argument */
+API int  api_capture_open(const char *session, const char *username, int direction, const char *path);
+/* 1 if the writer queue is full after this write, see above */
+API int  api_capture_write(int fd, const void *data, size_t len);
+API void api_capture_close(int fd);
+/* 1 while the writer queue is past API_CAPTURE_QUEUE_MAX */
+API int  api_capture_full(void);
+
+/* read `length` bytes from `offset` of the capture `fd` (0 for all of
+ * it) to `out`, returns the number of bytes written or -1 */
+API int64_t api_capture_extract(int fd, uint64_t offset, uint64_t length, int out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! API_CAPTURE_H */
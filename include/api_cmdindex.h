@@ -0,0 +1,118 @@
+#ifndef API_CMDINDEX_H
+#define API_CMDINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Searchable history of the commands run through the proxy: the shell
+ * lines it puts together from the keystrokes and the exec requests. An
+ * indexer thread appends each command to a log and its terms to an
+ * inverted index of segments that are never changed once written, all in
+ * API_CMDINDEX_DIR:
+ *
+ *   commands.dat  "SPXCMD01", then per command u32 length and the record:
+ *                 u64 time, u8 kind, u8 action and u16 length prefixed
+ *                 session, user, host, route and command line
+ *   <n>.seg       "SPXCMS01", u32 level, u32 terms, u64 first and u64
+ *                 last time, u64 start and u64 end of the commands.dat
+ *                 range it indexes, u64 offset of the terms, u64 offset
+ *                 of the term table; then the posting lists, the terms
+ *                 (u8 length prefixed, sorted) and per term an
+ *                 API_CMDINDEX_ENTRY bytes entry: u64 offset of its
+ *                 postings, u32 their number, u32 offset of the term
+ *
+ * A posting is the record offset and time of a command, each a varint of
+ * the difference to the previous posting of the list (the time zigzag
+ * coded, clocks step back). The terms of a command are its words, split
+ * at blanks and shell operators, in lower case and cut to
+ * API_CMDINDEX_TERM bytes, plus the part after the last '/' or '=' of a
+ * word, plus "\001u<user>", "\001h<host>" and "\001h<route>": user and
+ * host filters are posting lists like words.
+ *
+ * The indexer keeps the postings of new commands in memory and writes
+ * them out as a segment of level 0 after API_CMDINDEX_FLUSH_USEC or
+ * API_CMDINDEX_FLUSH_POSTINGS postings; once there are API_CMDINDEX_MERGE
+ * segments of a level, it merges them into one of the next. A segment is
+ * written under a temporary name and renamed, the segments it replaces
+ * are removed after it; a query finding both reads the one covering more.
+ *
+ * A query looks up each word in each segment whose time range it
+ * overlaps (a binary search of the term table), intersects the lists and
+ * reads the matching records only. Commands the segments do not cover
+ * yet, the last ones or those a crash left out, are read from
+ * commands.dat directly, and indexed again by the next indexer. All
+ * numbers are big endian, samples/commands.c (tcommands) runs the
+ * queries.
+ */
+#ifdef _WIN32
+#define API_CMDINDEX_DIR            "/runtime/logs/proxy/commands"
+#else
+#define API_CMDINDEX_DIR            "/home/runtime/logs/proxy/commands"
+#endif
+#define API_CMDINDEX_MAGIC          "SPXCMD01"
+#define API_CMDINDEX_SEGMENT_MAGIC  "SPXCMS01"
+#define API_CMDINDEX_HEADER         64
+#define API_CMDINDEX_ENTRY          16
+#define API_CMDINDEX_TERM           64           // bytes of a word
+#define API_CMDINDEX_WORDS          64           // indexed words of a command
+#define API_CMDINDEX_RECORD_MAX     (32 * 1024)  // with its length
+#define API_CMDINDEX_FLUSH_USEC     (60 * 1000000ULL)
+#define API_CMDINDEX_FLUSH_POSTINGS (256 * 1024)
+#define API_CMDINDEX_MERGE          8
+
+// as ssh_cmdpolicy_e
+enum api_cmdindex_action_e {
+	API_CMDINDEX_PASS = 0,
+	API_CMDINDEX_ALERT,
+	API_CMDINDEX_BLOCK
+};
+
+typedef struct api_cmdindex_command_struct {
+	uint64_t    time;    // microseconds since the epoch, 0 for now
+	int         kind;    // API_AUDIT_SHELL or API_AUDIT_EXEC
+	int         action;
+	const char *session; // "cip:cport->sip:sport"
+	const char *user;
+	const char *host;    // server address
+	const char *route;
+	const char *command;
+} api_cmdindex_command_t;
+
+typedef struct api_cmdindex_filter_struct {
+	const char *words;   // all of them, "word*" for any word starting so
+	const char *user;    // NULL for any
+	const char *host;    // server address or route, NULL for any
+	uint64_t    from;    // [from, to), 0 for no bound
+	uint64_t    to;
+} api_cmdindex_filter_t;
+
+/* a command given to the callback is only valid during the call, a non
+ * zero return stops the query */
+typedef int (*api_cmdindex_cb)(const api_cmdindex_command_t *command, void *arg);
+
+/* use the store at `dir`, before the first command */
+API void api_cmdindex_dir(const char *dir);
+
+API int  api_cmdindex_start(void);
+/* indexes what is left, without api_cmdindex_start() too */
+API void api_cmdindex_stop(void);
+
+/* copies `command`; without api_cmdindex_start() the call indexes it */
+API void api_cmdindex_add(const api_cmdindex_command_t *command);
+
+/* the commands of the store at `dir` matching `filter`, oldest first,
+ * returns their number or -1 (no store, or no words, user or host) */
+API int  api_cmdindex_query(const char *dir, const api_cmdindex_filter_t *filter, api_cmdindex_cb cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! API_CMDINDEX_H */
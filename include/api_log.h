@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
 
@@ -49,7 +50,24 @@ API_DECLARE(int) api_log_trace(log_level_e level, const char *filename, int line
 API_DECLARE(void) api_log_fatal(log_level_e level, const char *fmt,...);
 API_DECLARE(void) api_log_assert(log_level_e level, int exp, const char *exps, const char *filename, int line, const char *function);
 
+/* the wall clock of the calling thread: microseconds since the epoch from
+ * `source` (gettimeofday() if NULL), the proxy sets the time its event loop
+ * cached for the iteration; the formatted second is kept until it changes */
+typedef uint64_t (*api_clock_source_t)(void);
+API void api_clock_source(api_clock_source_t source);
+API uint64_t api_clock_usec(void);
+/* "YYYY/MM/DD HH:MM:SS.uuuuuu" into `buf`, returns its length and the time
+ * in `*usec` if not NULL */
+API size_t api_clock_string(char *buf, size_t size, uint64_t *usec);
+
+/* a formatted line, "\r\n" included, to stdout and access.log */
+API int api_log_access(const char *line, size_t len);
+
+/* `filename` in the log directory of the day, as access.log */
+API int api_logfile_open(const char *filename, int flags);
 API int api_sftpfile_open(const char *username, const char *filename);
+/* as api_sftpfile_open(), the name of the file goes to `sftpfile` */
+API int api_sftpfile_create(const char *username, const char *filename, char *sftpfile, size_t size);
 
 #ifdef __cplusplus
 }
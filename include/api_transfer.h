@@ -0,0 +1,83 @@
+#ifndef API_TRANSFER_H
+#define API_TRANSFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Index of captured transfers: who moved which file, when, and its
+ * SHA-256. The capture writer appends one record per transfer as the
+ * capture is closed, the store in API_TRANSFER_DIR is three files:
+ *
+ *   transfers.dat  "SPXTRD01", then per transfer u32 length and the
+ *                  record: u64 start, u64 end (microseconds since the
+ *                  epoch), u64 size, u8 direction, 32 bytes SHA-256 and
+ *                  u16 length prefixed session, user, remote path and
+ *                  capture file
+ *   transfers.idx  "SPXTRI01", then one API_TRANSFER_ENTRY bytes entry
+ *                  per record: u64 end, u64 record offset, u64 leading
+ *                  bytes of the hash, u32 user key, u32 next entry of the
+ *                  same hash bucket, u32 next entry of the same user
+ *                  bucket, u32 0 (entry numbers are counted from 1)
+ *   transfers.hash "SPXTRH01", then API_TRANSFER_BUCKETS u32 newest
+ *                  entries by hash and as many by user
+ *
+ * Records and entries are only ever appended, the entries in the order
+ * of their end time (the index keeps it through clock steps), so a time
+ * range is a binary search. A lookup by hash or by user walks its bucket
+ * chain from the newest entry and reads the records that match. An entry
+ * is written before its bucket heads, a crash in between loses it from
+ * the chains only. All numbers are big endian, samples/transfer.c
+ * (ttransfer) runs the queries.
+ */
+#ifdef _WIN32
+#define API_TRANSFER_DIR      "/runtime/logs/proxy/transfers"
+#else
+#define API_TRANSFER_DIR      "/home/runtime/logs/proxy/transfers"
+#endif
+#define API_TRANSFER_ENTRY    40
+#define API_TRANSFER_BUCKETS  65536
+
+enum api_transfer_direction_e {
+	API_TRANSFER_UNKNOWN = 0,
+	API_TRANSFER_UPLOAD,
+	API_TRANSFER_DOWNLOAD
+};
+
+typedef struct api_transfer_struct {
+	uint64_t    start;    // microseconds since the epoch
+	uint64_t    end;
+	uint64_t    size;
+	int         direction;
+	uint8_t     hash[32]; // SHA-256 of the data
+	const char *session;  // client ip:port->server ip:port
+	const char *user;
+	const char *path;     // as the client named it
+	const char *capture;  // the capture file holding the data
+} api_transfer_t;
+
+/* a record given to the callback is only valid during the call, a non
+ * zero return stops the lookup */
+typedef int (*api_transfer_cb)(const api_transfer_t *transfer, void *arg);
+
+/* add `transfer` to the store in `dir`, 0 on success */
+API int api_transfer_append(const char *dir, const api_transfer_t *transfer);
+
+/* the lookups return the number of records given to `cb` or -1, hash and
+ * user ones newest first, time ones oldest first */
+API int api_transfer_by_hash(const char *dir, const uint8_t hash[32], api_transfer_cb cb, void *arg);
+API int api_transfer_by_user(const char *dir, const char *user, api_transfer_cb cb, void *arg);
+/* transfers that ended in [from, to) */
+API int api_transfer_by_time(const char *dir, uint64_t from, uint64_t to, api_transfer_cb cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! API_TRANSFER_H */
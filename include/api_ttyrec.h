@@ -0,0 +1,102 @@
+#ifndef API_TTYREC_H
+#define API_TTYREC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "api.h"
+#include "api_vt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Terminal recordings of pty channels, for review. What the server sends
+ * to the client is recorded with its time, and once API_TTYREC_KEYFRAME_USEC
+ * or API_TTYREC_KEYFRAME_BYTES of output went by, the screen at that point
+ * (see api_vt.h) as a keyframe, which is indexed:
+ *
+ *   <name>.tty      "SPXTTY01", then frames:
+ *                   u64 time, u8 kind, u32 length, data
+ *   <name>.tty.idx  "SPXTTI01", then per keyframe:
+ *                   u64 time, u64 offset of its frame
+ *
+ * API_TTYREC_OUTPUT is the bytes as sent, API_TTYREC_RESIZE u16 columns and
+ * u16 rows, API_TTYREC_KEYFRAME u16 columns, u16 rows and the escape
+ * sequences drawing the screen on a cleared terminal, API_TTYREC_END has
+ * no data. The first frame is a keyframe. Times are microseconds since
+ * the epoch, the rest big endian.
+ *
+ * Seeking is a binary search of the index for the last keyframe up to the
+ * time, then no more than one keyframe interval of output replayed from
+ * there; nothing before the keyframe is read. Keyframes the index misses
+ * (the proxy died) are found as the frames are read. samples/playback.c
+ * (tplayback) plays recordings from any point.
+ */
+#define API_TTYREC_MAGIC          "SPXTTY01"
+#define API_TTYREC_INDEX_MAGIC    "SPXTTI01"
+#define API_TTYREC_INDEX_SUFFIX   ".idx"
+#define API_TTYREC_HEADER         13
+#define API_TTYREC_ENTRY          16
+#define API_TTYREC_KEYFRAME_USEC  (10 * 1000000ULL)
+#define API_TTYREC_KEYFRAME_BYTES (128 * 1024)
+#define API_TTYREC_BUFFER         (64 * 1024)
+
+enum api_ttyrec_kind_e {
+	API_TTYREC_OUTPUT = 1,
+	API_TTYREC_RESIZE,
+	API_TTYREC_KEYFRAME,
+	API_TTYREC_END
+};
+
+/* the proxy side, one recording per pty channel */
+typedef struct api_ttyrec_struct api_ttyrec_t;
+
+/* `name` in the sftp directory of `username` (see api_sftpfile_create()),
+ * NULL if it can not be written */
+API api_ttyrec_t *api_ttyrec_open(const char *username, const char *name, int cols, int rows);
+API void api_ttyrec_output(api_ttyrec_t *rec, const void *data, size_t len);
+API void api_ttyrec_resize(api_ttyrec_t *rec, int cols, int rows);
+API const char *api_ttyrec_path(const api_ttyrec_t *rec);
+API void api_ttyrec_close(api_ttyrec_t *rec);
+/* write out the frames the open recordings buffered, every second */
+API void api_ttyrec_flush(void);
+
+/* the player side */
+typedef struct api_ttyrec_frame_struct {
+	uint64_t    time;
+	int         kind;
+	uint32_t    len;
+	const char *data;    // valid until the next call
+} api_ttyrec_frame_t;
+
+typedef struct api_ttyrec_reader_struct {
+	int         fd;
+	int         index;   // -1 without one
+	uint64_t    offset;  // of the next frame
+	uint64_t    start;   // time of the first frame
+	api_vt_t   *vt;      // the screen, after api_ttyrec_seek()
+	char       *data;
+	size_t      size;
+} api_ttyrec_reader_t;
+
+/* `path` and its index, 0 on success */
+API int  api_ttyrec_reader_open(api_ttyrec_reader_t *reader, const char *path);
+API void api_ttyrec_reader_close(api_ttyrec_reader_t *reader);
+
+/* 1 and the next frame, 0 at the end, -1 if the recording is damaged */
+API int  api_ttyrec_next(api_ttyrec_reader_t *reader, api_ttyrec_frame_t *frame);
+
+/* reader->vt shows the screen at `time` and the next frame is the first
+ * after it, 0 on success */
+API int  api_ttyrec_seek(api_ttyrec_reader_t *reader, uint64_t time);
+
+/* time of the last frame and the number of indexed keyframes */
+API int  api_ttyrec_info(api_ttyrec_reader_t *reader, uint64_t *end, uint32_t *keyframes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! API_TTYREC_H */
@@ -0,0 +1,66 @@
+#ifndef API_VT_H
+#define API_VT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The screen of a terminal, as far as playing a recording back needs it:
+ * UTF-8 text with double width characters, the cursor, colors (16, 256
+ * and true colors, kept as the nearest of 256), bold, underline and the
+ * like, scrolling regions, the alternate screen and the DEC line drawing
+ * set. Everything else (title, mouse, bracketed paste, ...) is read and
+ * dropped.
+ *
+ * api_vt_snapshot() writes the escape sequences that draw the screen on a
+ * cleared terminal of the same size, including the main screen behind an
+ * alternate one. Feeding them to a new api_vt_t gives the same screen, so
+ * a snapshot is all a keyframe of api_ttyrec.h holds.
+ */
+#define API_VT_COLS_MAX  1000
+#define API_VT_ROWS_MAX  1000
+
+// cell attributes
+#define API_VT_BOLD      0x01
+#define API_VT_DIM       0x02
+#define API_VT_ITALIC    0x04
+#define API_VT_UNDERLINE 0x08
+#define API_VT_BLINK     0x10
+#define API_VT_REVERSE   0x20
+#define API_VT_HIDDEN    0x40
+#define API_VT_WIDE      0x80     // the right half of a double width character
+
+typedef struct api_vt_cell_struct {
+	uint32_t ch;      // code point, 0 for blank
+	uint16_t fg;      // 0 default, 1 + color
+	uint16_t bg;
+	uint8_t  attr;
+} api_vt_cell_t;
+
+typedef struct api_vt_struct api_vt_t;
+
+API api_vt_t *api_vt_new(int cols, int rows);
+API void api_vt_free(api_vt_t *vt);
+API void api_vt_write(api_vt_t *vt, const void *data, size_t len);
+API void api_vt_resize(api_vt_t *vt, int cols, int rows);
+API void api_vt_size(const api_vt_t *vt, int *cols, int *rows);
+/* the cell at `col`, `row` of the screen shown, NULL out of it */
+API const api_vt_cell_t *api_vt_cell(const api_vt_t *vt, int col, int row);
+
+/* the screen as escape sequences, valid until the next call; `*len` is
+ * their length */
+API const char *api_vt_snapshot(api_vt_t *vt, size_t *len);
+/* the screen as text, one line per row without trailing blanks */
+API const char *api_vt_text(api_vt_t *vt, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! API_VT_H */
@@ -59,6 +59,30 @@ struct ssh_channel_struct {
 	// WANGFENG: proxy
 	char *subsystem;
 	int type;
+	ssh_channel_t *peer; // paired channel on the other leg, no free
+	struct ssh_list_struct *pending; // client messages waiting for the backend reply
+	int      inspect; // see ssh_policy.h, 0 - full
+	int      sched; // see proxy/ssh_packet.h, 0 - not known yet
+	char     bash[1024];
+	uint32_t cmdstate; // see ssh_cmdpolicy.h, automaton state after bash
+	uint32_t cmdgen;
+	int      cmdrule; // strongest rule bash matches, -1 none
+	uint32_t cmdover; // bytes of the line past bash, fed but not kept
+	int      cmdlost; // edited past bash, cmdrule no longer covers the line
+	void    *tty; // terminal recording of a pty, see api_ttyrec.h
+	struct {
+		uint32_t version;
+		char    *filename;
+		int      active; // a file is under way, scanned with or without a capture
+		int      file; // its capture, -1 none
+		uint64_t fsize;
+		uint64_t offset;
+		uint64_t  expect_data;
+		ssh_buffer_t *in_buffer;
+		int       pstate;
+		uint64_t  skip; // rest of an sftp packet over SFTP_PACKET_MAX, relayed unread
+		struct ssh_dlp_stream_struct *dlp; // see ssh_dlp.h, plain memory
+	}sftp;
 };
 
 SSH_PACKET_CALLBACK(ssh_packet_channel_open_conf);
@@ -33,8 +33,10 @@ enum ssh_key_exchange_e {
   SSH_KEX_DH_GROUP14_SHA1,
   /* ecdh-sha2-nistp256 */
   SSH_KEX_ECDH_SHA2_NISTP256,
-  /* curve25519-sha256@libssh.org */
-  SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG
+  /* curve25519-sha256@libssh.org, curve25519-sha256 */
+  SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG,
+  /* diffie-hellman-group-exchange-sha256 */
+  SSH_KEX_DH_GEX_SHA256
 };
 
 typedef struct ssh_crypto_struct {
@@ -48,6 +50,14 @@ typedef struct ssh_crypto_struct {
     ssh_curve25519_privkey curve25519_privkey;
     ssh_curve25519_pubkey curve25519_client_pubkey;
     ssh_curve25519_pubkey curve25519_server_pubkey;
+#endif
+    /* group exchange: the sizes asked for (min and max 0 for the old
+     * request of n only), the group and, of a moduli group, its
+     * Montgomery context (not owned) */
+    uint32_t gex_min, gex_n, gex_max;
+    bignum gex_p, gex_g;
+#ifdef HAVE_LIBCRYPTO
+    BN_MONT_CTX *gex_mont;
 #endif
     ssh_string_t * dh_server_signature; /* information used by dh_handshake. */
     size_t digest_len; /* len of all the fields below */
@@ -74,6 +84,8 @@ typedef struct ssh_crypto_struct {
     ssh_kex_t client_kex;
     char *kex_methods[SSH_KEX_METHODS];
     enum ssh_key_exchange_e kex_type;
+    int kex_guessed; /* our guessed kex packet went out with the KEXINIT */
+    int kex_skip; /* the peer guessed wrong, its next kex packet is ignored */
     enum ssh_mac_e mac_type; /* Mac operations to use for key gen */
 }ssh_crypto_t;
 
@@ -13,6 +13,16 @@ int dh_generate_y(ssh_session_t * session);
 int ssh_crypto_init(void);
 void ssh_crypto_finalize(void);
 
+/* the groups of diffie-hellman-group-exchange-sha256, read once by
+ * ssh_crypto_init() */
+#define SSH_MODULI_FILE "/etc/ssh/moduli"
+#define DH_GEX_MIN 2048
+#define DH_GEX_N   3072
+#define DH_GEX_MAX 8192
+
+int dh_moduli_load(const char *path);
+int dh_gex_choose(ssh_session_t * session, uint32_t min, uint32_t n, uint32_t max);
+
 ssh_string_t * dh_get_e(ssh_session_t * session);
 ssh_string_t * dh_get_f(ssh_session_t * session);
 int dh_import_f(ssh_session_t * session,ssh_string_t * f_string);
@@ -21,6 +31,8 @@ void dh_import_pubkey(ssh_session_t * session,ssh_string_t * pubkey_string);
 int dh_build_k(ssh_session_t * session);
 int ssh_client_dh_init(ssh_session_t * session);
 int ssh_client_dh_reply(ssh_session_t * session, ssh_buffer_t * packet);
+int ssh_client_dh_gex_request(ssh_session_t * session);
+int ssh_client_dh_gex_group(ssh_session_t * session, ssh_buffer_t * packet);
 
 int make_sessionid(ssh_session_t * session);
 /* add data for the final cookie */
@@ -15,6 +15,7 @@
 
 SSH_API int ssh_client_ecdh_init(ssh_session_t * session);
 SSH_API int ssh_client_ecdh_reply(ssh_session_t * session, ssh_buffer_t * packet);
+SSH_API void ssh_client_ecdh_reset(ssh_session_t * session);
 
 #ifdef WITH_SERVER
 SSH_API int ssh_server_ecdh_init(ssh_session_t * session, ssh_buffer_t * packet);
@@ -9,6 +9,7 @@
 struct ssh_kex_struct {
     unsigned char cookie[16];
     char *methods[SSH_KEX_METHODS];
+    uint8_t first_kex_follows; /* a guessed kex packet follows the KEXINIT */
 };
 
 SSH_PACKET_CALLBACK(ssh_packet_kexinit);
@@ -20,6 +21,10 @@ SSH_API int ssh_send_kex(ssh_session_t * session, int server_kex);
 SSH_API void ssh_list_kex(ssh_kex_t *kex);
 SSH_API int set_client_kex(ssh_session_t * session);
 SSH_API int ssh_kex_select_methods(ssh_session_t * session);
+SSH_API int ssh_kex_guess_ok(ssh_session_t * session);
+SSH_API int ssh_kex_guess_client(ssh_session_t * session);
+SSH_API void ssh_kex_guess_banner(ssh_session_t * session);
+SSH_API void ssh_kex_guess_learn(ssh_session_t * session);
 SSH_API int verify_existing_algo(int algo, const char *name);
 SSH_API char **space_tokenize(const char *chain);
 SSH_API int ssh_get_kex1(ssh_session_t * session);
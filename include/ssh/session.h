@@ -14,6 +14,10 @@
 #define SSH_SESSION_CLIENT  (1)
 #define SSH_SESSION_SERVER  (2)
 
+// WANGFENG: read_held, a leg reads again once nothing holds it
+#define SSH_HELD_OUTPUT     (0x01) // until the partner's output drains
+#define SSH_HELD_CAPTURE    (0x02) // until the capture writer catches up
+
 /* These are the different states a SSH session can be into its life */
 enum ssh_session_state_e {
 	SSH_SESSION_STATE_NONE=0,
@@ -31,6 +35,7 @@ enum ssh_session_state_e {
 
 enum ssh_dh_state_e {
   DH_STATE_INIT=0,
+  DH_STATE_GROUP_SENT, /* group exchange: request sent, or group sent by the server */
   DH_STATE_INIT_SENT,
   DH_STATE_NEWKEYS_SENT,
   DH_STATE_FINISHED
@@ -55,6 +60,9 @@ enum ssh_pending_call_e {
 /* Client successfully authenticated */
 #define SSH_SESSION_FLAG_AUTHENTICATED 2
 
+/* Our KEXINIT went out with the banner, not after the peer's banner */
+#define SSH_SESSION_FLAG_KEXINIT_SENT 4
+
 /* codes to use with ssh_handle_packets*() */
 /* Infinite timeout */
 #define SSH_TIMEOUT_INFINITE -1
@@ -189,21 +197,38 @@ struct ssh_session_struct {
 	// WANGFENG: data send
 	void    *evbuffer;
 	char    *username;
-	char     bash[1024];
-	ssh_channel_t *chan;
+	// WANGFENG: called for each open confirmation/failure and channel request
+	// reply as it is read, a read may carry several of them
+	void     (*channel_reply)(ssh_session_t *session, uint8_t command, ssh_channel_t *channel);
 	ssh_message_t *msg;
+	struct ssh_list_struct *pending; // global requests waiting for the server reply
+	// WANGFENG: called for each REQUEST_SUCCESS/FAILURE as it is read, with
+	// the port a tcpip-forward to port 0 was bound to
+	void     (*global_reply)(ssh_session_t *session, uint8_t command, uint32_t bound_port);
 	const char *direct; // ip route
 	int      (*data_send)(ssh_session_t *session, uint8_t command,const void* data, int len);
-	struct {
-		uint32_t version;
-		char    *filename;
-		int      file;
-		uint64_t fsize;
-		uint64_t offset;
-		uint64_t  expect_data;
-		ssh_buffer_t *in_buffer;
-		int       pstate;
-	}sftp;
+	// WANGFENG: packet recorder, see proxy/ssh_record.h
+	int      record;
+	void     (*newkeys_notify)(ssh_session_t *session);
+	// WANGFENG: login routing, see include/ssh_route.h
+	int      route; // SSH_ROUTE_NONE: server connected at accept
+	int      (*route_connect)(ssh_session_t *session, const char *target);
+	// WANGFENG: server host key, checked once the key exchange is done
+	int      (*hostkey_check)(ssh_session_t *session);
+	// WANGFENG: bandwidth shaping of this leg, see include/ssh_shaper.h
+	void    *shaper;
+	int      read_held; // SSH_HELD_*, why reads are stopped
+	// WANGFENG: capture backpressure, see include/api_capture.h
+	int      capture_full; // a capture write of this read found the queue full
+	void    *capture_tick; // struct event, polls the queue while held
+	// WANGFENG: write scheduling class, see proxy/ssh_packet.h
+	int      sched;
+	void     (*sched_update)(ssh_session_t *session);
+	// WANGFENG: "cip:cport->sip:sport,user,direct," of ssh_log(), see ssh_log_reset()
+	char     log_prefix[192];
+	uint16_t log_head; // length up to the user, 0 to build it again
+	uint16_t log_len;
+	const char *log_direct;
 };
 
 /** @internal
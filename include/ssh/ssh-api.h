@@ -429,7 +429,11 @@ SSH_API void _ssh_log(int verbosity,
                          const char *function,
                          const char *format, ...) PRINTF_ATTRIBUTE(3, 4);
 
-SSH_API int ssh_log(ssh_session_t *session, const char *format, ...);
+SSH_API int ssh_log(ssh_session_t *session, const char *format, ...) PRINTF_ATTRIBUTE(2, 3);
+/* as ssh_log(), `type` is an api_audit_type_e, see api_audit.h */
+SSH_API int ssh_log_event(ssh_session_t *session, int type, const char *format, ...) PRINTF_ATTRIBUTE(3, 4);
+/* the addresses or the user of `session` changed, its log prefix is built again */
+SSH_API void ssh_log_reset(ssh_session_t *session);
 
 /* legacy */
 SSH_DEPRECATED SSH_API void _ssh_log2(ssh_session_t * session,
@@ -0,0 +1,48 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2014 by Wang Feng
+ *
+ */
+
+#ifndef SSH_PROXY_ACM_H
+#define SSH_PROXY_ACM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Aho-Corasick multi-pattern matcher for literal byte strings. The
+ * failure links are folded into a full transition table over the bytes
+ * the patterns use, so a stream is scanned at one table lookup per byte
+ * and its state is a single integer carried from chunk to chunk. Outside
+ * of a partial match the scan skips ahead to the next byte a pattern
+ * starts with, with memchr(3) when they all start with the same one.
+ *
+ * Of several patterns matching, the one with the higher rank wins, then
+ * the one given first.
+ */
+typedef struct ssh_acm_struct ssh_acm_t;
+
+/* NULL on no memory, `count` may be 0 */
+ssh_acm_t *ssh_acm_new(char * const *patterns, const int *rank, int count);
+void ssh_acm_free(ssh_acm_t *acm);
+
+uint32_t ssh_acm_states(const ssh_acm_t *acm);
+
+/* advance `*state` (0 to start) over `len` bytes, returns the winner of
+ * `match` and the patterns matched on the way, -1 for none */
+int ssh_acm_feed(const ssh_acm_t *acm, uint32_t *state, int match, const void *data, size_t len);
+
+/* the winner of two pattern indexes, -1 for none */
+int ssh_acm_better(const ssh_acm_t *acm, int a, int b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! SSH_PROXY_ACM_H */
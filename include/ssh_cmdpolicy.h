@@ -0,0 +1,87 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2014 by Wang Feng
+ *
+ */
+
+#ifndef SSH_PROXY_CMDPOLICY_H
+#define SSH_PROXY_CMDPOLICY_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Command policy for shells and exec requests. SSH_CMDPOLICY_FILE holds one
+ * rule per line, an action and the rest of the line as a literal pattern:
+ *
+ *   # action  pattern
+ *   block     rm -rf /
+ *   block     mkfs
+ *   alert     sudo su
+ *
+ * A command matches a rule when the pattern occurs anywhere in it. Of the
+ * rules a command matches, a block rule wins over an alert rule and the
+ * earlier rule wins over a later one with the same action.
+ *
+ * All patterns are compiled into one Aho-Corasick automaton (ssh_acm.h),
+ * so the shell line the client types is scanned as its bytes arrive at
+ * one table lookup per byte. A line ends as the tty line discipline ends
+ * it, on CR, and on LF or ^D after something was typed. A blocked line
+ * never gets that byte: the server is sent a Ctrl-C instead and the
+ * client a notice. A blocked
+ * exec request is refused. Alerts are logged, the command runs.
+ *
+ * Bytes past the line buffer are still scanned, but a line edited or
+ * rescanned there cannot be checked anymore and is blocked as long as
+ * there are rules. Exec requests are checked on every channel, shell
+ * lines on the channels the inspection policy (ssh_policy.h) does not
+ * put at none.
+ *
+ * kill -HUP recompiles the rules, shells in the middle of a line rescan it.
+ */
+#ifdef _WIN32
+#define SSH_CMDPOLICY_FILE "/runtime/etc/ssh/commands.conf"
+#else
+#define SSH_CMDPOLICY_FILE "/home/runtime/etc/ssh/commands.conf"
+#endif
+
+enum ssh_cmdpolicy_e {
+	SSH_CMDPOLICY_PASS = 0,
+	SSH_CMDPOLICY_ALERT,
+	SSH_CMDPOLICY_BLOCK
+};
+
+/* replace the automaton with `filename`, returns the number of rules or -1 */
+int  ssh_cmdpolicy_load(const char *filename);
+void ssh_cmdpolicy_free(void);
+
+/* rules loaded, 0 without a file */
+int  ssh_cmdpolicy_count(void);
+
+/* changes with every load, a state of another generation is stale */
+uint32_t ssh_cmdpolicy_generation(void);
+
+/* advance `*state` (0 to start) over `len` bytes, returns the strongest
+ * of `rule` and the rules matched on the way, -1 for none */
+int  ssh_cmdpolicy_feed(uint32_t *state, int rule, const void *data, uint32_t len);
+
+/* strongest rule `command` matches or -1 */
+int  ssh_cmdpolicy_check(const char *command);
+
+/* 1 if the shell keystroke `ch` ends the line, `typed` says the line is
+ * not empty */
+int  ssh_cmdpolicy_enter(char ch, int typed);
+
+/* of a rule returned above, valid until the next load */
+int  ssh_cmdpolicy_action(int rule);
+const char *ssh_cmdpolicy_pattern(int rule);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! SSH_PROXY_CMDPOLICY_H */
@@ -0,0 +1,53 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2014 by Wang Feng
+ *
+ */
+
+#ifndef SSH_PROXY_HANDOFF_H
+#define SSH_PROXY_HANDOFF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Listener handoff for upgrades without dropping sessions. Every proxy
+ * serves SSH_HANDOFF_FILE (formatted with its listen port). A new proxy
+ * started on the same port first asks there for the listening socket,
+ * it is passed with SCM_RIGHTS. SSH_HANDOFF_DIR is made 0700 and must
+ * belong to the proxy user, and the socket is given only to a peer of
+ * the same user or root (SO_PEERCRED). The old proxy stops accepting, lets its
+ * sessions finish and exits once the last one is gone, or after
+ * SSH_DRAIN_TIMEOUT seconds with whatever is still open.
+ *
+ *   ssh-proxy.new 0.0.0.0:10022 192.168.1.110:22 &   # old one drains
+ *
+ * kill -HUP reloads host keys, routes, shaping, the inspection, command
+ * and content policies in place. Sessions already open keep what they
+ * started with, except for the command and content rules which apply at
+ * once.
+ */
+#ifdef _WIN32
+#define SSH_HANDOFF_DIR  "/runtime/run"
+#else
+#define SSH_HANDOFF_DIR  "/home/runtime/run"
+#endif
+#define SSH_HANDOFF_FILE SSH_HANDOFF_DIR "/ssh-proxy.%d.sock"
+#define SSH_DRAIN_TIMEOUT 3600
+
+/* listening socket of a running proxy at `path`, -1 if there is none */
+int ssh_handoff_take(const char *path);
+
+/* serve `path`, returns the unix socket to watch for a successor or -1 */
+int ssh_handoff_open(const char *path);
+
+/* accept the successor on `server` and pass `fd` to it, 0 on success */
+int ssh_handoff_give(int server, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! SSH_PROXY_HANDOFF_H */
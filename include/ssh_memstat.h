@@ -0,0 +1,57 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2014 by Wang Feng
+ *
+ */
+
+#ifndef SSH_PROXY_MEMSTAT_H
+#define SSH_PROXY_MEMSTAT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Memory statistics of the proxy process. On SIGUSR1 the proxy rewrites
+ * SSH_MEMSTAT_FILE (formatted with its pid, mode 0600) with one "name value" pair
+ * per line, samples/memload.c reads it back:
+ *
+ *   sessions_live   proxied connections currently open
+ *   sessions_total  proxied connections accepted since start
+ *   rss_kb          resident set size, from /proc/self/statm
+ *   heap_inuse      bytes handed out by malloc (mallinfo2 uordblks + hblkhd)
+ *   heap_arena      bytes obtained from the system by malloc
+ *   heap_free       free bytes held by malloc
+ *   seq             incremented on every dump
+ */
+#define SSH_MEMSTAT_FILE "/tmp/ssh-proxy.%d.mem"
+
+typedef struct ssh_memstat_struct {
+	uint64_t sessions_live;
+	uint64_t sessions_total;
+	uint64_t rss_kb;
+	uint64_t heap_inuse;
+	uint64_t heap_arena;
+	uint64_t heap_free;
+	uint64_t seq;
+} ssh_memstat_t;
+
+void ssh_memstat_session_open(void);
+void ssh_memstat_session_close(void);
+
+/* fill `stat` for the calling process */
+void ssh_memstat_get(ssh_memstat_t *stat);
+/* write SSH_MEMSTAT_FILE for the calling process, 0 on success */
+int  ssh_memstat_dump(void);
+/* read the file of process `pid`, 0 on success */
+int  ssh_memstat_load(pid_t pid, ssh_memstat_t *stat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! SSH_PROXY_MEMSTAT_H */
@@ -0,0 +1,71 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2014 by Wang Feng
+ *
+ */
+
+#ifndef SSH_PROXY_POLICY_H
+#define SSH_PROXY_POLICY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Inspection policy. Decides, once per channel when the shell, exec or
+ * subsystem request arrives, how much of the channel the proxy looks at:
+ *
+ *   full      sftp/scp files are captured, ptys recorded, shell lines
+ *             and sftp/scp file names and sizes logged
+ *   metadata  as full without the captures and the pty recording: the
+ *             request, shell lines and file names and sizes are logged,
+ *             command and DLP rules apply
+ *   none      nothing is logged, straight relay: shell lines are not
+ *             checked against the command rules (exec requests still
+ *             are), transfers not against the DLP rules
+ *
+ * SSH_POLICY_FILE holds one rule per line, the first matching rule wins
+ * and a channel no rule matches is fully inspected:
+ *
+ *   # user    group   target          kind   inspect
+ *   deploy    *       *               *      none
+ *   *         ops     10.1.*          sftp   metadata
+ *   *         *       10.1.2.3:2222   shell  full
+ *
+ * user, group and target are fnmatch(3) patterns, target is matched
+ * against the server address with an optional ":port". kind is one of
+ * shell, exec, scp, sftp (or another subsystem name). group is checked
+ * against the groups of the user on the proxy host, which costs an NSS
+ * lookup, so it is only done for rules that name a group.
+ */
+#ifdef _WIN32
+#define SSH_POLICY_FILE "/runtime/etc/ssh/inspect.conf"
+#else
+#define SSH_POLICY_FILE "/home/runtime/etc/ssh/inspect.conf"
+#endif
+
+/* zero, the value of a new channel, is full inspection */
+enum ssh_inspect_e {
+	SSH_INSPECT_FULL = 0,
+	SSH_INSPECT_METADATA,
+	SSH_INSPECT_NONE
+};
+
+/* replace the rule table with `filename`, returns the number of rules or -1 */
+int  ssh_policy_load(const char *filename);
+void ssh_policy_free(void);
+
+/* inspection level for a channel of `user` to `target`:`port` */
+int  ssh_policy_inspect(const char *user, const char *target, int port, const char *kind);
+
+const char *ssh_inspect_name(int level);
+
+/* 1 if `user` is in a group matching `pattern` on the proxy host */
+int  ssh_policy_in_group(const char *user, const char *pattern);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! SSH_PROXY_POLICY_H */
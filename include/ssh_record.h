@@ -0,0 +1,56 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2014 by Wang Feng
+ *
+ */
+
+#ifndef SSH_PROXY_RECORD_H
+#define SSH_PROXY_RECORD_H
+
+#include "ssh_adapter.h"
+#include "ssh/crypto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Raw packet stream recorder. The proxy writes one file per accepted
+ * connection when it is built with DEBUG_CRYPTO, samples/replay.c reads
+ * it back.
+ *
+ *   file    := magic record*
+ *   magic   := "SSHREC01"
+ *   record  := uint8 type, uint8 leg, uint32 length, byte[length]
+ *
+ * leg is the ssh_session_t type of the receiving session, so
+ * SSH_SESSION_CLIENT is the client->proxy stream and SSH_SESSION_SERVER
+ * the server->proxy stream. Integers are in network byte order.
+ *
+ * SSH_RECORD_DATA carries the ciphertext exactly as read from the socket.
+ * SSH_RECORD_KEYS carries the inbound crypto installed by SSH2_MSG_NEWKEYS
+ * on that leg, before anything was decrypted with it:
+ *   string cipher (zero terminated), string key, string IV, string MAC key, uint32 digest_len
+ */
+#define SSH_RECORD_MAGIC     "SSHREC01"
+#define SSH_RECORD_MAGIC_LEN 8
+#define SSH_RECORD_HDR_LEN   6
+
+#define SSH_RECORD_DATA      1
+#define SSH_RECORD_KEYS      2
+
+#ifdef DEBUG_CRYPTO
+int  ssh_record_open(ssh_session_t *session_in, ssh_session_t *session_out);
+void ssh_record_data(ssh_session_t *session, const void *data, uint32_t len);
+void ssh_record_keys(ssh_session_t *session);
+void ssh_record_close(ssh_session_t *session);
+#endif
+
+ssh_crypto_t *ssh_record_keys_load(const void *data, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! SSH_PROXY_RECORD_H */
@@ -0,0 +1,73 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2014 by Wang Feng
+ *
+ */
+
+#ifndef SSH_PROXY_ROUTE_H
+#define SSH_PROXY_ROUTE_H
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Login routing. With a route table one listener serves many servers: the
+ * client names the server in its login, either
+ *
+ *   ssh user@target@proxy      (login "user@target")
+ *   ssh user%target@proxy      (login "user%target")
+ *
+ * and the proxy connects to it when the first USERAUTH_REQUEST arrives,
+ * the server sees the plain "user". SSH_ROUTE_FILE holds one route per
+ * line:
+ *
+ *   # target          address[:port]
+ *   db1               10.1.2.3
+ *   *.lab             10.9.0.1:2222
+ *   *                 192.168.1.110:22
+ *
+ * A target is looked up as is, then as "*.suffix" for every dot in it
+ * from the left, then as "*". Addresses are numeric, nothing is resolved
+ * on the event loop. Without the file (or with an empty one) the proxy
+ * connects every session to the address on its command line as before.
+ */
+#ifdef _WIN32
+#define SSH_ROUTE_FILE "/runtime/etc/ssh/route.conf"
+#else
+#define SSH_ROUTE_FILE "/home/runtime/etc/ssh/route.conf"
+#endif
+
+/* session->route, where a routed session is */
+enum ssh_route_e {
+	SSH_ROUTE_NONE = 0, // not routed, or no route table
+	SSH_ROUTE_LOGIN,    // waiting for the login name
+	SSH_ROUTE_CONNECT,  // connecting, key exchange with the server
+	SSH_ROUTE_SERVICE,  // ssh-userauth requested from the server
+	SSH_ROUTE_DONE      // relaying as an unrouted session
+};
+
+/* replace the route table with `filename`, returns the number of routes or -1 */
+int  ssh_route_load(const char *filename);
+void ssh_route_free(void);
+int  ssh_route_count(void);
+
+/* cut "user@target" or "user%target" at the separator, returns target or NULL */
+char *ssh_route_split(char *login);
+
+/* address of `target`, 0 on success, -1 if no route matches */
+int  ssh_route_lookup(const char *target, struct sockaddr_storage *addr, int *addrlen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! SSH_PROXY_ROUTE_H */
@@ -0,0 +1,74 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2014 by Wang Feng
+ *
+ */
+
+#ifndef SSH_PROXY_SHAPER_H
+#define SSH_PROXY_SHAPER_H
+
+#include <stdint.h>
+
+#include "ssh/ssh-api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bandwidth shaping per user and per group. SSH_SHAPER_FILE holds one
+ * rule per line, rates in KB/s and bursts in KB:
+ *
+ *   # kind   name   rate    burst
+ *   group    ops    20480   2048
+ *   user     bob    4096    512
+ *   user     *      8192    1024
+ *
+ * A session gets the bucket of the first user rule matching its user
+ * (one bucket per user, shared by all of its sessions) below the bucket
+ * of the first group rule the user is a member of (one bucket per group).
+ * Bytes read on either leg are charged to both, a leg that overdraws one
+ * stops reading and waits in that bucket's queue. Waiting legs are woken
+ * in turn as tokens come back and the overdraft of each read stays with
+ * the bucket, so sessions sharing a bucket get deficit round robin shares.
+ * A leg reads again only when neither the shaper nor anything in
+ * session->read_held (the output watermark of its partner, the capture
+ * queue) holds it.
+ *
+ * kill -HUP reloads the rules, buckets keep their state. kill -USR1
+ * writes SSH_SHAPER_STAT_FILE (formatted with the pid, mode 0600), one line per
+ * bucket: name, rate, tokens, bytes, throttled (times a leg had to wait)
+ * and waiting (legs waiting now).
+ */
+#ifdef _WIN32
+#define SSH_SHAPER_FILE "/runtime/etc/ssh/shaper.conf"
+#else
+#define SSH_SHAPER_FILE "/home/runtime/etc/ssh/shaper.conf"
+#endif
+#define SSH_SHAPER_STAT_FILE "/tmp/ssh-proxy.%d.shaper"
+
+struct event_base;
+
+/* replace the rules with `filename`, returns the number of rules or -1 */
+int  ssh_shaper_load(struct event_base *base, const char *filename);
+void ssh_shaper_free(void);
+
+/* shape both legs of an authenticated session, the client one is given */
+void ssh_shaper_attach(ssh_session_t *session);
+void ssh_shaper_detach(ssh_session_t *session);
+
+/* `len` bytes were read on the leg of `session` */
+void ssh_shaper_charge(ssh_session_t *session, uint32_t len);
+
+/* 1 while the leg of `session` waits for tokens */
+int  ssh_shaper_queued(ssh_session_t *session);
+
+/* write SSH_SHAPER_STAT_FILE, 0 on success */
+int  ssh_shaper_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! SSH_PROXY_SHAPER_H */
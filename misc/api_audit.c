@@ -0,0 +1,512 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <zlib.h>
+
+#include "api_log.h"
+#include "api_misc.h"
+#include "api_hashtable.h"
+#include "api_audit.h"
+
+#define AUDIT_HEADER     32
+#define AUDIT_EVENT_MAX  (8 * 1024)  // longer strings are cut
+#define AUDIT_RAW_MAX    (API_AUDIT_BLOCK + AUDIT_EVENT_MAX)
+#define AUDIT_BLOOM_BITS (API_AUDIT_BLOOM * 8)
+
+static const char *audit_types[API_AUDIT_TYPES] = {
+	"other", "session", "auth", "route", "channel", "shell", "exec", "transfer", "forward", "dlp"
+};
+
+// the block being filled, only the event loop logs
+static int audit_fd = -1;
+static int audit_index = -1;
+static int audit_failed = 0;
+static uint8_t *audit_raw = NULL;
+static uint8_t *audit_out = NULL;
+static size_t audit_rawlen = 0;
+static uint32_t audit_count = 0;
+static uint32_t audit_mask = 0;
+static uint64_t audit_first = 0;
+static uint64_t audit_last = 0;
+static uint8_t audit_bloom[API_AUDIT_BLOOM];
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+	put_u32(p, (uint32_t)(v >> 32));
+	put_u32(p + 4, (uint32_t)v);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+	return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static size_t put_varint(uint8_t *p, uint64_t v)
+{
+	size_t n = 0;
+
+	while(v >= 0x80) {
+		p[n++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (uint8_t)v;
+	return n;
+}
+
+// 0 if the varint at `*at` runs past `end`
+static int get_varint(const uint8_t *p, size_t *at, size_t end, uint64_t *v)
+{
+	int shift = 0;
+
+	*v = 0;
+	while(*at < end && shift < 64) {
+		*v |= (uint64_t)(p[*at] & 0x7f) << shift;
+		if((p[(*at)++] & 0x80) == 0) {
+			return 1;
+		}
+		shift += 7;
+	}
+	return 0;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	ssize_t n = 0;
+
+	while(len > 0) {
+		n = write(fd, p, len);
+		if(n <= 0) {
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int read_at(int fd, uint64_t offset, void *data, size_t len)
+{
+	uint8_t *p = data;
+	ssize_t n = 0;
+
+	if(lseek(fd, (off_t)offset, SEEK_SET) == (off_t)-1) {
+		return -1;
+	}
+	while(len > 0) {
+		n = read(fd, p, len);
+		if(n <= 0) {
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+const char *api_audit_type_name(int type)
+{
+	return type >= 0 && type < API_AUDIT_TYPES ? audit_types[type] : audit_types[API_AUDIT_OTHER];
+}
+
+int api_audit_type_parse(const char *name)
+{
+	int i = 0;
+
+	for(i = 0; i < API_AUDIT_TYPES; i++) {
+		if(strcmp(name, audit_types[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+//----------------< the bloom filter of a block >----------------
+
+static void audit_bloom_bits(const char *key, uint32_t bits[3])
+{
+	uint64_t h[2];
+	int i = 0;
+
+	MurmurHash3_x64_128(key, (int)strlen(key), 0, h);
+	for(i = 0; i < 3; i++) {
+		bits[i] = (uint32_t)((h[0] + i * h[1]) % AUDIT_BLOOM_BITS);
+	}
+}
+
+static void audit_bloom_add(uint8_t *bloom, const char *key)
+{
+	uint32_t bits[3];
+	int i = 0;
+
+	audit_bloom_bits(key, bits);
+	for(i = 0; i < 3; i++) {
+		bloom[bits[i] / 8] |= 1 << (bits[i] % 8);
+	}
+}
+
+static int audit_bloom_has(const uint8_t *bloom, const char *key)
+{
+	uint32_t bits[3];
+	int i = 0;
+
+	audit_bloom_bits(key, bits);
+	for(i = 0; i < 3; i++) {
+		if((bloom[bits[i] / 8] & (1 << (bits[i] % 8))) == 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void audit_session(char *buf, size_t size, const api_audit_event_t *e)
+{
+	snprintf(buf, size, "%s:%d->%s:%d", e->cip, e->cport, e->sip, e->sport);
+}
+
+//----------------< the writer side >----------------
+
+static int audit_open_file(const char *name, const char *magic)
+{
+	char head[8];
+	int fd = api_logfile_open(name, O_RDWR|O_CREAT|O_APPEND);
+
+	if(fd < 0) {
+		return -1;
+	}
+	if(lseek(fd, 0, SEEK_END) == 0) {
+		if(write_all(fd, magic, 8) == 0) {
+			return fd;
+		}
+	} else if(read_at(fd, 0, head, 8) == 0 && memcmp(head, magic, 8) == 0) {
+		return fd;
+	}
+	trace_err("audit %s: not an audit file", name);
+	close(fd);
+	return -1;
+}
+
+static int audit_open(void)
+{
+	if(audit_fd >= 0) {
+		return 0;
+	}
+	if(audit_failed) {
+		return -1;
+	}
+	audit_raw = malloc(AUDIT_RAW_MAX);
+	audit_out = malloc(AUDIT_HEADER + compressBound(AUDIT_RAW_MAX));
+	audit_fd = audit_open_file(API_AUDIT_FILE, API_AUDIT_MAGIC);
+	audit_index = audit_open_file(API_AUDIT_INDEX_FILE, API_AUDIT_INDEX_MAGIC);
+	if(audit_raw == NULL || audit_out == NULL || audit_fd < 0 || audit_index < 0) {
+		// once, not at every event
+		audit_failed = 1;
+		api_audit_close();
+		return -1;
+	}
+	return 0;
+}
+
+void api_audit_flush(void)
+{
+	uint8_t entry[API_AUDIT_ENTRY];
+	uLongf clen = 0;
+	off_t at = 0;
+
+	if(audit_fd < 0 || audit_count == 0) {
+		return;
+	}
+	clen = compressBound(AUDIT_RAW_MAX);
+	if(compress2(audit_out + AUDIT_HEADER, &clen, audit_raw, audit_rawlen, 1) == Z_OK) {
+		put_u32(audit_out, API_AUDIT_MARKER);
+		put_u32(audit_out + 4, audit_rawlen);
+		put_u32(audit_out + 8, clen);
+		put_u32(audit_out + 12, audit_count);
+		put_u64(audit_out + 16, audit_first);
+		put_u64(audit_out + 24, audit_last);
+		at = lseek(audit_fd, 0, SEEK_END);
+		// the block first, an index entry never points past the file
+		if(at >= 8 && write_all(audit_fd, audit_out, AUDIT_HEADER + clen) == 0) {
+			put_u64(entry, at);
+			put_u64(entry + 8, audit_first);
+			put_u64(entry + 16, audit_last);
+			put_u32(entry + 24, audit_count);
+			put_u32(entry + 28, audit_mask);
+			memcpy(entry + 32, audit_bloom, API_AUDIT_BLOOM);
+			if(write_all(audit_index, entry, sizeof(entry)) != 0) {
+				trace_err("audit index: %s", strerror(errno));
+			}
+		} else {
+			trace_err("audit: %s, %u events lost", strerror(errno), audit_count);
+		}
+	}
+	audit_rawlen = 0;
+	audit_count = 0;
+	audit_mask = 0;
+	memset(audit_bloom, 0x00, sizeof(audit_bloom));
+}
+
+void api_audit_close(void)
+{
+	api_audit_flush();
+	if(audit_fd >= 0) {
+		close(audit_fd);
+		audit_fd = -1;
+	}
+	if(audit_index >= 0) {
+		close(audit_index);
+		audit_index = -1;
+	}
+	SAFE_FREE(audit_raw);
+	SAFE_FREE(audit_out);
+}
+
+static size_t audit_put_string(uint8_t *p, const char *s, size_t max)
+{
+	size_t len = s == NULL ? 0 : strlen(s), n = 0;
+
+	if(len > max) {
+		len = max;
+	}
+	n = put_varint(p, len);
+	if(len > 0) {
+		memcpy(p + n, s, len);
+	}
+	return n + len;
+}
+
+void api_audit_log(const api_audit_event_t *event)
+{
+	const char *strings[5] = {event->cip, event->sip, event->user, event->route, event->message};
+	char session[160];
+	uint8_t *p = NULL;
+	size_t n = 0;
+	int i = 0;
+
+	if(audit_open() != 0) {
+		return;
+	}
+	if(audit_rawlen > 0 && (audit_rawlen >= API_AUDIT_BLOCK || event->time < audit_first)) {
+		api_audit_flush();
+	}
+	if(audit_count == 0) {
+		audit_first = event->time;
+	}
+	p = audit_raw + audit_rawlen;
+	n = put_varint(p, event->time - audit_first);
+	p[n++] = (uint8_t)event->type;
+	n += put_varint(p + n, (uint32_t)event->cport);
+	n += put_varint(p + n, (uint32_t)event->sport);
+	for(i = 0; i < 5; i++) {
+		// the message gets what the addresses and names leave
+		n += audit_put_string(p + n, strings[i], i < 4 ? 255 : AUDIT_EVENT_MAX - 40 - 4 * 257);
+	}
+	audit_rawlen += n;
+	audit_count++;
+	audit_last = event->time > audit_last ? event->time : audit_last;
+	audit_mask |= 1U << (event->type & 31);
+	if(event->user != NULL) {
+		audit_bloom_add(audit_bloom, event->user);
+	}
+	if(event->cip != NULL && event->sip != NULL) {
+		audit_bloom_add(audit_bloom, event->cip);
+		audit_bloom_add(audit_bloom, event->sip);
+		audit_session(session, sizeof(session), event);
+		audit_bloom_add(audit_bloom, session);
+	}
+	if(audit_rawlen >= API_AUDIT_BLOCK) {
+		api_audit_flush();
+	}
+}
+
+//----------------< the reader side >----------------
+
+static int audit_match(const api_audit_event_t *e, const api_audit_filter_t *f)
+{
+	char session[160];
+
+	if((f->from != 0 && e->time < f->from) || (f->to != 0 && e->time >= f->to)) {
+		return 0;
+	}
+	if(f->types != 0 && (f->types & (1U << (e->type & 31))) == 0) {
+		return 0;
+	}
+	if(f->user != NULL && strcmp(e->user, f->user) != 0) {
+		return 0;
+	}
+	if(f->ip != NULL && strcmp(e->cip, f->ip) != 0 && strcmp(e->sip, f->ip) != 0) {
+		return 0;
+	}
+	if(f->session != NULL) {
+		audit_session(session, sizeof(session), e);
+		if(strcmp(session, f->session) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// can a block of this index entry hold a match
+static int audit_entry_match(const uint8_t *entry, const api_audit_filter_t *f)
+{
+	const uint8_t *bloom = entry + 32;
+
+	if((f->from != 0 && get_u64(entry + 16) < f->from) || (f->to != 0 && get_u64(entry + 8) >= f->to)) {
+		return 0;
+	}
+	if(f->types != 0 && (f->types & get_u32(entry + 28)) == 0) {
+		return 0;
+	}
+	return (f->user == NULL || audit_bloom_has(bloom, f->user))
+		&& (f->ip == NULL || audit_bloom_has(bloom, f->ip))
+		&& (f->session == NULL || audit_bloom_has(bloom, f->session));
+}
+
+/*
+ * The events of the block at `offset` to `cb`, returns the number given or
+ * -1, `*next` is set to the offset after the block.
+ */
+static int audit_block(int fd, uint64_t offset, uint64_t *next, const api_audit_filter_t *f,
+		api_audit_cb cb, void *arg, int *stop)
+{
+	const char **strings[5];
+	api_audit_event_t e;
+	uint8_t head[AUDIT_HEADER], *comp = NULL, *raw = NULL;
+	char *text = NULL, *t = NULL;
+	uint64_t first = 0, v = 0, len = 0;
+	uLongf rawlen = 0;
+	uint32_t clen = 0;
+	size_t at = 0;
+	int found = 0, i = 0;
+
+	if(read_at(fd, offset, head, sizeof(head)) != 0 || get_u32(head) != API_AUDIT_MARKER) {
+		return -1;
+	}
+	rawlen = get_u32(head + 4);
+	clen = get_u32(head + 8);
+	first = get_u64(head + 16);
+	*next = offset + AUDIT_HEADER + clen;
+	if(rawlen > AUDIT_RAW_MAX || clen > compressBound(AUDIT_RAW_MAX)) {
+		return -1;
+	}
+	comp = malloc(clen + 1);
+	raw = malloc(rawlen + 1);
+	text = malloc(rawlen + 5);
+	if(comp == NULL || raw == NULL || text == NULL || read_at(fd, offset + AUDIT_HEADER, comp, clen) != 0
+		|| uncompress(raw, &rawlen, comp, clen) != Z_OK) {
+		found = -1;
+		goto done;
+	}
+	strings[0] = &e.cip;
+	strings[1] = &e.sip;
+	strings[2] = &e.user;
+	strings[3] = &e.route;
+	strings[4] = &e.message;
+	while(at < rawlen && !*stop) {
+		if(!get_varint(raw, &at, rawlen, &v) || at >= rawlen) {
+			break;
+		}
+		e.time = first + v;
+		e.type = raw[at++];
+		if(!get_varint(raw, &at, rawlen, &v)) {
+			break;
+		}
+		e.cport = (int)v;
+		if(!get_varint(raw, &at, rawlen, &v)) {
+			break;
+		}
+		e.sport = (int)v;
+		// the strings go to `text`, terminated
+		t = text;
+		for(i = 0; i < 5; i++) {
+			if(!get_varint(raw, &at, rawlen, &len) || len > rawlen - at) {
+				break;
+			}
+			memcpy(t, raw + at, len);
+			t[len] = '\0';
+			*strings[i] = t;
+			t += len + 1;
+			at += len;
+		}
+		if(i < 5) {
+			break;
+		}
+		if(audit_match(&e, f)) {
+			found++;
+			*stop = cb(&e, arg) != 0;
+		}
+	}
+done:
+	SAFE_FREE(comp);
+	SAFE_FREE(raw);
+	SAFE_FREE(text);
+	return found;
+}
+
+int api_audit_query(int fd, int index, const api_audit_filter_t *filter, api_audit_cb cb, void *arg)
+{
+	uint8_t head[AUDIT_HEADER], entry[API_AUDIT_ENTRY];
+	uint64_t next = 8, end = 0, count = 0, i = 0, skip = 0;
+	int found = 0, n = 0, stop = 0;
+
+	end = (uint64_t)lseek(fd, 0, SEEK_END);
+	if(end < 8 || read_at(fd, 0, head, 8) != 0 || memcmp(head, API_AUDIT_MAGIC, 8) != 0) {
+		return -1;
+	}
+	if(index >= 0 && read_at(index, 0, head, 8) == 0 && memcmp(head, API_AUDIT_INDEX_MAGIC, 8) == 0) {
+		count = ((uint64_t)lseek(index, 0, SEEK_END) - 8) / API_AUDIT_ENTRY;
+	}
+	for(i = 0; i < count && !stop; i++) {
+		if(read_at(index, 8 + i * API_AUDIT_ENTRY, entry, sizeof(entry)) != 0) {
+			break;
+		}
+		if(!audit_entry_match(entry, filter)) {
+			skip = get_u64(entry);
+			continue;
+		}
+		n = audit_block(fd, get_u64(entry), &next, filter, cb, arg, &stop);
+		if(n < 0) {
+			return -1;
+		}
+		found += n;
+		skip = 0;
+	}
+	if(skip != 0) {
+		// past the last indexed block, which was skipped
+		if(read_at(fd, skip, head, sizeof(head)) != 0) {
+			return found;
+		}
+		next = skip + AUDIT_HEADER + get_u32(head + 8);
+	}
+	// blocks written but not indexed
+	while(!stop && next + AUDIT_HEADER <= end && read_at(fd, next, head, sizeof(head)) == 0
+		&& get_u32(head) == API_AUDIT_MARKER && next + AUDIT_HEADER + get_u32(head + 8) <= end) {
+		n = audit_block(fd, next, &next, filter, cb, arg, &stop);
+		if(n < 0) {
+			break;
+		}
+		found += n;
+	}
+	return found;
+}
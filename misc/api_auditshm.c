@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "api_log.h"
+#include "api_misc.h"
+#include "api_auditshm.h"
+
+#define AUDITSHM_HEADER 64 // a cache line of its own
+#define AUDITSHM_TEXT   (API_AUDITSHM_SLOT - 32)
+
+typedef struct auditshm_header_struct {
+	char     magic[8];
+	uint32_t slot_size;
+	uint32_t slots;
+	uint64_t next;
+	uint32_t closed;
+} auditshm_header_t;
+
+typedef struct auditshm_slot_struct {
+	uint64_t seq;      // sequence + 1, 0 while the slot is written
+	uint64_t time;
+	uint16_t type;
+	uint16_t cport;
+	uint16_t sport;
+	uint16_t len[5];
+	char     text[AUDITSHM_TEXT];
+} auditshm_slot_t;
+
+// the ring of the proxy, only the event loop publishes
+static auditshm_header_t *ring = NULL;
+static size_t ring_size = 0;
+static int ring_fd = -1;
+static char ring_name[64];
+
+static auditshm_slot_t *auditshm_slot(void *base, uint32_t slots, uint64_t seq)
+{
+	return (auditshm_slot_t *)((char *)base + AUDITSHM_HEADER + (seq & (slots - 1)) * (size_t)API_AUDITSHM_SLOT);
+}
+
+#ifndef _WIN32
+int api_auditshm_create(const char *name)
+{
+	auditshm_header_t *h = NULL;
+
+	if(ring != NULL) {
+		return 0;
+	}
+	ring_size = AUDITSHM_HEADER + (size_t)API_AUDITSHM_SLOTS * API_AUDITSHM_SLOT;
+	// a ring left by a proxy that died goes, its consumers see it closed
+	shm_unlink(name);
+	ring_fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR);
+	if(ring_fd < 0 || ftruncate(ring_fd, ring_size) != 0) {
+		trace_err("auditshm %s: %s", name, strerror(errno));
+		if(ring_fd >= 0) {
+			close(ring_fd);
+			shm_unlink(name);
+			ring_fd = -1;
+		}
+		return -1;
+	}
+	h = mmap(NULL, ring_size, PROT_READ|PROT_WRITE, MAP_SHARED, ring_fd, 0);
+	if(h == MAP_FAILED) {
+		trace_err("auditshm %s: %s", name, strerror(errno));
+		close(ring_fd);
+		shm_unlink(name);
+		ring_fd = -1;
+		return -1;
+	}
+	h->slot_size = API_AUDITSHM_SLOT;
+	h->slots = API_AUDITSHM_SLOTS;
+	h->next = 0;
+	h->closed = 0;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(h->magic, API_AUDITSHM_MAGIC, 8);
+	snprintf(ring_name, sizeof(ring_name), "%s", name);
+	ring = h;
+	return 0;
+}
+
+void api_auditshm_destroy(void)
+{
+	struct stat ours, named;
+	int fd = -1;
+
+	if(ring == NULL) {
+		return;
+	}
+	__atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+	munmap(ring, ring_size);
+	ring = NULL;
+	// the name may be a new proxy's ring by now
+	fd = shm_open(ring_name, O_RDONLY, 0);
+	if(fd >= 0) {
+		if(fstat(fd, &named) == 0 && fstat(ring_fd, &ours) == 0 && named.st_ino == ours.st_ino) {
+			shm_unlink(ring_name);
+		}
+		close(fd);
+	}
+	close(ring_fd);
+	ring_fd = -1;
+}
+
+static size_t auditshm_put(char *text, size_t at, size_t max, const char *s, uint16_t *len)
+{
+	size_t n = s == NULL ? 0 : strlen(s);
+
+	if(n > max) {
+		n = max;
+	}
+	if(n > AUDITSHM_TEXT - at) {
+		n = AUDITSHM_TEXT - at;
+	}
+	memcpy(text + at, s, n);
+	*len = (uint16_t)n;
+	return at + n;
+}
+
+void api_auditshm_publish(const api_audit_event_t *event)
+{
+	auditshm_slot_t *slot = NULL;
+	uint64_t seq = 0;
+	size_t at = 0;
+
+	if(ring == NULL) {
+		return;
+	}
+	seq = ring->next;
+	slot = auditshm_slot(ring, API_AUDITSHM_SLOTS, seq);
+	// a consumer reading the slot now sees it change and drops its copy
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->time = event->time;
+	slot->type = (uint16_t)event->type;
+	slot->cport = (uint16_t)event->cport;
+	slot->sport = (uint16_t)event->sport;
+	at = auditshm_put(slot->text, at, 63, event->cip, &slot->len[0]);
+	at = auditshm_put(slot->text, at, 63, event->sip, &slot->len[1]);
+	at = auditshm_put(slot->text, at, 127, event->user, &slot->len[2]);
+	at = auditshm_put(slot->text, at, 127, event->route, &slot->len[3]);
+	at = auditshm_put(slot->text, at, AUDITSHM_TEXT, event->message, &slot->len[4]);
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->next, seq + 1, __ATOMIC_RELEASE);
+}
+
+//----------------< the consumer side >----------------
+
+int api_auditshm_attach(api_auditshm_reader_t *reader, const char *name, int oldest)
+{
+	auditshm_header_t *h = NULL;
+	struct stat st;
+	uint64_t next = 0;
+	int fd = -1;
+
+	memset(reader, 0x00, sizeof(*reader));
+	fd = shm_open(name, O_RDONLY, 0);
+	if(fd < 0) {
+		return -1;
+	}
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < AUDITSHM_HEADER) {
+		close(fd);
+		return -1;
+	}
+	h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(h == MAP_FAILED) {
+		return -1;
+	}
+	if(memcmp(h->magic, API_AUDITSHM_MAGIC, 8) != 0 || h->slot_size != API_AUDITSHM_SLOT
+		|| h->slots == 0 || (h->slots & (h->slots - 1)) != 0
+		|| AUDITSHM_HEADER + (size_t)h->slots * API_AUDITSHM_SLOT > (size_t)st.st_size) {
+		munmap(h, st.st_size);
+		return -1;
+	}
+	reader->ring = h;
+	reader->size = st.st_size;
+	next = __atomic_load_n(&h->next, __ATOMIC_ACQUIRE);
+	reader->next = oldest && next >= h->slots ? next - h->slots + 1 : (oldest ? 0 : next);
+	return 0;
+}
+
+void api_auditshm_detach(api_auditshm_reader_t *reader)
+{
+	if(reader->ring != NULL) {
+		munmap(reader->ring, reader->size);
+		reader->ring = NULL;
+	}
+}
+
+int api_auditshm_read(api_auditshm_reader_t *reader, api_audit_event_t *event, uint64_t *seq)
+{
+	auditshm_header_t *h = reader->ring;
+	auditshm_slot_t *slot = NULL, *copy = (auditshm_slot_t *)reader->slot;
+	const char **strings[5] = {&event->cip, &event->sip, &event->user, &event->route, &event->message};
+	uint64_t head = 0, s1 = 0, s2 = 0;
+	size_t at = 0, total = 0;
+	char *t = reader->text;
+	int i = 0;
+
+	if(h == NULL) {
+		return -1;
+	}
+	for(;;) {
+		head = __atomic_load_n(&h->next, __ATOMIC_ACQUIRE);
+		if(reader->next == head) {
+			return __atomic_load_n(&h->closed, __ATOMIC_ACQUIRE) ? -1 : 0;
+		}
+		// the slot of `head - slots` is the one being written next
+		if(head - reader->next >= h->slots) {
+			reader->lost += head - h->slots + 1 - reader->next;
+			reader->next = head - h->slots + 1;
+		}
+		slot = auditshm_slot(h, h->slots, reader->next);
+		s1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		memcpy(copy, slot, API_AUDITSHM_SLOT);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		s2 = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+		if(s1 == reader->next + 1 && s2 == s1) {
+			break;
+		}
+		// overwritten under us, the writer is ahead by a whole ring
+		reader->lost++;
+		reader->next++;
+	}
+	for(i = 0; i < 5; i++) {
+		total += copy->len[i];
+	}
+	if(total > AUDITSHM_TEXT) {
+		reader->lost++;
+		reader->next++;
+		return 0;
+	}
+	event->time = copy->time;
+	event->type = copy->type;
+	event->cport = copy->cport;
+	event->sport = copy->sport;
+	for(i = 0; i < 5; i++) {
+		memcpy(t, copy->text + at, copy->len[i]);
+		t[copy->len[i]] = '\0';
+		*strings[i] = t;
+		t += copy->len[i] + 1;
+		at += copy->len[i];
+	}
+	*seq = reader->next++;
+	return 1;
+}
+#else
+int api_auditshm_create(const char *name)
+{
+	return -1;
+}
+
+void api_auditshm_destroy(void)
+{
+}
+
+void api_auditshm_publish(const api_audit_event_t *event)
+{
+}
+
+int api_auditshm_attach(api_auditshm_reader_t *reader, const char *name, int oldest)
+{
+	memset(reader, 0x00, sizeof(*reader));
+	return -1;
+}
+
+void api_auditshm_detach(api_auditshm_reader_t *reader)
+{
+}
+
+int api_auditshm_read(api_auditshm_reader_t *reader, api_audit_event_t *event, uint64_t *seq)
+{
+	return -1;
+}
+#endif
@@ -0,0 +1,829 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <zlib.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "api_log.h"
+#include "api_misc.h"
+#include "api_capture.h"
+#include "api_transfer.h"
+
+#define CAPTURE_MARKER     0xffffffffU
+#define CAPTURE_CHUNK_MASK 0xfffc000000000000ULL // top 14 bits, 16KB chunks on average
+
+enum capture_op_e {
+	CAPTURE_OPEN = 0,
+	CAPTURE_WRITE,
+	CAPTURE_CLOSE
+};
+
+typedef struct capture_job_struct {
+	struct capture_job_struct *next;
+	int      op;
+	int      fd;
+	size_t   len;
+	uint8_t  data[];
+} capture_job_t;
+
+typedef struct capture_frame_struct {
+	uint64_t raw;  // offset in the captured data
+	uint64_t file; // offset of its header in the file
+} capture_frame_t;
+
+// of an open capture, only the writer touches it
+typedef struct capture_state_struct {
+	uint8_t  *chunk;    // the chunk being cut
+	uint32_t  chunklen;
+	uint64_t  roll;     // gear hash of its last 64 bytes
+	uint8_t  *out;
+	uLongf    outsize;
+	uint64_t  raw_off;  // of the chunk in the captured data
+	uint32_t  chunks;
+	uint32_t  stored;   // chunks the store did not have yet
+	uint64_t  bytes;    // deflated bytes they took
+	int       failed;   // a chunk was lost, the capture is dropped
+	EVP_MD_CTX *sha;    // of the whole transfer
+	api_transfer_t transfer;
+	char     *meta;     // the strings of `transfer`
+} capture_state_t;
+
+static capture_state_t **states = NULL;
+static int nstates = 0;
+static uint64_t gear[256];
+static char store[256] = API_CAPTURE_STORE;
+static char transfers[256] = API_TRANSFER_DIR;
+
+#ifndef _WIN32
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+static capture_job_t *head = NULL, *tail = NULL;
+static size_t pending = 0;
+static int running = 0, stopping = 0;
+#endif
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+	put_u32(p, (uint32_t)(v >> 32));
+	put_u32(p + 4, (uint32_t)v);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+	return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	ssize_t n = 0;
+
+	while(len > 0) {
+		n = write(fd, p, len);
+		if(n <= 0) {
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int read_at(int fd, uint64_t offset, void *data, size_t len)
+{
+	uint8_t *p = data;
+	ssize_t n = 0;
+
+	if(lseek(fd, (off_t)offset, SEEK_SET) == (off_t)-1) {
+		return -1;
+	}
+	while(len > 0) {
+		n = read(fd, p, len);
+		if(n <= 0) {
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+//----------------< the writer side >----------------
+
+static capture_state_t *capture_state(int fd)
+{
+	return fd >= 0 && fd < nstates ? states[fd] : NULL;
+}
+
+// fixed for good, the chunk boundaries and so the dedup depend on it
+static void capture_gear_init(void)
+{
+	uint64_t x = 0x5350584341503032ULL, z = 0; // "SPXCAP02"
+	int i = 0;
+
+	if(gear[0] != 0) {
+		return;
+	}
+	for(i = 0; i < 256; i++) {
+		// splitmix64
+		z = (x += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+static uint64_t capture_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void capture_state_free(capture_state_t *st)
+{
+	SAFE_FREE(st->chunk);
+	SAFE_FREE(st->out);
+	SAFE_FREE(st->meta);
+	EVP_MD_CTX_free(st->sha);
+	free(st);
+}
+
+/*
+ * `meta` is what api_capture_open() knew of the transfer: u64 start, u8
+ * direction and the session, user, path and capture file strings, each
+ * one terminated.
+ */
+static void capture_do_open(int fd, const uint8_t *meta, size_t len)
+{
+	capture_state_t *st = NULL, **grown = NULL;
+	const char **strings[4];
+	size_t at = 9, end = 0;
+	int n = nstates, i = 0;
+
+	if(fd >= nstates) {
+		n = fd + 64;
+		grown = realloc(states, n * sizeof(capture_state_t *));
+		if(grown == NULL) {
+			return;
+		}
+		memset(grown + nstates, 0x00, (n - nstates) * sizeof(capture_state_t *));
+		states = grown;
+		nstates = n;
+	}
+	st = calloc(1, sizeof(*st));
+	if(st == NULL) {
+		return;
+	}
+	st->outsize = compressBound(API_CAPTURE_CHUNK_MAX);
+	st->chunk = malloc(API_CAPTURE_CHUNK_MAX);
+	st->out = malloc(st->outsize);
+	st->meta = malloc(len + 1);
+	if(st->meta != NULL && len >= 9) {
+		memcpy(st->meta, meta, len);
+		st->meta[len] = '\0';
+		st->transfer.start = get_u64(meta);
+		st->transfer.direction = meta[8];
+		strings[0] = &st->transfer.session;
+		strings[1] = &st->transfer.user;
+		strings[2] = &st->transfer.path;
+		strings[3] = &st->transfer.capture;
+		for(i = 0; i < 4 && at <= len; i++) {
+			*strings[i] = st->meta + at;
+			end = at;
+			while(end < len && meta[end] != '\0') {
+				end++;
+			}
+			at = end + 1;
+		}
+	}
+	st->sha = EVP_MD_CTX_new();
+	if(st->sha == NULL || EVP_DigestInit_ex(st->sha, EVP_sha256(), NULL) != 1 ||
+		st->chunk == NULL || st->out == NULL || st->meta == NULL || write_all(fd, API_CAPTURE_MAGIC, 8) != 0) {
+		trace_err("capture %d: %s", fd, strerror(errno));
+		capture_state_free(st);
+		return;
+	}
+	states[fd] = st;
+}
+
+static void capture_hex(const uint8_t *hash, char *hex)
+{
+	static const char digits[] = "0123456789abcdef";
+	int i = 0;
+
+	for(i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+		hex[2 * i] = digits[hash[i] >> 4];
+		hex[2 * i + 1] = digits[hash[i] & 0x0f];
+	}
+	hex[2 * i] = '\0';
+}
+
+static int capture_mkdir(const char *path)
+{
+#ifdef _WIN32
+	if(_mkdir(path) != 0 && errno != EEXIST) {
+#else
+	if(mkdir(path, S_IRWXU) != 0 && errno != EEXIST) {
+#endif
+		return -1;
+	}
+	return 0;
+}
+
+// the chunk under its hash, unless the store has it already
+static int capture_store_put(capture_state_t *st, const uint8_t *hash)
+{
+	char hex[2 * SHA256_DIGEST_LENGTH + 1], path[512], tmp[576];
+	uLongf clen = st->outsize;
+	int fd = -1;
+
+	capture_hex(hash, hex);
+	snprintf(path, sizeof(path), "%s/%.2s/%s", store, hex, hex + 2);
+	if(access(path, F_OK) == 0) {
+		return 0;
+	}
+	snprintf(tmp, sizeof(tmp), "%s/%.2s", store, hex);
+	if(capture_mkdir(store) != 0 || capture_mkdir(tmp) != 0) {
+		trace_err("capture store %s: %s", tmp, strerror(errno));
+		return -1;
+	}
+	if(compress2(st->out, &clen, st->chunk, st->chunklen, API_CAPTURE_LEVEL) != Z_OK) {
+		return -1;
+	}
+	// a proxy handing over shares the store, the rename makes it whole or absent
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC
+#ifndef _WIN32
+		, S_IRUSR|S_IWUSR
+#endif
+		);
+	if(fd < 0 || write_all(fd, st->out, clen) != 0) {
+		trace_err("capture store %s: %s", tmp, strerror(errno));
+		if(fd >= 0) {
+			close(fd);
+			unlink(tmp);
+		}
+		return -1;
+	}
+	close(fd);
+	if(rename(tmp, path) != 0) {
+		unlink(tmp);
+		return -1;
+	}
+	st->stored++;
+	st->bytes += clen;
+	return 0;
+}
+
+// a chunk is complete: into the store, a manifest entry for it
+static void capture_cut(int fd, capture_state_t *st)
+{
+	uint8_t entry[API_CAPTURE_ENTRY];
+
+	if(st->chunklen == 0) {
+		return;
+	}
+	SHA256(st->chunk, st->chunklen, entry + 12);
+	put_u64(entry, st->raw_off);
+	put_u32(entry + 8, st->chunklen);
+	if(capture_store_put(st, entry + 12) != 0 || write_all(fd, entry, sizeof(entry)) != 0) {
+		trace_err("capture %d: chunk at %llu lost, capture dropped", fd, (unsigned long long)st->raw_off);
+		st->failed = 1;
+	}
+	st->raw_off += st->chunklen;
+	st->chunks++;
+	st->chunklen = 0;
+	st->roll = 0;
+}
+
+/*
+ * Gear hash content defined chunking: a chunk ends where the low bits of
+ * the rolling hash are all zero, so an insert early in a file moves the
+ * boundaries around it only and the chunks after it are found again.
+ */
+static void capture_do_write(int fd, const uint8_t *data, size_t len)
+{
+	capture_state_t *st = capture_state(fd);
+	uint64_t roll = 0;
+	size_t i = 0, n = 0;
+	int cut = 0;
+
+	if(st == NULL || st->failed) {
+		return;
+	}
+	EVP_DigestUpdate(st->sha, data, len);
+	while(len > 0) {
+		n = API_CAPTURE_CHUNK_MAX - st->chunklen;
+		if(n > len) {
+			n = len;
+		}
+		roll = st->roll;
+		cut = 0;
+		i = 0;
+		if(st->chunklen < API_CAPTURE_CHUNK_MIN) {
+			// no boundary this early, the hash window is 64 bytes
+			i = API_CAPTURE_CHUNK_MIN - st->chunklen;
+			i = i > 64 ? i - 64 : 0;
+			i = i < n ? i : n;
+		}
+		for(; i < n; i++) {
+			roll = (roll << 1) + gear[data[i]];
+			if((roll & CAPTURE_CHUNK_MASK) == 0 && st->chunklen + i + 1 >= API_CAPTURE_CHUNK_MIN) {
+				i++;
+				cut = 1;
+				break;
+			}
+		}
+		memcpy(st->chunk + st->chunklen, data, i);
+		st->chunklen += i;
+		st->roll = roll;
+		data += i;
+		len -= i;
+		if(cut || st->chunklen == API_CAPTURE_CHUNK_MAX) {
+			capture_cut(fd, st);
+		}
+	}
+}
+
+// `end` is when the transfer ended, 0 for now
+static void capture_do_close(int fd, uint64_t end)
+{
+	capture_state_t *st = capture_state(fd);
+
+	if(st != NULL && !st->failed) {
+		capture_cut(fd, st);
+	}
+	if(st != NULL && st->failed) {
+		// a partial capture is worse than none, it is not indexed either
+		if(st->transfer.capture != NULL) {
+			unlink(st->transfer.capture);
+		}
+	} else if(st != NULL) {
+		trace_out("capture %d: %llu bytes, %u chunks, %u new, %llu bytes stored", fd,
+			(unsigned long long)st->raw_off, st->chunks, st->stored, (unsigned long long)st->bytes);
+		EVP_DigestFinal_ex(st->sha, st->transfer.hash, NULL);
+		st->transfer.end = end != 0 ? end : capture_now();
+		st->transfer.size = st->raw_off;
+		if(st->transfer.capture != NULL && api_transfer_append(transfers, &st->transfer) != 0) {
+			trace_err("capture %d: %s not indexed", fd, st->transfer.capture);
+		}
+	}
+	if(st != NULL) {
+		capture_state_free(st);
+		states[fd] = NULL;
+	}
+	close(fd);
+}
+
+static void capture_do(capture_job_t *job)
+{
+	switch(job->op) {
+	case CAPTURE_OPEN:
+		capture_do_open(job->fd, job->data, job->len);
+		break;
+	case CAPTURE_WRITE:
+		capture_do_write(job->fd, job->data, job->len);
+		break;
+	case CAPTURE_CLOSE:
+		capture_do_close(job->fd, job->len == 8 ? get_u64(job->data) : 0);
+		break;
+	}
+}
+
+#ifndef _WIN32
+static void *capture_writer(void *arg)
+{
+	capture_job_t *jobs = NULL, *job = NULL;
+	size_t done = 0;
+	int fd = 0;
+
+	(void)arg;
+	pthread_mutex_lock(&lock);
+	for(;;) {
+		while(head == NULL && !stopping) {
+			pthread_cond_wait(&ready, &lock);
+		}
+		if(head == NULL) {
+			break;
+		}
+		jobs = head;
+		head = tail = NULL;
+		pthread_mutex_unlock(&lock);
+		done = 0;
+		while(jobs != NULL) {
+			job = jobs;
+			jobs = job->next;
+			capture_do(job);
+			done += job->len;
+			free(job);
+		}
+		pthread_mutex_lock(&lock);
+		pending -= done;
+	}
+	pthread_mutex_unlock(&lock);
+	// sessions still open at exit get their index all the same
+	for(fd = 0; fd < nstates; fd++) {
+		if(states[fd] != NULL) {
+			capture_do_close(fd, 0);
+		}
+	}
+	return NULL;
+}
+#endif
+
+// 1 if the queue is past API_CAPTURE_QUEUE_MAX, the job is queued all the same
+static int capture_submit(int op, int fd, const void *data, size_t len)
+{
+	capture_job_t *job = malloc(sizeof(capture_job_t) + len);
+	int full = 0;
+
+	if(job == NULL) {
+		trace_err("capture %d: out of memory, %lu bytes lost", fd, (unsigned long)len);
+		return 0;
+	}
+	job->next = NULL;
+	job->op = op;
+	job->fd = fd;
+	job->len = len;
+	if(len > 0) {
+		memcpy(job->data, data, len);
+	}
+#ifndef _WIN32
+	pthread_mutex_lock(&lock);
+	if(running) {
+		pending += len;
+		full = pending > API_CAPTURE_QUEUE_MAX;
+		if(tail != NULL) {
+			tail->next = job;
+		} else {
+			head = job;
+		}
+		tail = job;
+		pthread_cond_signal(&ready);
+		pthread_mutex_unlock(&lock);
+		return full;
+	}
+	pthread_mutex_unlock(&lock);
+#endif
+	capture_do(job);
+	free(job);
+	return full;
+}
+
+int api_capture_start(void)
+{
+#ifndef _WIN32
+	pthread_mutex_lock(&lock);
+	if(!running) {
+		stopping = 0;
+		if(pthread_create(&writer, NULL, capture_writer, NULL) != 0) {
+			pthread_mutex_unlock(&lock);
+			trace_err("capture: no writer thread, writing inline");
+			return -1;
+		}
+		running = 1;
+	}
+	pthread_mutex_unlock(&lock);
+#endif
+	return 0;
+}
+
+void api_capture_stop(void)
+{
+#ifndef _WIN32
+	pthread_mutex_lock(&lock);
+	if(!running) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	stopping = 1;
+	pthread_cond_signal(&ready);
+	pthread_mutex_unlock(&lock);
+	pthread_join(writer, NULL);
+	pthread_mutex_lock(&lock);
+	running = 0;
+	pthread_mutex_unlock(&lock);
+#endif
+}
+
+void api_capture_store(const char *dir)
+{
+	snprintf(store, sizeof(store), "%s", dir);
+}
+
+void api_capture_index(const char *dir)
+{
+	snprintf(transfers, sizeof(transfers), "%s", dir);
+}
+
+int api_capture_open(const char *session, const char *username, int direction, const char *path)
+{
+	const char *strings[4], *base = NULL;
+	char name[512], capture[1024];
+	uint8_t *meta = NULL;
+	size_t len = 9, n = 0;
+	int fd = -1, i = 0;
+
+	if(session == NULL || username == NULL || path == NULL) {
+		return -1;
+	}
+	base = strrchr(path, '/');
+	capture_gear_init();
+	snprintf(name, sizeof(name), "%s%s", base != NULL && base[1] != '\0' ? base + 1 : path, API_CAPTURE_SUFFIX);
+	fd = api_sftpfile_create(username, name, capture, sizeof(capture));
+	if(fd == -1) {
+		return fd;
+	}
+	strings[0] = session;
+	strings[1] = username;
+	strings[2] = path;
+	strings[3] = capture;
+	for(i = 0; i < 4; i++) {
+		len += strlen(strings[i]) + 1;
+	}
+	meta = malloc(len);
+	if(meta != NULL) {
+		put_u64(meta, capture_now());
+		meta[8] = (uint8_t)direction;
+		len = 9;
+		for(i = 0; i < 4; i++) {
+			n = strlen(strings[i]) + 1;
+			memcpy(meta + len, strings[i], n);
+			len += n;
+		}
+	}
+	capture_submit(CAPTURE_OPEN, fd, meta, meta != NULL ? len : 0);
+	SAFE_FREE(meta);
+	return fd;
+}
+
+int api_capture_write(int fd, const void *data, size_t len)
+{
+	if(fd != -1 && len > 0) {
+		return capture_submit(CAPTURE_WRITE, fd, data, len);
+	}
+	return 0;
+}
+
+void api_capture_close(int fd)
+{
+	uint8_t end[8];
+
+	if(fd != -1) {
+		put_u64(end, capture_now());
+		capture_submit(CAPTURE_CLOSE, fd, end, sizeof(end));
+	}
+}
+
+int api_capture_full(void)
+{
+	int full = 0;
+
+#ifndef _WIN32
+	pthread_mutex_lock(&lock);
+	full = running && pending > API_CAPTURE_QUEUE_MAX;
+	pthread_mutex_unlock(&lock);
+#endif
+	return full;
+}
+
+//----------------< the reader side >----------------
+
+// SPXCAP01 captures: the frame table from the index, or from the headers of a cut capture
+static int capture_frames(int fd, capture_frame_t **table, uint32_t *count, uint64_t *total)
+{
+	capture_frame_t *frames = NULL, *grown = NULL;
+	uint8_t buf[16], *index = NULL;
+	uint64_t pos = 8, end = 0, at = 0;
+	uint32_t n = 0, size = 0, i = 0;
+
+	end = (uint64_t)lseek(fd, 0, SEEK_END);
+	*table = NULL;
+	*count = 0;
+	*total = 0;
+	if(end < 8 || read_at(fd, 0, buf, 8) != 0 || memcmp(buf, API_CAPTURE_FRAMES_MAGIC, 8) != 0) {
+		return -1;
+	}
+	if(end >= 8 + 16 && read_at(fd, end - 16, buf, 16) == 0
+		&& memcmp(buf, API_CAPTURE_INDEX, 8) == 0) {
+		at = get_u64(buf + 8);
+		if(at + 8 <= end - 16 && read_at(fd, at, buf, 8) == 0 && get_u32(buf) == CAPTURE_MARKER
+			&& at + 8 + get_u32(buf + 4) == end - 16) {
+			n = get_u32(buf + 4) / 16;
+			frames = calloc(n + 1, sizeof(capture_frame_t));
+			index = malloc(16 * (size_t)n + 1);
+			if(frames != NULL && index != NULL && read_at(fd, at + 8, index, 16 * (size_t)n) == 0) {
+				for(i = 0; i < n; i++) {
+					frames[i].raw = get_u64(index + 16 * i);
+					frames[i].file = get_u64(index + 16 * i + 8);
+				}
+				if(n > 0 && read_at(fd, frames[n - 1].file, buf, 8) == 0) {
+					*total = frames[n - 1].raw + get_u32(buf);
+				}
+				free(index);
+				*table = frames;
+				*count = n;
+				return 0;
+			}
+			SAFE_FREE(frames);
+			SAFE_FREE(index);
+		}
+	}
+	// no index, walk the headers up to the first incomplete frame
+	n = 0;
+	while(pos + 8 <= end && read_at(fd, pos, buf, 8) == 0 && get_u32(buf) != CAPTURE_MARKER
+		&& pos + 8 + get_u32(buf + 4) <= end) {
+		if(n == size) {
+			size = size == 0 ? 64 : size * 2;
+			grown = realloc(frames, size * sizeof(capture_frame_t));
+			if(grown == NULL) {
+				break;
+			}
+			frames = grown;
+		}
+		frames[n].raw = *total;
+		frames[n].file = pos;
+		n++;
+		*total += get_u32(buf);
+		pos += 8 + get_u32(buf + 4);
+	}
+	*table = frames;
+	*count = n;
+	return 0;
+}
+
+static int64_t capture_extract_frames(int fd, uint64_t offset, uint64_t length, int out)
+{
+	capture_frame_t *frames = NULL;
+	uint8_t hdr[8], *comp = NULL, *raw = NULL;
+	uint64_t total = 0, end = 0, from = 0, to = 0;
+	uLongf rawlen = 0;
+	uint32_t count = 0, i = 0, clen = 0;
+	int64_t written = 0;
+
+	if(capture_frames(fd, &frames, &count, &total) != 0) {
+		return -1;
+	}
+	end = length == 0 || offset + length > total ? total : offset + length;
+	for(i = 0; i < count && written >= 0; i++) {
+		if(read_at(fd, frames[i].file, hdr, 8) != 0) {
+			written = -1;
+			break;
+		}
+		rawlen = get_u32(hdr);
+		clen = get_u32(hdr + 4);
+		if(frames[i].raw + rawlen <= offset) {
+			continue;
+		}
+		if(frames[i].raw >= end) {
+			break;
+		}
+		comp = malloc(clen + 1);
+		raw = malloc(rawlen + 1);
+		if(comp == NULL || raw == NULL || read_at(fd, frames[i].file + 8, comp, clen) != 0
+			|| uncompress(raw, &rawlen, comp, clen) != Z_OK) {
+			written = -1;
+		} else {
+			from = offset > frames[i].raw ? offset - frames[i].raw : 0;
+			to = end < frames[i].raw + rawlen ? end - frames[i].raw : rawlen;
+			if(write_all(out, raw + from, to - from) != 0) {
+				written = -1;
+			} else {
+				written += to - from;
+			}
+		}
+		SAFE_FREE(comp);
+		SAFE_FREE(raw);
+	}
+	SAFE_FREE(frames);
+	return written;
+}
+
+// a chunk back from the store, checked against its hash
+static int capture_store_get(const uint8_t *hash, uint8_t *raw, uLongf rawlen)
+{
+	char hex[2 * SHA256_DIGEST_LENGTH + 1], path[512];
+	uint8_t *comp = NULL, check[SHA256_DIGEST_LENGTH];
+	uLongf len = rawlen;
+	off_t clen = 0;
+	int fd = -1, rc = -1;
+
+	capture_hex(hash, hex);
+	snprintf(path, sizeof(path), "%s/%.2s/%s", store, hex, hex + 2);
+	fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		trace_err("capture store %s: %s", path, strerror(errno));
+		return -1;
+	}
+	clen = lseek(fd, 0, SEEK_END);
+	comp = malloc(clen + 1);
+	if(comp != NULL && clen > 0 && read_at(fd, 0, comp, clen) == 0
+		&& uncompress(raw, &len, comp, clen) == Z_OK && len == rawlen) {
+		SHA256(raw, rawlen, check);
+		rc = memcmp(check, hash, SHA256_DIGEST_LENGTH) == 0 ? 0 : -1;
+	}
+	if(rc != 0) {
+		trace_err("capture store %s: damaged", path);
+	}
+	SAFE_FREE(comp);
+	close(fd);
+	return rc;
+}
+
+static int64_t capture_extract_chunks(int fd, uint64_t offset, uint64_t length, int out)
+{
+	uint8_t entry[API_CAPTURE_ENTRY], *raw = NULL;
+	uint64_t count = 0, lo = 0, hi = 0, mid = 0, at = 0, end = 0, from = 0, to = 0;
+	uint32_t len = 0;
+	int64_t written = 0;
+
+	// entries are whole unless the capture was cut short
+	count = ((uint64_t)lseek(fd, 0, SEEK_END) - 8) / API_CAPTURE_ENTRY;
+	end = length == 0 ? UINT64_MAX : offset + length;
+	// the first chunk ending after `offset`, the entries are sorted
+	hi = count;
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if(read_at(fd, 8 + mid * API_CAPTURE_ENTRY, entry, sizeof(entry)) != 0) {
+			return -1;
+		}
+		if(get_u64(entry) + get_u32(entry + 8) <= offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	raw = malloc(API_CAPTURE_CHUNK_MAX);
+	if(raw == NULL) {
+		return -1;
+	}
+	for(; lo < count; lo++) {
+		if(read_at(fd, 8 + lo * API_CAPTURE_ENTRY, entry, sizeof(entry)) != 0) {
+			written = -1;
+			break;
+		}
+		at = get_u64(entry);
+		len = get_u32(entry + 8);
+		if(at >= end) {
+			break;
+		}
+		if(len > API_CAPTURE_CHUNK_MAX || capture_store_get(entry + 12, raw, len) != 0) {
+			written = -1;
+			break;
+		}
+		from = offset > at ? offset - at : 0;
+		to = end - at < len ? end - at : len;
+		if(write_all(out, raw + from, to - from) != 0) {
+			written = -1;
+			break;
+		}
+		written += to - from;
+	}
+	free(raw);
+	return written;
+}
+
+int64_t api_capture_extract(int fd, uint64_t offset, uint64_t length, int out)
+{
+	char magic[8];
+
+	if(read_at(fd, 0, magic, sizeof(magic)) != 0) {
+		return -1;
+	}
+	if(memcmp(magic, API_CAPTURE_MAGIC, 8) == 0) {
+		return capture_extract_chunks(fd, offset, length, out);
+	}
+	return capture_extract_frames(fd, offset, length, out);
+}
@@ -0,0 +1,1457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "api_log.h"
+#include "api_misc.h"
+#include "api_hashtable.h"
+#include "api_cmdindex.h"
+
+#define CMDINDEX_DATA    "commands.dat"
+#define CMDINDEX_LOCK    "commands.lock"
+#define CMDINDEX_SUFFIX  ".seg"
+#define CMDINDEX_TEMP    ".tmp"
+#define CMDINDEX_TERMS   (2 * API_CMDINDEX_WORDS + 3)  // of a command, with user and host
+#define CMDINDEX_RECORD  20                            // the shortest record
+#define CMDINDEX_CHUNK   (1024 * 1024)                 // of commands.dat read at a time
+#define CMDINDEX_WRITE   (64 * 1024)                   // of postings written at a time
+
+typedef char cmdindex_term_t[API_CMDINDEX_TERM + 3];
+
+typedef struct cmdindex_job_struct {
+	struct cmdindex_job_struct *next;
+	size_t   len;
+	uint8_t  data[];   // the record with its length
+} cmdindex_job_t;
+
+// a byte buffer; as a posting list, `offset` and `time` are of its last posting
+typedef struct cmdindex_list_struct {
+	uint8_t  *data;
+	size_t    len;
+	size_t    size;
+	uint32_t  count;
+	uint64_t  offset;
+	uint64_t  time;
+} cmdindex_list_t;
+
+typedef struct cmdindex_segment_struct {
+	int       fd;
+	uint32_t  seq;
+	uint32_t  level;
+	uint32_t  terms;
+	uint64_t  first;   // times
+	uint64_t  last;
+	uint64_t  start;   // range of commands.dat
+	uint64_t  end;
+	uint64_t  strings;
+	uint64_t  table;
+	uint64_t  size;
+	uint8_t  *block;   // strings and table, read in for a merge
+} cmdindex_segment_t;
+
+typedef struct cmdindex_entry_struct {
+	uint64_t  postings;
+	uint64_t  end;     // of the postings
+	uint32_t  count;
+	size_t    len;
+	char      term[API_CMDINDEX_TERM + 3];
+} cmdindex_entry_t;
+
+typedef struct cmdindex_writer_struct {
+	int       fd;
+	char      path[512];
+	uint32_t  terms;
+	uint64_t  pos;     // of the next posting list
+	cmdindex_list_t out;
+	cmdindex_list_t strings;
+	cmdindex_list_t table;
+	int       failed;
+} cmdindex_writer_t;
+
+typedef struct cmdindex_want_struct {
+	cmdindex_term_t term;
+	size_t    len;
+	int       prefix;
+	uint64_t  count;   // postings in the segment at hand
+} cmdindex_want_t;
+
+typedef struct cmdindex_hit_struct {
+	uint64_t  offset;
+	uint64_t  time;
+} cmdindex_hit_t;
+
+typedef struct cmdindex_hits_struct {
+	cmdindex_hit_t *hits;
+	size_t    count;
+	size_t    size;
+} cmdindex_hits_t;
+
+typedef struct cmdindex_query_struct {
+	int       fd;      // commands.dat
+	cmdindex_want_t wants[CMDINDEX_TERMS];
+	int       nwants;
+	uint64_t  from;
+	uint64_t  to;
+	api_cmdindex_cb cb;
+	void     *arg;
+	int       count;
+	int       stop;
+	uint8_t   record[API_CMDINDEX_RECORD_MAX];
+	char      text[API_CMDINDEX_RECORD_MAX];
+} cmdindex_query_t;
+
+typedef int (*cmdindex_scan_cb)(uint64_t offset, const api_cmdindex_command_t *command, void *arg);
+
+// the indexer's, one thread at a time
+static char store[256] = API_CMDINDEX_DIR;
+static int data_fd = -1;
+static int lock_fd = -1;
+static int indexing = 0;          // this process holds the lock and the index
+static uint64_t indexed = 0;      // commands.dat up to here is in memory or in segments
+static uint32_t next_seq = 0;
+static api_hashtable_t memory;    // term -> cmdindex_list_t *
+static int memory_ready = 0;
+static uint64_t mem_start = 0;    // range of commands.dat in memory
+static uint64_t mem_first = 0;
+static uint64_t mem_last = 0;
+static uint64_t mem_since = 0;
+static size_t mem_postings = 0;
+
+#ifndef _WIN32
+static pthread_t indexer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+static cmdindex_job_t *head = NULL, *tail = NULL;
+static int running = 0, stopping = 0;
+#endif
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+	put_u32(p, (uint32_t)(v >> 32));
+	put_u32(p + 4, (uint32_t)v);
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+	return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+	return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	ssize_t n = 0;
+
+	while(len > 0) {
+		n = write(fd, p, len);
+		if(n <= 0) {
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int read_at(int fd, uint64_t offset, void *data, size_t len)
+{
+	uint8_t *p = data;
+	ssize_t n = 0;
+
+	if(lseek(fd, (off_t)offset, SEEK_SET) == (off_t)-1) {
+		return -1;
+	}
+	while(len > 0) {
+		n = read(fd, p, len);
+		if(n <= 0) {
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int cmdindex_varint_put(uint8_t *p, uint64_t v)
+{
+	int n = 0;
+
+	while(v >= 0x80) {
+		p[n++] = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = (uint8_t)v;
+	return n;
+}
+
+static int cmdindex_varint_get(const uint8_t *p, size_t len, size_t *pos, uint64_t *v)
+{
+	int shift = 0;
+
+	*v = 0;
+	while(*pos < len && shift < 64) {
+		*v |= (uint64_t)(p[*pos] & 0x7f) << shift;
+		if((p[(*pos)++] & 0x80) == 0) {
+			return 0;
+		}
+		shift += 7;
+	}
+	return -1;
+}
+
+static int cmdindex_buffer_put(cmdindex_list_t *b, const void *data, size_t len)
+{
+	uint8_t *p = NULL;
+	size_t size = b->size > 0 ? b->size : 64;
+
+	while(size - b->len < len) {
+		size *= 2;
+	}
+	if(size != b->size) {
+		p = realloc(b->data, size);
+		if(p == NULL) {
+			return -1;
+		}
+		b->data = p;
+		b->size = size;
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	return 0;
+}
+
+static int cmdindex_posting_put(cmdindex_list_t *list, uint64_t offset, uint64_t time)
+{
+	uint8_t p[20];
+	int64_t step = (int64_t)(time - list->time);
+	int n = 0;
+
+	n = cmdindex_varint_put(p, offset - list->offset);
+	n += cmdindex_varint_put(p + n, ((uint64_t)step << 1) ^ (uint64_t)(step >> 63));
+	if(cmdindex_buffer_put(list, p, n) != 0) {
+		return -1;
+	}
+	list->offset = offset;
+	list->time = time;
+	list->count++;
+	return 0;
+}
+
+// the posting after `*offset`, `*time` at `*pos` of a list
+static int cmdindex_posting_get(const uint8_t *p, size_t len, size_t *pos, uint64_t *offset, uint64_t *time)
+{
+	uint64_t step = 0, zz = 0;
+
+	if(cmdindex_varint_get(p, len, pos, &step) != 0 || cmdindex_varint_get(p, len, pos, &zz) != 0) {
+		return -1;
+	}
+	*offset += step;
+	*time += (uint64_t)((int64_t)(zz >> 1) ^ -(int64_t)(zz & 1));
+	return 0;
+}
+
+//----------------< records and terms >----------------
+
+// the record of `command` with its length, the command line cut to fit
+static size_t cmdindex_record_put(uint8_t *p, const api_cmdindex_command_t *command)
+{
+	const char *strings[5] = {command->session, command->user, command->host, command->route, command->command};
+	size_t len = 14, n = 0;
+	int i = 0;
+
+	put_u64(p + 4, command->time);
+	p[12] = (uint8_t)command->kind;
+	p[13] = (uint8_t)command->action;
+	for(i = 0; i < 5; i++) {
+		n = strings[i] == NULL ? 0 : strlen(strings[i]);
+		if(n > 0xffff) {
+			n = 0xffff;
+		}
+		if(n > API_CMDINDEX_RECORD_MAX - len - 2 * (5 - i)) {
+			n = API_CMDINDEX_RECORD_MAX - len - 2 * (5 - i);
+		}
+		put_u16(p + len, (uint16_t)n);
+		if(n > 0) {
+			memcpy(p + len + 2, strings[i], n);
+		}
+		len += 2 + n;
+	}
+	put_u32(p, (uint32_t)(len - 4));
+	return len;
+}
+
+// `command` points into `text`, which takes `len` bytes
+static int cmdindex_record_get(const uint8_t *p, size_t len, api_cmdindex_command_t *command, char *text)
+{
+	const char **strings[5] = {&command->session, &command->user, &command->host, &command->route, &command->command};
+	size_t pos = 10, n = 0;
+	int i = 0;
+
+	if(len < CMDINDEX_RECORD) {
+		return -1;
+	}
+	command->time = get_u64(p);
+	command->kind = p[8];
+	command->action = p[9];
+	for(i = 0; i < 5; i++) {
+		if(pos + 2 > len || pos + 2 + (n = get_u16(p + pos)) > len) {
+			return -1;
+		}
+		memcpy(text, p + pos + 2, n);
+		text[n] = '\0';
+		*strings[i] = text;
+		text += n + 1;
+		pos += 2 + n;
+	}
+	return 0;
+}
+
+static int cmdindex_separator(unsigned char c)
+{
+	return c <= ' ' || strchr(";|&<>()`'\"{}\\", c) != NULL;
+}
+
+static int cmdindex_term_add(cmdindex_term_t *terms, int n, const char *tag, const char *s, size_t len, int fold)
+{
+	cmdindex_term_t term;
+	size_t h = strlen(tag), i = 0;
+	int k = 0;
+
+	if(len == 0) {
+		return n;
+	}
+	if(len > API_CMDINDEX_TERM) {
+		len = API_CMDINDEX_TERM;
+	}
+	memcpy(term, tag, h);
+	for(i = 0; i < len; i++) {
+		term[h + i] = fold && s[i] >= 'A' && s[i] <= 'Z' ? s[i] + ('a' - 'A') : s[i];
+	}
+	term[h + len] = '\0';
+	for(k = 0; k < n; k++) {
+		if(strcmp(terms[k], term) == 0) {
+			return n;
+		}
+	}
+	memcpy(terms[n], term, h + len + 1);
+	return n + 1;
+}
+
+// the words of `s` and the part after the last '/' or '=' of each, or as
+// a query: the words, a trailing '*' making a prefix of one
+static int cmdindex_words(const char *s, cmdindex_term_t *terms, int max, int query)
+{
+	const char *word = NULL, *part = NULL;
+	int n = 0;
+
+	while(*s != '\0' && n < max) {
+		while(*s != '\0' && cmdindex_separator((unsigned char)*s)) {
+			s++;
+		}
+		word = s;
+		part = NULL;
+		while(*s != '\0' && !cmdindex_separator((unsigned char)*s)) {
+			if(*s == '/' || *s == '=') {
+				part = s + 1;
+			}
+			s++;
+		}
+		n = cmdindex_term_add(terms, n, "", word, s - word, 1);
+		if(!query && part != NULL && n < max) {
+			n = cmdindex_term_add(terms, n, "", part, s - part, 1);
+		}
+	}
+	return n;
+}
+
+// the terms of `command`, returns their number
+static int cmdindex_terms(const api_cmdindex_command_t *command, cmdindex_term_t *terms)
+{
+	int n = cmdindex_words(command->command, terms, CMDINDEX_TERMS - 3, 0);
+
+	n = cmdindex_term_add(terms, n, "\001u", command->user, strlen(command->user), 0);
+	n = cmdindex_term_add(terms, n, "\001h", command->host, strlen(command->host), 0);
+	n = cmdindex_term_add(terms, n, "\001h", command->route, strlen(command->route), 0);
+	return n;
+}
+
+// the records of `fd` in [from, to), returns the end of the last whole one
+static uint64_t cmdindex_scan(int fd, uint64_t from, uint64_t to, cmdindex_scan_cb fn, void *arg)
+{
+	api_cmdindex_command_t command;
+	uint8_t *buf = NULL;
+	char *text = NULL;
+	uint64_t pos = from;
+	size_t have = 0, off = 0;
+	uint32_t len = 0;
+
+	if(from >= to) {
+		return from;
+	}
+	have = to - from < CMDINDEX_CHUNK ? (size_t)(to - from) : CMDINDEX_CHUNK;
+	buf = malloc(have);
+	text = malloc(API_CMDINDEX_RECORD_MAX);
+	if(buf == NULL || text == NULL) {
+		goto done;
+	}
+	while(pos < to) {
+		have = to - pos < CMDINDEX_CHUNK ? (size_t)(to - pos) : CMDINDEX_CHUNK;
+		if(read_at(fd, pos, buf, have) != 0) {
+			break;
+		}
+		for(off = 0; off + 4 <= have; off += 4 + len) {
+			len = get_u32(buf + off);
+			if(len < CMDINDEX_RECORD || len > API_CMDINDEX_RECORD_MAX - 4) {
+				trace_err("commands: no record at %llu", (unsigned long long)(pos + off));
+				pos += off;
+				goto done;
+			}
+			if(off + 4 + len > have) {
+				break;
+			}
+			if(cmdindex_record_get(buf + off + 4, len, &command, text) != 0) {
+				trace_err("commands: damaged record at %llu", (unsigned long long)(pos + off));
+				pos += off;
+				goto done;
+			}
+			if(fn(pos + off, &command, arg) != 0) {
+				pos += off + 4 + len;
+				goto done;
+			}
+		}
+		if(off == 0) {
+			// cut short, or being written
+			break;
+		}
+		pos += off;
+	}
+done:
+	SAFE_FREE(buf);
+	SAFE_FREE(text);
+	return pos;
+}
+
+//----------------< segments >----------------
+
+static int cmdindex_segment_open(const char *dir, uint32_t seq, cmdindex_segment_t *seg)
+{
+	uint8_t h[API_CMDINDEX_HEADER];
+	char path[512];
+	off_t size = 0;
+
+	memset(seg, 0x00, sizeof(*seg));
+	snprintf(path, sizeof(path), "%s/%08x%s", dir, seq, CMDINDEX_SUFFIX);
+	seg->fd = open(path, O_RDONLY);
+	if(seg->fd < 0) {
+		return -1;
+	}
+	seg->seq = seq;
+	size = lseek(seg->fd, 0, SEEK_END);
+	if(read_at(seg->fd, 0, h, sizeof(h)) == 0 && memcmp(h, API_CMDINDEX_SEGMENT_MAGIC, 8) == 0) {
+		seg->level = get_u32(h + 8);
+		seg->terms = get_u32(h + 12);
+		seg->first = get_u64(h + 16);
+		seg->last = get_u64(h + 24);
+		seg->start = get_u64(h + 32);
+		seg->end = get_u64(h + 40);
+		seg->strings = get_u64(h + 48);
+		seg->table = get_u64(h + 56);
+		seg->size = seg->table + (uint64_t)seg->terms * API_CMDINDEX_ENTRY;
+		if(seg->strings >= API_CMDINDEX_HEADER && seg->strings <= seg->table
+			&& seg->size == (uint64_t)size && seg->start < seg->end) {
+			return 0;
+		}
+	}
+	trace_err("commands: %s is no segment", path);
+	close(seg->fd);
+	seg->fd = -1;
+	return 0;
+}
+
+static void cmdindex_segment_close(cmdindex_segment_t *seg)
+{
+	if(seg->fd >= 0) {
+		close(seg->fd);
+		seg->fd = -1;
+	}
+	SAFE_FREE(seg->block);
+}
+
+static int cmdindex_segment_cmp(const void *a, const void *b)
+{
+	const cmdindex_segment_t *x = a, *y = b;
+
+	if(x->start != y->start) {
+		return x->start < y->start ? -1 : 1;
+	}
+	return x->end > y->end ? -1 : (x->end < y->end ? 1 : 0);
+}
+
+// the segments of `dir` by their range of commands.dat; those within the
+// range of another (a merge was cut short) are left out and, with
+// `clean`, removed; `*seq` is the highest number in use
+static int cmdindex_segments(const char *dir, int clean, cmdindex_segment_t **segments, uint32_t *seq)
+{
+	cmdindex_segment_t *segs = NULL, *p = NULL;
+	struct dirent *de = NULL;
+	DIR *d = NULL;
+	char path[512];
+	uint64_t covered = 0;
+	unsigned int number = 0;
+	int n = 0, size = 0, i = 0, k = 0, tries = 0, vanished = 0;
+	int len = 0;
+
+	*segments = NULL;
+	do {
+		for(i = 0; i < n; i++) {
+			cmdindex_segment_close(&segs[i]);
+		}
+		n = 0;
+		vanished = 0;
+		d = opendir(dir);
+		if(d == NULL) {
+			SAFE_FREE(segs);
+			return -1;
+		}
+		while((de = readdir(d)) != NULL) {
+			len = 0;
+			if(sscanf(de->d_name, "%8x%n", &number, &len) != 1 || len != 8
+				|| strcmp(de->d_name + 8, CMDINDEX_SUFFIX) != 0) {
+				continue;
+			}
+			if(n == size) {
+				size = size > 0 ? size * 2 : 16;
+				p = realloc(segs, size * sizeof(cmdindex_segment_t));
+				if(p == NULL) {
+					break;
+				}
+				segs = p;
+			}
+			if(seq != NULL && number > *seq) {
+				*seq = number;
+			}
+			if(cmdindex_segment_open(dir, number, &segs[n]) != 0) {
+				// merged away since the listing
+				vanished = 1;
+				continue;
+			}
+			if(segs[n].fd >= 0) {
+				n++;
+			}
+		}
+		closedir(d);
+	} while(vanished && ++tries < 3);
+	if(n > 1) {
+		qsort(segs, n, sizeof(cmdindex_segment_t), cmdindex_segment_cmp);
+	}
+	for(i = 0, k = 0; i < n; i++) {
+		if(segs[i].start < covered) {
+			if(clean) {
+				snprintf(path, sizeof(path), "%s/%08x%s", dir, segs[i].seq, CMDINDEX_SUFFIX);
+				unlink(path);
+			}
+			cmdindex_segment_close(&segs[i]);
+			continue;
+		}
+		covered = segs[i].end;
+		segs[k++] = segs[i];
+	}
+	if(k == 0) {
+		SAFE_FREE(segs);
+	}
+	*segments = segs;
+	return k;
+}
+
+static int cmdindex_segment_read(cmdindex_segment_t *seg, uint64_t offset, void *data, size_t len)
+{
+	if(offset + len > seg->size || offset < seg->strings) {
+		return -1;
+	}
+	if(seg->block != NULL) {
+		memcpy(data, seg->block + (offset - seg->strings), len);
+		return 0;
+	}
+	return read_at(seg->fd, offset, data, len);
+}
+
+// the entry `i` of the term table and its term
+static int cmdindex_entry(cmdindex_segment_t *seg, uint32_t i, cmdindex_entry_t *e)
+{
+	uint8_t p[2 * API_CMDINDEX_ENTRY];
+	uint8_t term[1 + API_CMDINDEX_TERM + 2];
+	size_t n = i + 1 < seg->terms ? 2 * API_CMDINDEX_ENTRY : API_CMDINDEX_ENTRY;
+	uint64_t at = 0;
+
+	if(cmdindex_segment_read(seg, seg->table + (uint64_t)i * API_CMDINDEX_ENTRY, p, n) != 0) {
+		return -1;
+	}
+	e->postings = get_u64(p);
+	e->count = get_u32(p + 8);
+	e->end = n > API_CMDINDEX_ENTRY ? get_u64(p + API_CMDINDEX_ENTRY) : seg->strings;
+	at = seg->strings + get_u32(p + 12);
+	n = seg->table - at < sizeof(term) ? (size_t)(seg->table - at) : sizeof(term);
+	if(at >= seg->table || e->postings > e->end || e->end > seg->strings
+		|| cmdindex_segment_read(seg, at, term, n) != 0 || term[0] >= n) {
+		return -1;
+	}
+	e->len = term[0];
+	memcpy(e->term, term + 1, e->len);
+	e->term[e->len] = '\0';
+	return 0;
+}
+
+// the postings of `e`
+static uint8_t *cmdindex_entry_postings(cmdindex_segment_t *seg, const cmdindex_entry_t *e)
+{
+	uint8_t *p = malloc(e->end > e->postings ? (size_t)(e->end - e->postings) : 1);
+
+	if(p != NULL && read_at(seg->fd, e->postings, p, (size_t)(e->end - e->postings)) != 0) {
+		SAFE_FREE(p);
+	}
+	return p;
+}
+
+static int cmdindex_term_cmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+	int c = memcmp(a, b, alen < blen ? alen : blen);
+
+	if(c != 0) {
+		return c;
+	}
+	return alen < blen ? -1 : (alen > blen ? 1 : 0);
+}
+
+// the first entry not before `term`
+static uint32_t cmdindex_find(cmdindex_segment_t *seg, const char *term, size_t len)
+{
+	cmdindex_entry_t e;
+	uint32_t lo = 0, hi = seg->terms, mid = 0;
+
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if(cmdindex_entry(seg, mid, &e) != 0) {
+			return seg->terms;
+		}
+		if(cmdindex_term_cmp(e.term, e.len, term, len) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static int cmdindex_writer_open(cmdindex_writer_t *w, uint32_t seq)
+{
+	uint8_t h[API_CMDINDEX_HEADER];
+
+	memset(w, 0x00, sizeof(*w));
+	snprintf(w->path, sizeof(w->path), "%s/%08x%s", store, seq, CMDINDEX_TEMP);
+	w->fd = open(w->path, O_RDWR|O_CREAT|O_TRUNC
+#ifndef _WIN32
+		, S_IRUSR|S_IWUSR
+#endif
+		);
+	if(w->fd < 0) {
+		trace_err("commands %s: %s", w->path, strerror(errno));
+		return -1;
+	}
+	memset(h, 0x00, sizeof(h));
+	w->failed = write_all(w->fd, h, sizeof(h));
+	w->pos = API_CMDINDEX_HEADER;
+	return 0;
+}
+
+static void cmdindex_writer_term(cmdindex_writer_t *w, const char *term, size_t len, const cmdindex_list_t *list)
+{
+	uint8_t e[API_CMDINDEX_ENTRY];
+	uint8_t n = (uint8_t)len;
+
+	put_u64(e, w->pos);
+	put_u32(e + 8, list->count);
+	put_u32(e + 12, (uint32_t)w->strings.len);
+	if(cmdindex_buffer_put(&w->table, e, sizeof(e)) != 0
+		|| cmdindex_buffer_put(&w->strings, &n, 1) != 0
+		|| cmdindex_buffer_put(&w->strings, term, len) != 0
+		|| cmdindex_buffer_put(&w->out, list->data, list->len) != 0) {
+		w->failed = -1;
+		return;
+	}
+	w->pos += list->len;
+	w->terms++;
+	if(w->out.len >= CMDINDEX_WRITE) {
+		w->failed |= write_all(w->fd, w->out.data, w->out.len);
+		w->out.len = 0;
+	}
+}
+
+// the segment in place as `seq` of `level` for the range [start, end) of
+// commands.dat, 0 on success
+static int cmdindex_writer_close(cmdindex_writer_t *w, uint32_t seq, uint32_t level,
+		uint64_t first, uint64_t last, uint64_t start, uint64_t end)
+{
+	uint8_t h[API_CMDINDEX_HEADER];
+	char path[512];
+
+	memcpy(h, API_CMDINDEX_SEGMENT_MAGIC, 8);
+	put_u32(h + 8, level);
+	put_u32(h + 12, w->terms);
+	put_u64(h + 16, first);
+	put_u64(h + 24, last);
+	put_u64(h + 32, start);
+	put_u64(h + 40, end);
+	put_u64(h + 48, w->pos);
+	put_u64(h + 56, w->pos + w->strings.len);
+	w->failed |= write_all(w->fd, w->out.data, w->out.len);
+	w->failed |= write_all(w->fd, w->strings.data, w->strings.len);
+	w->failed |= write_all(w->fd, w->table.data, w->table.len);
+	if(w->failed == 0 && lseek(w->fd, 0, SEEK_SET) == 0) {
+		w->failed = write_all(w->fd, h, sizeof(h));
+	}
+	close(w->fd);
+	SAFE_FREE(w->out.data);
+	SAFE_FREE(w->strings.data);
+	SAFE_FREE(w->table.data);
+	snprintf(path, sizeof(path), "%s/%08x%s", store, seq, CMDINDEX_SUFFIX);
+	if(w->failed != 0 || rename(w->path, path) != 0) {
+		trace_err("commands %s: %s", path, strerror(errno));
+		unlink(w->path);
+		return -1;
+	}
+	return 0;
+}
+
+//----------------< the indexer side >----------------
+
+static int cmdindex_index(uint64_t offset, const api_cmdindex_command_t *command, void *arg)
+{
+	cmdindex_term_t terms[CMDINDEX_TERMS];
+	cmdindex_list_t *list = NULL, **found = NULL;
+	size_t size = 0;
+	int n = cmdindex_terms(command, terms), i = 0;
+
+	(void)arg;
+	if(!memory_ready) {
+		api_hashtable_init(&memory, HT_NONE, 0.05);
+		memory_ready = 1;
+	}
+	for(i = 0; i < n; i++) {
+		found = api_hashtable_get(&memory, terms[i], strlen(terms[i]) + 1, &size);
+		if(found != NULL) {
+			list = *found;
+		} else if((list = calloc(1, sizeof(cmdindex_list_t))) != NULL) {
+			api_hashtable_insert(&memory, terms[i], strlen(terms[i]) + 1, &list, sizeof(list));
+		}
+		if(list == NULL || cmdindex_posting_put(list, offset, command->time) != 0) {
+			trace_err("commands: out of memory, %s not indexed", terms[i]);
+		}
+	}
+	if(mem_postings == 0) {
+		mem_first = mem_last = command->time;
+		mem_since = api_clock_usec();
+	}
+	mem_first = command->time < mem_first ? command->time : mem_first;
+	mem_last = command->time > mem_last ? command->time : mem_last;
+	mem_postings += n;
+	return 0;
+}
+
+static int cmdindex_key_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// the postings in memory as a segment of level 0
+static void cmdindex_flush(void)
+{
+	cmdindex_writer_t w;
+	cmdindex_list_t **found = NULL;
+	char **keys = NULL;
+	unsigned int count = 0, i = 0;
+	size_t size = 0;
+	int rc = -1;
+
+	keys = (char **)api_hashtable_keys(&memory, &count);
+	if(keys != NULL) {
+		qsort(keys, count, sizeof(char *), cmdindex_key_cmp);
+	}
+	rc = keys != NULL ? cmdindex_writer_open(&w, next_seq) : -1;
+	for(i = 0; i < count && keys != NULL; i++) {
+		found = api_hashtable_get(&memory, keys[i], strlen(keys[i]) + 1, &size);
+		if(found == NULL) {
+			continue;
+		}
+		if(rc == 0) {
+			cmdindex_writer_term(&w, keys[i], strlen(keys[i]), *found);
+		}
+		SAFE_FREE((*found)->data);
+		SAFE_FREE(*found);
+	}
+	if(rc == 0) {
+		rc = cmdindex_writer_close(&w, next_seq, 0, mem_first, mem_last, mem_start, indexed);
+	}
+	if(rc == 0) {
+		trace_out("commands: %08x%s, %u terms, %lu postings", next_seq, CMDINDEX_SUFFIX,
+			count, (unsigned long)mem_postings);
+		next_seq++;
+		mem_start = indexed;
+	} else {
+		// read the range again for the next try
+		trace_err("commands: %lu postings not written", (unsigned long)mem_postings);
+		indexed = mem_start;
+	}
+	SAFE_FREE(keys);
+	api_hashtable_clear(&memory);
+	mem_postings = 0;
+}
+
+// merges the newest run of segments of one level once it is long enough,
+// returns 1 if it did
+static int cmdindex_merge(void)
+{
+	cmdindex_segment_t *segs = NULL, *in = NULL;
+	cmdindex_entry_t *cur = NULL, *best = NULL, term;
+	cmdindex_writer_t w;
+	cmdindex_list_t list;
+	uint8_t *p = NULL;
+	uint64_t first = UINT64_MAX, last = 0, offset = 0, time = 0;
+	size_t pos = 0, len = 0;
+	char path[512];
+	uint32_t *at = NULL, i = 0;
+	int n = 0, from = 0, k = 0, rc = -1;
+
+	n = cmdindex_segments(store, 1, &segs, NULL);
+	if(n <= 0) {
+		return 0;
+	}
+	for(from = n - 1; from > 0 && segs[from - 1].level == segs[n - 1].level; from--);
+	if(n - from < API_CMDINDEX_MERGE) {
+		goto done;
+	}
+	in = segs + from;
+	at = calloc(n - from, sizeof(uint32_t));
+	cur = calloc(n - from, sizeof(cmdindex_entry_t));
+	memset(&list, 0x00, sizeof(list));
+	if(at == NULL || cur == NULL || cmdindex_writer_open(&w, next_seq) != 0) {
+		goto done;
+	}
+	for(k = 0; k < n - from; k++) {
+		len = (size_t)(in[k].size - in[k].strings);
+		in[k].block = malloc(len > 0 ? len : 1);
+		if(in[k].block == NULL || read_at(in[k].fd, in[k].strings, in[k].block, len) != 0
+			|| (in[k].terms > 0 && cmdindex_entry(&in[k], 0, &cur[k]) != 0)) {
+			w.failed = -1;
+		}
+		first = in[k].first < first ? in[k].first : first;
+		last = in[k].last > last ? in[k].last : last;
+	}
+	// the lists of a term one after the other, the segments are in the
+	// order of their ranges
+	while(w.failed == 0) {
+		best = NULL;
+		for(k = 0; k < n - from; k++) {
+			if(at[k] < in[k].terms && (best == NULL
+				|| cmdindex_term_cmp(cur[k].term, cur[k].len, best->term, best->len) < 0)) {
+				best = &cur[k];
+			}
+		}
+		if(best == NULL) {
+			break;
+		}
+		memcpy(&term, best, sizeof(term));
+		list.len = 0;
+		list.count = 0;
+		list.offset = list.time = 0;
+		for(k = 0; k < n - from && w.failed == 0; k++) {
+			if(at[k] >= in[k].terms || cmdindex_term_cmp(cur[k].term, cur[k].len, term.term, term.len) != 0) {
+				continue;
+			}
+			if((p = cmdindex_entry_postings(&in[k], &cur[k])) == NULL) {
+				w.failed = -1;
+				break;
+			}
+			pos = 0;
+			offset = time = 0;
+			for(i = 0; i < cur[k].count && w.failed == 0; i++) {
+				if(cmdindex_posting_get(p, (size_t)(cur[k].end - cur[k].postings), &pos, &offset, &time) != 0
+					|| cmdindex_posting_put(&list, offset, time) != 0) {
+					w.failed = -1;
+				}
+			}
+			free(p);
+			if(++at[k] < in[k].terms && cmdindex_entry(&in[k], at[k], &cur[k]) != 0) {
+				w.failed = -1;
+			}
+		}
+		if(w.failed == 0) {
+			cmdindex_writer_term(&w, term.term, term.len, &list);
+		}
+	}
+	SAFE_FREE(list.data);
+	rc = cmdindex_writer_close(&w, next_seq, in[0].level + 1, first, last, in[0].start, in[n - from - 1].end);
+	if(rc == 0) {
+		trace_out("commands: %d segments of level %u merged into %08x%s", n - from, in[0].level,
+			next_seq, CMDINDEX_SUFFIX);
+		next_seq++;
+		for(k = 0; k < n - from; k++) {
+			snprintf(path, sizeof(path), "%s/%08x%s", store, in[k].seq, CMDINDEX_SUFFIX);
+			unlink(path);
+		}
+	}
+done:
+	for(k = 0; k < n; k++) {
+		cmdindex_segment_close(&segs[k]);
+	}
+	SAFE_FREE(segs);
+	SAFE_FREE(at);
+	SAFE_FREE(cur);
+	return rc == 0;
+}
+
+static int cmdindex_open(void)
+{
+	char path[512], magic[8];
+
+	if(data_fd >= 0) {
+		return 0;
+	}
+#ifdef _WIN32
+	if(_mkdir(store) != 0 && errno != EEXIST) {
+#else
+	if(mkdir(store, S_IRWXU) != 0 && errno != EEXIST) {
+#endif
+		trace_err("commands %s: %s", store, strerror(errno));
+		return -1;
+	}
+	snprintf(path, sizeof(path), "%s/%s", store, CMDINDEX_DATA);
+	data_fd = open(path, O_RDWR|O_CREAT|O_APPEND
+#ifndef _WIN32
+		, S_IRUSR|S_IWUSR
+#endif
+		);
+	if(data_fd < 0) {
+		trace_err("commands %s: %s", path, strerror(errno));
+		return -1;
+	}
+	if(read_at(data_fd, 0, magic, 8) == 0 ? memcmp(magic, API_CMDINDEX_MAGIC, 8) != 0
+		: (lseek(data_fd, 0, SEEK_END) != 0 || write_all(data_fd, API_CMDINDEX_MAGIC, 8) != 0)) {
+		trace_err("commands %s: not a command log", path);
+		close(data_fd);
+		data_fd = -1;
+		return -1;
+	}
+	// proxies handing over share the log, the one holding the lock indexes it
+	snprintf(path, sizeof(path), "%s/%s", store, CMDINDEX_LOCK);
+	lock_fd = open(path, O_RDWR|O_CREAT
+#ifndef _WIN32
+		, S_IRUSR|S_IWUSR
+#endif
+		);
+	return 0;
+}
+
+// takes the index over once no other proxy holds it
+static int cmdindex_lock(void)
+{
+	cmdindex_segment_t *segs = NULL;
+	int n = 0, i = 0;
+#ifndef _WIN32
+	struct flock fl;
+
+	memset(&fl, 0x00, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	if(lock_fd < 0 || fcntl(lock_fd, F_SETLK, &fl) != 0) {
+		return -1;
+	}
+#endif
+	indexing = 1;
+	indexed = 8;
+	next_seq = 0;
+	n = cmdindex_segments(store, 1, &segs, &next_seq);
+	next_seq++;
+	for(i = 0; i < n; i++) {
+		indexed = segs[i].end;
+		cmdindex_segment_close(&segs[i]);
+	}
+	SAFE_FREE(segs);
+	mem_start = indexed;
+	trace_out("commands: indexing %s from %llu", store, (unsigned long long)indexed);
+	return 0;
+}
+
+// indexes what the log gained, writes the postings out when due (or with
+// `all`) and merges what can be
+static void cmdindex_maintain(int all)
+{
+	off_t size = 0;
+
+	if(data_fd < 0 || (!indexing && cmdindex_lock() != 0)) {
+		return;
+	}
+	size = lseek(data_fd, 0, SEEK_END);
+	if(size > 0 && (uint64_t)size > indexed) {
+		indexed = cmdindex_scan(data_fd, indexed, (uint64_t)size, cmdindex_index, NULL);
+	}
+	if(mem_postings > 0 && (all || mem_postings >= API_CMDINDEX_FLUSH_POSTINGS
+		|| api_clock_usec() - mem_since >= API_CMDINDEX_FLUSH_USEC)) {
+		cmdindex_flush();
+		while(!all && cmdindex_merge());
+	}
+}
+
+static void cmdindex_close(void)
+{
+	cmdindex_maintain(1);
+	if(memory_ready) {
+		api_hashtable_destroy(&memory);
+		memory_ready = 0;
+	}
+	if(lock_fd >= 0) {
+		close(lock_fd);
+		lock_fd = -1;
+	}
+	if(data_fd >= 0) {
+		close(data_fd);
+		data_fd = -1;
+	}
+	indexing = 0;
+}
+
+static void cmdindex_do(cmdindex_job_t *job)
+{
+	if(cmdindex_open() != 0 || write_all(data_fd, job->data, job->len) != 0) {
+		trace_err("commands: a record of %lu bytes lost", (unsigned long)job->len);
+	}
+}
+
+#ifndef _WIN32
+static void *cmdindex_indexer(void *arg)
+{
+	cmdindex_job_t *jobs = NULL, *job = NULL;
+	struct timespec ts;
+	struct timeval tv;
+	int done = 0;
+
+	(void)arg;
+	// what an earlier proxy left unindexed does not wait for a command
+	cmdindex_open();
+	pthread_mutex_lock(&lock);
+	for(;;) {
+		if(head == NULL && !stopping) {
+			// a second at most, postings are written out by time too
+			gettimeofday(&tv, NULL);
+			ts.tv_sec = tv.tv_sec + 1;
+			ts.tv_nsec = tv.tv_usec * 1000;
+			pthread_cond_timedwait(&ready, &lock, &ts);
+		}
+		jobs = head;
+		head = tail = NULL;
+		done = stopping && jobs == NULL;
+		pthread_mutex_unlock(&lock);
+		if(done) {
+			break;
+		}
+		while(jobs != NULL) {
+			job = jobs;
+			jobs = job->next;
+			cmdindex_do(job);
+			free(job);
+		}
+		cmdindex_maintain(0);
+		pthread_mutex_lock(&lock);
+	}
+	cmdindex_close();
+	return NULL;
+}
+#endif
+
+void api_cmdindex_dir(const char *dir)
+{
+	snprintf(store, sizeof(store), "%s", dir);
+}
+
+int api_cmdindex_start(void)
+{
+#ifndef _WIN32
+	pthread_mutex_lock(&lock);
+	if(!running) {
+		stopping = 0;
+		if(pthread_create(&indexer, NULL, cmdindex_indexer, NULL) != 0) {
+			pthread_mutex_unlock(&lock);
+			trace_err("commands: no indexer thread, indexing inline");
+			return -1;
+		}
+		running = 1;
+	}
+	pthread_mutex_unlock(&lock);
+#endif
+	return 0;
+}
+
+void api_cmdindex_stop(void)
+{
+#ifndef _WIN32
+	pthread_mutex_lock(&lock);
+	if(running) {
+		stopping = 1;
+		pthread_cond_signal(&ready);
+		pthread_mutex_unlock(&lock);
+		pthread_join(indexer, NULL);
+		pthread_mutex_lock(&lock);
+		running = 0;
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	pthread_mutex_unlock(&lock);
+#endif
+	cmdindex_close();
+}
+
+void api_cmdindex_add(const api_cmdindex_command_t *command)
+{
+	api_cmdindex_command_t c = *command;
+	cmdindex_job_t *job = NULL;
+	uint8_t record[API_CMDINDEX_RECORD_MAX];
+	size_t len = 0;
+
+	if(c.time == 0) {
+		c.time = api_clock_usec();
+	}
+	len = cmdindex_record_put(record, &c);
+	job = malloc(sizeof(cmdindex_job_t) + len);
+	if(job == NULL) {
+		trace_err("commands: out of memory, a command lost");
+		return;
+	}
+	job->next = NULL;
+	job->len = len;
+	memcpy(job->data, record, len);
+#ifndef _WIN32
+	pthread_mutex_lock(&lock);
+	if(running) {
+		if(tail != NULL) {
+			tail->next = job;
+		} else {
+			head = job;
+		}
+		tail = job;
+		pthread_cond_signal(&ready);
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	pthread_mutex_unlock(&lock);
+#endif
+	cmdindex_do(job);
+	free(job);
+	cmdindex_maintain(0);
+}
+
+//----------------< the query side >----------------
+
+static int cmdindex_hit_cmp(const void *a, const void *b)
+{
+	const cmdindex_hit_t *x = a, *y = b;
+
+	return x->offset < y->offset ? -1 : (x->offset > y->offset ? 1 : 0);
+}
+
+// the postings of `e` within the time range, appended to `hits`
+static int cmdindex_hits_add(cmdindex_query_t *q, cmdindex_segment_t *seg, const cmdindex_entry_t *e, cmdindex_hits_t *hits)
+{
+	cmdindex_hit_t *p = NULL;
+	uint8_t *data = cmdindex_entry_postings(seg, e);
+	uint64_t offset = 0, time = 0;
+	size_t pos = 0, size = 0;
+	uint32_t i = 0;
+
+	if(data == NULL) {
+		return -1;
+	}
+	if(hits->size - hits->count < e->count) {
+		size = hits->count + e->count;
+		p = realloc(hits->hits, size * sizeof(cmdindex_hit_t));
+		if(p == NULL) {
+			free(data);
+			return -1;
+		}
+		hits->hits = p;
+		hits->size = size;
+	}
+	for(i = 0; i < e->count; i++) {
+		if(cmdindex_posting_get(data, (size_t)(e->end - e->postings), &pos, &offset, &time) != 0) {
+			break;
+		}
+		if(time >= q->from && time < q->to) {
+			hits->hits[hits->count].offset = offset;
+			hits->hits[hits->count].time = time;
+			hits->count++;
+		}
+	}
+	free(data);
+	return 0;
+}
+
+// the postings `want` has in `seg`, sorted by offset; with `count_only`
+// their number in want->count only
+static int cmdindex_lookup(cmdindex_query_t *q, cmdindex_segment_t *seg, cmdindex_want_t *want,
+		cmdindex_hits_t *hits, int count_only)
+{
+	cmdindex_entry_t e;
+	uint32_t i = cmdindex_find(seg, want->term, want->len);
+	size_t k = 0, n = 0;
+
+	want->count = 0;
+	for(; i < seg->terms && cmdindex_entry(seg, i, &e) == 0; i++) {
+		if(want->prefix ? e.len < want->len || memcmp(e.term, want->term, want->len) != 0
+			: cmdindex_term_cmp(e.term, e.len, want->term, want->len) != 0) {
+			break;
+		}
+		want->count += e.count;
+		if(!count_only && cmdindex_hits_add(q, seg, &e, hits) != 0) {
+			return -1;
+		}
+		if(!want->prefix) {
+			break;
+		}
+	}
+	if(!count_only && want->prefix && hits->count > 1) {
+		// the lists of several words, a command may hold more than one
+		qsort(hits->hits, hits->count, sizeof(cmdindex_hit_t), cmdindex_hit_cmp);
+		for(k = 1, n = 1; k < hits->count; k++) {
+			if(hits->hits[k].offset != hits->hits[n - 1].offset) {
+				hits->hits[n++] = hits->hits[k];
+			}
+		}
+		hits->count = n;
+	}
+	return 0;
+}
+
+static int cmdindex_want_cmp(const void *a, const void *b)
+{
+	const cmdindex_want_t *x = a, *y = b;
+
+	return x->count < y->count ? -1 : (x->count > y->count ? 1 : 0);
+}
+
+static int cmdindex_report(cmdindex_query_t *q, uint64_t offset)
+{
+	api_cmdindex_command_t command;
+	uint8_t p[4];
+	uint32_t len = 0;
+
+	if(read_at(q->fd, offset, p, 4) != 0 || (len = get_u32(p)) < CMDINDEX_RECORD
+		|| len > API_CMDINDEX_RECORD_MAX - 4 || read_at(q->fd, offset + 4, q->record, len) != 0
+		|| cmdindex_record_get(q->record, len, &command, q->text) != 0) {
+		trace_err("commands: damaged record at %llu", (unsigned long long)offset);
+		return 0;
+	}
+	q->count++;
+	if(q->cb(&command, q->arg) != 0) {
+		q->stop = 1;
+	}
+	return q->stop;
+}
+
+// the smallest list first, the others intersected with it
+static void cmdindex_query_segment(cmdindex_query_t *q, cmdindex_segment_t *seg)
+{
+	cmdindex_hits_t hits, more;
+	size_t i = 0, k = 0, n = 0;
+	int w = 0;
+
+	if(seg->last < q->from || seg->first >= q->to) {
+		return;
+	}
+	for(w = 0; w < q->nwants; w++) {
+		if(cmdindex_lookup(q, seg, &q->wants[w], NULL, 1) != 0 || q->wants[w].count == 0) {
+			return;
+		}
+	}
+	qsort(q->wants, q->nwants, sizeof(cmdindex_want_t), cmdindex_want_cmp);
+	memset(&hits, 0x00, sizeof(hits));
+	memset(&more, 0x00, sizeof(more));
+	if(cmdindex_lookup(q, seg, &q->wants[0], &hits, 0) != 0) {
+		goto done;
+	}
+	for(w = 1; w < q->nwants && hits.count > 0; w++) {
+		more.count = 0;
+		if(cmdindex_lookup(q, seg, &q->wants[w], &more, 0) != 0) {
+			goto done;
+		}
+		for(i = 0, k = 0, n = 0; i < hits.count && k < more.count;) {
+			if(hits.hits[i].offset < more.hits[k].offset) {
+				i++;
+			} else if(hits.hits[i].offset > more.hits[k].offset) {
+				k++;
+			} else {
+				hits.hits[n++] = hits.hits[i++];
+				k++;
+			}
+		}
+		hits.count = n;
+	}
+	for(i = 0; i < hits.count && !q->stop; i++) {
+		cmdindex_report(q, hits.hits[i].offset);
+	}
+done:
+	SAFE_FREE(hits.hits);
+	SAFE_FREE(more.hits);
+}
+
+// commands.dat where no segment covers it
+static int cmdindex_query_scan(uint64_t offset, const api_cmdindex_command_t *command, void *arg)
+{
+	cmdindex_query_t *q = arg;
+	cmdindex_term_t terms[CMDINDEX_TERMS];
+	int n = 0, w = 0, i = 0;
+
+	if(command->time < q->from || command->time >= q->to) {
+		return 0;
+	}
+	n = cmdindex_terms(command, terms);
+	for(w = 0; w < q->nwants; w++) {
+		for(i = 0; i < n; i++) {
+			if(q->wants[w].prefix ? strncmp(terms[i], q->wants[w].term, q->wants[w].len) == 0
+				: strcmp(terms[i], q->wants[w].term) == 0) {
+				break;
+			}
+		}
+		if(i == n) {
+			return 0;
+		}
+	}
+	(void)offset;
+	q->count++;
+	if(q->cb(command, q->arg) != 0) {
+		q->stop = 1;
+	}
+	return q->stop;
+}
+
+static int cmdindex_want_add(cmdindex_query_t *q, const char *tag, const char *s)
+{
+	cmdindex_term_t one[1];
+
+	if(cmdindex_term_add(one, 0, tag, s, strlen(s), 0) == 1) {
+		memcpy(q->wants[q->nwants].term, one[0], sizeof(one[0]));
+		q->wants[q->nwants].len = strlen(one[0]);
+		q->wants[q->nwants].prefix = 0;
+		q->nwants++;
+	}
+	return q->nwants;
+}
+
+int api_cmdindex_query(const char *dir, const api_cmdindex_filter_t *filter, api_cmdindex_cb cb, void *arg)
+{
+	cmdindex_term_t words[CMDINDEX_TERMS - 2];
+	cmdindex_segment_t *segs = NULL;
+	cmdindex_query_t *q = NULL;
+	char path[512], magic[8];
+	uint64_t covered = 8;
+	off_t size = 0;
+	int n = 0, i = 0, count = -1;
+	size_t len = 0;
+
+	q = calloc(1, sizeof(cmdindex_query_t));
+	if(q == NULL) {
+		return -1;
+	}
+	n = filter->words != NULL ? cmdindex_words(filter->words, words, CMDINDEX_TERMS - 2, 1) : 0;
+	for(i = 0; i < n; i++) {
+		len = strlen(words[i]);
+		if(words[i][len - 1] == '*') {
+			words[i][--len] = '\0';
+			if(len == 0) {
+				continue;
+			}
+			q->wants[q->nwants].prefix = 1;
+		}
+		memcpy(q->wants[q->nwants].term, words[i], len + 1);
+		q->wants[q->nwants].len = len;
+		q->nwants++;
+	}
+	if(filter->user != NULL) {
+		cmdindex_want_add(q, "\001u", filter->user);
+	}
+	if(filter->host != NULL) {
+		cmdindex_want_add(q, "\001h", filter->host);
+	}
+	q->from = filter->from;
+	q->to = filter->to > 0 ? filter->to : UINT64_MAX;
+	q->cb = cb;
+	q->arg = arg;
+	snprintf(path, sizeof(path), "%s/%s", dir, CMDINDEX_DATA);
+	q->fd = q->nwants > 0 ? open(path, O_RDONLY) : -1;
+	if(q->fd < 0) {
+		free(q);
+		return -1;
+	}
+	if(read_at(q->fd, 0, magic, 8) != 0 || memcmp(magic, API_CMDINDEX_MAGIC, 8) != 0) {
+		goto done;
+	}
+	size = lseek(q->fd, 0, SEEK_END);
+	n = cmdindex_segments(dir, 0, &segs, NULL);
+	for(i = 0; i < n && !q->stop; i++) {
+		if(segs[i].start > covered) {
+			cmdindex_scan(q->fd, covered, segs[i].start, cmdindex_query_scan, q);
+		}
+		if(!q->stop) {
+			cmdindex_query_segment(q, &segs[i]);
+		}
+		covered = segs[i].end;
+	}
+	if(!q->stop && (uint64_t)size > covered) {
+		cmdindex_scan(q->fd, covered, (uint64_t)size, cmdindex_query_scan, q);
+	}
+	count = q->count;
+done:
+	for(i = 0; i < n; i++) {
+		cmdindex_segment_close(&segs[i]);
+	}
+	SAFE_FREE(segs);
+	close(q->fd);
+	free(q);
+	return count;
+}
@@ -80,43 +80,86 @@ int gettimeofday(struct timeval *__p, void *__t) {
 }
 #endif
 
-static int current_timestring(int hires, char *buf, size_t len)
+#if defined(HAVE_GCC_THREAD_LOCAL_STORAGE)
+# define API_THREAD __thread
+#elif defined(HAVE_MSC_THREAD_LOCAL_STORAGE)
+# define API_THREAD __declspec(thread)
+#else
+# define API_THREAD
+#endif
+
+// the clock of a thread, localtime() and strftime() once a second
+typedef struct api_clock_struct {
+	api_clock_source_t source;
+	time_t   sec;
+	char     second[24];   // "YYYY/MM/DD HH:MM:SS."
+	size_t   len;
+} api_clock_t;
+
+static API_THREAD api_clock_t log_clock = {NULL, -1, {0}, 0};
+
+void api_clock_source(api_clock_source_t source)
 {
-    char tbuf[64];
-    struct timeval tv;
-    struct tm *tm;
-    time_t t;
+	log_clock.source = source;
+}
 
-    gettimeofday(&tv, NULL);
-    t = (time_t) tv.tv_sec;
+uint64_t api_clock_usec(void)
+{
+	struct timeval tv;
 
-    tm = localtime(&t);
-    if (tm == NULL) {
-        return -1;
-    }
+	if(log_clock.source != NULL) {
+		return log_clock.source();
+	}
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
 
-    if (hires) {
-        strftime(tbuf, sizeof(tbuf) - 1, "%Y/%m/%d %H:%M:%S", tm);
-        snprintf(buf, len, "%s.%06ld", tbuf, (long)tv.tv_usec);
-    } else {
-        strftime(tbuf, sizeof(tbuf) - 1, "%Y/%m/%d %H:%M:%S", tm);
-        snprintf(buf, len, "%s", tbuf);
-    }
+size_t api_clock_string(char *buf, size_t size, uint64_t *usec)
+{
+	uint64_t now = api_clock_usec();
+	time_t t = (time_t)(now / 1000000);
+	unsigned int us = (unsigned int)(now % 1000000);
+	struct tm tm;
+	int i = 0;
 
-    return 0;
+	if(t != log_clock.sec) {
+#ifndef _WIN32
+		localtime_r(&t, &tm);
+#else
+		localtime_s(&tm, &t);
+#endif
+		log_clock.len = strftime(log_clock.second, sizeof(log_clock.second) - 1, "%Y/%m/%d %H:%M:%S", &tm);
+		log_clock.second[log_clock.len++] = '.';
+		log_clock.sec = t;
+	}
+	if(usec != NULL) {
+		*usec = now;
+	}
+	if(size < log_clock.len + 7) {
+		if(size > 0) {
+			buf[0] = '\0';
+		}
+		return 0;
+	}
+	memcpy(buf, log_clock.second, log_clock.len);
+	for(i = 5; i >= 0; i--) {
+		buf[log_clock.len + i] = '0' + us % 10;
+		us /= 10;
+	}
+	buf[log_clock.len + 6] = '\0';
+	return log_clock.len + 6;
 }
 
-int api_sftpfile_open(const char *username, const char *filename)
+int api_sftpfile_create(const char *username, const char *filename, char *sftpfile, size_t size)
 {
 	int fp = -1;
 	time_t t = time(NULL);
 	struct tm *dt = localtime(&t);
 	char dir[256];
 	char tbuf[64];
-	char sftpfile[1024];
 
 	memset(dir, 0x00, sizeof(dir));
-	memset(sftpfile, 0x00, sizeof(sftpfile));
+	memset(sftpfile, 0x00, size);
 	snprintf(dir, sizeof(dir) - 1, "%s/%4i/%.2i/%.2i/",
 		log_path,
 		dt->tm_year + 1900,
@@ -128,7 +171,7 @@ int api_sftpfile_open(const char *username, const char *filename)
 		}
 	}
 	strftime(tbuf, sizeof(tbuf) - 1, "%H%M%S", dt);
-	snprintf(sftpfile, sizeof(sftpfile) - 1, "%s/%s-%s-%s", dir, username, tbuf, filename);
+	snprintf(sftpfile, size - 1, "%s/%s-%s-%s", dir, username, tbuf, filename);
 	if((fp = open(sftpfile, O_RDWR|O_CREAT|O_APPEND
 #ifndef _WIN32
 		, S_IRUSR|S_IWUSR
@@ -140,6 +183,59 @@ int api_sftpfile_open(const char *username, const char *filename)
 	return fp;
 }
 
+int api_logfile_open(const char *filename, int flags)
+{
+	int fp = -1;
+	time_t t = time(NULL);
+	struct tm *dt = localtime(&t);
+	char dir[256];
+	char logfile[1024];
+
+	memset(dir, 0x00, sizeof(dir));
+	memset(logfile, 0x00, sizeof(logfile));
+	snprintf(dir, sizeof(dir) - 1, "%s/%4i/%.2i/%.2i/",
+		log_path,
+		dt->tm_year + 1900,
+		dt->tm_mon + 1,
+		dt->tm_mday);
+	if(access(dir, F_OK) != 0) {
+		if(createDir(dir) != 0) {
+			trace_err("mkdir error: %s", dir);
+		}
+	}
+	snprintf(logfile, sizeof(logfile) - 1, "%s/%s", dir, filename);
+	if((fp = open(logfile, flags
+#ifndef _WIN32
+		, S_IRUSR|S_IWUSR
+#endif
+		)) == -1) {
+		fp = -1;
+		trace_out("can not open file: %s", logfile);
+	}
+	return fp;
+}
+
+int api_sftpfile_open(const char *username, const char *filename)
+{
+	char sftpfile[1024];
+
+	return api_sftpfile_create(username, filename, sftpfile, sizeof(sftpfile));
+}
+
+int api_log_access(const char *line, size_t len)
+{
+	int iRet = -1;
+
+	iRet = fwrite(line, 1, len, stdout);
+	if(log_fd_access == -1) {
+		log_fd_access = api_logfile_open(log_access, O_RDWR|O_CREAT|O_APPEND);
+	}
+	if(log_fd_access > 0) {
+		iRet = write(log_fd_access, line, len);
+	}
+	return iRet;
+}
+
 API_DECLARE(int) 
 api_log(log_level_e level, const char *fmt, va_list args)
 {
@@ -189,61 +285,28 @@ api_log(log_level_e level, const char *fmt, va_list args)
 	memset(fmtbuf, 0x00, sizeof(fmtbuf));
 	memset(msgbuf, 0x00, sizeof(msgbuf));
 	if(level == LOG_LEVEL_INFO) {
-		char ts[100];
-		memset(ts, 0x00, sizeof(ts));
-		current_timestring(1, ts, sizeof(ts));
+		char ts[32];
+		api_clock_string(ts, sizeof(ts), NULL);
 		snprintf(fmtbuf, sizeof(fmtbuf), "[%s] %s", ts, fmt);
 	} else {
 		snprintf(fmtbuf, sizeof(fmtbuf), "%s: %s", prefix, fmt);
 	}
 	len = vsnprintf(msgbuf, sizeof(msgbuf) - 2, fmtbuf, args);
-	if(len > 0) {
-		char *p = msgbuf;
-		while(len > 0)
-	    {
-			if(strchr(" \t\r\n", *(p + len - 1))) {
-	            *(p + len - 1) = 0x00;
-	            len--;
-	        } else {
-	            break;
-	        }
-	    }
+	if(len > (int)sizeof(msgbuf) - 3) {
+		len = sizeof(msgbuf) - 3;
 	}
-	iRet = fprintf(out, "%s\r\n", msgbuf);
-	if(level == LOG_LEVEL_INFO)
-	{
-		if(log_fd_access == -1) {
-			time_t t = time(NULL);
-			struct tm *dt = localtime(&t);
-			char dir[256];
-			char logfile[1024];
-
-			memset(dir, 0x00, sizeof(dir));
-			memset(logfile, 0x00, sizeof(logfile));
-			snprintf(dir, sizeof(dir) - 1, "%s/%4i/%.2i/%.2i/",
-				log_path,
-				dt->tm_year + 1900,
-				dt->tm_mon + 1,
-				dt->tm_mday);
-			if(access(dir, F_OK) != 0) {
-				if(createDir(dir) != 0) {
-					trace_err("mkdir error: %s", dir);
-				}
-			}
-			snprintf(logfile, sizeof(logfile) - 1, "%s/%s", dir, log_access);
-			if((log_fd_access = open(logfile, O_RDWR|O_CREAT|O_APPEND
-#ifndef _WIN32
-				, S_IRUSR|S_IWUSR
-#endif
-				)) == -1) {
-				log_fd_access = -1;
-				trace_out("can not open file: %s", logfile);
-			}
-		}
-		if(log_fd_access > 0) {
-			strcat(msgbuf, "\r\n");
-			iRet = write(log_fd_access, msgbuf, strlen(msgbuf));
-		}
+	while(len > 0 && strchr(" \t\r\n", msgbuf[len - 1]) != NULL) {
+		len--;
+	}
+	if(len < 0) {
+		len = 0;
+	}
+	msgbuf[len++] = '\r';
+	msgbuf[len++] = '\n';
+	if(level == LOG_LEVEL_INFO) {
+		iRet = api_log_access(msgbuf, len);
+	} else {
+		iRet = fwrite(msgbuf, 1, len, out);
 	}
 	return iRet;
 }
@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include "api_log.h"
+#include "api_misc.h"
+#include "api_hashtable.h"
+#include "api_transfer.h"
+
+#define TRANSFER_DATA_MAGIC  "SPXTRD01"
+#define TRANSFER_INDEX_MAGIC "SPXTRI01"
+#define TRANSFER_HASH_MAGIC  "SPXTRH01"
+#define TRANSFER_RECORD_MAX  (32 * 1024) // with its length
+
+enum transfer_file_e {
+	TRANSFER_DATA = 0,
+	TRANSFER_INDEX,
+	TRANSFER_HASH,
+	TRANSFER_FILES
+};
+
+static const char *transfer_names[TRANSFER_FILES] = {
+	"transfers.dat", "transfers.idx", "transfers.hash"
+};
+
+static const char *transfer_magics[TRANSFER_FILES] = {
+	TRANSFER_DATA_MAGIC, TRANSFER_INDEX_MAGIC, TRANSFER_HASH_MAGIC
+};
+
+typedef struct transfer_entry_struct {
+	uint64_t end;
+	uint64_t offset;
+	uint64_t lead;      // first 8 bytes of the hash
+	uint32_t user;      // key of the user name
+	uint32_t next_hash;
+	uint32_t next_user;
+} transfer_entry_t;
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+	put_u32(p, (uint32_t)(v >> 32));
+	put_u32(p + 4, (uint32_t)v);
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+	return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+	return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static int write_at(int fd, uint64_t offset, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	ssize_t n = 0;
+
+	if(lseek(fd, (off_t)offset, SEEK_SET) == (off_t)-1) {
+		return -1;
+	}
+	while(len > 0) {
+		n = write(fd, p, len);
+		if(n <= 0) {
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int read_at(int fd, uint64_t offset, void *data, size_t len)
+{
+	uint8_t *p = data;
+	ssize_t n = 0;
+
+	if(lseek(fd, (off_t)offset, SEEK_SET) == (off_t)-1) {
+		return -1;
+	}
+	while(len > 0) {
+		n = read(fd, p, len);
+		if(n <= 0) {
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static uint32_t transfer_user_key(const char *user)
+{
+	uint32_t key = 0;
+
+	MurmurHash3_x86_32(user, (int)strlen(user), 0, &key);
+	return key;
+}
+
+static uint32_t transfer_hash_bucket(const uint8_t *hash)
+{
+	return get_u32(hash) % API_TRANSFER_BUCKETS;
+}
+
+static uint32_t transfer_user_bucket(uint32_t key)
+{
+	return key % API_TRANSFER_BUCKETS;
+}
+
+static void transfer_entry_put(uint8_t *p, const transfer_entry_t *e)
+{
+	put_u64(p, e->end);
+	put_u64(p + 8, e->offset);
+	put_u64(p + 16, e->lead);
+	put_u32(p + 24, e->user);
+	put_u32(p + 28, e->next_hash);
+	put_u32(p + 32, e->next_user);
+	put_u32(p + 36, 0);
+}
+
+static int transfer_entry_get(int fd, uint32_t number, transfer_entry_t *e)
+{
+	uint8_t p[API_TRANSFER_ENTRY];
+
+	if(read_at(fd, 8 + (uint64_t)(number - 1) * API_TRANSFER_ENTRY, p, sizeof(p)) != 0) {
+		return -1;
+	}
+	e->end = get_u64(p);
+	e->offset = get_u64(p + 8);
+	e->lead = get_u64(p + 16);
+	e->user = get_u32(p + 24);
+	e->next_hash = get_u32(p + 28);
+	e->next_user = get_u32(p + 32);
+	return 0;
+}
+
+static uint32_t transfer_entries(int fd)
+{
+	off_t size = lseek(fd, 0, SEEK_END);
+
+	return size < 8 ? 0 : (uint32_t)((size - 8) / API_TRANSFER_ENTRY);
+}
+
+// opens the files of the store, `create` makes the missing ones
+static int transfer_open(const char *dir, int create, int fds[TRANSFER_FILES])
+{
+	char path[512], magic[8];
+	int i = 0;
+
+	for(i = 0; i < TRANSFER_FILES; i++) {
+		fds[i] = -1;
+	}
+	if(create) {
+#ifdef _WIN32
+		if(_mkdir(dir) != 0 && errno != EEXIST) {
+#else
+		if(mkdir(dir, S_IRWXU) != 0 && errno != EEXIST) {
+#endif
+			trace_err("transfers %s: %s", dir, strerror(errno));
+			return -1;
+		}
+	}
+	for(i = 0; i < TRANSFER_FILES; i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, transfer_names[i]);
+		fds[i] = open(path, create ? O_RDWR|O_CREAT : O_RDONLY
+#ifndef _WIN32
+			, S_IRUSR|S_IWUSR
+#endif
+			);
+		if(fds[i] < 0) {
+			if(create || errno != ENOENT) {
+				trace_err("transfers %s: %s", path, strerror(errno));
+			}
+			break;
+		}
+		if(read_at(fds[i], 0, magic, 8) == 0) {
+			if(memcmp(magic, transfer_magics[i], 8) == 0) {
+				continue;
+			}
+		} else if(create && lseek(fds[i], 0, SEEK_END) == 0) {
+			// a new store, the bucket heads start out empty
+			if(write_at(fds[i], 0, transfer_magics[i], 8) == 0
+				&& (i != TRANSFER_HASH || ftruncate(fds[i], 8 + 8 * (off_t)API_TRANSFER_BUCKETS) == 0)) {
+				continue;
+			}
+		}
+		trace_err("transfers %s: not a transfer store", path);
+		break;
+	}
+	if(i == TRANSFER_FILES) {
+		return 0;
+	}
+	for(i = 0; i < TRANSFER_FILES; i++) {
+		if(fds[i] >= 0) {
+			close(fds[i]);
+		}
+	}
+	return -1;
+}
+
+static void transfer_close(int fds[TRANSFER_FILES])
+{
+	int i = 0;
+
+	for(i = 0; i < TRANSFER_FILES; i++) {
+		close(fds[i]);
+	}
+}
+
+static int transfer_lock(int fd, int type)
+{
+#ifndef _WIN32
+	struct flock fl;
+
+	memset(&fl, 0x00, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	while(fcntl(fd, F_SETLKW, &fl) != 0) {
+		if(errno != EINTR) {
+			return -1;
+		}
+	}
+#endif
+	return 0;
+}
+
+static size_t transfer_put_string(uint8_t *p, const char *s)
+{
+	size_t len = s == NULL ? 0 : strlen(s);
+
+	if(len > 0xffff) {
+		len = 0xffff;
+	}
+	put_u16(p, (uint16_t)len);
+	if(len > 0) {
+		memcpy(p + 2, s, len);
+	}
+	return 2 + len;
+}
+
+int api_transfer_append(const char *dir, const api_transfer_t *transfer)
+{
+	const char *strings[4] = {transfer->session, transfer->user, transfer->path, transfer->capture};
+	transfer_entry_t e;
+	uint8_t *rec = NULL, heads[4], entry[API_TRANSFER_ENTRY];
+	uint32_t count = 0, hb = 0, ub = 0;
+	size_t len = 4 + 8 * 3 + 1 + 32;
+	int fds[TRANSFER_FILES], rc = -1, i = 0;
+
+	for(i = 0; i < 4; i++) {
+		len += 2 + (strings[i] == NULL ? 0 : strlen(strings[i]));
+	}
+	if(len > TRANSFER_RECORD_MAX) {
+		trace_err("transfers: record of %s too long", transfer->path);
+		return -1;
+	}
+	rec = malloc(len);
+	if(rec == NULL) {
+		return -1;
+	}
+	put_u64(rec + 4, transfer->start);
+	put_u64(rec + 12, transfer->end);
+	put_u64(rec + 20, transfer->size);
+	rec[28] = (uint8_t)transfer->direction;
+	memcpy(rec + 29, transfer->hash, 32);
+	len = 4 + 8 * 3 + 1 + 32;
+	for(i = 0; i < 4; i++) {
+		len += transfer_put_string(rec + len, strings[i]);
+	}
+	put_u32(rec, len - 4);
+
+	if(transfer_open(dir, 1, fds) != 0) {
+		free(rec);
+		return -1;
+	}
+	// proxies handing over may share the store, one writer at a time
+	if(transfer_lock(fds[TRANSFER_INDEX], F_WRLCK) != 0) {
+		goto done;
+	}
+	memset(&e, 0x00, sizeof(e));
+	count = transfer_entries(fds[TRANSFER_INDEX]);
+	if(count > 0 && transfer_entry_get(fds[TRANSFER_INDEX], count, &e) != 0) {
+		goto unlock;
+	}
+	e.end = transfer->end > e.end ? transfer->end : e.end;
+	e.offset = (uint64_t)lseek(fds[TRANSFER_DATA], 0, SEEK_END);
+	e.lead = get_u64(transfer->hash);
+	e.user = transfer_user_key(transfer->user == NULL ? "" : transfer->user);
+	hb = transfer_hash_bucket(transfer->hash);
+	ub = transfer_user_bucket(e.user);
+	if(read_at(fds[TRANSFER_HASH], 8 + 4 * (uint64_t)hb, heads, 4) != 0) {
+		goto unlock;
+	}
+	e.next_hash = get_u32(heads);
+	if(read_at(fds[TRANSFER_HASH], 8 + 4 * ((uint64_t)API_TRANSFER_BUCKETS + ub), heads, 4) != 0) {
+		goto unlock;
+	}
+	e.next_user = get_u32(heads);
+	transfer_entry_put(entry, &e);
+	// the record, its entry, then the heads pointing to it
+	if(write_at(fds[TRANSFER_DATA], e.offset, rec, len) != 0
+		|| write_at(fds[TRANSFER_INDEX], 8 + (uint64_t)count * API_TRANSFER_ENTRY, entry, sizeof(entry)) != 0) {
+		trace_err("transfers %s: %s", dir, strerror(errno));
+		goto unlock;
+	}
+	put_u32(heads, count + 1);
+	if(write_at(fds[TRANSFER_HASH], 8 + 4 * (uint64_t)hb, heads, 4) != 0
+		|| write_at(fds[TRANSFER_HASH], 8 + 4 * ((uint64_t)API_TRANSFER_BUCKETS + ub), heads, 4) != 0) {
+		trace_err("transfers %s: %s", dir, strerror(errno));
+		goto unlock;
+	}
+	rc = 0;
+unlock:
+	transfer_lock(fds[TRANSFER_INDEX], F_UNLCK);
+done:
+	transfer_close(fds);
+	free(rec);
+	return rc;
+}
+
+/*
+ * Reads the record at `offset` into `buf` (2 * TRANSFER_RECORD_MAX bytes)
+ * and points `t` into it.
+ */
+static int transfer_record(int fd, uint64_t offset, uint8_t *buf, api_transfer_t *t)
+{
+	const char **strings[4] = {&t->session, &t->user, &t->path, &t->capture};
+	uint8_t *raw = buf + TRANSFER_RECORD_MAX;
+	uint32_t len = 0, at = 0, n = 0;
+	char *out = (char *)buf;
+	int i = 0;
+
+	if(read_at(fd, offset, raw, 4) != 0) {
+		return -1;
+	}
+	len = get_u32(raw);
+	if(len < 8 * 3 + 1 + 32 + 2 * 4 || len > TRANSFER_RECORD_MAX - 4
+		|| read_at(fd, offset + 4, raw, len) != 0) {
+		return -1;
+	}
+	t->start = get_u64(raw);
+	t->end = get_u64(raw + 8);
+	t->size = get_u64(raw + 16);
+	t->direction = raw[24];
+	memcpy(t->hash, raw + 25, 32);
+	at = 8 * 3 + 1 + 32;
+	for(i = 0; i < 4; i++) {
+		if(at + 2 > len || at + 2 + (n = get_u16(raw + at)) > len) {
+			return -1;
+		}
+		// the strings go in front of the raw record, terminated
+		memcpy(out, raw + at + 2, n);
+		out[n] = '\0';
+		*strings[i] = out;
+		out += n + 1;
+		at += 2 + n;
+	}
+	return 0;
+}
+
+int api_transfer_by_hash(const char *dir, const uint8_t hash[32], api_transfer_cb cb, void *arg)
+{
+	transfer_entry_t e;
+	api_transfer_t t;
+	uint8_t heads[4], *buf = NULL;
+	uint32_t number = 0, count = 0;
+	int fds[TRANSFER_FILES], found = 0;
+
+	if(transfer_open(dir, 0, fds) != 0) {
+		return -1;
+	}
+	buf = malloc(2 * TRANSFER_RECORD_MAX);
+	if(buf == NULL || read_at(fds[TRANSFER_HASH], 8 + 4 * (uint64_t)transfer_hash_bucket(hash), heads, 4) != 0) {
+		found = -1;
+		goto done;
+	}
+	count = transfer_entries(fds[TRANSFER_INDEX]);
+	for(number = get_u32(heads); number > 0 && number <= count; number = e.next_hash) {
+		if(transfer_entry_get(fds[TRANSFER_INDEX], number, &e) != 0 || e.next_hash >= number) {
+			break;
+		}
+		if(e.lead != get_u64(hash) || transfer_record(fds[TRANSFER_DATA], e.offset, buf, &t) != 0
+			|| memcmp(t.hash, hash, 32) != 0) {
+			continue;
+		}
+		found++;
+		if(cb(&t, arg) != 0) {
+			break;
+		}
+	}
+done:
+	SAFE_FREE(buf);
+	transfer_close(fds);
+	return found;
+}
+
+int api_transfer_by_user(const char *dir, const char *user, api_transfer_cb cb, void *arg)
+{
+	transfer_entry_t e;
+	api_transfer_t t;
+	uint8_t heads[4], *buf = NULL;
+	uint32_t number = 0, count = 0, key = transfer_user_key(user);
+	int fds[TRANSFER_FILES], found = 0;
+
+	if(transfer_open(dir, 0, fds) != 0) {
+		return -1;
+	}
+	buf = malloc(2 * TRANSFER_RECORD_MAX);
+	if(buf == NULL || read_at(fds[TRANSFER_HASH],
+		8 + 4 * ((uint64_t)API_TRANSFER_BUCKETS + transfer_user_bucket(key)), heads, 4) != 0) {
+		found = -1;
+		goto done;
+	}
+	count = transfer_entries(fds[TRANSFER_INDEX]);
+	for(number = get_u32(heads); number > 0 && number <= count; number = e.next_user) {
+		if(transfer_entry_get(fds[TRANSFER_INDEX], number, &e) != 0 || e.next_user >= number) {
+			break;
+		}
+		if(e.user != key || transfer_record(fds[TRANSFER_DATA], e.offset, buf, &t) != 0
+			|| strcmp(t.user, user) != 0) {
+			continue;
+		}
+		found++;
+		if(cb(&t, arg) != 0) {
+			break;
+		}
+	}
+done:
+	SAFE_FREE(buf);
+	transfer_close(fds);
+	return found;
+}
+
+int api_transfer_by_time(const char *dir, uint64_t from, uint64_t to, api_transfer_cb cb, void *arg)
+{
+	transfer_entry_t e;
+	api_transfer_t t;
+	uint8_t *buf = NULL;
+	uint32_t lo = 1, hi = 0, mid = 0;
+	int fds[TRANSFER_FILES], found = 0;
+
+	if(transfer_open(dir, 0, fds) != 0) {
+		return -1;
+	}
+	buf = malloc(2 * TRANSFER_RECORD_MAX);
+	if(buf == NULL) {
+		found = -1;
+		goto done;
+	}
+	// the first entry ending at `from` or later
+	hi = transfer_entries(fds[TRANSFER_INDEX]) + 1;
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if(transfer_entry_get(fds[TRANSFER_INDEX], mid, &e) != 0) {
+			found = -1;
+			goto done;
+		}
+		if(e.end < from) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	for(; transfer_entry_get(fds[TRANSFER_INDEX], lo, &e) == 0 && e.end < to; lo++) {
+		if(transfer_record(fds[TRANSFER_DATA], e.offset, buf, &t) != 0) {
+			continue;
+		}
+		found++;
+		if(cb(&t, arg) != 0) {
+			break;
+		}
+	}
+done:
+	SAFE_FREE(buf);
+	transfer_close(fds);
+	return found;
+}
@@ -0,0 +1,510 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "api_log.h"
+#include "api_misc.h"
+#include "api_ttyrec.h"
+
+#define TTYREC_FRAME_MAX (16 * 1024 * 1024)
+
+struct api_ttyrec_struct {
+	int       fd;
+	int       index;
+	char      path[1024];
+	api_vt_t *vt;
+	uint64_t  offset;    // of the next frame in the file
+	uint64_t  keyframe;  // time of the last keyframe
+	size_t    since;     // output bytes after it
+	char     *buf;       // frames not written yet
+	size_t    len;
+	struct api_ttyrec_struct *prev;
+	struct api_ttyrec_struct *next;
+};
+
+// the open recordings, only the event loop records
+static api_ttyrec_t *recordings = NULL;
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+	put_u32(p, (uint32_t)(v >> 32));
+	put_u32(p + 4, (uint32_t)v);
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+	return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+	return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	ssize_t n = 0;
+
+	while(len > 0) {
+		n = write(fd, p, len);
+		if(n <= 0) {
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int read_at(int fd, uint64_t offset, void *data, size_t len)
+{
+	uint8_t *p = data;
+	ssize_t n = 0;
+
+	if(lseek(fd, (off_t)offset, SEEK_SET) == (off_t)-1) {
+		return -1;
+	}
+	while(len > 0) {
+		n = read(fd, p, len);
+		if(n <= 0) {
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+//----------------< the proxy side >----------------
+
+static void ttyrec_write(api_ttyrec_t *rec)
+{
+	if(rec->len > 0 && rec->fd >= 0 && write_all(rec->fd, rec->buf, rec->len) != 0) {
+		trace_err("tty %s: %s", rec->path, strerror(errno));
+		close(rec->fd);
+		rec->fd = -1;
+	}
+	rec->len = 0;
+}
+
+static void ttyrec_frame(api_ttyrec_t *rec, uint64_t time, int kind, const void *head, size_t hlen,
+	const void *data, size_t len)
+{
+	uint8_t hdr[API_TTYREC_HEADER];
+
+	if(rec->fd < 0) {
+		return;
+	}
+	put_u64(hdr, time);
+	hdr[8] = kind;
+	put_u32(hdr + 9, (uint32_t)(hlen + len));
+	if(rec->len + sizeof(hdr) + hlen + len > API_TTYREC_BUFFER) {
+		ttyrec_write(rec);
+	}
+	if(sizeof(hdr) + hlen + len > API_TTYREC_BUFFER) {
+		// larger than the buffer, straight out
+		if(write_all(rec->fd, hdr, sizeof(hdr)) != 0 || write_all(rec->fd, head, hlen) != 0
+			|| write_all(rec->fd, data, len) != 0) {
+			trace_err("tty %s: %s", rec->path, strerror(errno));
+			close(rec->fd);
+			rec->fd = -1;
+			return;
+		}
+	} else {
+		memcpy(rec->buf + rec->len, hdr, sizeof(hdr));
+		rec->len += sizeof(hdr);
+		if(hlen > 0) {
+			memcpy(rec->buf + rec->len, head, hlen);
+			rec->len += hlen;
+		}
+		if(len > 0) {
+			memcpy(rec->buf + rec->len, data, len);
+			rec->len += len;
+		}
+	}
+	rec->offset += sizeof(hdr) + hlen + len;
+}
+
+// indexed once its frame is on disk, the index never points past the data
+static void ttyrec_keyframe(api_ttyrec_t *rec, uint64_t time)
+{
+	uint8_t size[4], entry[API_TTYREC_ENTRY];
+	const char *screen = NULL;
+	uint64_t offset = rec->offset;
+	size_t len = 0;
+	int cols = 0, rows = 0;
+
+	api_vt_size(rec->vt, &cols, &rows);
+	put_u16(size, cols);
+	put_u16(size + 2, rows);
+	screen = api_vt_snapshot(rec->vt, &len);
+	ttyrec_frame(rec, time, API_TTYREC_KEYFRAME, size, sizeof(size), screen, len);
+	ttyrec_write(rec);
+	put_u64(entry, time);
+	put_u64(entry + 8, offset);
+	if(rec->fd >= 0 && rec->index >= 0 && write_all(rec->index, entry, sizeof(entry)) != 0) {
+		trace_err("tty %s: index: %s", rec->path, strerror(errno));
+		close(rec->index);
+		rec->index = -1;
+	}
+	rec->keyframe = time;
+	rec->since = 0;
+}
+
+api_ttyrec_t *api_ttyrec_open(const char *username, const char *name, int cols, int rows)
+{
+	api_ttyrec_t *rec = NULL;
+	char index[1100];
+
+	rec = calloc(1, sizeof(api_ttyrec_t));
+	if(rec == NULL) {
+		return NULL;
+	}
+	rec->index = -1;
+	rec->buf = malloc(API_TTYREC_BUFFER);
+	rec->vt = api_vt_new(cols, rows);
+	rec->fd = api_sftpfile_create(username, name, rec->path, sizeof(rec->path));
+	if(rec->buf == NULL || rec->vt == NULL || rec->fd < 0
+		|| write_all(rec->fd, API_TTYREC_MAGIC, 8) != 0) {
+		goto err;
+	}
+	snprintf(index, sizeof(index), "%s%s", rec->path, API_TTYREC_INDEX_SUFFIX);
+	rec->index = open(index, O_RDWR|O_CREAT|O_TRUNC|O_APPEND
+#ifndef _WIN32
+		, S_IRUSR|S_IWUSR
+#endif
+		);
+	if(rec->index < 0 || write_all(rec->index, API_TTYREC_INDEX_MAGIC, 8) != 0) {
+		// plays without, seeking reads it all
+		trace_err("tty %s: index: %s", index, strerror(errno));
+		if(rec->index >= 0) {
+			close(rec->index);
+		}
+		rec->index = -1;
+	}
+	rec->offset = 8;
+	ttyrec_keyframe(rec, api_clock_usec());
+	rec->next = recordings;
+	if(recordings != NULL) {
+		recordings->prev = rec;
+	}
+	recordings = rec;
+	return rec;
+
+err:
+	if(rec->fd >= 0) {
+		close(rec->fd);
+	}
+	api_vt_free(rec->vt);
+	SAFE_FREE(rec->buf);
+	free(rec);
+	return NULL;
+}
+
+void api_ttyrec_output(api_ttyrec_t *rec, const void *data, size_t len)
+{
+	uint64_t now = 0;
+
+	if(rec == NULL || rec->fd < 0 || len == 0) {
+		return;
+	}
+	now = api_clock_usec();
+	// the screen before this output
+	if(rec->since > 0 && (now - rec->keyframe >= API_TTYREC_KEYFRAME_USEC
+		|| rec->since >= API_TTYREC_KEYFRAME_BYTES)) {
+		ttyrec_keyframe(rec, now);
+	}
+	ttyrec_frame(rec, now, API_TTYREC_OUTPUT, NULL, 0, data, len);
+	api_vt_write(rec->vt, data, len);
+	rec->since += len;
+}
+
+void api_ttyrec_resize(api_ttyrec_t *rec, int cols, int rows)
+{
+	uint8_t size[4];
+
+	if(rec == NULL || rec->fd < 0) {
+		return;
+	}
+	put_u16(size, cols);
+	put_u16(size + 2, rows);
+	ttyrec_frame(rec, api_clock_usec(), API_TTYREC_RESIZE, size, sizeof(size), NULL, 0);
+	api_vt_resize(rec->vt, cols, rows);
+	rec->since++;
+}
+
+const char *api_ttyrec_path(const api_ttyrec_t *rec)
+{
+	return rec->path;
+}
+
+void api_ttyrec_close(api_ttyrec_t *rec)
+{
+	if(rec == NULL) {
+		return;
+	}
+	ttyrec_frame(rec, api_clock_usec(), API_TTYREC_END, NULL, 0, NULL, 0);
+	ttyrec_write(rec);
+	if(rec->fd >= 0) {
+		close(rec->fd);
+	}
+	if(rec->index >= 0) {
+		close(rec->index);
+	}
+	if(rec->prev != NULL) {
+		rec->prev->next = rec->next;
+	} else {
+		recordings = rec->next;
+	}
+	if(rec->next != NULL) {
+		rec->next->prev = rec->prev;
+	}
+	api_vt_free(rec->vt);
+	SAFE_FREE(rec->buf);
+	free(rec);
+}
+
+void api_ttyrec_flush(void)
+{
+	api_ttyrec_t *rec = NULL;
+
+	for(rec = recordings; rec != NULL; rec = rec->next) {
+		ttyrec_write(rec);
+	}
+}
+
+//----------------< the player side >----------------
+
+int api_ttyrec_reader_open(api_ttyrec_reader_t *reader, const char *path)
+{
+	uint8_t head[API_TTYREC_HEADER];
+	char index[1100];
+
+	memset(reader, 0x00, sizeof(*reader));
+	reader->index = -1;
+	reader->fd = open(path, O_RDONLY);
+	if(reader->fd < 0) {
+		return -1;
+	}
+	if(read_at(reader->fd, 0, head, 8) != 0 || memcmp(head, API_TTYREC_MAGIC, 8) != 0
+		|| read_at(reader->fd, 8, head, sizeof(head)) != 0) {
+		close(reader->fd);
+		reader->fd = -1;
+		return -1;
+	}
+	reader->start = get_u64(head);
+	reader->offset = 8;
+	snprintf(index, sizeof(index), "%s%s", path, API_TTYREC_INDEX_SUFFIX);
+	reader->index = open(index, O_RDONLY);
+	if(reader->index >= 0 && (read_at(reader->index, 0, head, 8) != 0
+		|| memcmp(head, API_TTYREC_INDEX_MAGIC, 8) != 0)) {
+		close(reader->index);
+		reader->index = -1;
+	}
+	return 0;
+}
+
+void api_ttyrec_reader_close(api_ttyrec_reader_t *reader)
+{
+	if(reader->fd >= 0) {
+		close(reader->fd);
+	}
+	if(reader->index >= 0) {
+		close(reader->index);
+	}
+	api_vt_free(reader->vt);
+	SAFE_FREE(reader->data);
+	memset(reader, 0x00, sizeof(*reader));
+	reader->fd = -1;
+	reader->index = -1;
+}
+
+// 1 and the header of the frame at `offset`, 0 at the end
+static int ttyrec_header(api_ttyrec_reader_t *reader, uint64_t offset, api_ttyrec_frame_t *frame)
+{
+	uint8_t head[API_TTYREC_HEADER];
+
+	if(read_at(reader->fd, offset, head, sizeof(head)) != 0) {
+		return 0;
+	}
+	frame->time = get_u64(head);
+	frame->kind = head[8];
+	frame->len = get_u32(head + 9);
+	frame->data = NULL;
+	if(frame->len > TTYREC_FRAME_MAX || frame->kind < API_TTYREC_OUTPUT || frame->kind > API_TTYREC_END) {
+		return -1;
+	}
+	return 1;
+}
+
+int api_ttyrec_next(api_ttyrec_reader_t *reader, api_ttyrec_frame_t *frame)
+{
+	char *data = NULL;
+	int rc = 0;
+
+	rc = ttyrec_header(reader, reader->offset, frame);
+	if(rc <= 0) {
+		return rc;
+	}
+	if(frame->len + 1 > reader->size) {
+		data = realloc(reader->data, frame->len + 1);
+		if(data == NULL) {
+			return -1;
+		}
+		reader->data = data;
+		reader->size = frame->len + 1;
+	}
+	// a frame cut short is where a crash stopped the recording
+	if(read_at(reader->fd, reader->offset + API_TTYREC_HEADER, reader->data, frame->len) != 0) {
+		return 0;
+	}
+	reader->data[frame->len] = '\0';
+	frame->data = reader->data;
+	reader->offset += API_TTYREC_HEADER + frame->len;
+	return 1;
+}
+
+// the last indexed keyframe up to `time`, -1 if none
+static int64_t ttyrec_index_find(api_ttyrec_reader_t *reader, uint64_t time, uint64_t *offset)
+{
+	uint8_t entry[API_TTYREC_ENTRY];
+	struct stat st;
+	int64_t lo = 0, hi = 0, mid = 0, found = -1;
+
+	if(reader->index < 0 || fstat(reader->index, &st) != 0) {
+		return -1;
+	}
+	hi = (st.st_size - 8) / API_TTYREC_ENTRY - 1;
+	while(lo <= hi) {
+		mid = lo + (hi - lo) / 2;
+		if(read_at(reader->index, 8 + (uint64_t)mid * API_TTYREC_ENTRY, entry, sizeof(entry)) != 0) {
+			return -1;
+		}
+		if(get_u64(entry) <= time) {
+			found = mid;
+			*offset = get_u64(entry + 8);
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return found;
+}
+
+static void ttyrec_apply(api_ttyrec_reader_t *reader, const api_ttyrec_frame_t *frame)
+{
+	const uint8_t *p = (const uint8_t *)frame->data;
+
+	switch(frame->kind) {
+	case API_TTYREC_KEYFRAME:
+		if(frame->len >= 4) {
+			api_vt_free(reader->vt);
+			reader->vt = api_vt_new(get_u16(p), get_u16(p + 2));
+			if(reader->vt != NULL) {
+				api_vt_write(reader->vt, p + 4, frame->len - 4);
+			}
+		}
+		break;
+	case API_TTYREC_OUTPUT:
+		if(reader->vt != NULL) {
+			api_vt_write(reader->vt, frame->data, frame->len);
+		}
+		break;
+	case API_TTYREC_RESIZE:
+		if(reader->vt != NULL && frame->len >= 4) {
+			api_vt_resize(reader->vt, get_u16(p), get_u16(p + 2));
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+int api_ttyrec_seek(api_ttyrec_reader_t *reader, uint64_t time)
+{
+	api_ttyrec_frame_t frame;
+	uint64_t offset = 8;
+	int rc = 0;
+
+	if(time < reader->start) {
+		time = reader->start;
+	}
+	if(ttyrec_index_find(reader, time, &offset) < 0) {
+		offset = 8;
+	}
+	api_vt_free(reader->vt);
+	reader->vt = NULL;
+	reader->offset = offset;
+	for(;;) {
+		rc = ttyrec_header(reader, reader->offset, &frame);
+		if(rc < 0) {
+			return -1;
+		}
+		if(rc == 0 || frame.time > time) {
+			break;
+		}
+		rc = api_ttyrec_next(reader, &frame);
+		if(rc < 0) {
+			return -1;
+		}
+		if(rc == 0) {
+			break;
+		}
+		ttyrec_apply(reader, &frame);
+	}
+	if(reader->vt == NULL) {
+		// a keyframe is always first, the recording is damaged
+		return -1;
+	}
+	return 0;
+}
+
+int api_ttyrec_info(api_ttyrec_reader_t *reader, uint64_t *end, uint32_t *keyframes)
+{
+	api_ttyrec_frame_t frame;
+	struct stat st;
+	uint64_t offset = 8, saved = reader->offset;
+	int rc = 0;
+
+	*keyframes = 0;
+	if(reader->index >= 0 && fstat(reader->index, &st) == 0 && st.st_size > 8) {
+		*keyframes = (st.st_size - 8) / API_TTYREC_ENTRY;
+		ttyrec_index_find(reader, UINT64_MAX, &offset);
+	}
+	*end = reader->start;
+	reader->offset = offset;
+	while((rc = api_ttyrec_next(reader, &frame)) == 1) {
+		*end = frame.time;
+	}
+	reader->offset = saved;
+	return rc < 0 ? -1 : 0;
+}
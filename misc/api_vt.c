@@ -0,0 +1,1157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "api_log.h"
+#include "api_misc.h"
+#include "api_vt.h"
+
+#define VT_PARAMS 16
+#define VT_OUT(vt, s) vt_out((vt), (s), sizeof(s) - 1)
+
+enum vt_state_e {
+	VT_GROUND = 0,
+	VT_ESC,
+	VT_CHARSET,   // ESC ( ) * + and the like, one more byte
+	VT_CSI,
+	VT_STRING,    // OSC, DCS, SOS, PM, APC up to BEL or ST
+	VT_STRING_ESC
+};
+
+typedef struct vt_cursor_struct {
+	int x;
+	int y;
+	api_vt_cell_t pen;
+	int charset[2];
+	int gl;
+	int origin;
+} vt_cursor_t;
+
+struct api_vt_struct {
+	int cols;
+	int rows;
+	api_vt_cell_t *cells[2];  // main, alternate (once used)
+	api_vt_cell_t **screen[2]; // their rows, scrolling moves the pointers
+	int alt;
+	int x;
+	int y;
+	int wrap;                 // at the right margin, the next character wraps
+	int top;                  // scrolling region, inclusive
+	int bottom;
+	api_vt_cell_t pen;
+	int charset[2];           // G0, G1: 1 for DEC line drawing
+	int gl;
+	int autowrap;
+	int insert;
+	int origin;
+	int cursor_hidden;
+	vt_cursor_t saved[2];     // ESC 7 / CSI s, per screen
+	// parser
+	int state;
+	uint32_t utf8;
+	int utf8_left;
+	int params[VT_PARAMS];
+	int nparams;
+	char priv;                // '?', '>', '=' or 0
+	char inter;
+	// snapshot and text
+	char *out;
+	size_t out_len;
+	size_t out_size;
+};
+
+// DEC special graphics, 0x5f to 0x7e
+static const uint16_t vt_graphics[32] = {
+	0x00a0, 0x25c6, 0x2592, 0x2409, 0x240c, 0x240d, 0x240a, 0x00b0,
+	0x00b1, 0x2424, 0x240b, 0x2518, 0x2510, 0x250c, 0x2514, 0x253c,
+	0x23ba, 0x23bb, 0x2500, 0x23bc, 0x23bd, 0x251c, 0x2524, 0x2534,
+	0x252c, 0x2502, 0x2264, 0x2265, 0x03c0, 0x2260, 0x00a3, 0x00b7
+};
+
+static int vt_wide(uint32_t c)
+{
+	return (c >= 0x1100 && c <= 0x115f) || (c >= 0x2e80 && c <= 0xa4cf && c != 0x303f)
+		|| (c >= 0xac00 && c <= 0xd7a3) || (c >= 0xf900 && c <= 0xfaff)
+		|| (c >= 0xfe30 && c <= 0xfe4f) || (c >= 0xff00 && c <= 0xff60)
+		|| (c >= 0xffe0 && c <= 0xffe6) || (c >= 0x1f300 && c <= 0x1f64f)
+		|| (c >= 0x1f900 && c <= 0x1f9ff) || (c >= 0x20000 && c <= 0x3fffd);
+}
+
+static int vt_zero_width(uint32_t c)
+{
+	return (c >= 0x0300 && c <= 0x036f) || (c >= 0x200b && c <= 0x200f)
+		|| (c >= 0xfe00 && c <= 0xfe0f) || c == 0xfeff;
+}
+
+static api_vt_cell_t *vt_cell(api_vt_t *vt, int x, int y)
+{
+	return &vt->screen[vt->alt][y][x];
+}
+
+// erased cells keep the background of the pen
+static void vt_blank(api_vt_t *vt, api_vt_cell_t *cell, size_t n)
+{
+	size_t i = 0;
+
+	if(vt->pen.bg == 0) {
+		memset(cell, 0x00, n * sizeof(api_vt_cell_t));
+		return;
+	}
+	for(i = 0; i < n; i++) {
+		cell[i].ch = 0;
+		cell[i].fg = 0;
+		cell[i].bg = vt->pen.bg;
+		cell[i].attr = 0;
+	}
+}
+
+// no half of a double width character left alone in the row
+static void vt_fix_row(api_vt_t *vt, api_vt_cell_t *row)
+{
+	int x = 0;
+
+	for(x = 0; x < vt->cols; x++) {
+		if((row[x].attr & API_VT_WIDE) && (x == 0 || !vt_wide(row[x - 1].ch))) {
+			vt_blank(vt, &row[x], 1);
+		} else if(vt_wide(row[x].ch) && (x + 1 == vt->cols || !(row[x + 1].attr & API_VT_WIDE))) {
+			vt_blank(vt, &row[x], 1);
+		}
+	}
+}
+
+static void vt_blank_rows(api_vt_t *vt, int from, int to)
+{
+	for(; from < to; from++) {
+		vt_blank(vt, vt->screen[vt->alt][from], vt->cols);
+	}
+}
+
+static void vt_scroll_up(api_vt_t *vt, int top, int bottom, int n)
+{
+	api_vt_cell_t **rows = vt->screen[vt->alt], *row = NULL;
+	int i = 0;
+
+	if(n > bottom - top + 1) {
+		n = bottom - top + 1;
+	}
+	for(i = 0; i < n; i++) {
+		row = rows[top];
+		memmove(&rows[top], &rows[top + 1], (bottom - top) * sizeof(api_vt_cell_t *));
+		rows[bottom] = row;
+	}
+	vt_blank_rows(vt, bottom - n + 1, bottom + 1);
+}
+
+static void vt_scroll_down(api_vt_t *vt, int top, int bottom, int n)
+{
+	api_vt_cell_t **rows = vt->screen[vt->alt], *row = NULL;
+	int i = 0;
+
+	if(n > bottom - top + 1) {
+		n = bottom - top + 1;
+	}
+	for(i = 0; i < n; i++) {
+		row = rows[bottom];
+		memmove(&rows[top + 1], &rows[top], (bottom - top) * sizeof(api_vt_cell_t *));
+		rows[top] = row;
+	}
+	vt_blank_rows(vt, top, top + n);
+}
+
+static void vt_linefeed(api_vt_t *vt)
+{
+	vt->wrap = 0;
+	if(vt->y == vt->bottom) {
+		vt_scroll_up(vt, vt->top, vt->bottom, 1);
+	} else if(vt->y < vt->rows - 1) {
+		vt->y++;
+	}
+}
+
+static void vt_reverse_index(api_vt_t *vt)
+{
+	vt->wrap = 0;
+	if(vt->y == vt->top) {
+		vt_scroll_down(vt, vt->top, vt->bottom, 1);
+	} else if(vt->y > 0) {
+		vt->y--;
+	}
+}
+
+static void vt_goto(api_vt_t *vt, int x, int y)
+{
+	int top = vt->origin ? vt->top : 0;
+	int bottom = vt->origin ? vt->bottom : vt->rows - 1;
+
+	y += top;
+	vt->x = x < 0 ? 0 : (x >= vt->cols ? vt->cols - 1 : x);
+	vt->y = y < top ? top : (y > bottom ? bottom : y);
+	vt->wrap = 0;
+}
+
+static void vt_save(api_vt_t *vt)
+{
+	vt_cursor_t *c = &vt->saved[vt->alt];
+
+	c->x = vt->x;
+	c->y = vt->y;
+	c->pen = vt->pen;
+	c->charset[0] = vt->charset[0];
+	c->charset[1] = vt->charset[1];
+	c->gl = vt->gl;
+	c->origin = vt->origin;
+}
+
+static void vt_restore(api_vt_t *vt)
+{
+	vt_cursor_t *c = &vt->saved[vt->alt];
+
+	vt->x = c->x < vt->cols ? c->x : vt->cols - 1;
+	vt->y = c->y < vt->rows ? c->y : vt->rows - 1;
+	vt->pen = c->pen;
+	vt->charset[0] = c->charset[0];
+	vt->charset[1] = c->charset[1];
+	vt->gl = c->gl;
+	vt->origin = c->origin;
+	if(vt->origin) {
+		vt->y = vt->y < vt->top ? vt->top : (vt->y > vt->bottom ? vt->bottom : vt->y);
+	}
+	vt->wrap = 0;
+}
+
+// the cells of a screen and its rows in one block
+static int vt_screen_new(api_vt_t *vt, int i, int cols, int rows)
+{
+	int r = 0;
+
+	vt->screen[i] = malloc(rows * sizeof(api_vt_cell_t *));
+	vt->cells[i] = calloc((size_t)cols * rows, sizeof(api_vt_cell_t));
+	if(vt->screen[i] == NULL || vt->cells[i] == NULL) {
+		SAFE_FREE(vt->screen[i]);
+		SAFE_FREE(vt->cells[i]);
+		return -1;
+	}
+	for(r = 0; r < rows; r++) {
+		vt->screen[i][r] = vt->cells[i] + (size_t)r * cols;
+	}
+	return 0;
+}
+
+static void vt_alternate(api_vt_t *vt, int on)
+{
+	if(on == vt->alt) {
+		return;
+	}
+	if(on && vt->screen[1] == NULL && vt_screen_new(vt, 1, vt->cols, vt->rows) != 0) {
+		return;
+	}
+	vt->alt = on;
+	if(on) {
+		vt_blank_rows(vt, 0, vt->rows);
+	}
+	vt->wrap = 0;
+}
+
+static void vt_reset(api_vt_t *vt)
+{
+	vt->alt = 0;
+	memset(&vt->pen, 0x00, sizeof(vt->pen));
+	vt_blank_rows(vt, 0, vt->rows);
+	vt->x = 0;
+	vt->y = 0;
+	vt->wrap = 0;
+	vt->top = 0;
+	vt->bottom = vt->rows - 1;
+	vt->charset[0] = 0;
+	vt->charset[1] = 0;
+	vt->gl = 0;
+	vt->autowrap = 1;
+	vt->insert = 0;
+	vt->origin = 0;
+	vt->cursor_hidden = 0;
+	memset(vt->saved, 0x00, sizeof(vt->saved));
+	vt->state = VT_GROUND;
+	vt->utf8_left = 0;
+}
+
+api_vt_t *api_vt_new(int cols, int rows)
+{
+	api_vt_t *vt = NULL;
+
+	if(cols < 1 || rows < 1 || cols > API_VT_COLS_MAX || rows > API_VT_ROWS_MAX) {
+		cols = 80;
+		rows = 24;
+	}
+	vt = calloc(1, sizeof(api_vt_t));
+	if(vt == NULL) {
+		return NULL;
+	}
+	vt->cols = cols;
+	vt->rows = rows;
+	if(vt_screen_new(vt, 0, cols, rows) != 0) {
+		free(vt);
+		return NULL;
+	}
+	vt_reset(vt);
+	return vt;
+}
+
+void api_vt_free(api_vt_t *vt)
+{
+	if(vt == NULL) {
+		return;
+	}
+	SAFE_FREE(vt->screen[0]);
+	SAFE_FREE(vt->screen[1]);
+	SAFE_FREE(vt->cells[0]);
+	SAFE_FREE(vt->cells[1]);
+	SAFE_FREE(vt->out);
+	free(vt);
+}
+
+void api_vt_size(const api_vt_t *vt, int *cols, int *rows)
+{
+	*cols = vt->cols;
+	*rows = vt->rows;
+}
+
+const api_vt_cell_t *api_vt_cell(const api_vt_t *vt, int col, int row)
+{
+	if(col < 0 || row < 0 || col >= vt->cols || row >= vt->rows) {
+		return NULL;
+	}
+	return &vt->screen[vt->alt][row][col];
+}
+
+// the rows around the cursor stay, as a terminal keeps them
+void api_vt_resize(api_vt_t *vt, int cols, int rows)
+{
+	api_vt_cell_t **old[2] = {vt->screen[0], vt->screen[1]}, *cells[2] = {vt->cells[0], vt->cells[1]};
+	api_vt_cell_t *from = NULL, *to = NULL;
+	int i = 0, r = 0, shift = 0, n = 0;
+
+	if(cols < 1 || rows < 1 || cols > API_VT_COLS_MAX || rows > API_VT_ROWS_MAX
+		|| (cols == vt->cols && rows == vt->rows)) {
+		return;
+	}
+	shift = vt->y >= rows ? vt->y - rows + 1 : 0;
+	n = cols < vt->cols ? cols : vt->cols;
+	for(i = 0; i < 2; i++) {
+		if(old[i] == NULL) {
+			continue;
+		}
+		if(vt_screen_new(vt, i, cols, rows) != 0) {
+			if(i == 1) {
+				SAFE_FREE(vt->screen[0]);
+				SAFE_FREE(vt->cells[0]);
+			}
+			vt->screen[0] = old[0];
+			vt->cells[0] = cells[0];
+			vt->screen[1] = old[1];
+			vt->cells[1] = cells[1];
+			return;
+		}
+		for(r = 0; r < rows && r + shift < vt->rows; r++) {
+			from = old[i][r + shift];
+			to = vt->screen[i][r];
+			memcpy(to, from, n * sizeof(api_vt_cell_t));
+			// no half of a double width character at the edge
+			if(n < vt->cols && (from[n].attr & API_VT_WIDE)) {
+				memset(&to[n - 1], 0x00, sizeof(api_vt_cell_t));
+			}
+		}
+	}
+	for(i = 0; i < 2; i++) {
+		SAFE_FREE(old[i]);
+		SAFE_FREE(cells[i]);
+	}
+	vt->cols = cols;
+	vt->rows = rows;
+	vt->y -= shift;
+	vt->x = vt->x < cols ? vt->x : cols - 1;
+	vt->y = vt->y < rows ? vt->y : rows - 1;
+	vt->wrap = 0;
+	vt->top = 0;
+	vt->bottom = rows - 1;
+}
+
+static void vt_put(api_vt_t *vt, uint32_t c)
+{
+	api_vt_cell_t *cell = NULL;
+	int width = 1;
+
+	if(vt->charset[vt->gl] && c >= 0x5f && c <= 0x7e) {
+		c = vt_graphics[c - 0x5f];
+	}
+	if(c >= 0x300 && vt_zero_width(c)) {
+		return;
+	}
+	if(c == ' ') {
+		c = 0;
+	}
+	width = c >= 0x1100 && vt_wide(c) ? 2 : 1;
+	if(width > vt->cols) {
+		return;
+	}
+	if(vt->wrap && vt->autowrap) {
+		vt->x = 0;
+		vt_linefeed(vt);
+	}
+	vt->wrap = 0;
+	if(vt->x + width > vt->cols) {
+		if(vt->autowrap) {
+			vt_blank(vt, vt_cell(vt, vt->x, vt->y), vt->cols - vt->x);
+			vt->x = 0;
+			vt_linefeed(vt);
+		} else {
+			vt->x = vt->cols - width;
+		}
+	}
+	cell = vt_cell(vt, 0, vt->y);
+	if(vt->insert && vt->x + width < vt->cols) {
+		memmove(&cell[vt->x + width], &cell[vt->x], (vt->cols - vt->x - width) * sizeof(api_vt_cell_t));
+	}
+	// overwriting half of a double width character blanks the other half
+	if(vt->x > 0 && (cell[vt->x].attr & API_VT_WIDE)) {
+		vt_blank(vt, &cell[vt->x - 1], 1);
+	}
+	if(vt->x + width < vt->cols && (cell[vt->x + width].attr & API_VT_WIDE)) {
+		vt_blank(vt, &cell[vt->x + width], 1);
+	}
+	cell[vt->x] = vt->pen;
+	cell[vt->x].ch = c;
+	cell[vt->x].attr &= ~API_VT_WIDE;
+	if(width == 2) {
+		cell[vt->x + 1] = vt->pen;
+		cell[vt->x + 1].ch = 0;
+		cell[vt->x + 1].attr |= API_VT_WIDE;
+	}
+	if(vt->insert) {
+		vt_fix_row(vt, cell);
+	}
+	vt->x += width;
+	if(vt->x >= vt->cols) {
+		vt->x = vt->cols - 1;
+		vt->wrap = vt->autowrap;
+	}
+}
+
+static void vt_tab(api_vt_t *vt, int n)
+{
+	while(n-- > 0 && vt->x < vt->cols - 1) {
+		vt->x = (vt->x / 8 + 1) * 8;
+	}
+	if(vt->x >= vt->cols) {
+		vt->x = vt->cols - 1;
+	}
+}
+
+static void vt_control(api_vt_t *vt, uint8_t c)
+{
+	switch(c) {
+	case '\b':
+		if(vt->x > 0) {
+			vt->x--;
+		}
+		vt->wrap = 0;
+		break;
+	case '\t':
+		vt_tab(vt, 1);
+		break;
+	case '\n':
+	case '\v':
+	case '\f':
+		vt_linefeed(vt);
+		break;
+	case '\r':
+		vt->x = 0;
+		vt->wrap = 0;
+		break;
+	case 0x0e: // SO
+		vt->gl = 1;
+		break;
+	case 0x0f: // SI
+		vt->gl = 0;
+		break;
+	case 0x18: // CAN
+	case 0x1a: // SUB
+		vt->state = VT_GROUND;
+		break;
+	case 0x1b:
+		vt->state = VT_ESC;
+		vt->nparams = 0;
+		vt->params[0] = 0;
+		vt->priv = 0;
+		vt->inter = 0;
+		break;
+	default:
+		break;
+	}
+}
+
+static uint16_t vt_rgb(int r, int g, int b)
+{
+	r = r < 0 ? 0 : (r > 255 ? 255 : r);
+	g = g < 0 ? 0 : (g > 255 ? 255 : g);
+	b = b < 0 ? 0 : (b > 255 ? 255 : b);
+	return 1 + 16 + 36 * ((r * 5 + 127) / 255) + 6 * ((g * 5 + 127) / 255) + (b * 5 + 127) / 255;
+}
+
+static void vt_sgr(api_vt_t *vt)
+{
+	int *p = vt->params, n = vt->nparams, i = 0;
+	uint16_t *color = NULL;
+
+	if(n == 0) {
+		n = 1;
+		p[0] = 0;
+	}
+	for(i = 0; i < n; i++) {
+		switch(p[i]) {
+		case 0:
+			memset(&vt->pen, 0x00, sizeof(vt->pen));
+			break;
+		case 1: vt->pen.attr |= API_VT_BOLD; break;
+		case 2: vt->pen.attr |= API_VT_DIM; break;
+		case 3: vt->pen.attr |= API_VT_ITALIC; break;
+		case 4: vt->pen.attr |= API_VT_UNDERLINE; break;
+		case 5: vt->pen.attr |= API_VT_BLINK; break;
+		case 7: vt->pen.attr |= API_VT_REVERSE; break;
+		case 8: vt->pen.attr |= API_VT_HIDDEN; break;
+		case 22: vt->pen.attr &= ~(API_VT_BOLD|API_VT_DIM); break;
+		case 23: vt->pen.attr &= ~API_VT_ITALIC; break;
+		case 24: vt->pen.attr &= ~API_VT_UNDERLINE; break;
+		case 25: vt->pen.attr &= ~API_VT_BLINK; break;
+		case 27: vt->pen.attr &= ~API_VT_REVERSE; break;
+		case 28: vt->pen.attr &= ~API_VT_HIDDEN; break;
+		case 39: vt->pen.fg = 0; break;
+		case 49: vt->pen.bg = 0; break;
+		case 38:
+		case 48:
+			color = p[i] == 38 ? &vt->pen.fg : &vt->pen.bg;
+			if(i + 2 < n && p[i + 1] == 5) {
+				*color = 1 + (p[i + 2] & 0xff);
+				i += 2;
+			} else if(i + 4 < n && p[i + 1] == 2) {
+				*color = vt_rgb(p[i + 2], p[i + 3], p[i + 4]);
+				i += 4;
+			} else {
+				i = n;
+			}
+			break;
+		default:
+			if(p[i] >= 30 && p[i] <= 37) {
+				vt->pen.fg = 1 + p[i] - 30;
+			} else if(p[i] >= 40 && p[i] <= 47) {
+				vt->pen.bg = 1 + p[i] - 40;
+			} else if(p[i] >= 90 && p[i] <= 97) {
+				vt->pen.fg = 1 + 8 + p[i] - 90;
+			} else if(p[i] >= 100 && p[i] <= 107) {
+				vt->pen.bg = 1 + 8 + p[i] - 100;
+			}
+			break;
+		}
+	}
+}
+
+static void vt_mode(api_vt_t *vt, int set)
+{
+	int i = 0;
+
+	for(i = 0; i < vt->nparams; i++) {
+		if(vt->priv == 0) {
+			if(vt->params[i] == 4) {
+				vt->insert = set;
+			}
+			continue;
+		}
+		switch(vt->params[i]) {
+		case 6:
+			vt->origin = set;
+			vt_goto(vt, 0, 0);
+			break;
+		case 7:
+			vt->autowrap = set;
+			vt->wrap = 0;
+			break;
+		case 25:
+			vt->cursor_hidden = !set;
+			break;
+		case 47:
+		case 1047:
+			vt_alternate(vt, set);
+			break;
+		case 1048:
+			if(set) {
+				vt_save(vt);
+			} else {
+				vt_restore(vt);
+			}
+			break;
+		case 1049:
+			if(set) {
+				vt_save(vt);
+				vt_alternate(vt, 1);
+			} else {
+				vt_alternate(vt, 0);
+				vt_restore(vt);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void vt_csi(api_vt_t *vt, uint8_t final)
+{
+	int *p = vt->params;
+	int n1 = vt->nparams > 0 && p[0] > 0 ? p[0] : 1;
+	int top = 0, bottom = 0, left = 0, limit = 0;
+	api_vt_cell_t *row = vt_cell(vt, 0, vt->y);
+
+	if(vt->inter != 0 || vt->priv == '>' || vt->priv == '=') {
+		return;
+	}
+	if(vt->priv == '?' && final != 'h' && final != 'l') {
+		return;
+	}
+	switch(final) {
+	case 'A':
+		// stops at the region, if in it
+		limit = vt->y >= vt->top ? vt->top : 0;
+		vt->y = vt->y - n1 < limit ? limit : vt->y - n1;
+		vt->wrap = 0;
+		break;
+	case 'B':
+	case 'e':
+		limit = vt->y <= vt->bottom ? vt->bottom : vt->rows - 1;
+		vt->y = vt->y + n1 > limit ? limit : vt->y + n1;
+		vt->wrap = 0;
+		break;
+	case 'C':
+	case 'a':
+		vt->x = vt->x + n1 >= vt->cols ? vt->cols - 1 : vt->x + n1;
+		vt->wrap = 0;
+		break;
+	case 'D':
+		vt->x = vt->x - n1 < 0 ? 0 : vt->x - n1;
+		vt->wrap = 0;
+		break;
+	case 'E':
+		vt->y = vt->y + n1 > vt->bottom ? vt->bottom : vt->y + n1;
+		vt->x = 0;
+		vt->wrap = 0;
+		break;
+	case 'F':
+		vt->y = vt->y - n1 < vt->top ? vt->top : vt->y - n1;
+		vt->x = 0;
+		vt->wrap = 0;
+		break;
+	case 'G':
+	case '`':
+		vt->x = n1 - 1 >= vt->cols ? vt->cols - 1 : n1 - 1;
+		vt->wrap = 0;
+		break;
+	case 'd':
+		vt_goto(vt, vt->x, n1 - 1);
+		break;
+	case 'H':
+	case 'f':
+		vt_goto(vt, vt->nparams > 1 && p[1] > 0 ? p[1] - 1 : 0, n1 - 1);
+		break;
+	case 'I':
+		vt_tab(vt, n1);
+		break;
+	case 'Z':
+		while(n1-- > 0 && vt->x > 0) {
+			vt->x = (vt->x - 1) / 8 * 8;
+		}
+		break;
+	case 'J':
+		if(vt->nparams == 0 || p[0] == 0) {
+			vt_blank(vt, &row[vt->x], vt->cols - vt->x);
+			vt_blank_rows(vt, vt->y + 1, vt->rows);
+		} else if(p[0] == 1) {
+			vt_blank_rows(vt, 0, vt->y);
+			vt_blank(vt, row, vt->x + 1);
+		} else if(p[0] == 2) {
+			vt_blank_rows(vt, 0, vt->rows);
+		}
+		vt_fix_row(vt, row);
+		vt->wrap = 0;
+		break;
+	case 'K':
+		if(vt->nparams == 0 || p[0] == 0) {
+			vt_blank(vt, &row[vt->x], vt->cols - vt->x);
+		} else if(p[0] == 1) {
+			vt_blank(vt, row, vt->x + 1);
+		} else if(p[0] == 2) {
+			vt_blank(vt, row, vt->cols);
+		}
+		vt_fix_row(vt, row);
+		vt->wrap = 0;
+		break;
+	case 'L':
+	case 'M':
+		if(vt->y >= vt->top && vt->y <= vt->bottom) {
+			if(final == 'L') {
+				vt_scroll_down(vt, vt->y, vt->bottom, n1);
+			} else {
+				vt_scroll_up(vt, vt->y, vt->bottom, n1);
+			}
+			vt->x = 0;
+			vt->wrap = 0;
+		}
+		break;
+	case '@':
+		left = vt->cols - vt->x;
+		n1 = n1 > left ? left : n1;
+		memmove(&row[vt->x + n1], &row[vt->x], (left - n1) * sizeof(api_vt_cell_t));
+		vt_blank(vt, &row[vt->x], n1);
+		vt_fix_row(vt, row);
+		vt->wrap = 0;
+		break;
+	case 'P':
+		left = vt->cols - vt->x;
+		n1 = n1 > left ? left : n1;
+		memmove(&row[vt->x], &row[vt->x + n1], (left - n1) * sizeof(api_vt_cell_t));
+		vt_blank(vt, &row[vt->cols - n1], n1);
+		vt_fix_row(vt, row);
+		vt->wrap = 0;
+		break;
+	case 'X':
+		left = vt->cols - vt->x;
+		vt_blank(vt, &row[vt->x], n1 > left ? left : n1);
+		vt_fix_row(vt, row);
+		vt->wrap = 0;
+		break;
+	case 'S':
+		vt_scroll_up(vt, vt->top, vt->bottom, n1);
+		break;
+	case 'T':
+		vt_scroll_down(vt, vt->top, vt->bottom, n1);
+		break;
+	case 'm':
+		vt_sgr(vt);
+		break;
+	case 'r':
+		top = vt->nparams > 0 && p[0] > 0 ? p[0] - 1 : 0;
+		bottom = vt->nparams > 1 && p[1] > 0 ? p[1] - 1 : vt->rows - 1;
+		if(bottom >= vt->rows) {
+			bottom = vt->rows - 1;
+		}
+		if(top < bottom) {
+			vt->top = top;
+			vt->bottom = bottom;
+			vt_goto(vt, 0, 0);
+		}
+		break;
+	case 's':
+		vt_save(vt);
+		break;
+	case 'u':
+		vt_restore(vt);
+		break;
+	case 'h':
+		vt_mode(vt, 1);
+		break;
+	case 'l':
+		vt_mode(vt, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+static void vt_esc(api_vt_t *vt, uint8_t c)
+{
+	vt->state = VT_GROUND;
+	switch(c) {
+	case '[':
+		vt->state = VT_CSI;
+		break;
+	case ']':
+	case 'P':
+	case 'X':
+	case '^':
+	case '_':
+		vt->state = VT_STRING;
+		break;
+	case '(':
+	case ')':
+	case '*':
+	case '+':
+	case '#':
+	case '%':
+	case ' ':
+		vt->inter = c;
+		vt->state = VT_CHARSET;
+		break;
+	case '7':
+		vt_save(vt);
+		break;
+	case '8':
+		vt_restore(vt);
+		break;
+	case 'D':
+		vt_linefeed(vt);
+		break;
+	case 'E':
+		vt->x = 0;
+		vt_linefeed(vt);
+		break;
+	case 'M':
+		vt_reverse_index(vt);
+		break;
+	case 'c':
+		vt_alternate(vt, 0);
+		vt_reset(vt);
+		break;
+	default:
+		break;
+	}
+}
+
+void api_vt_write(api_vt_t *vt, const void *data, size_t len)
+{
+	const uint8_t *s = data;
+	size_t i = 0;
+	uint8_t c = 0;
+
+	for(i = 0; i < len; i++) {
+		c = s[i];
+		switch(vt->state) {
+		case VT_GROUND:
+			if(vt->utf8_left > 0) {
+				if((c & 0xc0) == 0x80) {
+					vt->utf8 = (vt->utf8 << 6) | (c & 0x3f);
+					if(--vt->utf8_left == 0) {
+						vt_put(vt, vt->utf8 <= 0x10ffff ? vt->utf8 : 0xfffd);
+					}
+					break;
+				}
+				vt->utf8_left = 0;
+				vt_put(vt, 0xfffd);
+			}
+			if(c < 0x20 || c == 0x7f) {
+				vt_control(vt, c);
+			} else if(c < 0x80) {
+				vt_put(vt, c);
+			} else if((c & 0xe0) == 0xc0) {
+				vt->utf8 = c & 0x1f;
+				vt->utf8_left = 1;
+			} else if((c & 0xf0) == 0xe0) {
+				vt->utf8 = c & 0x0f;
+				vt->utf8_left = 2;
+			} else if((c & 0xf8) == 0xf0) {
+				vt->utf8 = c & 0x07;
+				vt->utf8_left = 3;
+			} else {
+				vt_put(vt, 0xfffd);
+			}
+			break;
+		case VT_ESC:
+			if(c < 0x20) {
+				vt_control(vt, c);
+			} else {
+				vt_esc(vt, c);
+			}
+			break;
+		case VT_CHARSET:
+			if(vt->inter == '(' || vt->inter == ')') {
+				vt->charset[vt->inter == ')'] = c == '0';
+			}
+			vt->inter = 0;
+			vt->state = VT_GROUND;
+			break;
+		case VT_CSI:
+			if(c >= '0' && c <= '9') {
+				if(vt->nparams == 0) {
+					vt->nparams = 1;
+				}
+				if(vt->params[vt->nparams - 1] < 100000) {
+					vt->params[vt->nparams - 1] = vt->params[vt->nparams - 1] * 10 + c - '0';
+				}
+			} else if(c == ';' || c == ':') {
+				if(vt->nparams == 0) {
+					vt->nparams = 1;
+				}
+				if(vt->nparams < VT_PARAMS) {
+					vt->params[vt->nparams++] = 0;
+				}
+			} else if(c >= '<' && c <= '?') {
+				vt->priv = c;
+			} else if(c >= 0x20 && c <= 0x2f) {
+				vt->inter = c;
+			} else if(c >= 0x40 && c <= 0x7e) {
+				vt->state = VT_GROUND;
+				vt_csi(vt, c);
+			} else if(c < 0x20) {
+				vt_control(vt, c);
+			}
+			break;
+		case VT_STRING:
+			if(c == 0x07 || c == 0x18 || c == 0x1a) {
+				vt->state = VT_GROUND;
+			} else if(c == 0x1b) {
+				vt->state = VT_STRING_ESC;
+			}
+			break;
+		case VT_STRING_ESC:
+			// ST, any other escape ends the string too
+			vt->state = VT_GROUND;
+			if(c != '\\') {
+				vt_control(vt, 0x1b);
+				vt_esc(vt, c);
+			}
+			break;
+		default:
+			vt->state = VT_GROUND;
+			break;
+		}
+	}
+}
+
+//----------------< snapshot >----------------
+
+static void vt_out(api_vt_t *vt, const char *s, size_t n)
+{
+	char *out = NULL;
+	size_t size = 0;
+
+	if(vt->out_len + n > vt->out_size) {
+		size = vt->out_size > 0 ? vt->out_size : 4096;
+		while(size < vt->out_len + n) {
+			size *= 2;
+		}
+		out = realloc(vt->out, size);
+		if(out == NULL) {
+			return;
+		}
+		vt->out = out;
+		vt->out_size = size;
+	}
+	memcpy(vt->out + vt->out_len, s, n);
+	vt->out_len += n;
+}
+
+#ifdef __GNUC__
+static void vt_outf(api_vt_t *vt, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+#endif
+
+static void vt_outf(api_vt_t *vt, const char *fmt, ...)
+{
+	char buf[64];
+	va_list args;
+	int n = 0;
+
+	va_start(args, fmt);
+	n = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if(n > 0) {
+		vt_out(vt, buf, n < (int)sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+	}
+}
+
+static void vt_out_utf8(api_vt_t *vt, uint32_t c)
+{
+	char buf[4];
+
+	if(c < 0x80) {
+		buf[0] = c;
+		vt_out(vt, buf, 1);
+	} else if(c < 0x800) {
+		buf[0] = 0xc0 | (c >> 6);
+		buf[1] = 0x80 | (c & 0x3f);
+		vt_out(vt, buf, 2);
+	} else if(c < 0x10000) {
+		buf[0] = 0xe0 | (c >> 12);
+		buf[1] = 0x80 | ((c >> 6) & 0x3f);
+		buf[2] = 0x80 | (c & 0x3f);
+		vt_out(vt, buf, 3);
+	} else {
+		buf[0] = 0xf0 | (c >> 18);
+		buf[1] = 0x80 | ((c >> 12) & 0x3f);
+		buf[2] = 0x80 | ((c >> 6) & 0x3f);
+		buf[3] = 0x80 | (c & 0x3f);
+		vt_out(vt, buf, 4);
+	}
+}
+
+static void vt_out_color(api_vt_t *vt, uint16_t color, int base)
+{
+	int c = color - 1;
+
+	if(c < 8) {
+		vt_outf(vt, ";%d", base + c);
+	} else if(c < 16) {
+		vt_outf(vt, ";%d", base + 60 + c - 8);
+	} else {
+		vt_outf(vt, ";%d;5;%d", base + 8, c);
+	}
+}
+
+static void vt_out_sgr(api_vt_t *vt, const api_vt_cell_t *pen)
+{
+	static const char codes[] = "1234578";
+	int i = 0;
+
+	vt_out(vt, "\033[0", 3);
+	for(i = 0; i < 7; i++) {
+		if(pen->attr & (1 << i)) {
+			vt_out(vt, ";", 1);
+			vt_out(vt, &codes[i], 1);
+		}
+	}
+	if(pen->fg != 0) {
+		vt_out_color(vt, pen->fg, 30);
+	}
+	if(pen->bg != 0) {
+		vt_out_color(vt, pen->bg, 40);
+	}
+	vt_out(vt, "m", 1);
+}
+
+static int vt_same(const api_vt_cell_t *a, const api_vt_cell_t *b)
+{
+	return a->fg == b->fg && a->bg == b->bg
+		&& (a->attr & ~API_VT_WIDE) == (b->attr & ~API_VT_WIDE);
+}
+
+static int vt_empty(const api_vt_cell_t *cell)
+{
+	return (cell->ch == 0 || cell->ch == ' ') && cell->bg == 0
+		&& (cell->attr & (API_VT_UNDERLINE|API_VT_REVERSE)) == 0;
+}
+
+static void vt_out_screen(api_vt_t *vt, api_vt_cell_t **screen, api_vt_cell_t *pen)
+{
+	const api_vt_cell_t *row = NULL;
+	int x = 0, y = 0, last = 0;
+
+	for(y = 0; y < vt->rows; y++) {
+		row = screen[y];
+		for(last = vt->cols - 1; last >= 0 && vt_empty(&row[last]); last--);
+		if(last < 0) {
+			continue;
+		}
+		vt_outf(vt, "\033[%d;1H", y + 1);
+		for(x = 0; x <= last; x++) {
+			if(row[x].attr & API_VT_WIDE) {
+				continue;
+			}
+			if(!vt_same(&row[x], pen)) {
+				*pen = row[x];
+				pen->attr &= ~API_VT_WIDE;
+				vt_out_sgr(vt, pen);
+			}
+			vt_out_utf8(vt, row[x].ch != 0 ? row[x].ch : ' ');
+		}
+	}
+}
+
+static void vt_out_charset(api_vt_t *vt, const int *charset, int gl)
+{
+	vt_outf(vt, "\033(%c\033)%c%c", charset[0] ? '0' : 'B', charset[1] ? '0' : 'B', gl ? '\016' : '\017');
+}
+
+// a cursor saved by ESC 7, set up to be saved again while there is no
+// scrolling region yet, origin mode or not the position is absolute then
+static void vt_out_saved(api_vt_t *vt, const vt_cursor_t *c)
+{
+	vt_out_sgr(vt, &c->pen);
+	if(c->origin) {
+		VT_OUT(vt, "\033[?6h");
+	} else {
+		VT_OUT(vt, "\033[?6l");
+	}
+	vt_outf(vt, "\033[%d;%dH", c->y + 1, c->x + 1);
+	vt_out_charset(vt, c->charset, c->gl);
+}
+
+const char *api_vt_snapshot(api_vt_t *vt, size_t *len)
+{
+	static const int ascii[2] = {0, 0};
+	api_vt_cell_t pen;
+	const api_vt_cell_t *cell = NULL;
+	int x = 0, y = 0;
+
+	memset(&pen, 0x00, sizeof(pen));
+	vt->out_len = 0;
+	VT_OUT(vt, "\033[0m\033[r\033[?6l\033[?7h\033[4l\033(B\033)B\017\033[H\033[2J");
+	vt_out_screen(vt, vt->screen[0], &pen);
+	if(vt->alt) {
+		// the cursor that leaving the alternate screen brings back
+		vt_out_saved(vt, &vt->saved[0]);
+		VT_OUT(vt, "\033[?1049h\033[0m\033[?6l\033(B\033)B\017\033[2J");
+		memset(&pen, 0x00, sizeof(pen));
+		vt_out_screen(vt, vt->screen[1], &pen);
+	} else if(vt->screen[1] != NULL) {
+		// ESC 7 on the alternate screen is kept for the next time
+		VT_OUT(vt, "\033[?47h");
+		vt_out_saved(vt, &vt->saved[1]);
+		VT_OUT(vt, "\0337\033[?47l");
+	}
+	vt_out_saved(vt, &vt->saved[vt->alt]);
+	VT_OUT(vt, "\0337");
+	if(vt->top != 0 || vt->bottom != vt->rows - 1) {
+		vt_outf(vt, "\033[%d;%dr", vt->top + 1, vt->bottom + 1);
+	}
+	vt_out_charset(vt, ascii, 0);
+	if(vt->origin) {
+		VT_OUT(vt, "\033[?6h");
+	} else {
+		VT_OUT(vt, "\033[?6l");
+	}
+	y = vt->y - (vt->origin ? vt->top : 0) + 1;
+	if(vt->wrap) {
+		// the pending wrap comes back by writing the last character again
+		cell = vt_cell(vt, vt->cols - 1, vt->y);
+		x = (cell->attr & API_VT_WIDE) && vt->cols > 1 ? vt->cols - 2 : vt->cols - 1;
+		cell = vt_cell(vt, x, vt->y);
+		vt_outf(vt, "\033[%d;%dH", y, x + 1);
+		pen = *cell;
+		pen.attr &= ~API_VT_WIDE;
+		vt_out_sgr(vt, &pen);
+		vt_out_utf8(vt, cell->ch != 0 ? cell->ch : ' ');
+	} else {
+		vt_outf(vt, "\033[%d;%dH", y, vt->x + 1);
+	}
+	if(!vt->autowrap) {
+		VT_OUT(vt, "\033[?7l");
+	}
+	if(vt->insert) {
+		VT_OUT(vt, "\033[4h");
+	}
+	if(vt->cursor_hidden) {
+		VT_OUT(vt, "\033[?25l");
+	} else {
+		VT_OUT(vt, "\033[?25h");
+	}
+	vt_out_charset(vt, vt->charset, vt->gl);
+	vt_out_sgr(vt, &vt->pen);
+	*len = vt->out_len;
+	return vt->out;
+}
+
+const char *api_vt_text(api_vt_t *vt, size_t *len)
+{
+	const api_vt_cell_t *row = NULL;
+	int x = 0, y = 0, last = 0;
+
+	vt->out_len = 0;
+	for(y = 0; y < vt->rows; y++) {
+		row = vt_cell(vt, 0, y);
+		for(last = vt->cols - 1; last >= 0 && (row[last].ch == 0 || row[last].ch == ' '); last--);
+		for(x = 0; x <= last; x++) {
+			if(!(row[x].attr & API_VT_WIDE)) {
+				vt_out_utf8(vt, row[x].ch != 0 ? row[x].ch : ' ');
+			}
+		}
+		vt_out(vt, "\n", 1);
+	}
+	*len = vt->out_len;
+	return vt->out;
+}
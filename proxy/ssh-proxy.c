@@ -8,6 +8,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -15,8 +17,26 @@
 #else
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <unistd.h>
 #endif
 
+#ifdef __linux__
+// linux/netfilter_ipv4.h and ip6_tables.h, without their include clashes
+#ifndef SO_ORIGINAL_DST
+#define SO_ORIGINAL_DST 80
+#endif
+#ifndef IP6T_SO_ORIGINAL_DST
+#define IP6T_SO_ORIGINAL_DST 80
+#endif
+#ifndef IP_TRANSPARENT
+#define IP_TRANSPARENT 19
+#endif
+#ifndef IPV6_TRANSPARENT
+#define IPV6_TRANSPARENT 75
+#endif
+#endif
+
+#include <aio/event.h>
 #include <aio/bufferevent_ssl.h>
 #include <aio/bufferevent.h>
 #include <aio/buffer.h>
@@ -28,15 +48,38 @@
 #include <openssl/rand.h>
 
 static struct event_base *base = NULL;
+static struct evconnlistener *proxy_listener = NULL;
 static struct sockaddr_storage listen_on_addr;
 static struct sockaddr_storage connect_to_addr;
 static int connect_to_addrlen;
+static int connect_to_given = 0;
+static int transparent = 0;
 
 #define MAX_OUTPUT (1024*1024)
+// output queue of a session with a shell and a transfer, bounds echo latency
+#define MIXED_OUTPUT (64*1024)
+// bytes read per callback on sessions that carry transfers
+#define BULK_READ (16*1024)
+// event priorities, interactive sessions are served first in every loop
+#define PRIO_INTERACTIVE 0
+#define PRIO_BULK 1
 
 #include "ssh_adapter.h"
 #include "api_misc.h"
+#include "api_audit.h"
+#include "api_auditshm.h"
+#include "api_cmdindex.h"
+#include "api_capture.h"
+#include "api_ttyrec.h"
 #include "ssh_packet.h"
+#include "ssh_record.h"
+#include "ssh_memstat.h"
+#include "ssh_policy.h"
+#include "ssh_route.h"
+#include "ssh_handoff.h"
+#include "ssh_shaper.h"
+#include "ssh_cmdpolicy.h"
+#include "ssh_dlp.h"
 
 #ifdef _WIN32
 #define xKEYS_FOLDER "/runtime/etc/ssh/127.0.0.1/"
@@ -45,6 +88,11 @@ static int connect_to_addrlen;
 #endif
 
 static ssh_adapter_t *adapter = NULL;
+static char handoff_path[108];
+static evutil_socket_t handoff_fd = -1;
+static struct event *handoff_ev = NULL;
+static struct event *drain_ev = NULL;
+static time_t drain_deadline = 0;
 static void drained_writecb(struct bufferevent *bev, void *ctx);
 
 static void data_write_handler(struct bufferevent *bev, void *arg);
@@ -107,6 +155,9 @@ session_filter_handler(const char *role, ssh_session_t *session, struct evbuffer
 		}
 		#endif
 		evbuffer_remove(in, data, nbytes);
+#ifdef DEBUG_CRYPTO
+		ssh_record_data(session, data, nbytes);
+#endif
 		//evbuffer_add(out, data, nbytes);
 		//if(session->type == SSH_SESSION_CLIENT)
 		{
@@ -121,13 +172,83 @@ session_filter_handler(const char *role, ssh_session_t *session, struct evbuffer
 	}
 }
 
+static size_t
+session_max_output(ssh_session_t *session)
+{
+	ssh_session_t *cli = session->type == SSH_SESSION_CLIENT ? session : session->session_ptr;
+	return cli != NULL && cli->sched == SSH_SCHED_MIXED ? MIXED_OUTPUT : MAX_OUTPUT;
+}
+
+// the session's channels changed its class, see ssh_packet.h
+static void
+session_sched_update(ssh_session_t *session)
+{
+	ssh_session_t *session_out = session->session_ptr;
+	struct bufferevent *b_in = session_out->owner_ptr, *b_out = session->owner_ptr;
+	int prio = session->sched == SSH_SCHED_BULK ? PRIO_BULK : PRIO_INTERACTIVE;
+	size_t chunk = session->sched == SSH_SCHED_INTERACTIVE ? 0 : BULK_READ;
+
+	bufferevent_priority_set(b_in, prio);
+	bufferevent_priority_set(b_out, prio);
+	// a read high-watermark bounds what one callback reads
+	bufferevent_setwatermark(b_in, EV_READ, 0, chunk);
+	bufferevent_setwatermark(b_out, EV_READ, 0, chunk);
+}
+
+// the capture writer is behind, see api_capture.h: this leg waits for it
+static void
+capture_tick_cb(evutil_socket_t fd, short events, void *arg)
+{
+	ssh_session_t *session = arg;
+	ssh_session_t *partner = session->session_ptr;
+	struct bufferevent *bev = partner != NULL ? partner->owner_ptr : NULL;
+	struct timeval tv = {0, 10 * 1000};
+
+	if (api_capture_full()) {
+		evtimer_add(session->capture_tick, &tv);
+		return;
+	}
+	session->read_held &= ~SSH_HELD_CAPTURE;
+	if (bev != NULL && !session->read_held && !ssh_shaper_queued(session)) {
+		bufferevent_enable(bev, EV_READ);
+	}
+}
+
+static void
+capture_hold(ssh_session_t *session, struct bufferevent *bev)
+{
+	struct timeval tv = {0, 10 * 1000};
+
+	if (session->read_held & SSH_HELD_CAPTURE) {
+		return;
+	}
+	if (session->capture_tick == NULL) {
+		session->capture_tick = evtimer_new(base, capture_tick_cb, session);
+		if (session->capture_tick == NULL) {
+			return;
+		}
+	}
+	bufferevent_disable(bev, EV_READ);
+	session->read_held |= SSH_HELD_CAPTURE;
+	evtimer_add(session->capture_tick, &tv);
+}
+
+static void
+capture_release(ssh_session_t *session)
+{
+	if (session != NULL && session->capture_tick != NULL) {
+		event_free(session->capture_tick);
+		session->capture_tick = NULL;
+	}
+}
+
 static void
 data_read_handler(struct bufferevent *bev, void *ctx)
 {
 	const char *func = __FUNCTION__;
 	struct bufferevent *partner = NULL;
 	struct evbuffer *in = NULL, *out = NULL;
-	size_t len;
+	size_t len, max_output;
 	
 	ssh_session_t *session = ctx;
 	if(session == NULL || session->owner_ptr == NULL) {
@@ -153,19 +274,27 @@ data_read_handler(struct bufferevent *bev, void *ctx)
 	out = bufferevent_get_output(partner);
 	if( len > 0 ) {
 		session_filter_handler(func, session, in, out);
+		ssh_shaper_charge(session, len);
 	}
 	
-	if (evbuffer_get_length(out) >= MAX_OUTPUT) {
+	max_output = session_max_output(session);
+	if (evbuffer_get_length(out) >= max_output) {
 		/* We're giving the other side data faster than it can
 		 * pass it on.  Stop reading here until we have drained the
-		 * other side to MAX_OUTPUT/2 bytes.
+		 * other side to max_output/2 bytes.
 		 */
 		do_error("[%s: 2-1]: .....................", func);
+		// the partner's callbacks take the partner's session
 		bufferevent_setcb(partner, data_read_handler, drained_writecb,
-		    event_error_handler, bev);
-		bufferevent_setwatermark(partner, EV_WRITE, MAX_OUTPUT/2,
-		    MAX_OUTPUT);
+		    event_error_handler, session->session_ptr);
+		bufferevent_setwatermark(partner, EV_WRITE, max_output/2,
+		    max_output);
 		bufferevent_disable(bev, EV_READ);
+		session->read_held |= SSH_HELD_OUTPUT;
+	}
+	if (session->capture_full) {
+		session->capture_full = 0;
+		capture_hold(session, bev);
 	}
 }
 
@@ -173,6 +302,7 @@ static void
 drained_writecb(struct bufferevent *bev, void *ctx)
 {
 	ssh_session_t *session = ctx;
+	ssh_session_t *reader = session->session_ptr;
 	struct bufferevent *partner = session->owner_ptr;
 	printf("2----------------------------------------\r\n");
 
@@ -181,7 +311,11 @@ drained_writecb(struct bufferevent *bev, void *ctx)
 	 */
 	bufferevent_setcb(bev, data_read_handler, NULL, event_error_handler, ctx);
 	bufferevent_setwatermark(bev, EV_WRITE, 0, 0);
-	if (partner) {
+	if (reader != NULL) {
+		reader->read_held &= ~SSH_HELD_OUTPUT;
+	}
+	// a leg the shaper parked is enabled by the shaper, a capture hold by its tick
+	if (partner && (reader == NULL || (!reader->read_held && !ssh_shaper_queued(reader)))) {
 		bufferevent_enable(partner, EV_READ);
 	}
 }
@@ -239,8 +373,15 @@ event_error_handler(struct bufferevent *bev, short what, void *ctx)
 				 * side; close it. 
 				 */
 				bufferevent_free(partner);
-				ssh_log(session, "\"%s:closed\"", SESSION_TYPE(session));
+				ssh_log_event(session, API_AUDIT_SESSION, "\"%s:closed\"", SESSION_TYPE(session));
 			}
+#ifdef DEBUG_CRYPTO
+			ssh_record_close(session);
+#endif
+			ssh_shaper_detach(session);
+			capture_release(session);
+			capture_release(session->session_ptr);
+			ssh_memstat_session_close();
 		}
 		bufferevent_free(bev);
 	}
@@ -256,12 +397,150 @@ data_write_handler(struct bufferevent *bev, void *arg)
 	//
 }
 
+// destinations not fixed on the command line, pin their host keys
+static void
+session_pin_hostkey(ssh_session_t *session_out)
+{
+	ssh_options_set(session_out, SSH_OPTIONS_HOST, session_out->sip);
+	ssh_options_set(session_out, SSH_OPTIONS_PORT, &session_out->sport);
+	ssh_options_set(session_out, SSH_OPTIONS_KNOWNHOSTS, SSH_PINNED_FILE);
+	session_out->hostkey_check = knownhost_pin;
+}
+
+// routed session, connect the server named in the login, see ssh_route.h
+static int
+session_route_connect(ssh_session_t *session, const char *target)
+{
+	ssh_session_t *session_out = session->session_ptr;
+	struct bufferevent *b_out = session->owner_ptr;
+	struct sockaddr_storage addr;
+	int addrlen = sizeof(addr);
+
+	if(target == NULL || *target == '\0') {
+		// plain login, the command line target if there is one
+		if(!connect_to_given) {
+			return -1;
+		}
+		memcpy(&addr, &connect_to_addr, connect_to_addrlen);
+		addrlen = connect_to_addrlen;
+	} else if(ssh_route_lookup(target, &addr, &addrlen) != 0) {
+		return -1;
+	}
+	if(bufferevent_socket_connect(b_out, (struct sockaddr *)&addr, addrlen) < 0) {
+		trace_err("route %s: connect failed", target);
+		return -1;
+	}
+	SAFE_FREE(session->sip);
+	SAFE_FREE(session_out->sip);
+	api_name_from_addr((struct sockaddr *)&addr, addrlen, &(session->sip), &(session->sport));
+	api_name_from_addr((struct sockaddr *)&addr, addrlen, &(session_out->sip), &(session_out->sport));
+	ssh_log_reset(session);
+	ssh_log_reset(session_out);
+	session_out->session_state = SSH_SESSION_STATE_SOCKET_CONNECTED;
+	session_pin_hostkey(session_out);
+	if(ssh_connect(session_out) != SSH_OK) {
+		trace_err("init proxy-client failed.");
+	}
+	ssh_log_event(session, API_AUDIT_ROUTE, "route \"%s\": [%s:%d] -> [%s:%d]", target ? target : "",
+			session->cip, session->cport,
+			session->sip, session->sport);
+	return 0;
+}
+
+// port of an inet or inet6 address in host order, -1 for other families
+static int
+sockaddr_port(const struct sockaddr_storage *addr)
+{
+	if (addr->ss_family == AF_INET) {
+		return ntohs(((const struct sockaddr_in *)addr)->sin_port);
+	}
+	if (addr->ss_family == AF_INET6) {
+		return ntohs(((const struct sockaddr_in6 *)addr)->sin6_port);
+	}
+	return -1;
+}
+
+#ifdef __linux__
+// the listener port on an address of this host: the proxy itself
+static int
+session_is_listener(const struct sockaddr_storage *addr, socklen_t len)
+{
+	struct sockaddr_storage local;
+	evutil_socket_t fd = -1;
+	int rc = 0;
+
+	if (sockaddr_port(addr) != sockaddr_port(&listen_on_addr)) {
+		return 0;
+	}
+	// only a local address can be bound without IP_TRANSPARENT
+	memcpy(&local, addr, len);
+	if (local.ss_family == AF_INET) {
+		((struct sockaddr_in *)&local)->sin_port = 0;
+	} else {
+		((struct sockaddr_in6 *)&local)->sin6_port = 0;
+	}
+	fd = socket(local.ss_family, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return 1;
+	}
+	rc = bind(fd, (struct sockaddr *)&local, len) == 0;
+	evutil_closesocket(fd);
+	return rc;
+}
+#endif
+
+/*
+ * transparent: where the client meant to go. iptables REDIRECT keeps it
+ * in SO_ORIGINAL_DST, with TPROXY it is the local address of the socket.
+ * A connection made to the listener itself, which conntrack reports as
+ * its own original destination too, has nowhere to go.
+ */
+static int
+session_original_dst(evutil_socket_t fd, struct sockaddr_storage *addr, int *addrlen)
+{
+#ifdef __linux__
+	socklen_t len = sizeof(*addr);
+
+	memset(addr, 0, sizeof(*addr));
+	if (getsockopt(fd, IPPROTO_IP, SO_ORIGINAL_DST, addr, &len) != 0) {
+		len = sizeof(*addr);
+		if (getsockopt(fd, IPPROTO_IPV6, IP6T_SO_ORIGINAL_DST, addr, &len) != 0) {
+			len = sizeof(*addr);
+			if (getsockname(fd, (struct sockaddr *)addr, &len) != 0) {
+				return -1;
+			}
+		}
+	}
+	if (sockaddr_port(addr) < 0 || session_is_listener(addr, len)) {
+		return -1;
+	}
+	*addrlen = len;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
 static void
 accept_cb(struct evconnlistener *listener, evutil_socket_t fd,
     struct sockaddr *sa, int slen, void *p)
 {
 	ssh_session_t *session_in = NULL, *session_out = NULL;
 	struct bufferevent *b_out, *b_in;
+	struct sockaddr_storage target;
+	int targetlen = 0;
+	int routed = !transparent && ssh_route_count() > 0;
+
+	if (transparent) {
+		if (session_original_dst(fd, &target, &targetlen) != 0) {
+			trace_err("transparent: no original destination, closed.");
+			evutil_closesocket(fd);
+			return;
+		}
+	} else if (connect_to_given) {
+		memcpy(&target, &connect_to_addr, connect_to_addrlen);
+		targetlen = connect_to_addrlen;
+	}
 	// Create two linked bufferevent objects: one to connect, one for the new connection
 	b_in = bufferevent_socket_new(base, fd,
 	    BEV_OPT_CLOSE_ON_FREE|BEV_OPT_DEFER_CALLBACKS);
@@ -271,8 +550,9 @@ accept_cb(struct evconnlistener *listener, evutil_socket_t fd,
 	
 	do_assert(b_in && b_out);
 	
-	if (bufferevent_socket_connect(b_out,
-		(struct sockaddr*)&connect_to_addr, connect_to_addrlen)<0) {
+	// routed: the server is known, and connected, once the client logs in
+	if (!routed && bufferevent_socket_connect(b_out,
+		(struct sockaddr*)&target, targetlen)<0) {
 		perror("bufferevent_socket_connect");
 		bufferevent_free(b_out);
 		bufferevent_free(b_in);
@@ -288,11 +568,19 @@ accept_cb(struct evconnlistener *listener, evutil_socket_t fd,
 	session_in->type = SSH_SESSION_CLIENT;
 	session_in->owner_ptr =  b_out;
 	api_name_from_addr(sa, slen, &(session_in->cip),&(session_in->cport));
-	api_name_from_addr((struct sockaddr *)&connect_to_addr, connect_to_addrlen, &(session_in->sip),&(session_in->sport));
+	if(targetlen > 0) {
+		api_name_from_addr((struct sockaddr *)&target, targetlen, &(session_in->sip),&(session_in->sport));
+	}
 	ssh_adapter_accept(adapter, session_in);
 	session_in->session_ptr = session_out;
 	session_in->evbuffer = bufferevent_get_output(b_in);
 	session_in->data_send = session_data_send;
+	session_in->channel_reply = session_channel_reply;
+	if(routed) {
+		session_in->route = SSH_ROUTE_LOGIN;
+		session_in->route_connect = session_route_connect;
+	}
+	session_in->sched_update = session_sched_update;
 	//session_callback_init(session_in);
 	ssh_handle_key_exchange(session_in);
 	
@@ -303,14 +591,24 @@ accept_cb(struct evconnlistener *listener, evutil_socket_t fd,
 	session_out->type = SSH_SESSION_SERVER;
 	session_out->owner_ptr = b_in;
 	api_name_from_addr(sa, slen, &(session_out->cip),&(session_out->cport));
-	api_name_from_addr((struct sockaddr*)&connect_to_addr, connect_to_addrlen, 
-		&(session_out->sip),&(session_out->sport));
+	if(targetlen > 0) {
+		api_name_from_addr((struct sockaddr*)&target, targetlen, 
+			&(session_out->sip),&(session_out->sport));
+	}
 	//ssh_adapter_accept(adapter, session_out);
 	session_out->session_ptr = session_in;
 	session_out->evbuffer = bufferevent_get_output(b_out);
 	session_out->data_send = session_data_send;
+	session_out->channel_reply = session_channel_reply;
+	session_out->global_reply = session_global_reply;
+#ifdef DEBUG_CRYPTO
+	ssh_record_open(session_in, session_out);
+#endif
 	//session_callback_init(session_out);
-	{
+	if(transparent) {
+		session_pin_hostkey(session_out);
+	}
+	if(!routed) {
 		int ret = ssh_connect(session_out);
 		if(ret != SSH_OK) {
 			trace_err("init proxy-client failed.");
@@ -321,23 +619,160 @@ accept_cb(struct evconnlistener *listener, evutil_socket_t fd,
 			trace_err("iknownhost_verify failed.");
 		}*/
 	}
-	ssh_log(session_in, "accept a new session: [%s:%d] -> [%s:%d]",
+	ssh_log_event(session_in, API_AUDIT_SESSION, "accept a new session: [%s:%d] -> [%s:%d]",
 			session_in->cip, session_in->cport,
 			session_in->sip, session_in->sport);
 	
 	bufferevent_setcb(b_out, data_read_handler, data_write_handler, event_error_handler, session_out);
 
+	// the default is the middle queue, new sessions are interactive
+	bufferevent_priority_set(b_in, PRIO_INTERACTIVE);
+	bufferevent_priority_set(b_out, PRIO_INTERACTIVE);
 	bufferevent_enable(b_in, EV_READ|EV_WRITE);
 	bufferevent_enable(b_out, EV_READ|EV_WRITE);
+	ssh_memstat_session_open();
+}
+
+// the audit block being filled and the buffered terminal recordings go
+// to disk at least once a second
+static void
+audit_cb(evutil_socket_t fd, short events, void *arg)
+{
+	api_audit_flush();
+	api_ttyrec_flush();
+}
+
+// log lines take the time libevent cached for the loop iteration
+static uint64_t
+proxy_clock(void)
+{
+	struct timeval tv;
+
+	event_base_gettimeofday_cached(base, &tv);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void
+memstat_cb(evutil_socket_t sig, short events, void *arg)
+{
+	ssh_memstat_dump();
+	ssh_shaper_dump();
+}
+
+static ssh_adapter_t *
+proxy_adapter_new(void)
+{
+	ssh_adapter_t *ptr = ssh_adapter_new();
+	if(ptr == NULL) {
+		return NULL;
+	}
+	//ssh_adapter_options_set(ptr, SSH_BIND_OPTIONS_HOSTKEY, xKEYS_FOLDER "ssh_host_key");
+	ssh_adapter_options_set(ptr, SSH_BIND_OPTIONS_DSAKEY, xKEYS_FOLDER "ssh_host_dsa_key");
+	ssh_adapter_options_set(ptr, SSH_BIND_OPTIONS_RSAKEY, xKEYS_FOLDER "ssh_host_rsa_key");
+	ssh_adapter_options_set(ptr, SSH_BIND_OPTIONS_LOG_VERBOSITY_STR, "4");
+	return ptr;
+}
+
+// kill -HUP, open sessions keep the keys they were accepted with
+static void
+reload_cb(evutil_socket_t sig, short events, void *arg)
+{
+	ssh_adapter_t *fresh = proxy_adapter_new();
+
+	if(fresh != NULL && ssh_adapter_init(fresh) == SSH_OK) {
+		ssh_adapter_free(adapter);
+		adapter = fresh;
+	} else {
+		trace_err("reload: host keys failed, old ones kept.");
+		ssh_adapter_free(fresh);
+	}
+	ssh_policy_load(SSH_POLICY_FILE);
+	ssh_route_load(SSH_ROUTE_FILE);
+	ssh_shaper_load(base, SSH_SHAPER_FILE);
+	ssh_cmdpolicy_load(SSH_CMDPOLICY_FILE);
+	ssh_dlp_load(SSH_DLP_FILE);
+	do_info("reload: done.");
+}
+
+static void
+drain_cb(evutil_socket_t fd, short events, void *arg)
+{
+	ssh_memstat_t stat;
+
+	ssh_memstat_get(&stat);
+	if(stat.sessions_live == 0) {
+		do_info("drain: all sessions closed, exit.");
+		event_base_loopexit(base, NULL);
+	} else if(time(NULL) >= drain_deadline) {
+		do_info("drain: deadline, %llu sessions dropped.", (unsigned long long)stat.sessions_live);
+		event_base_loopexit(base, NULL);
+	}
+}
+
+// a new proxy asks for the listener, see ssh_handoff.h
+static void
+handoff_cb(evutil_socket_t fd, short events, void *arg)
+{
+	struct timeval tv = {1, 0};
+
+	if(ssh_handoff_give(handoff_fd, evconnlistener_get_fd(proxy_listener)) != 0) {
+		return;
+	}
+	evconnlistener_disable(proxy_listener);
+	event_del(handoff_ev);
+	evutil_closesocket(handoff_fd);
+	handoff_fd = -1;
+	do_info("handoff: listener passed on, draining.");
+	drain_deadline = time(NULL) + SSH_DRAIN_TIMEOUT;
+	drain_ev = event_new(base, -1, EV_PERSIST, drain_cb, NULL);
+	if(drain_ev == NULL || event_add(drain_ev, &tv) != 0) {
+		event_base_loopexit(base, NULL);
+	}
+}
+
+/*
+ * transparent listener. TPROXY delivers connections for addresses that are
+ * not ours and needs IP_TRANSPARENT (CAP_NET_ADMIN), REDIRECT does not, so
+ * failing to set it is only reported.
+ */
+static evutil_socket_t
+transparent_listen(struct sockaddr *sa, int socklen)
+{
+	evutil_socket_t fd;
+	int on = 1;
+
+	fd = socket(sa->sa_family, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+#ifdef __linux__
+	if (sa->sa_family == AF_INET6) {
+		on = setsockopt(fd, IPPROTO_IPV6, IPV6_TRANSPARENT, &on, sizeof(on));
+	} else {
+		on = setsockopt(fd, IPPROTO_IP, IP_TRANSPARENT, &on, sizeof(on));
+	}
+	if (on != 0) {
+		trace_err("IP_TRANSPARENT: %s, REDIRECT only.", strerror(errno));
+	}
+#endif
+	if (evutil_make_socket_nonblocking(fd) < 0 ||
+		evutil_make_listen_socket_reuseable(fd) < 0 ||
+		bind(fd, sa, socklen) < 0) {
+		evutil_closesocket(fd);
+		return -1;
+	}
+	return fd;
 }
 
 static void
 syntax(void)
 {
 	fputs("Syntax:\n", stderr);
-	fputs("   ssh-proxy <listen-on-addr> <connect-to-addr>\n", stderr);
+	fputs("   ssh-proxy <listen-on-addr> [connect-to-addr|transparent]\n", stderr);
 	fputs("Example:\n", stderr);
 	fputs("   ssh-proxy 0.0.0.0:10022 192.168.1.110:22\n", stderr);
+	fputs("   ssh-proxy 0.0.0.0:10022    (targets from " SSH_ROUTE_FILE ")\n", stderr);
+	fputs("   ssh-proxy 0.0.0.0:10022 transparent    (behind iptables REDIRECT/TPROXY)\n", stderr);
 	
 	exit(1);
 }
@@ -346,22 +781,28 @@ int
 main(int argc, char **argv)
 {
 	int socklen;
-	struct evconnlistener *listener;
+	evutil_socket_t fd = -1;
+	struct event *memstat_ev = NULL, *reload_ev = NULL, *audit_ev = NULL;
+	struct timeval audit_tv = {1, 0};
+	char auditshm_name[64];
 	
 	if (argc < 2) {
 		syntax();
 	}
-	adapter = ssh_adapter_new();
+	adapter = proxy_adapter_new();
 	if(adapter == NULL) {
 		trace_err("ssh_adapter create failed.");
 		return 0x01;
 	}
-	
-	//ssh_adapter_options_set(adapter, SSH_BIND_OPTIONS_HOSTKEY, xKEYS_FOLDER "ssh_host_key");
-	ssh_adapter_options_set(adapter, SSH_BIND_OPTIONS_DSAKEY, xKEYS_FOLDER "ssh_host_dsa_key");
-    ssh_adapter_options_set(adapter, SSH_BIND_OPTIONS_RSAKEY, xKEYS_FOLDER "ssh_host_rsa_key");
-	ssh_adapter_options_set(adapter, SSH_BIND_OPTIONS_LOG_VERBOSITY_STR, "4");
 	ssh_adapter_init(adapter);
+	// no file, no rules: every channel is fully inspected
+	ssh_policy_load(SSH_POLICY_FILE);
+	// no file, no routes: every session goes to <connect-to-addr>
+	ssh_route_load(SSH_ROUTE_FILE);
+	// no file, no rules: every command runs
+	ssh_cmdpolicy_load(SSH_CMDPOLICY_FILE);
+	// no file, no rules: transfers are not scanned
+	ssh_dlp_load(SSH_DLP_FILE);
 
 	memset(&listen_on_addr, 0, sizeof(listen_on_addr));
 	socklen = sizeof(listen_on_addr);
@@ -380,8 +821,16 @@ main(int argc, char **argv)
 	
 	memset(&connect_to_addr, 0, sizeof(connect_to_addr));
 	connect_to_addrlen = sizeof(connect_to_addr);
-	if (evutil_parse_sockaddr_port(argv[2],
-		(struct sockaddr*)&connect_to_addr, &connect_to_addrlen)<0) {
+	if (argc > 2 && strcmp(argv[2], "transparent") == 0) {
+		// every connection goes where it was headed, see accept_cb
+		transparent = 1;
+	} else if (argc > 2) {
+		if (evutil_parse_sockaddr_port(argv[2],
+			(struct sockaddr*)&connect_to_addr, &connect_to_addrlen)<0) {
+			syntax();
+		}
+		connect_to_given = 1;
+	} else if (ssh_route_count() == 0) {
 		syntax();
 	}
 	base = event_base_new();
@@ -389,21 +838,101 @@ main(int argc, char **argv)
 		perror("event_base_new()");
 		return 1;
 	}
+	// before any event is added
+	event_base_priority_init(base, PRIO_BULK + 1);
+	api_clock_source(proxy_clock);
+	// no file, no rules: nothing is shaped
+	ssh_shaper_load(base, SSH_SHAPER_FILE);
 	
-	listener = evconnlistener_new_bind(base, accept_cb, NULL,
-	    LEV_OPT_CLOSE_ON_FREE|LEV_OPT_CLOSE_ON_EXEC|LEV_OPT_REUSEABLE,
-	    -1, (struct sockaddr*)&listen_on_addr, socklen);
+	// a proxy already on this port hands its listener over and drains
+	snprintf(handoff_path, sizeof(handoff_path), SSH_HANDOFF_FILE,
+		sockaddr_port(&listen_on_addr));
+	fd = ssh_handoff_take(handoff_path);
+	if (fd >= 0) {
+		do_info("handoff: listener taken over.");
+		proxy_listener = evconnlistener_new(base, accept_cb, NULL,
+		    LEV_OPT_CLOSE_ON_FREE|LEV_OPT_CLOSE_ON_EXEC, -1, fd);
+	} else if (transparent) {
+		fd = transparent_listen((struct sockaddr*)&listen_on_addr, socklen);
+		proxy_listener = fd < 0 ? NULL : evconnlistener_new(base, accept_cb, NULL,
+		    LEV_OPT_CLOSE_ON_FREE|LEV_OPT_CLOSE_ON_EXEC, -1, fd);
+	} else {
+		proxy_listener = evconnlistener_new_bind(base, accept_cb, NULL,
+		    LEV_OPT_CLOSE_ON_FREE|LEV_OPT_CLOSE_ON_EXEC|LEV_OPT_REUSEABLE,
+		    -1, (struct sockaddr*)&listen_on_addr, socklen);
+	}
 	
-	if (!listener) {
+	if (!proxy_listener) {
 		fprintf(stderr, "Couldn't open listener.\n");
 		event_base_free(base);
 		return 1;
 	}
 	
+	// kill -USR1 writes the memory statistics, see ssh_memstat.h
+	memstat_ev = evsignal_new(base, SIGUSR1, memstat_cb, NULL);
+	if(memstat_ev == NULL || event_add(memstat_ev, NULL) != 0) {
+		trace_err("SIGUSR1 handler failed.");
+	}
+	// kill -HUP reloads keys, routes and policy, see ssh_handoff.h
+	reload_ev = evsignal_new(base, SIGHUP, reload_cb, NULL);
+	if(reload_ev == NULL || event_add(reload_ev, NULL) != 0) {
+		trace_err("SIGHUP handler failed.");
+	}
+	handoff_fd = ssh_handoff_open(handoff_path);
+	if(handoff_fd >= 0) {
+		handoff_ev = event_new(base, handoff_fd, EV_READ|EV_PERSIST, handoff_cb, NULL);
+		if(handoff_ev == NULL || event_add(handoff_ev, NULL) != 0) {
+			trace_err("handoff handler failed.");
+		}
+	}
+	// audit events for local consumers, a proxy taking over makes its own
+	snprintf(auditshm_name, sizeof(auditshm_name), API_AUDITSHM_NAME,
+		sockaddr_port(&listen_on_addr));
+	api_auditshm_create(auditshm_name);
+	audit_ev = event_new(base, -1, EV_PERSIST, audit_cb, NULL);
+	if(audit_ev == NULL || event_add(audit_ev, &audit_tv) != 0) {
+		trace_err("audit timer failed.");
+	}
+	// compression and disk writes of captures stay off the event loop
+	api_capture_start();
+	// so does indexing the command history
+	api_cmdindex_start();
+	
 	event_base_dispatch(base);
 	
-	evconnlistener_free(listener);
+	api_capture_stop();
+	api_cmdindex_stop();
+	if(audit_ev != NULL) {
+		event_free(audit_ev);
+	}
+	api_audit_close();
+	api_ttyrec_flush();
+	api_auditshm_destroy();
+	if(memstat_ev != NULL) {
+		event_free(memstat_ev);
+	}
+	if(reload_ev != NULL) {
+		event_free(reload_ev);
+	}
+	if(drain_ev != NULL) {
+		event_free(drain_ev);
+	}
+	if(handoff_ev != NULL) {
+		event_free(handoff_ev);
+	}
+	if(handoff_fd >= 0) {
+		// still ours, nobody took the listener
+		evutil_closesocket(handoff_fd);
+		unlink(handoff_path);
+	}
+	evconnlistener_free(proxy_listener);
+	ssh_shaper_free();
 	event_base_free(base);
+	ssh_policy_free();
+	ssh_route_free();
+	ssh_cmdpolicy_free();
+	ssh_dlp_free();
+	ssh_adapter_free(adapter);
 	
 	return 0;
 }
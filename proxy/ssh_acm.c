@@ -0,0 +1,190 @@
+#include "ssh-includes.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "api_misc.h"
+#include "ssh_acm.h"
+
+struct ssh_acm_struct {
+	int      *rank;
+	int       count;
+	uint32_t  states;
+	uint32_t  classes;
+	uint8_t   cls[256];   // byte -> column, 0 for bytes no pattern has
+	uint8_t   first[256]; // 1 for bytes a pattern starts with
+	int       lead;       // the byte all patterns start with, -1 if not one
+	uint32_t *delta;      // states x classes, failure links folded in
+	int      *out;        // winner ending in a state, -1 none
+};
+
+void ssh_acm_free(ssh_acm_t *acm)
+{
+	if(acm == NULL) {
+		return;
+	}
+	SAFE_FREE(acm->rank);
+	SAFE_FREE(acm->delta);
+	SAFE_FREE(acm->out);
+	free(acm);
+}
+
+uint32_t ssh_acm_states(const ssh_acm_t *acm)
+{
+	return acm->states;
+}
+
+int ssh_acm_better(const ssh_acm_t *acm, int a, int b)
+{
+	if(a < 0) {
+		return b;
+	}
+	if(b < 0) {
+		return a;
+	}
+	if(acm->rank[a] != acm->rank[b]) {
+		return acm->rank[a] > acm->rank[b] ? a : b;
+	}
+	return a < b ? a : b;
+}
+
+static int acm_compile(ssh_acm_t *acm, char * const *patterns)
+{
+	uint32_t total = 1, next = 1, head = 0, tail = 0;
+	uint32_t s = 0, t = 0, c = 0, *fail = NULL, *queue = NULL;
+	const uint8_t *p = NULL;
+	int i = 0, leads = 0;
+
+	// one column per distinct pattern byte keeps the table small
+	acm->classes = 1;
+	acm->lead = -1;
+	for(i = 0; i < acm->count; i++) {
+		for(p = (const uint8_t *)patterns[i]; *p != '\0'; p++) {
+			if(acm->cls[*p] == 0) {
+				acm->cls[*p] = acm->classes++;
+			}
+			total++;
+		}
+		p = (const uint8_t *)patterns[i];
+		if(!acm->first[*p]) {
+			acm->first[*p] = 1;
+			acm->lead = *p;
+			leads++;
+		}
+	}
+	if(leads != 1) {
+		acm->lead = -1;
+	}
+	acm->delta = calloc((size_t)total * acm->classes, sizeof(uint32_t));
+	acm->out = malloc(total * sizeof(int));
+	fail = calloc(total, sizeof(uint32_t));
+	queue = malloc(total * sizeof(uint32_t));
+	if(acm->delta == NULL || acm->out == NULL || fail == NULL || queue == NULL) {
+		SAFE_FREE(fail);
+		SAFE_FREE(queue);
+		return -1;
+	}
+	for(s = 0; s < total; s++) {
+		acm->out[s] = -1;
+	}
+	// the trie, 0 is no edge yet as nothing goes back to the root
+	for(i = 0; i < acm->count; i++) {
+		s = 0;
+		for(p = (const uint8_t *)patterns[i]; *p != '\0'; p++) {
+			c = acm->cls[*p];
+			if(acm->delta[s * acm->classes + c] == 0) {
+				acm->delta[s * acm->classes + c] = next++;
+			}
+			s = acm->delta[s * acm->classes + c];
+		}
+		acm->out[s] = ssh_acm_better(acm, acm->out[s], i);
+	}
+	acm->states = next;
+	// breadth first, a failure link is always shallower and done already
+	for(c = 0; c < acm->classes; c++) {
+		t = acm->delta[c];
+		if(t != 0) {
+			queue[tail++] = t;
+		}
+	}
+	while(head < tail) {
+		s = queue[head++];
+		for(c = 0; c < acm->classes; c++) {
+			t = acm->delta[s * acm->classes + c];
+			if(t != 0) {
+				fail[t] = acm->delta[fail[s] * acm->classes + c];
+				acm->out[t] = ssh_acm_better(acm, acm->out[t], acm->out[fail[t]]);
+				queue[tail++] = t;
+			} else {
+				acm->delta[s * acm->classes + c] = acm->delta[fail[s] * acm->classes + c];
+			}
+		}
+	}
+	free(fail);
+	free(queue);
+	return 0;
+}
+
+ssh_acm_t *ssh_acm_new(char * const *patterns, const int *rank, int count)
+{
+	ssh_acm_t *acm = NULL;
+	int i = 0;
+
+	acm = calloc(1, sizeof(*acm));
+	if(acm == NULL) {
+		return NULL;
+	}
+	acm->count = count;
+	acm->rank = calloc(count > 0 ? count : 1, sizeof(int));
+	if(acm->rank == NULL) {
+		ssh_acm_free(acm);
+		return NULL;
+	}
+	for(i = 0; i < count; i++) {
+		acm->rank[i] = rank != NULL ? rank[i] : 0;
+		if(patterns[i][0] == '\0') {
+			// matches everywhere, not a pattern
+			ssh_acm_free(acm);
+			return NULL;
+		}
+	}
+	if(acm_compile(acm, patterns) != 0) {
+		ssh_acm_free(acm);
+		return NULL;
+	}
+	return acm;
+}
+
+int ssh_acm_feed(const ssh_acm_t *acm, uint32_t *state, int match, const void *data, size_t len)
+{
+	const uint8_t *p = data, *end = p + len;
+	uint32_t s = *state;
+
+	if(s >= acm->states) {
+		s = 0;
+	}
+	while(p < end) {
+		if(s == 0) {
+			// at the root only a byte some pattern starts with moves
+			if(acm->lead >= 0) {
+				p = memchr(p, acm->lead, end - p);
+				if(p == NULL) {
+					break;
+				}
+			} else {
+				while(p < end && !acm->first[*p]) {
+					p++;
+				}
+				if(p == end) {
+					break;
+				}
+			}
+		}
+		s = acm->delta[s * acm->classes + acm->cls[*p++]];
+		if(acm->out[s] >= 0) {
+			match = ssh_acm_better(acm, match, acm->out[s]);
+		}
+	}
+	*state = s;
+	return match;
+}
@@ -0,0 +1,197 @@
+#include "ssh-includes.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "api_misc.h"
+#include "ssh_acm.h"
+#include "ssh_cmdpolicy.h"
+
+#define COMMAND_PATTERN_MAX 255
+
+typedef struct command_rule_struct {
+	int   action;
+	char *pattern;
+} command_rule_t;
+
+typedef struct command_dfa_struct {
+	command_rule_t *rules;
+	int        count;
+	ssh_acm_t *acm;
+} command_dfa_t;
+
+static command_dfa_t *dfa = NULL;
+static uint32_t generation = 1; // never 0, the value of a new channel
+
+static void command_dfa_free(command_dfa_t *d)
+{
+	int i = 0;
+
+	if(d == NULL) {
+		return;
+	}
+	for(i = 0; i < d->count; i++) {
+		SAFE_FREE(d->rules[i].pattern);
+	}
+	SAFE_FREE(d->rules);
+	ssh_acm_free(d->acm);
+	free(d);
+}
+
+void ssh_cmdpolicy_free(void)
+{
+	command_dfa_free(dfa);
+	dfa = NULL;
+	generation++;
+}
+
+int ssh_cmdpolicy_count(void)
+{
+	return dfa != NULL ? dfa->count : 0;
+}
+
+uint32_t ssh_cmdpolicy_generation(void)
+{
+	return generation;
+}
+
+// block rules rank over alert rules
+static int command_compile(command_dfa_t *d)
+{
+	char **patterns = NULL;
+	int *rank = NULL, i = 0;
+
+	patterns = calloc(d->count + 1, sizeof(char *));
+	rank = calloc(d->count + 1, sizeof(int));
+	if(patterns != NULL && rank != NULL) {
+		for(i = 0; i < d->count; i++) {
+			patterns[i] = d->rules[i].pattern;
+			rank[i] = d->rules[i].action;
+		}
+		d->acm = ssh_acm_new(patterns, rank, d->count);
+	}
+	SAFE_FREE(patterns);
+	SAFE_FREE(rank);
+	return d->acm != NULL ? 0 : -1;
+}
+
+int ssh_cmdpolicy_load(const char *filename)
+{
+	command_dfa_t *d = NULL;
+	command_rule_t *rules = NULL;
+	char line[512], action[16], *pattern = NULL, *end = NULL;
+	int lineno = 0, size = 0, act = 0;
+	FILE *fp = NULL;
+
+	fp = fopen(filename, "r");
+	if(fp == NULL) {
+		trace_err("command: %s: %s", filename, strerror(errno));
+		return -1;
+	}
+	d = calloc(1, sizeof(*d));
+	if(d == NULL) {
+		fclose(fp);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		pattern = line + strspn(line, " \t");
+		if(*pattern == '#' || pattern[strspn(pattern, "\r\n")] == '\0') {
+			continue;
+		}
+		if(sscanf(pattern, "%15s", action) != 1) {
+			continue;
+		}
+		if(!strcmp(action, "block")) {
+			act = SSH_CMDPOLICY_BLOCK;
+		} else if(!strcmp(action, "alert")) {
+			act = SSH_CMDPOLICY_ALERT;
+		} else {
+			trace_err("command: %s:%d: unknown action %s", filename, lineno, action);
+			continue;
+		}
+		pattern += strlen(action);
+		pattern += strspn(pattern, " \t");
+		end = pattern + strlen(pattern);
+		while(end > pattern && strchr(" \t\r\n", end[-1]) != NULL) {
+			*--end = '\0';
+		}
+		if(*pattern == '\0' || end - pattern > COMMAND_PATTERN_MAX) {
+			trace_err("command: %s:%d: expected action pattern", filename, lineno);
+			continue;
+		}
+		if(d->count == size) {
+			size = size == 0 ? 16 : size * 2;
+			rules = realloc(d->rules, size * sizeof(command_rule_t));
+			if(rules == NULL) {
+				break;
+			}
+			d->rules = rules;
+		}
+		d->rules[d->count].action = act;
+		d->rules[d->count].pattern = strdup(pattern);
+		if(d->rules[d->count].pattern == NULL) {
+			break;
+		}
+		d->count++;
+	}
+	fclose(fp);
+
+	if(command_compile(d) != 0) {
+		trace_err("command: %s: out of memory, old rules kept", filename);
+		command_dfa_free(d);
+		return -1;
+	}
+	ssh_cmdpolicy_free();
+	if(d->count > 0) {
+		dfa = d;
+	} else {
+		command_dfa_free(d);
+		d = NULL;
+	}
+	do_info("command: %d rules, %u states from %s", d ? d->count : 0, d ? ssh_acm_states(d->acm) : 0, filename);
+	return d ? d->count : 0;
+}
+
+int ssh_cmdpolicy_feed(uint32_t *state, int rule, const void *data, uint32_t len)
+{
+	if(dfa == NULL) {
+		*state = 0;
+		return -1;
+	}
+	return ssh_acm_feed(dfa->acm, state, rule, data, len);
+}
+
+int ssh_cmdpolicy_check(const char *command)
+{
+	uint32_t state = 0;
+
+	if(command == NULL) {
+		return -1;
+	}
+	return ssh_cmdpolicy_feed(&state, -1, command, strlen(command));
+}
+
+int ssh_cmdpolicy_enter(char ch, int typed)
+{
+	// VEOL is not set by shells, ^D on an empty line is the shell's EOF
+	return ch == '\r' || (typed && (ch == '\n' || ch == 0x04));
+}
+
+int ssh_cmdpolicy_action(int rule)
+{
+	if(dfa == NULL || rule < 0 || rule >= dfa->count) {
+		return SSH_CMDPOLICY_PASS;
+	}
+	return dfa->rules[rule].action;
+}
+
+const char *ssh_cmdpolicy_pattern(int rule)
+{
+	if(dfa == NULL || rule < 0 || rule >= dfa->count) {
+		return "";
+	}
+	return dfa->rules[rule].pattern;
+}
@@ -19,6 +19,7 @@
 #define MACSIZE SHA_DIGEST_LEN
 
 #include "ssh_compat.h"
+#include "api_audit.h"
 
 /**
  * @internal
@@ -64,7 +65,7 @@ static int banner_parse(ssh_session_t *session, const void *data, size_t len) {
 			} else {
 				trace_out("protocol version %d.%d; software version %.100s\n",
 	    			remote_major, remote_minor, remote_version);
-	    		ssh_log(session, "version=%d, banner=%.100s",
+	    		ssh_log_event(session, API_AUDIT_SESSION, "version=%d, banner=%.100s",
 	    				session->version, remote_version);
 			}
 			compat_datafellows(session, remote_version);
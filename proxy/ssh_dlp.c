@@ -0,0 +1,314 @@
+#include "ssh-includes.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "api_misc.h"
+#include "ssh_acm.h"
+#include "ssh_dlp.h"
+
+#define DLP_PATTERN_MAX 255
+#define DLP_CARD_MIN 13
+#define DLP_CARD_MAX 19
+
+typedef struct dlp_rule_struct {
+	int   action;
+	char *pattern; // NULL for a card rule
+} dlp_rule_t;
+
+typedef struct dlp_rules_struct {
+	dlp_rule_t *rules;
+	int         count;
+	ssh_acm_t  *acm;
+	int        *literal; // automaton pattern -> rule
+	int         card;    // strongest card rule, -1 none
+} dlp_rules_t;
+
+static dlp_rules_t *dlp = NULL;
+static uint32_t generation = 1;
+
+static void dlp_rules_free(dlp_rules_t *d)
+{
+	int i = 0;
+
+	if(d == NULL) {
+		return;
+	}
+	for(i = 0; i < d->count; i++) {
+		SAFE_FREE(d->rules[i].pattern);
+	}
+	SAFE_FREE(d->rules);
+	SAFE_FREE(d->literal);
+	ssh_acm_free(d->acm);
+	free(d);
+}
+
+void ssh_dlp_free(void)
+{
+	dlp_rules_free(dlp);
+	dlp = NULL;
+	generation++;
+}
+
+int ssh_dlp_count(void)
+{
+	return dlp != NULL ? dlp->count : 0;
+}
+
+// block over alert, then the earlier rule
+static int dlp_better(const dlp_rules_t *d, int a, int b)
+{
+	if(a < 0) {
+		return b;
+	}
+	if(b < 0) {
+		return a;
+	}
+	if(d->rules[a].action != d->rules[b].action) {
+		return d->rules[a].action > d->rules[b].action ? a : b;
+	}
+	return a < b ? a : b;
+}
+
+static int dlp_compile(dlp_rules_t *d)
+{
+	char **patterns = NULL;
+	int *rank = NULL, i = 0, n = 0;
+
+	d->card = -1;
+	patterns = calloc(d->count + 1, sizeof(char *));
+	rank = calloc(d->count + 1, sizeof(int));
+	d->literal = calloc(d->count + 1, sizeof(int));
+	if(patterns != NULL && rank != NULL && d->literal != NULL) {
+		for(i = 0; i < d->count; i++) {
+			if(d->rules[i].pattern == NULL) {
+				d->card = dlp_better(d, d->card, i);
+				continue;
+			}
+			patterns[n] = d->rules[i].pattern;
+			rank[n] = d->rules[i].action;
+			d->literal[n++] = i;
+		}
+		d->acm = ssh_acm_new(patterns, rank, n);
+	}
+	SAFE_FREE(patterns);
+	SAFE_FREE(rank);
+	return d->acm != NULL ? 0 : -1;
+}
+
+int ssh_dlp_load(const char *filename)
+{
+	dlp_rules_t *d = NULL;
+	dlp_rule_t *rules = NULL;
+	char line[512], action[16], kind[16], *pattern = NULL, *end = NULL;
+	int lineno = 0, size = 0, act = 0;
+	FILE *fp = NULL;
+
+	fp = fopen(filename, "r");
+	if(fp == NULL) {
+		trace_err("dlp: %s: %s", filename, strerror(errno));
+		return -1;
+	}
+	d = calloc(1, sizeof(*d));
+	if(d == NULL) {
+		fclose(fp);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		pattern = line + strspn(line, " \t");
+		if(*pattern == '#' || pattern[strspn(pattern, "\r\n")] == '\0') {
+			continue;
+		}
+		if(sscanf(pattern, "%15s %15s", action, kind) != 2) {
+			trace_err("dlp: %s:%d: expected action kind [pattern]", filename, lineno);
+			continue;
+		}
+		if(!strcmp(action, "block")) {
+			act = SSH_DLP_BLOCK;
+		} else if(!strcmp(action, "alert")) {
+			act = SSH_DLP_ALERT;
+		} else {
+			trace_err("dlp: %s:%d: unknown action %s", filename, lineno, action);
+			continue;
+		}
+		// the pattern is the rest of the line
+		pattern += strspn(pattern, " \t") + strlen(action);
+		pattern += strspn(pattern, " \t") + strlen(kind);
+		pattern += strspn(pattern, " \t");
+		end = pattern + strlen(pattern);
+		while(end > pattern && strchr(" \t\r\n", end[-1]) != NULL) {
+			*--end = '\0';
+		}
+		if(!strcmp(kind, "card")) {
+			pattern = NULL;
+		} else if(strcmp(kind, "literal") != 0) {
+			trace_err("dlp: %s:%d: unknown kind %s", filename, lineno, kind);
+			continue;
+		} else if(*pattern == '\0' || end - pattern > DLP_PATTERN_MAX) {
+			trace_err("dlp: %s:%d: expected a pattern", filename, lineno);
+			continue;
+		}
+		if(d->count == size) {
+			size = size == 0 ? 16 : size * 2;
+			rules = realloc(d->rules, size * sizeof(dlp_rule_t));
+			if(rules == NULL) {
+				break;
+			}
+			d->rules = rules;
+		}
+		d->rules[d->count].action = act;
+		d->rules[d->count].pattern = NULL;
+		if(pattern != NULL && (d->rules[d->count].pattern = strdup(pattern)) == NULL) {
+			break;
+		}
+		d->count++;
+	}
+	fclose(fp);
+
+	if(dlp_compile(d) != 0) {
+		trace_err("dlp: %s: out of memory, old rules kept", filename);
+		dlp_rules_free(d);
+		return -1;
+	}
+	ssh_dlp_free();
+	if(d->count > 0) {
+		dlp = d;
+	} else {
+		dlp_rules_free(d);
+		d = NULL;
+	}
+	do_info("dlp: %d rules from %s", d ? d->count : 0, filename);
+	return d ? d->count : 0;
+}
+
+ssh_dlp_stream_t *ssh_dlp_open(void)
+{
+	ssh_dlp_stream_t *stream = NULL;
+
+	if(dlp == NULL) {
+		return NULL;
+	}
+	stream = calloc(1, sizeof(*stream));
+	if(stream != NULL) {
+		stream->gen = generation;
+		stream->rule = -1;
+	}
+	return stream;
+}
+
+static int dlp_card_valid(const ssh_dlp_stream_t *stream)
+{
+	return stream->digits >= DLP_CARD_MIN && stream->digits <= DLP_CARD_MAX
+		&& stream->lead >= 3 && stream->lead <= 6 && stream->luhn[0] == 0;
+}
+
+/*
+ * Luhn from the left: luhn[0] is the sum with the last digit taken as is,
+ * luhn[1] with it doubled, a new digit shifts every other one over.
+ */
+static int dlp_card(ssh_dlp_stream_t *stream, const uint8_t *p, size_t len)
+{
+	const uint8_t *end = p + len;
+	uint32_t d = 0, single = 0;
+	int found = 0;
+
+	while(p < end) {
+		if(stream->digits == 0) {
+			// most of a file is not a digit
+			while(p < end && (uint8_t)(*p - '0') > 9) {
+				p++;
+			}
+			if(p == end) {
+				break;
+			}
+			stream->lead = *p - '0';
+			stream->luhn[0] = 0;
+			stream->luhn[1] = 0;
+		}
+		d = (uint8_t)(*p - '0');
+		if(d <= 9) {
+			single = (stream->luhn[1] + d) % 10;
+			stream->luhn[1] = (stream->luhn[0] + (d < 5 ? d * 2 : d * 2 - 9)) % 10;
+			stream->luhn[0] = single;
+			if(stream->digits <= DLP_CARD_MAX) {
+				stream->digits++;
+			}
+			stream->sep = 0;
+		} else if((*p == ' ' || *p == '-') && !stream->sep) {
+			stream->sep = 1;
+		} else {
+			found |= dlp_card_valid(stream);
+			stream->digits = 0;
+			stream->sep = 0;
+		}
+		p++;
+	}
+	return found;
+}
+
+// a rule stronger than the stream has seen, or -1
+static int dlp_found(ssh_dlp_stream_t *stream, int rule)
+{
+	if(rule < 0 || dlp_better(dlp, stream->rule, rule) == stream->rule) {
+		return -1;
+	}
+	stream->rule = rule;
+	return rule;
+}
+
+int ssh_dlp_scan(ssh_dlp_stream_t *stream, const void *data, size_t len)
+{
+	int rule = -1;
+
+	if(dlp == NULL || stream == NULL) {
+		return -1;
+	}
+	if(stream->gen != generation) {
+		// other rules, the automaton state means nothing to them
+		stream->gen = generation;
+		stream->state = 0;
+		stream->rule = -1;
+		stream->digits = 0;
+	}
+	rule = ssh_acm_feed(dlp->acm, &stream->state, -1, data, len);
+	if(rule >= 0) {
+		rule = dlp->literal[rule];
+	}
+	if(dlp->card >= 0 && dlp_card(stream, data, len)) {
+		rule = dlp_better(dlp, rule, dlp->card);
+	}
+	return dlp_found(stream, rule);
+}
+
+int ssh_dlp_finish(ssh_dlp_stream_t *stream)
+{
+	int rule = -1;
+
+	if(dlp == NULL || stream == NULL || stream->gen != generation) {
+		return -1;
+	}
+	if(dlp->card >= 0 && stream->digits > 0 && dlp_card_valid(stream)) {
+		rule = dlp->card;
+	}
+	stream->digits = 0;
+	return dlp_found(stream, rule);
+}
+
+int ssh_dlp_action(int rule)
+{
+	if(dlp == NULL || rule < 0 || rule >= dlp->count) {
+		return SSH_DLP_PASS;
+	}
+	return dlp->rules[rule].action;
+}
+
+const char *ssh_dlp_name(int rule)
+{
+	if(dlp == NULL || rule < 0 || rule >= dlp->count) {
+		return "";
+	}
+	return dlp->rules[rule].pattern != NULL ? dlp->rules[rule].pattern : "card";
+}
@@ -0,0 +1,209 @@
+// struct ucred
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "ssh-includes.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#include "ssh_handoff.h"
+
+#ifndef _WIN32
+// the directory of `path` is a real one of ours nobody else can enter,
+// `create` makes it when missing
+static int handoff_private_dir(const char *path, int create)
+{
+	char dir[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	const char *slash = strrchr(path, '/');
+	struct stat st;
+
+	if(slash == NULL || slash == path || (size_t)(slash - path) >= sizeof(dir)) {
+		return -1;
+	}
+	memcpy(dir, path, slash - path);
+	dir[slash - path] = '\0';
+	if(create && mkdir(dir, S_IRWXU) != 0 && errno != EEXIST) {
+		trace_err("handoff: %s: %s", dir, strerror(errno));
+		return -1;
+	}
+	if(lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode)
+		|| st.st_uid != geteuid() || (st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+		trace_err("handoff: %s: not a private directory", dir);
+		return -1;
+	}
+	return 0;
+}
+
+// the other end runs as this user or root
+static int handoff_peer_trusted(int sock)
+{
+	uid_t uid = (uid_t)-1;
+#ifdef SO_PEERCRED
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if(getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+		return 0;
+	}
+	uid = cred.uid;
+#else
+	gid_t gid;
+
+	if(getpeereid(sock, &uid, &gid) != 0) {
+		return 0;
+	}
+#endif
+	return uid == geteuid() || uid == 0;
+}
+
+static int handoff_address(const char *path, struct sockaddr_un *sun)
+{
+	memset(sun, 0x00, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(sun->sun_path)) {
+		return -1;
+	}
+	strcpy(sun->sun_path, path);
+	return 0;
+}
+
+int ssh_handoff_take(const char *path)
+{
+	struct sockaddr_un sun;
+	struct msghdr mh;
+	struct cmsghdr *cmsg = NULL;
+	struct iovec iov;
+	char byte = 0, control[CMSG_SPACE(sizeof(int))];
+	int sock = -1, fd = -1;
+
+	if(handoff_address(path, &sun) != 0 || handoff_private_dir(path, 0) != 0) {
+		return -1;
+	}
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(sock < 0) {
+		return -1;
+	}
+	if(connect(sock, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+		// nobody there, a fresh start
+		close(sock);
+		return -1;
+	}
+	if(!handoff_peer_trusted(sock)) {
+		trace_err("handoff: %s: served by another user", path);
+		close(sock);
+		return -1;
+	}
+	memset(&mh, 0x00, sizeof(mh));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control;
+	mh.msg_controllen = sizeof(control);
+	if(recvmsg(sock, &mh, 0) == 1) {
+		cmsg = CMSG_FIRSTHDR(&mh);
+		if(cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+	close(sock);
+	if(fd < 0) {
+		trace_err("handoff: %s: no listener received", path);
+	}
+	return fd;
+}
+
+int ssh_handoff_open(const char *path)
+{
+	struct sockaddr_un sun;
+	mode_t mask;
+	int sock = -1, rc = -1;
+
+	if(handoff_address(path, &sun) != 0) {
+		trace_err("handoff: %s: path too long", path);
+		return -1;
+	}
+	if(handoff_private_dir(path, 1) != 0) {
+		return -1;
+	}
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(sock < 0) {
+		return -1;
+	}
+	// a predecessor's, it has handed its listener over already
+	unlink(path);
+	// 0600 from the start, not after it can be reached
+	mask = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+	rc = bind(sock, (struct sockaddr *)&sun, sizeof(sun));
+	umask(mask);
+	if(rc != 0 || listen(sock, 1) != 0) {
+		trace_err("handoff: %s: %s", path, strerror(errno));
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+int ssh_handoff_give(int server, int fd)
+{
+	struct msghdr mh;
+	struct cmsghdr *cmsg = NULL;
+	struct iovec iov;
+	char byte = 'L', control[CMSG_SPACE(sizeof(int))];
+	int sock = -1, rc = -1;
+
+	sock = accept(server, NULL, NULL);
+	if(sock < 0) {
+		return -1;
+	}
+	if(!handoff_peer_trusted(sock)) {
+		trace_err("handoff: refused a peer of another user");
+		close(sock);
+		return -1;
+	}
+	memset(&mh, 0x00, sizeof(mh));
+	memset(control, 0x00, sizeof(control));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control;
+	mh.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	if(sendmsg(sock, &mh, 0) == 1) {
+		rc = 0;
+	} else {
+		trace_err("handoff: %s", strerror(errno));
+	}
+	close(sock);
+	return rc;
+}
+#else
+int ssh_handoff_take(const char *path)
+{
+	return -1;
+}
+
+int ssh_handoff_open(const char *path)
+{
+	return -1;
+}
+
+int ssh_handoff_give(int server, int fd)
+{
+	return -1;
+}
+#endif
@@ -0,0 +1,143 @@
+#include "ssh-includes.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "ssh_memstat.h"
+
+static uint64_t memstat_live = 0;
+static uint64_t memstat_total = 0;
+static uint64_t memstat_seq = 0;
+
+void ssh_memstat_session_open(void)
+{
+	memstat_live++;
+	memstat_total++;
+}
+
+void ssh_memstat_session_close(void)
+{
+	if(memstat_live > 0) {
+		memstat_live--;
+	}
+}
+
+void ssh_memstat_get(ssh_memstat_t *stat)
+{
+	FILE *fp = NULL;
+	unsigned long size = 0, resident = 0;
+
+	memset(stat, 0x00, sizeof(*stat));
+	stat->sessions_live = memstat_live;
+	stat->sessions_total = memstat_total;
+	stat->seq = memstat_seq;
+
+	fp = fopen("/proc/self/statm", "r");
+	if(fp != NULL) {
+		if(fscanf(fp, "%lu %lu", &size, &resident) == 2) {
+			stat->rss_kb = (uint64_t)resident * (sysconf(_SC_PAGESIZE) / 1024);
+		}
+		fclose(fp);
+	}
+#ifdef __GLIBC__
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33)
+	{
+		struct mallinfo2 mi = mallinfo2();
+		stat->heap_inuse = mi.uordblks + mi.hblkhd;
+		stat->heap_arena = mi.arena + mi.hblkhd;
+		stat->heap_free = mi.fordblks;
+	}
+#else
+	{
+		struct mallinfo mi = mallinfo();
+		/* the int fields wrap above 2GB, good enough for deltas */
+		stat->heap_inuse = (unsigned int)mi.uordblks + (unsigned int)mi.hblkhd;
+		stat->heap_arena = (unsigned int)mi.arena + (unsigned int)mi.hblkhd;
+		stat->heap_free = (unsigned int)mi.fordblks;
+	}
+#endif
+#endif
+}
+
+int ssh_memstat_dump(void)
+{
+	ssh_memstat_t stat;
+	char path[64], tmp[72];
+	FILE *fp = NULL;
+	int fd = -1;
+
+	memstat_seq++;
+	ssh_memstat_get(&stat);
+	snprintf(path, sizeof(path), SSH_MEMSTAT_FILE, (int)getpid());
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	/* a new file of ours only, never a link planted in /tmp */
+	unlink(tmp);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+	fp = fd != -1 ? fdopen(fd, "w") : NULL;
+	if(fp == NULL) {
+		trace_err("memstat: %s: %s", tmp, strerror(errno));
+		if(fd != -1) {
+			close(fd);
+		}
+		return -1;
+	}
+	fprintf(fp, "sessions_live %llu\n", (unsigned long long)stat.sessions_live);
+	fprintf(fp, "sessions_total %llu\n", (unsigned long long)stat.sessions_total);
+	fprintf(fp, "rss_kb %llu\n", (unsigned long long)stat.rss_kb);
+	fprintf(fp, "heap_inuse %llu\n", (unsigned long long)stat.heap_inuse);
+	fprintf(fp, "heap_arena %llu\n", (unsigned long long)stat.heap_arena);
+	fprintf(fp, "heap_free %llu\n", (unsigned long long)stat.heap_free);
+	fprintf(fp, "seq %llu\n", (unsigned long long)stat.seq);
+	fclose(fp);
+	/* readers never see a half written file */
+	if(rename(tmp, path) != 0) {
+		trace_err("memstat: %s: %s", path, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	do_info("memstat: sessions=%llu rss=%lluKB heap=%llu",
+		(unsigned long long)stat.sessions_live,
+		(unsigned long long)stat.rss_kb,
+		(unsigned long long)stat.heap_inuse);
+	return 0;
+}
+
+int ssh_memstat_load(pid_t pid, ssh_memstat_t *stat)
+{
+	char path[64], name[32];
+	unsigned long long value;
+	FILE *fp = NULL;
+
+	memset(stat, 0x00, sizeof(*stat));
+	snprintf(path, sizeof(path), SSH_MEMSTAT_FILE, (int)pid);
+	fp = fopen(path, "r");
+	if(fp == NULL) {
+		return -1;
+	}
+	while(fscanf(fp, "%31s %llu", name, &value) == 2) {
+		if(strcmp(name, "sessions_live") == 0) {
+			stat->sessions_live = value;
+		} else if(strcmp(name, "sessions_total") == 0) {
+			stat->sessions_total = value;
+		} else if(strcmp(name, "rss_kb") == 0) {
+			stat->rss_kb = value;
+		} else if(strcmp(name, "heap_inuse") == 0) {
+			stat->heap_inuse = value;
+		} else if(strcmp(name, "heap_arena") == 0) {
+			stat->heap_arena = value;
+		} else if(strcmp(name, "heap_free") == 0) {
+			stat->heap_free = value;
+		} else if(strcmp(name, "seq") == 0) {
+			stat->seq = value;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
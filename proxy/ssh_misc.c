@@ -4,6 +4,8 @@
 #include <string.h>
 
 #include <ssh/ssh-api.h>
+#include "api_capture.h"
+#include "api_cmdindex.h"
 #include "ssh_packet.h"
 
 
@@ -91,12 +93,67 @@ int knownhost_verify(ssh_session_t *session){
   return 0;
 }
 
-int sftp_file_open(const char *username, const char *longname)
+// no prompt: trust on first use, refuse a changed key
+int knownhost_pin(ssh_session_t *session)
 {
-	int fp = -1;
-	char *filename = ssh_basename(longname);
-	fp = api_sftpfile_open(username, filename);
-	SAFE_FREE(filename);
-	return fp;
+	int state = ssh_is_server_known(session);
+
+	switch(state) {
+	case SSH_SERVER_KNOWN_OK:
+		return 0;
+	case SSH_SERVER_FILE_NOT_FOUND:
+	case SSH_SERVER_NOT_KNOWN:
+		if(ssh_write_knownhost(session) < 0) {
+			trace_err("pin %s:%d: %s", session->sip, session->sport, ssh_get_error(session));
+			return -1;
+		}
+		do_info("pin %s:%d: host key pinned", session->sip, session->sport);
+		return 0;
+	case SSH_SERVER_KNOWN_CHANGED:
+	case SSH_SERVER_FOUND_OTHER:
+		do_error("pin %s:%d: host key changed", session->sip, session->sport);
+		return -1;
+	default:
+		trace_err("pin %s:%d: %s", session->sip, session->sport, ssh_get_error(session));
+		return -1;
+	}
+}
+
+int sftp_file_open(ssh_session_t *session, int direction, const char *longname)
+{
+	char id[128];
+
+	// as ssh_log() names the session
+	if(session->type == SSH_SESSION_CLIENT) {
+		snprintf(id, sizeof(id), "%s:%d->%s:%d", session->cip, session->cport, session->sip, session->sport);
+	} else {
+		snprintf(id, sizeof(id), "%s:%d->%s:%d", session->sip, session->sport, session->cip, session->cport);
+	}
+	return api_capture_open(id, session->username != NULL ? session->username : "", direction, longname);
+}
+
+void command_history_add(ssh_session_t *session, int kind, int action, const char *command)
+{
+	api_cmdindex_command_t c;
+	char id[128];
+
+	if(command == NULL || command[0] == '\0') {
+		return;
+	}
+	memset(&c, 0x00, sizeof(c));
+	if(session->type == SSH_SESSION_CLIENT) {
+		snprintf(id, sizeof(id), "%s:%d->%s:%d", session->cip, session->cport, session->sip, session->sport);
+		c.host = session->sip;
+	} else {
+		snprintf(id, sizeof(id), "%s:%d->%s:%d", session->sip, session->sport, session->cip, session->cport);
+		c.host = session->cip;
+	}
+	c.kind = kind;
+	c.action = action;
+	c.session = id;
+	c.user = session->username;
+	c.route = session->direct;
+	c.command = command;
+	api_cmdindex_add(&c);
 }
 
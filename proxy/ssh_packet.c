@@ -8,9 +8,20 @@
 
 #include "ssh/messages.h"
 #include "ssh/buffer.h"
+#include "ssh/misc.h"
 
 #include "ssh/sftp.h"
 
+#include "api_audit.h"
+#include "api_capture.h"
+#include "api_ttyrec.h"
+
+#include "ssh_cmdpolicy.h"
+#include "ssh_dlp.h"
+#include "ssh_policy.h"
+#include "ssh_route.h"
+#include "ssh_shaper.h"
+
 #define VS(x) #x
 
 #if 0
@@ -85,9 +96,9 @@ static ssh2_command_t ssh2_commands[] = {
                                                             // SSH2_MSG_KEX_DH_GEX_REQUEST_OLD     30
 {SSH2_MSG_KEXDH_REPLY,              VS(SSH2_MSG_KEXDH_REPLY),               ssh2cb_ignore},     // 31
                                                             // SSH2_MSG_KEX_DH_GEX_GROUP           31
-{0XFF,NULL,NULL},                                            // SSH2_MSG_KEX_DH_GEX_INIT           32
-{0XFF,NULL,NULL},                                            // SSH2_MSG_KEX_DH_GEX_REPLY          33
-{0XFF,NULL,NULL},                                            // SSH2_MSG_KEX_DH_GEX_REQUEST        34
+{SSH2_MSG_KEX_DH_GEX_INIT,          VS(SSH2_MSG_KEX_DH_GEX_INIT),           ssh2cb_ignore},     // 32
+{SSH2_MSG_KEX_DH_GEX_REPLY,         VS(SSH2_MSG_KEX_DH_GEX_REPLY),          ssh2cb_ignore},     // 33
+{SSH2_MSG_KEX_DH_GEX_REQUEST,       VS(SSH2_MSG_KEX_DH_GEX_REQUEST),        ssh2cb_ignore},     // 34
 {0XFF,NULL,NULL}, {0XFF,NULL,NULL}, {0XFF,NULL,NULL}, {0XFF,NULL,NULL}, {0XFF,NULL,NULL},       // 35-39
 {0XFF,NULL,NULL}, {0XFF,NULL,NULL}, {0XFF,NULL,NULL}, {0XFF,NULL,NULL}, {0XFF,NULL,NULL},       // 40-44
 {0XFF,NULL,NULL}, {0XFF,NULL,NULL}, {0XFF,NULL,NULL}, {0XFF,NULL,NULL}, {0XFF,NULL,NULL},       // 45-49
@@ -145,15 +156,100 @@ session_get_callback(uint8_t cmd)
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// file data about to be relayed, 1 if it must be held back, see ssh_dlp.h
+static int
+proxy_dlp_check(ssh_session_t *session, ssh_channel_t *channel, const char *filename,
+		const void *data, size_t len)
+{
+	int rule = -1;
+
+	if(channel->sftp.dlp == NULL) {
+		// NULL without rules
+		channel->sftp.dlp = ssh_dlp_open();
+		if(channel->sftp.dlp == NULL) {
+			return 0;
+		}
+	}
+	if(channel->sftp.dlp->blocked) {
+		return 1;
+	}
+	rule = ssh_dlp_scan(channel->sftp.dlp, data, len);
+	if(ssh_dlp_action(rule) == SSH_DLP_BLOCK) {
+		channel->sftp.dlp->blocked = 1;
+		ssh_log_event(session, API_AUDIT_DLP, "\"DLP: %s\", blocked by \"%s\"", filename ? filename : "", ssh_dlp_name(rule));
+	} else if(ssh_dlp_action(rule) == SSH_DLP_ALERT) {
+		ssh_log_event(session, API_AUDIT_DLP, "\"DLP: %s\", alert \"%s\"", filename ? filename : "", ssh_dlp_name(rule));
+	}
+	return channel->sftp.dlp->blocked;
+}
+
+// the file is done, the data is through already so it can only alert
+static void
+proxy_dlp_close(ssh_session_t *session, ssh_channel_t *channel, const char *filename)
+{
+	int rule = -1;
+
+	if(channel->sftp.dlp == NULL) {
+		return;
+	}
+	rule = ssh_dlp_finish(channel->sftp.dlp);
+	if(rule >= 0) {
+		ssh_log_event(session, API_AUDIT_DLP, "\"DLP: %s\", at the end \"%s\"", filename ? filename : "", ssh_dlp_name(rule));
+	}
+	SAFE_FREE(channel->sftp.dlp);
+}
+
+// the content of a transfer is captured under full inspection only
+static int
+proxy_capture_open(ssh_channel_t *channel, int direction, const char *filename)
+{
+	// no FXP_OPEN seen, the handle names no file
+	if(channel->inspect != SSH_INSPECT_FULL || filename == NULL) {
+		return -1;
+	}
+	return sftp_file_open(channel->session, direction, filename);
+}
+
+// data read on `channel`, its leg stops reading while the writer is behind
+static void
+proxy_capture_write(ssh_channel_t *channel, int file, const void *data, size_t len)
+{
+	if(api_capture_write(file, data, len) != 0) {
+		channel->session->capture_full = 1;
+	}
+}
+
+// answer request `id` in place of the server
+static void
+proxy_sftp_status(ssh_channel_t *to, uint32_t id, uint32_t code, const char *message)
+{
+	ssh_buffer_t *buf = ssh_buffer_new();
+	ssh_string_t *msg = ssh_string_from_char(message);
+	ssh_string_t *lang = ssh_string_from_char("");
+
+	if(buf != NULL && msg != NULL && lang != NULL
+		&& buffer_add_u32(buf, htonl(1 + 4 + 4 + 4 + strlen(message) + 4)) == 0
+		&& buffer_add_u8(buf, SSH_FXP_STATUS) == 0
+		&& buffer_add_u32(buf, htonl(id)) == 0
+		&& buffer_add_u32(buf, htonl(code)) == 0
+		&& buffer_add_ssh_string(buf, msg) == 0
+		&& buffer_add_ssh_string(buf, lang) == 0) {
+		channel_write_common(to, buffer_get_rest(buf), buffer_get_rest_len(buf), 0);
+	}
+	ssh_string_free(msg);
+	ssh_string_free(lang);
+	ssh_buffer_free(buf);
+}
+
 /**
  *
  * @see SSH File Transfer Protocol
  * @see http://tools.ietf.org/html/draft-ietf-secsh-filexfer-12
  */
 static int 
-sftp_data_process(ssh_session_t *session, ssh_buffer_t *packet)
+sftp_data_process(ssh_channel_t *channel, ssh_buffer_t *packet)
 {
-	ssh_session_t *peer = session->session_ptr;
+	ssh_channel_t *peer = channel->peer;
 	uint32_t plen = 0;
 	uint8_t  pcmd = 0;
 	uint32_t prequestId = 0;
@@ -165,7 +261,7 @@ sftp_data_process(ssh_session_t *session, ssh_buffer_t *packet)
 	prequestId = ntohl(prequestId);
 	processed += 4;
 
-	trace_out("sftp[%d]: command=%d, reqId=%d", session->sftp.expect_data, pcmd, prequestId);
+	trace_out("sftp[%d]: command=%d, reqId=%d", channel->sftp.expect_data, pcmd, prequestId);
 	
 	switch(pcmd)
 	{
@@ -173,24 +269,28 @@ sftp_data_process(ssh_session_t *session, ssh_buffer_t *packet)
 		break;
 	case SSH_FXP_VERSION://  2
 		{
-			session->sftp.version = prequestId;
-			trace_out("sftp> version: %d", session->sftp.version);
+			channel->sftp.version = prequestId;
+			trace_out("sftp> version: %d", channel->sftp.version);
 		}
 		break;
 	case SSH_FXP_OPEN://	 3
 		{
 			ssh_string_t *str = buffer_get_ssh_string(packet);
-			session->sftp.filename = ssh_string_to_char(str);
-			trace_out("sftp> open file = %s", session->sftp.filename);
+			SAFE_FREE(channel->sftp.filename);
+			channel->sftp.filename = ssh_string_to_char(str);
+			trace_out("sftp> open file = %s", channel->sftp.filename);
 			ssh_string_free(str);
 		}
 		break;
 	case SSH_FXP_CLOSE://	 4
 		{
-			ssh_session_t *s = session->sftp.file == -1 ? peer:session;
-			if(s->sftp.file != -1) {
-				close(s->sftp.file);
+			ssh_channel_t *s = channel->sftp.active ? channel : peer;
+			proxy_dlp_close(channel->session, channel, channel->sftp.filename);
+			proxy_dlp_close(peer->session, peer, channel->sftp.filename);
+			if(s->sftp.active) {
+				api_capture_close(s->sftp.file);
 				s->sftp.file = -1;
+				s->sftp.active = 0;
 				s->sftp.expect_data = 0;
 				trace_out("sftp> close file");
 			}
@@ -199,15 +299,16 @@ sftp_data_process(ssh_session_t *session, ssh_buffer_t *packet)
 	case SSH_FXP_READ://	 5
 		// http://tools.ietf.org/html/draft-ietf-secsh-filexfer-12#section-8.2.1
 		{
-			ssh_session_t *s = peer;
+			ssh_channel_t *s = peer;
 			int rc = 0;
 			ssh_string_t *str = NULL;
 			uint64_t offset = 0;
 			uint32_t length = 0;
 			// download, data from session to peer
-			if(s->sftp.file == -1) {
-				ssh_log(s, "sftp> download %s, length %llu", session->sftp.filename, s->sftp.fsize);
-				s->sftp.file = sftp_file_open(s->username, session->sftp.filename);
+			if(!s->sftp.active) {
+				ssh_log_event(s->session, API_AUDIT_TRANSFER, "sftp> download %s, length %llu", channel->sftp.filename, (unsigned long long)s->sftp.fsize);
+				s->sftp.active = 1;
+				s->sftp.file = proxy_capture_open(s, API_TRANSFER_DOWNLOAD, channel->sftp.filename);
 				//s->sftp.expect_data = 0;
 				//s->sftp.fsize = 0;
 				s->sftp.offset = 0;
@@ -231,14 +332,15 @@ sftp_data_process(ssh_session_t *session, ssh_buffer_t *packet)
 	case SSH_FXP_WRITE://	 6
 		{
 			// remaining ???
-			ssh_session_t *s = session;
+			ssh_channel_t *s = channel;
 			uint64_t tlen = 9, val = 0;
 			ssh_string_t *str = buffer_get_ssh_string(packet);
 			
 			// upload, data from session to peer
-			if(s->sftp.file == -1) {
-				ssh_log(s, "sftp> upload %s, length %llu", s->sftp.filename, s->sftp.fsize);
-				s->sftp.file = sftp_file_open(s->username, s->sftp.filename);
+			if(!s->sftp.active) {
+				ssh_log_event(s->session, API_AUDIT_TRANSFER, "sftp> upload %s, length %llu", s->sftp.filename, (unsigned long long)s->sftp.fsize);
+				s->sftp.active = 1;
+				s->sftp.file = proxy_capture_open(s, API_TRANSFER_UPLOAD, s->sftp.filename);
 				//peer->sftp.expect_data = 0;
 				//peer->sftp.fsize = 0;
 				s->sftp.offset = 0;
@@ -261,9 +363,17 @@ sftp_data_process(ssh_session_t *session, ssh_buffer_t *packet)
 			str = buffer_get_ssh_string(packet);
 			if(str != NULL) {
 				val = ssh_string_len(str);
-				write(s->sftp.file, ssh_string_data(str), val);
+				if(s->sftp.file != -1) {
+					proxy_capture_write(channel, s->sftp.file, ssh_string_data(str), val);
+				}
 				s->sftp.offset += val;
-				trace_out("sftp> expect %llu, offset %llu, write %llu bytes", session->sftp.expect_data, s->sftp.offset, val);
+				trace_out("sftp> expect %llu, offset %llu, write %llu bytes", channel->sftp.expect_data, s->sftp.offset, val);
+				if(proxy_dlp_check(s->session, s, s->sftp.filename, ssh_string_data(str), val)) {
+					// the server never sees it, the client is told
+					proxy_sftp_status(channel, prequestId, SSH_FX_FAILURE, "blocked by policy");
+					processed = -1;
+				}
+				ssh_string_free(str);
 			} else {
 				trace_out("str is NULL");
 				abort();
@@ -299,8 +409,8 @@ sftp_data_process(ssh_session_t *session, ssh_buffer_t *packet)
 	case SSH_FXP_DATA://	 103
 		{
 			uint64_t tlen = 9;
-			ssh_session_t *s = session;
-			if(s->sftp.file != -1) {
+			ssh_channel_t *s = channel;
+			if(s->sftp.active) {
 				ssh_string_t *str = NULL;
 				
 				str = buffer_get_ssh_string(packet);
@@ -312,9 +422,16 @@ sftp_data_process(ssh_session_t *session, ssh_buffer_t *packet)
 					if(s->sftp.fsize - s->sftp.offset < flen) {
 						flen = s->sftp.fsize - s->sftp.offset;
 					}
-					(void)write(s->sftp.file, fdata, flen);
+					if(s->sftp.file != -1) {
+						proxy_capture_write(channel, s->sftp.file, fdata, flen);
+					}
 					s->sftp.offset += flen;
 					trace_out("sftp> expect %llu, offset %llu, write %llu bytes", s->sftp.expect_data, s->sftp.offset, flen);
+					if(proxy_dlp_check(peer->session, s, peer->sftp.filename, fdata, ssh_string_len(str))) {
+						// the client gets a failure for the read instead
+						proxy_sftp_status(peer, prequestId, SSH_FX_FAILURE, "blocked by policy");
+						processed = -1;
+					}
 				} else {
 					trace_out("str - 2 is NULL");
 					abort();
@@ -337,10 +454,12 @@ sftp_data_process(ssh_session_t *session, ssh_buffer_t *packet)
 				buffer_get_u64(packet, &flen);
 				flen = ntohll(flen);
 				trace_out("sftp> file length = %llu", flen);
-				session->sftp.fsize = flen;
-				session->sftp.offset = 0;
-				if(session->sftp.file == -1 && peer->sftp.file != -1) {
-					session->sftp.file = peer->sftp.file;
+				channel->sftp.fsize = flen;
+				channel->sftp.offset = 0;
+				if(!channel->sftp.active && peer->sftp.active) {
+					channel->sftp.active = 1;
+					channel->sftp.file = peer->sftp.file;
+					peer->sftp.active = 0;
 					peer->sftp.file = -1;
 					peer->sftp.fsize = 0;
 					peer->sftp.offset = 0;
@@ -358,6 +477,179 @@ sftp_data_process(ssh_session_t *session, ssh_buffer_t *packet)
 	return processed;
 }
 
+// the shell line typed so far against the command rules, see ssh_cmdpolicy.h
+static void
+proxy_shell_rescan(ssh_channel_t *channel)
+{
+	channel->cmdstate = 0;
+	channel->cmdgen = ssh_cmdpolicy_generation();
+	channel->cmdrule = ssh_cmdpolicy_feed(&channel->cmdstate, -1, channel->bash, strlen(channel->bash));
+	// the bytes past bash are gone, without them bash is the whole line
+	channel->cmdlost = channel->cmdover > 0;
+}
+
+// a new line
+static void
+proxy_shell_reset(ssh_channel_t *channel)
+{
+	memset(channel->bash, 0x00, sizeof(channel->bash));
+	channel->cmdover = 0;
+	proxy_shell_rescan(channel);
+}
+
+// client keystrokes, each line is checked before its Enter is passed on
+static void
+proxy_shell_input(ssh_session_t *session, ssh_channel_t *channel,
+		const char *buf, uint32_t len, int is_stderr)
+{
+	static const char notice[] = "\r\n*** command blocked by policy ***\r\n";
+	ssh_channel_t *peer = channel->peer;
+	uint32_t i = 0, start = 0;
+	size_t n = 0;
+	int rule = -1, lost = 0;
+	char ch = 0;
+
+	if(channel->cmdgen != ssh_cmdpolicy_generation()) {
+		proxy_shell_rescan(channel);
+	}
+	n = strlen(channel->bash);
+	for(i = 0; i < len; i++) {
+		ch = buf[i];
+		if(ssh_cmdpolicy_enter(ch, n > 0 || channel->cmdover > 0)) {
+			// enter
+			rule = channel->cmdrule;
+			lost = channel->cmdlost && ssh_cmdpolicy_count() > 0;
+			if(lost || ssh_cmdpolicy_action(rule) == SSH_CMDPOLICY_BLOCK) {
+				// withhold the Enter, the shell drops the line on Ctrl-C
+				channel_write_common(peer, buf + start, i - start, is_stderr);
+				channel_write_common(peer, "\003", 1, is_stderr);
+				channel_write_common(channel, notice, sizeof(notice) - 1, 0);
+				start = i + 1;
+				ssh_log_event(session, API_AUDIT_SHELL, "\"SHELL: %s\", blocked by \"%s\"", channel->bash,
+					lost ? "line too long to check" : ssh_cmdpolicy_pattern(rule));
+			} else if(ssh_cmdpolicy_action(rule) == SSH_CMDPOLICY_ALERT) {
+				ssh_log_event(session, API_AUDIT_SHELL, "\"SHELL: %s\", alert \"%s\"", channel->bash, ssh_cmdpolicy_pattern(rule));
+			} else {
+				ssh_log_event(session, API_AUDIT_SHELL, "\"SHELL: %s\"", channel->bash);
+			}
+			command_history_add(session, API_AUDIT_SHELL, lost ? SSH_CMDPOLICY_BLOCK : ssh_cmdpolicy_action(rule), channel->bash);
+			n = 0;
+			proxy_shell_reset(channel);
+		} else if(ch == 0x08 || ch == 0x7f) {
+			// backspace, the automaton cannot step back
+			if(channel->cmdover > 0) {
+				channel->cmdover--;
+				proxy_shell_rescan(channel);
+			} else if(n > 0) {
+				channel->bash[--n] = 0x00;
+				proxy_shell_rescan(channel);
+			}
+		} else if(ch == 0x03 || ch == 0x15) {
+			// Ctrl-C, Ctrl-U, the shell drops the line
+			n = 0;
+			proxy_shell_reset(channel);
+		} else {
+			// every byte is scanned, only the first ones are kept for the log
+			if(n + 1 < sizeof(channel->bash)) {
+				channel->bash[n++] = ch;
+			} else {
+				channel->cmdover++;
+			}
+			channel->cmdrule = ssh_cmdpolicy_feed(&channel->cmdstate, channel->cmdrule, &ch, 1);
+		}
+	}
+	if(start < len) {
+		channel_write_common(peer, buf + start, len - start, is_stderr);
+	}
+}
+
+// scp file data, 1 if it must be held back
+static int
+proxy_scp_held(ssh_session_t *session, ssh_channel_t *channel, const void *data, uint32_t len)
+{
+	static const char notice[] = "scp: blocked by policy\r\n";
+	ssh_channel_t *client = session->type == SSH_SESSION_CLIENT ? channel : channel->peer;
+	uint64_t flen = len;
+
+	if(channel->sftp.dlp != NULL && channel->sftp.dlp->blocked) {
+		return 1;
+	}
+	if(channel->subsystem == NULL || strcmp(channel->subsystem, "scp") != 0
+		|| channel->sftp.pstate != 3 || !channel->sftp.active) {
+		return 0;
+	}
+	if(flen > channel->sftp.fsize - channel->sftp.offset) {
+		// the rest is the end of file mark
+		flen = channel->sftp.fsize - channel->sftp.offset;
+	}
+	if(!proxy_dlp_check(session, channel, channel->sftp.filename, data, flen)) {
+		return 0;
+	}
+	// scp cannot skip a file, the receiving end is closed and takes the sender along
+	channel_write_common(client, notice, sizeof(notice) - 1, 1);
+	ssh_channel_close(channel->peer);
+	return 1;
+}
+
+// sftp packets are relayed whole once they have been looked at
+static void
+proxy_sftp_input(ssh_channel_t *channel, const char *data, uint32_t len, int is_stderr)
+{
+	ssh_channel_t *peer = channel->peer;
+	ssh_buffer_t *in = channel->sftp.in_buffer;
+	ssh_buffer_t *packet = NULL;
+	uint32_t have = 0, want = 0, plen = 0, processed = 0;
+
+	while(processed < len) {
+		if(channel->sftp.skip > 0) {
+			want = channel->sftp.skip < len - processed ? (uint32_t)channel->sftp.skip : len - processed;
+			channel_write_common(peer, data + processed, want, is_stderr);
+			channel->sftp.skip -= want;
+			processed += want;
+			continue;
+		}
+		have = buffer_get_rest_len(in);
+		if(have >= 4) {
+			memcpy(&plen, buffer_get_rest(in), 4);
+			plen = ntohl(plen);
+			if(plen > SFTP_PACKET_MAX) {
+				// this one is relayed unread, the next is parsed again
+				trace_err("sftp> packet of %u bytes, relayed unread", plen);
+				channel_write_common(peer, buffer_get_rest(in), have, is_stderr);
+				channel->sftp.skip = (uint64_t)4 + plen - have;
+				buffer_reinit(in);
+				continue;
+			}
+			want = 4 + plen - have;
+		} else {
+			want = 4 - have;
+		}
+		if(want > len - processed) {
+			want = len - processed;
+		}
+		buffer_add_data(in, (char *)data + processed, want);
+		processed += want;
+		have += want;
+		if(have < 4) {
+			break;
+		}
+		memcpy(&plen, buffer_get_rest(in), 4);
+		plen = ntohl(plen);
+		if(have < 4 + plen) {
+			// the length alone, or a part of the rest
+			continue;
+		}
+		packet = ssh_buffer_new();
+		buffer_add_data(packet, (char *)buffer_get_rest(in) + 4, have - 4);
+		trace_out("sftp> packet %u bytes", have);
+		if(sftp_data_process(channel, packet) >= 0) {
+			channel_write_common(peer, buffer_get_rest(in), have, is_stderr);
+		}
+		ssh_buffer_free(packet);
+		buffer_reinit(in);
+	}
+}
+
 /**
  * @brief SSH channel data callback. Called when data is available on a channel
  * @param session Current session handler
@@ -374,18 +666,42 @@ proxy_channel_data_handler(ssh_session_t *session, ssh_channel_t *channel,
 		void *data, uint32_t receivedlen, int is_stderr, void *userdata)
 {
 	int iRet = 1; // denied
-	ssh_session_t *peer = (ssh_session_t *)session->session_ptr;
-	int processed = 0;
+	ssh_channel_t *peer = channel->peer;
 	
 	trace_out("channel->subsystem = [%s]................................BEGIN", channel->subsystem);
-	trace_out("[%llu]from: %s, to: %s", receivedlen, SESSION_TYPE(session), SESSION_TYPE(peer));
-	channel_write_common(peer->chan, data, receivedlen, is_stderr);
+	if(peer == NULL) {
+		// the other leg is already closed, drop it
+		trace_out("channel %d: no peer, drop %u bytes", channel->local_channel, receivedlen);
+		return receivedlen;
+	}
+	trace_out("[%llu]from: %s:%d, to: %s:%d", receivedlen, SESSION_TYPE(session), channel->local_channel,
+		SESSION_TYPE(peer->session), peer->local_channel);
+	if(session->type == SSH_SESSION_CLIENT &&
+		(channel->type == SSH_CHANNEL_REQUEST_SHELL || channel->type == SSH_CHANNEL_REQUEST_PTY)) {
+		// forwarded by the line checks
+		proxy_shell_input(session, channel, data, receivedlen, is_stderr);
+		goto end;
+	}
+	if(channel->type == SSH_CHANNEL_REQUEST_SUBSYSTEM
+		&& channel->subsystem != NULL && !strcmp(channel->subsystem, "sftp")) {
+		// forwarded packet by packet
+		proxy_sftp_input(channel, data, receivedlen, is_stderr);
+		goto end;
+	}
+	if(channel->type == SSH_CHANNEL_REQUEST_EXEC && proxy_scp_held(session, channel, data, receivedlen)) {
+		goto end;
+	}
+	if(channel->tty != NULL) {
+		// server output of a pty
+		api_ttyrec_output(channel->tty, data, receivedlen);
+	}
+	channel_write_common(peer, data, receivedlen, is_stderr);
 
 	if(channel->type == SSH_CHANNEL_REQUEST_EXEC)
 	{
 		// scp
 		char *buf = (char *)data;
-		ssh_session_t *from = NULL, *to;
+		ssh_channel_t *from = NULL, *to;
 		#if 1
 		char temp[50];
 		uint32_t tlen = receivedlen;
@@ -397,15 +713,15 @@ proxy_channel_data_handler(ssh_session_t *session, ssh_channel_t *channel,
 		strncpy(temp, buf, tlen);
 		trace_out("exec data=[%s]", temp);
 		#endif
-		if(session->sftp.expect_data) {
-			from = session;
+		if(channel->sftp.expect_data) {
+			from = channel;
 			to = peer;
 		} else {
 			from = peer;
-			to = session;
+			to = channel;
 		}
-		trace_out("scp> state %d.", session->sftp.pstate);
-		switch(session->sftp.pstate)
+		trace_out("scp> state %d.", channel->sftp.pstate);
+		switch(channel->sftp.pstate)
 		{
 		case 0:
 			if(receivedlen == 1 && buf[0] == 0x00) {
@@ -424,14 +740,18 @@ proxy_channel_data_handler(ssh_session_t *session, ssh_channel_t *channel,
 				memset(fname, 0x00, sizeof(fname));
 				rc = sscanf(buf, "%s %d %[^\r\n][\r\n]", fattr, &fsize, fname);
 				if(rc != 3) {
-					ssh_log(session, "scp> parse %s failed.", buf);
+					ssh_log_event(session, API_AUDIT_TRANSFER, "scp> parse %s failed.", buf);
 				} else {
-					ssh_log(session, "scp> %s file %s, length %d.", 
-						session->sftp.expect_data ? "upload":"download",
+					ssh_log_event(session, API_AUDIT_TRANSFER, "scp> %s file %s, length %d.", 
+						channel->sftp.expect_data ? "upload":"download",
 						fname, fsize);
-					session->sftp.file = sftp_file_open(session->username, fname);
-					session->sftp.fsize = fsize;
-					session->sftp.offset = 0;
+					channel->sftp.active = 1;
+					channel->sftp.file = proxy_capture_open(channel,
+						channel->sftp.expect_data ? API_TRANSFER_UPLOAD : API_TRANSFER_DOWNLOAD, fname);
+					SAFE_FREE(channel->sftp.filename);
+					channel->sftp.filename = strdup(fname);
+					channel->sftp.fsize = fsize;
+					channel->sftp.offset = 0;
 				}
 				peer->sftp.pstate = 2;
 			}
@@ -444,95 +764,27 @@ proxy_channel_data_handler(ssh_session_t *session, ssh_channel_t *channel,
 			break;
 		case 3:
 			{
-				if(session->sftp.file != -1 && session->sftp.offset < session->sftp.fsize) {
+				if(channel->sftp.active && channel->sftp.offset < channel->sftp.fsize) {
 					uint32_t wlen = receivedlen;
-					if(session->sftp.offset + wlen >= session->sftp.fsize) {
-						wlen = session->sftp.fsize - session->sftp.offset;
+					if(channel->sftp.offset + wlen >= channel->sftp.fsize) {
+						wlen = channel->sftp.fsize - channel->sftp.offset;
+					}
+					if(channel->sftp.file != -1) {
+						proxy_capture_write(channel, channel->sftp.file, data, wlen);
 					}
-					session->sftp.offset += write(session->sftp.file, data, wlen);
+					channel->sftp.offset += wlen;
 				}
-				if(session->sftp.offset >= session->sftp.fsize){
-					close(session->sftp.file);
-					session->sftp.file = -1;
+				if(channel->sftp.active && channel->sftp.offset >= channel->sftp.fsize){
+					api_capture_close(channel->sftp.file);
+					channel->sftp.file = -1;
+					channel->sftp.active = 0;
+					proxy_dlp_close(session, channel, channel->sftp.filename);
 				}
 			}
 			break;
 		default:
 			break;
 		}
-	} else if(channel->type == SSH_CHANNEL_REQUEST_SUBSYSTEM
-			&& channel->subsystem != NULL && !strcmp(channel->subsystem, "sftp"))
-	{
-		// sftp process...
-		int pLen = 0, rc = 0, remaining = 0;
-		ssh_buffer_t *packet = NULL;
-		do{
-			//
-			trace_out("recv %llu, process %llu, state = %d", receivedlen, processed, session->sftp.pstate);
-			switch(session->sftp.pstate)
-			{
-			case PACKET_STATE_INIT:
-				buffer_reinit(session->sftp.in_buffer);
-				session->sftp.expect_data = 0;
-				if(receivedlen - processed < 4) {
-					buffer_add_data(session->sftp.in_buffer, (char *)data + processed, receivedlen - processed);
-					processed += receivedlen - processed;
-					session->sftp.pstate = PACKET_STATE_INIT_SIZEREAD;
-					goto end;
-				}
-			case PACKET_STATE_INIT_SIZEREAD:
-				memcpy((void *)&pLen, data + processed, 4);
-				pLen = ntohl(pLen);
-				processed += 4;
-				session->sftp.expect_data = pLen;
-				session->sftp.pstate = PACKET_STATE_SIZEREAD;
-			case PACKET_STATE_SIZEREAD:
-				remaining = buffer_get_rest_len(session->sftp.in_buffer);
-				pLen = session->sftp.expect_data;
-				if(receivedlen - processed  + remaining < pLen) {
-					buffer_add_data(session->sftp.in_buffer, (char *)data + processed, receivedlen - processed);
-					processed += receivedlen - processed;
-					goto end;
-				}
-				packet = ssh_buffer_new();
-				buffer_add_buffer(packet, session->sftp.in_buffer);
-				buffer_add_data(packet, (char *)data + processed, pLen - remaining);
-				processed += pLen - remaining;
-				rc = sftp_data_process(session, packet);
-				ssh_buffer_free(packet);
-				session->sftp.pstate = PACKET_STATE_INIT;
-				break;
-			}
-			//
-		}while(receivedlen > processed);
-		packet = NULL;
-	} else if(session->type == SSH_SESSION_CLIENT && 
-			(channel->type == SSH_CHANNEL_REQUEST_SHELL || 
-			 channel->type == SSH_CHANNEL_REQUEST_PTY))
-	{
-		char *buf = (char *)data;
-		int cmd_len = strlen(session->bash);
-		uint8_t ch = '0';
-		uint32_t i = 0;
-		char temp[1024];
-		
-		memset(temp, 0x00, sizeof(temp));
-		strncpy(temp, buf, sizeof(temp) - 1);
-		trace_out("data=[%s]", temp);
-		for(i = 0; i < receivedlen; i++) {
-			ch = buf[i];
-			trace_out("ch = %02x", ch);
-			if(ch == '\r') {
-				// enter
-				ssh_log(session, "\"SHELL: %s\"", session->bash);
-				memset(session->bash, 0x00, sizeof(session->bash));
-			} else if(ch == 0x08) {
-				// backspace
-				session->bash[strlen(session->bash)] = 0x00;
-			} else if(strlen(session->bash) + 1 < sizeof(session->bash)){
-				session->bash[cmd_len + i] = ch;
-			}
-		}
 	}
 end:
 	// must return len
@@ -541,6 +793,56 @@ end:
 	return iRet;
 }
 
+// class of the session from its channels, see ssh_packet.h
+static void
+proxy_session_schedule(ssh_session_t *session)
+{
+	ssh_session_t *cli = session->type == SSH_SESSION_CLIENT ? session : session->session_ptr;
+	ssh_iterator_t *it = NULL;
+	ssh_channel_t *channel = NULL;
+	int interactive = 0, bulk = 0, sched = SSH_SCHED_INTERACTIVE;
+
+	if(cli == NULL) {
+		return;
+	}
+	for(it = ssh_list_get_iterator(cli->channels); it != NULL; it = it->next) {
+		channel = ssh_iterator_value(ssh_channel_t *, it);
+		interactive += channel->sched == SSH_SCHED_INTERACTIVE;
+		bulk += channel->sched == SSH_SCHED_BULK;
+	}
+	if(interactive > 0 && bulk > 0) {
+		sched = SSH_SCHED_MIXED;
+	} else if(bulk > 0) {
+		sched = SSH_SCHED_BULK;
+	}
+	if(sched != cli->sched) {
+		trace_out("sched: %d -> %d", cli->sched, sched);
+		cli->sched = sched;
+		if(cli->sched_update != NULL) {
+			cli->sched_update(cli);
+		}
+	}
+}
+
+// a pty makes a channel interactive for good, whatever runs in it
+static void
+proxy_channel_schedule(ssh_channel_t *channel, int type)
+{
+	int sched = channel->sched;
+
+	if(type == SSH_CHANNEL_REQUEST_PTY || type == SSH_CHANNEL_REQUEST_SHELL) {
+		sched = SSH_SCHED_INTERACTIVE;
+	} else if((type == SSH_CHANNEL_REQUEST_EXEC || type == SSH_CHANNEL_REQUEST_SUBSYSTEM)
+		&& sched != SSH_SCHED_INTERACTIVE) {
+		sched = SSH_SCHED_BULK;
+	}
+	channel->sched = sched;
+	if(channel->peer != NULL) {
+		channel->peer->sched = sched;
+	}
+	proxy_session_schedule(channel->session);
+}
+
 /**
  * @brief SSH channel eof callback. Called when a channel receives EOF
  * @param session Current session handler
@@ -550,8 +852,11 @@ end:
 static void
 proxy_request_eof(ssh_session_t *session, ssh_channel_t *channel, void *userdata)
 {
-	ssh_session_t *peer = session->session_ptr;
-	ssh_channel_send_eof(peer->chan);
+	(void)session;
+	(void)userdata;
+	if(channel->peer != NULL) {
+		ssh_channel_send_eof(channel->peer);
+	}
 }
 
 /**
@@ -566,11 +871,29 @@ proxy_request_close(ssh_session_t *session, ssh_channel_t *channel, void *userda
 	//(void)session;
 	//(void)channel;
 	//(void)userdata;
-	ssh_session_t *peer = session->session_ptr;
+	ssh_channel_t *peer = channel->peer;
 	
-	ssh_log(session, "CLOSE");
-	ssh_channel_close(peer->chan);
-	ssh_channel_close(channel);
+	if(peer == NULL) {
+		// closed from the other leg already
+		return;
+	}
+	ssh_log_event(session, API_AUDIT_CHANNEL, "CLOSE channel %d", channel->local_channel);
+	peer->peer = NULL;
+	channel->peer = NULL;
+	// both stay listed until libssh releases them
+	peer->sched = SSH_SCHED_NONE;
+	channel->sched = SSH_SCHED_NONE;
+	proxy_session_schedule(session);
+	// either may have been closed by the proxy itself
+	if(peer->state != SSH_CHANNEL_STATE_CLOSED) {
+		ssh_channel_close(peer);
+	}
+	ssh_channel_free(peer);
+	if(channel->state != SSH_CHANNEL_STATE_CLOSED) {
+		ssh_channel_close(channel);
+	}
+	// released by libssh once this callback returns
+	ssh_channel_free(channel);
 }
 
 #ifdef _WIN32
@@ -587,9 +910,8 @@ static struct ssh_channel_callbacks_struct channel_cb = {
 #endif
 
 static void
-proxy_channel_set_callback(ssh_session_t *session, void *userdata)
+proxy_channel_set_callback(ssh_channel_t *channel, void *userdata)
 {
-    (void) session;
     (void) userdata;
 #ifdef _WIN32
 	channel_cb.channel_eof_function = proxy_request_eof;
@@ -600,7 +922,80 @@ proxy_channel_set_callback(ssh_session_t *session, void *userdata)
 	//channel_cb.channel_shell_request_function = request_shell;
 #endif
     ssh_callbacks_init(&channel_cb);
-    ssh_set_channel_callbacks(session->chan, &channel_cb);
+    ssh_set_channel_callbacks(channel, &channel_cb);
+}
+
+/**
+ * @brief Data callback of forwarded channels (direct-tcpip, forwarded-tcpip).
+ * Nothing is audited on them, the data is handed to the paired channel as is.
+ */
+static int
+proxy_forward_data_handler(ssh_session_t *session, ssh_channel_t *channel,
+		void *data, uint32_t receivedlen, int is_stderr, void *userdata)
+{
+	(void)session;
+	(void)userdata;
+	if(channel->peer != NULL) {
+		channel_write_common(channel->peer, data, receivedlen, is_stderr);
+	}
+	return receivedlen;
+}
+
+#ifdef _WIN32
+static struct ssh_channel_callbacks_struct forward_cb;
+#else
+static struct ssh_channel_callbacks_struct forward_cb = {
+	.channel_eof_function = proxy_request_eof,
+	.channel_close_function = proxy_request_close,
+	.channel_data_function = proxy_forward_data_handler,
+};
+#endif
+
+static void
+proxy_forward_set_callback(ssh_channel_t *channel)
+{
+#ifdef _WIN32
+	forward_cb.channel_eof_function = proxy_request_eof;
+	forward_cb.channel_close_function = proxy_request_close;
+	forward_cb.channel_data_function = proxy_forward_data_handler;
+#endif
+	ssh_callbacks_init(&forward_cb);
+	ssh_set_channel_callbacks(channel, &forward_cb);
+}
+
+static proxy_forward_policy forward_policy = NULL;
+static void *forward_policy_data = NULL;
+
+void proxy_forward_set_policy(proxy_forward_policy fn, void *userdata)
+{
+	forward_policy = fn;
+	forward_policy_data = userdata;
+}
+
+// ask the policy hook and log the forwarding on the client session
+static int
+proxy_forward_denied(ssh_session_t *session, ssh_message_t *msg)
+{
+	int denied = 0;
+
+	if(forward_policy != NULL) {
+		denied = forward_policy(session, msg, forward_policy_data) != 0;
+	}
+	if(msg->type == SSH_REQUEST_GLOBAL) {
+		ssh_log_event(session, API_AUDIT_FORWARD, "\"FORWARD: %s %s:%d\"%s",
+			msg->global_request.type == SSH_GLOBAL_REQUEST_TCPIP_FORWARD ?
+				"tcpip-forward" : "cancel-tcpip-forward",
+			msg->global_request.bind_address ? msg->global_request.bind_address : "",
+			msg->global_request.bind_port, denied ? ", denied" : "");
+	} else {
+		ssh_log_event(session, API_AUDIT_FORWARD, "\"FORWARD: %s %s:%d from %s:%d\"%s",
+			msg->channel_request_open.type == SSH_CHANNEL_DIRECT_TCPIP ?
+				"direct-tcpip" : "forwarded-tcpip",
+			msg->channel_request_open.destination, msg->channel_request_open.destination_port,
+			msg->channel_request_open.originator, msg->channel_request_open.originator_port,
+			denied ? ", denied" : "");
+	}
+	return denied;
 }
 
 /**
@@ -739,6 +1134,8 @@ proxy_userauth_request_password(ssh_session_t * session,
 	}
 	session->username = strdup(username);
 	peer->username = strdup(username);
+	ssh_log_reset(session);
+	ssh_log_reset(peer);
 #ifdef WITH_SSH1
     if (session->version == 1) {
         rc = ssh_userauth1_password(session, username, password);
@@ -817,7 +1214,9 @@ proxy_userauth_request_password(ssh_session_t * session,
         return SSH_AUTH_ERROR;
     }
 	rc = SSH_OK;
-	ssh_log(session, "\"SSH2_MSG_USERAUTH_REQUEST(50)\", password=\"%s\"", password);
+	// the method only, the password itself goes to no log
+	ssh_log_event(session, API_AUDIT_AUTH, "\"SSH2_MSG_USERAUTH_REQUEST(50)\", method=password, length=%zu",
+		password != NULL ? strlen(password) : (size_t)0);
     return rc;
 fail:
     ssh_set_error_oom(session);
@@ -907,17 +1306,178 @@ end:
   return err;
 }
 
-/*
+// message forwarded to the other leg, answered when the reply comes back.
+// Replies come in order, per channel for channel messages and per session
+// for global requests.
+static void
+proxy_pending_push(ssh_list_t **queue, ssh_message_t *msg)
+{
+	if(*queue == NULL) {
+		*queue = ssh_list_new();
+	}
+	if(*queue == NULL || ssh_list_append(*queue, msg) < 0) {
+		ssh_message_reply_default(msg);
+		ssh_message_free(msg);
+	}
+}
+
+static ssh_message_t *
+proxy_pending_pop(ssh_list_t *queue)
+{
+	if(queue == NULL) {
+		return NULL;
+	}
+	return ssh_list_pop_head(ssh_message_t *, queue);
+}
+
+// `channel` opened by the proxy was confirmed, accept the open message
+// waiting on it with a new channel on the leg the message came from
+static void
+proxy_channel_open_confirm(ssh_channel_t *channel)
+{
+	ssh_message_t *reply = NULL;
+	ssh_channel_t *peer = NULL;
+
+	if(channel == NULL || (reply = proxy_pending_pop(channel->pending)) == NULL) {
+		return;
+	}
+	peer = ssh_channel_new(reply->session);
+	if(peer == NULL) {
+		ssh_message_reply_default(reply);
+		ssh_message_free(reply);
+		ssh_channel_close(channel);
+		ssh_channel_free(channel);
+		return;
+	}
+	//ssh_message_channel_request_open_reply_accept(reply);
+	ssh_message_channel_request_open_reply_accept_channel(reply, peer);
+	channel->peer = peer;
+	peer->peer = channel;
+	trace_out("channel %d <-> %d", peer->local_channel, channel->local_channel);
+	if(reply->channel_request_open.type == SSH_CHANNEL_SESSION) {
+		proxy_channel_set_callback(channel, NULL);
+		proxy_channel_set_callback(peer, NULL);
+	} else {
+		// fast path, no inspection
+		proxy_forward_set_callback(channel);
+		proxy_forward_set_callback(peer);
+		channel->sched = SSH_SCHED_BULK;
+		peer->sched = SSH_SCHED_BULK;
+		proxy_session_schedule(channel->session);
+	}
+	ssh_message_free(reply);
+}
+
+static void
+proxy_channel_open_failure(ssh_channel_t *channel)
+{
+	ssh_message_t *reply = NULL;
+
+	if(channel == NULL) {
+		return;
+	}
+	reply = proxy_pending_pop(channel->pending);
+	if(reply != NULL) {
+		ssh_message_reply_default(reply);
+		ssh_message_free(reply);
+	}
+	ssh_channel_free(channel);
+}
+
 // server->proxy, proxy forward, session MUST is SSH_SESSION_SERVER
-static int proxy_response(ssh_session_t *session)
+static int
+proxy_response(ssh_session_t *session, ssh_message_t *msg)
 {
-	int rc = SSH_ERROR;
+	ssh_session_t *cli = session->session_ptr;
+	ssh_channel_t *channel = NULL;
 
-	rc = SSH_OK;
-	
-	return rc;
+	trace_out("server message.type = %d.%d", msg->type, ssh_message_subtype(msg));
+	if(msg->type == SSH_REQUEST_CHANNEL_OPEN
+		&& msg->channel_request_open.type == SSH_CHANNEL_FORWARDED_TCPIP
+		&& !proxy_forward_denied(cli, msg)) {
+		// remote forward, open it towards the client
+		channel = ssh_channel_new(cli);
+		if(channel != NULL) {
+			ssh_channel_open_reverse_forward(channel,
+				msg->channel_request_open.destination, msg->channel_request_open.destination_port,
+				msg->channel_request_open.originator, msg->channel_request_open.originator_port);
+			if(channel->state == SSH_CHANNEL_STATE_OPENING) {
+				proxy_pending_push(&channel->pending, msg);
+				return SSH_OK;
+			}
+			ssh_channel_free(channel);
+		}
+	}
+	ssh_message_reply_default(msg);
+	ssh_message_free(msg);
+	return SSH_AGAIN;
+}
+
+// decide once per channel how much of it is inspected, see ssh_policy.h
+static void
+proxy_channel_inspect(ssh_session_t *session, ssh_channel_t *channel,
+		const char *kind, const char *detail)
+{
+	ssh_session_t *srv = session->session_ptr;
+	int level = ssh_policy_inspect(session->username, srv->sip, srv->sport, kind);
+
+	channel->inspect = level;
+	if(channel->peer != NULL) {
+		channel->peer->inspect = level;
+	}
+	if(level != SSH_INSPECT_FULL) {
+		// no recording, metadata keeps the parsing without the captures
+		api_ttyrec_close(channel->tty);
+		channel->tty = NULL;
+	}
+	if(level == SSH_INSPECT_NONE) {
+		// straight relay, no sftp/scp/shell parsing
+		proxy_forward_set_callback(channel);
+		if(channel->peer != NULL) {
+			proxy_forward_set_callback(channel->peer);
+		}
+	}
+	if(level != SSH_INSPECT_NONE) {
+		ssh_log_event(session, API_AUDIT_CHANNEL, "\"%s: %s\", inspect=%s", kind, detail ? detail : "", ssh_inspect_name(level));
+	}
+}
+
+// the pty as the client sees it, for review, see api_ttyrec.h
+static void
+proxy_tty_record(ssh_session_t *session, ssh_channel_t *channel, ssh_message_t *msg)
+{
+	char name[128];
+
+	if(channel->tty != NULL) {
+		return;
+	}
+	snprintf(name, sizeof(name), "%s_%d_%u.tty", session->cip, session->cport, channel->local_channel);
+	channel->tty = api_ttyrec_open(session->username != NULL ? session->username : "", name,
+		msg->channel_request.width, msg->channel_request.height);
+	if(channel->tty != NULL) {
+		ssh_log_event(session, API_AUDIT_CHANNEL, "tty> recording %s", api_ttyrec_path(channel->tty));
+	}
+}
+
+// exec requests go to the command history, refused ones get a notice on
+// stderr of the client channel
+static int
+proxy_exec_blocked(ssh_session_t *session, ssh_message_t *msg)
+{
+	static const char notice[] = "*** command blocked by policy ***\r\n";
+	int rule = ssh_cmdpolicy_check(msg->channel_request.command);
+
+	command_history_add(session, API_AUDIT_EXEC, ssh_cmdpolicy_action(rule), msg->channel_request.command);
+	if(ssh_cmdpolicy_action(rule) == SSH_CMDPOLICY_BLOCK) {
+		ssh_log_event(session, API_AUDIT_EXEC, "\"EXEC: %s\", blocked by \"%s\"", msg->channel_request.command, ssh_cmdpolicy_pattern(rule));
+		channel_write_common(msg->channel_request.channel, notice, sizeof(notice) - 1, 1);
+		return 1;
+	}
+	if(ssh_cmdpolicy_action(rule) == SSH_CMDPOLICY_ALERT) {
+		ssh_log_event(session, API_AUDIT_EXEC, "\"EXEC: %s\", alert \"%s\"", msg->channel_request.command, ssh_cmdpolicy_pattern(rule));
+	}
+	return 0;
 }
-*/
 
 // client->proxy, proxy forward, session MUST is SSH_SESSION_CLIENT
 static int
@@ -925,13 +1485,26 @@ proxy_request(ssh_session_t *session, ssh_message_t *msg)
 {
     ssh_channel_t *channel = NULL;
 	ssh_session_t *srv = session->session_ptr;
-    int rc;
+	ssh_list_t **queue = NULL;
+    int rc = SSH_AGAIN;
 
 	trace_out("-----------------------------------------------  begin");
 	trace_out("message.type = %d.%d", msg->type, ssh_message_subtype(msg));
 	
 	switch(msg->type) {
     case SSH_REQUEST_AUTH:
+		if(session->route != SSH_ROUTE_NONE) {
+			// every attempt names the target, the server only knows the user
+			ssh_route_split(msg->auth_request.username);
+		}
+		if(session->username == NULL && msg->auth_request.username != NULL) {
+			// every method, the inspection policy is keyed by it
+			session->username = strdup(msg->auth_request.username);
+			SAFE_FREE(srv->username);
+			srv->username = strdup(msg->auth_request.username);
+			ssh_log_reset(session);
+			ssh_log_reset(srv);
+		}
 		if (msg->auth_request.method == SSH_AUTH_METHOD_NONE) {
             rc = proxy_userauth_request_none(srv,  msg->auth_request.username);
         } else if (msg->auth_request.method == SSH_AUTH_METHOD_PASSWORD) {
@@ -953,7 +1526,7 @@ proxy_request(ssh_session_t *session, ssh_message_t *msg)
             if (rc == SSH_ERROR) {
 				trace_out("read private key failed.");
             }
-            trace_out("username = %s, password = %s", msg->auth_request.username, msg->auth_request.password);
+            trace_out("username = %s", msg->auth_request.username);
         	//rc = ssh_userauth_try_publickey(srv, msg->auth_request.username, msg->auth_request.pubkey);
         	//rc = ssh_userauth_publickey_auto(srv, msg->auth_request.username, msg->auth_request.password);
 			rc = ssh_userauth_publickey(srv, msg->auth_request.username, privkey);
@@ -973,7 +1546,7 @@ proxy_request(ssh_session_t *session, ssh_message_t *msg)
 				srv->pending_call_state = SSH_PENDING_CALL_NONE;
 				trace_out("kbdint->nanswers: %d, %d", session->kbdint->nanswers, srv->kbdint->nanswers);
 				for(i = 0; i < session->kbdint->nanswers; i++) {
-					trace_out("answers: %d, [%s]", i, session->kbdint->answers[i]);
+					trace_out("answers: %d", i);
 					ssh_userauth_kbdint_setanswer(srv, i, session->kbdint->answers[i]);
 				}
 			}
@@ -984,21 +1557,45 @@ proxy_request(ssh_session_t *session, ssh_message_t *msg)
         }
         break;
     case SSH_REQUEST_CHANNEL_OPEN:
-        if (msg->channel_request_open.type == SSH_CHANNEL_SESSION) {
-			// client -> proxy, proxy request server
-			srv->chan = ssh_channel_new(srv);
-    		rc = proxy_channel_request_open(srv->chan, msg);
+        if (msg->channel_request_open.type == SSH_CHANNEL_SESSION ||
+			(msg->channel_request_open.type == SSH_CHANNEL_DIRECT_TCPIP &&
+			 !proxy_forward_denied(session, msg))) {
+			// client -> proxy, proxy request server, one server channel per
+			// client channel, the client one is created on confirmation
+			channel = ssh_channel_new(srv);
+			if(channel == NULL) {
+				break;
+			}
+			if(msg->channel_request_open.type == SSH_CHANNEL_SESSION) {
+    			proxy_channel_request_open(channel, msg);
+			} else {
+				ssh_channel_open_forward(channel,
+					msg->channel_request_open.destination, msg->channel_request_open.destination_port,
+					msg->channel_request_open.originator, msg->channel_request_open.originator_port);
+			}
+			if(channel->state == SSH_CHANNEL_STATE_OPENING) {
+				queue = &channel->pending;
+				rc = SSH_OK;
+			} else {
+				ssh_channel_free(channel);
+			}
         }
         break;
     case SSH_REQUEST_CHANNEL:
-        channel = msg->channel_request.channel;
-		channel = srv->chan;
+        // the server channel paired with the client one
+        channel = msg->channel_request.channel->peer;
 		trace_out("SSH_REQUEST_CHANNEL: %d", msg->channel_request.type);
+		if(channel == NULL) {
+			break;
+		}
 		channel->type = msg->channel_request.type;
+		queue = &channel->pending;
         if (msg->channel_request.type == SSH_CHANNEL_REQUEST_PTY) {
 			rc = ssh_channel_request_pty_size(channel, msg->channel_request.TERM,
                     msg->channel_request.width, msg->channel_request.height);
+			proxy_tty_record(session, channel, msg);
         } else if (msg->channel_request.type == SSH_CHANNEL_REQUEST_SHELL) {
+             proxy_channel_inspect(session, channel, "shell", NULL);
              rc = ssh_channel_request_shell(channel);
         } else if (msg->channel_request.type == SSH_CHANNEL_REQUEST_X11) {
         	rc = ssh_channel_request_x11(channel,
@@ -1007,29 +1604,39 @@ proxy_request(ssh_session_t *session, ssh_message_t *msg)
         } else if (msg->channel_request.type == SSH_CHANNEL_REQUEST_WINDOW_CHANGE) {
             rc = ssh_channel_change_pty_size(channel,
 				msg->channel_request.width, msg->channel_request.height);
+			api_ttyrec_resize(channel->tty, msg->channel_request.width, msg->channel_request.height);
+			// sent without want-reply
+			ssh_message_channel_request_reply_success(msg);
+			queue = NULL;
         } else if (msg->channel_request.type == SSH_CHANNEL_REQUEST_EXEC) {
         	trace_out("exec ------------ begin, command[%s]", msg->channel_request.command);
+			if(proxy_exec_blocked(session, msg)) {
+				break;
+			}
 			if(channel->subsystem == NULL) {
 				const char *cmd = msg->channel_request.command;
 				if(cmd != NULL && strstr(cmd, "scp")) {
+					ssh_channel_t *peer = channel->peer;
 					channel->type = SSH_CHANNEL_REQUEST_EXEC;
-					session->chan->type = SSH_CHANNEL_REQUEST_EXEC;
+					peer->type = SSH_CHANNEL_REQUEST_EXEC;
 					SAFE_FREE(channel->subsystem);
         			channel->subsystem = strdup("scp");
-					SAFE_FREE(session->chan->subsystem);
-					session->chan->subsystem = strdup("scp");
+					SAFE_FREE(peer->subsystem);
+					peer->subsystem = strdup("scp");
 					trace_out("exec ------------ protocol[%s]", channel->subsystem);
 					if(strstr(cmd, "scp -f")) {
-						srv->sftp.expect_data = 0;
-						session->sftp.expect_data = 0;
+						channel->sftp.expect_data = 0;
+						peer->sftp.expect_data = 0;
 					} else {
-						srv->sftp.expect_data = 1;
-						session->sftp.expect_data = 1;
+						channel->sftp.expect_data = 1;
+						peer->sftp.expect_data = 1;
 					}
-					srv->sftp.pstate = 0;
-					session->sftp.pstate = 0;
+					channel->sftp.pstate = 0;
+					peer->sftp.pstate = 0;
 				}
 			}
+			proxy_channel_inspect(session, channel,
+				channel->subsystem != NULL ? channel->subsystem : "exec", msg->channel_request.command);
 			rc = ssh_channel_request_exec(channel, msg->channel_request.command);
 			trace_out("exec ------------ end");
         } else if (msg->channel_request.type == SSH_CHANNEL_REQUEST_ENV) {
@@ -1037,27 +1644,47 @@ proxy_request(ssh_session_t *session, ssh_message_t *msg)
 				msg->channel_request.var_name, msg->channel_request.var_value);
         } else if (msg->channel_request.type == SSH_CHANNEL_REQUEST_SUBSYSTEM) {
         	trace_out("subsystem ------------ begin");
+			SAFE_FREE(channel->subsystem);
 			channel->subsystem = strdup(msg->channel_request.subsystem);
+			proxy_channel_inspect(session, channel, msg->channel_request.subsystem, "subsystem");
             rc = ssh_channel_request_subsystem(channel, msg->channel_request.subsystem);
 			trace_out("subsystem ------------ end");
         } else {
         	rc = ssh_message_channel_request_reply_success(msg);
         	//rc = SSH_AGAIN;
+			queue = NULL;
         }
         break;
     case SSH_REQUEST_SERVICE:
 		rc = ssh_service_request(srv, msg->service_request.service);
 		break;
     case SSH_REQUEST_GLOBAL:
-		rc = SSH_AGAIN;
+		if(proxy_forward_denied(session, msg)) {
+			break;
+		}
+		if(msg->global_request.type == SSH_GLOBAL_REQUEST_TCPIP_FORWARD) {
+			rc = ssh_forward_listen(srv, msg->global_request.bind_address,
+				msg->global_request.bind_port, NULL);
+			queue = &srv->pending;
+		} else if(msg->global_request.type == SSH_GLOBAL_REQUEST_CANCEL_TCPIP_FORWARD) {
+			rc = ssh_forward_cancel(srv, msg->global_request.bind_address,
+				msg->global_request.bind_port);
+			queue = &srv->pending;
+		}
         break;
     }
 	trace_out("rc = %d", rc);
-	if(rc == SSH_AGAIN) {
+	if(rc == SSH_AGAIN || (queue != NULL && rc == SSH_ERROR)) {
 		//msg->channel_request.want_reply = 1;
 		ssh_message_reply_default(msg);
 		ssh_message_free(msg);
 		msg = NULL;
+	} else if(queue != NULL) {
+		proxy_pending_push(queue, msg);
+	} else if(msg->type == SSH_REQUEST_CHANNEL) {
+		// already answered
+		ssh_message_free(msg);
+		msg = NULL;
 	} else {
 		srv->msg = msg;
 	}
@@ -1065,6 +1692,136 @@ proxy_request(ssh_session_t *session, ssh_message_t *msg)
     return rc;
 }
 
+// tell the client why, it closes the connection and both legs go
+static void
+proxy_disconnect(ssh_session_t *session, uint32_t code, const char *reason)
+{
+	ssh_string_t *str = ssh_string_from_char(reason);
+
+	if(str != NULL && buffer_add_u8(session->out_buffer, SSH2_MSG_DISCONNECT) == 0
+		&& buffer_add_u32(session->out_buffer, htonl(code)) == 0
+		&& buffer_add_ssh_string(session->out_buffer, str) == 0) {
+		packet_send(session);
+	}
+	ssh_string_free(str);
+	session->session_state = SSH_SESSION_STATE_DISCONNECTED;
+}
+
+// routed session, nothing is relayed before the login names the server
+static int
+proxy_route(ssh_session_t *cli, ssh_session_t *srv)
+{
+	ssh_message_t *message = NULL;
+	char *target = NULL;
+
+	switch(cli->route) {
+	case SSH_ROUTE_LOGIN:
+		if(cli->session_state < SSH_SESSION_STATE_AUTHENTICATING) {
+			break;
+		}
+		while(cli->route == SSH_ROUTE_LOGIN && (message = ssh_message_pop_head(cli)) != NULL) {
+			if(message->type == SSH_REQUEST_SERVICE) {
+				// no server yet, it is asked for ssh-userauth after the connect
+				ssh_message_service_reply_success(message);
+				ssh_message_free(message);
+			} else if(message->type == SSH_REQUEST_AUTH) {
+				target = ssh_route_split(message->auth_request.username);
+				if(cli->route_connect(cli, target) == 0) {
+					// replayed once the server accepted ssh-userauth
+					cli->msg = message;
+					cli->route = SSH_ROUTE_CONNECT;
+				} else {
+					ssh_log_event(cli, API_AUDIT_ROUTE, "\"route: %s\", no route", target ? target : "");
+					ssh_message_reply_default(message);
+					ssh_message_free(message);
+				}
+			} else {
+				ssh_message_reply_default(message);
+				ssh_message_free(message);
+			}
+		}
+		break;
+	case SSH_ROUTE_CONNECT:
+		if(srv->session_state >= SSH_SESSION_STATE_AUTHENTICATING) {
+			ssh_service_request(srv, "ssh-userauth");
+			cli->route = SSH_ROUTE_SERVICE;
+		}
+		break;
+	case SSH_ROUTE_SERVICE:
+		if(srv->command == SSH2_MSG_SERVICE_ACCEPT) {
+			srv->command |= 0x80;
+			cli->route = SSH_ROUTE_DONE;
+			message = cli->msg;
+			cli->msg = NULL;
+			proxy_request(cli, message);
+		}
+		break;
+	default:
+		break;
+	}
+	return cli->route == SSH_ROUTE_DONE ? SSH_OK : SSH_AGAIN;
+}
+
+// an open or channel request reply of either leg, while the packet is read:
+// answers the message of the other leg waiting on `channel`
+void session_channel_reply(ssh_session_t *session, uint8_t command, ssh_channel_t *channel)
+{
+	ssh_message_t *reply = NULL;
+	ssh_channel_t *peer = NULL;
+
+	switch(command) {
+	case SSH2_MSG_CHANNEL_OPEN_CONFIRMATION:
+		proxy_channel_open_confirm(channel);
+		break;
+	case SSH2_MSG_CHANNEL_OPEN_FAILURE:
+		proxy_channel_open_failure(channel);
+		break;
+	case SSH2_MSG_CHANNEL_SUCCESS:
+		reply = proxy_pending_pop(channel->pending);
+		if(reply != NULL) {
+			channel->type = ssh_message_subtype(reply);
+			peer = channel->peer;
+			if(peer != NULL) {
+				peer->type = channel->type;
+				if(reply->channel_request.subsystem != NULL) {
+					// sftp from msg->channel_request.subsystem
+					SAFE_FREE(peer->subsystem);
+					peer->subsystem = strdup(reply->channel_request.subsystem);
+				}
+			}
+			ssh_message_channel_request_reply_success(reply);
+			proxy_channel_schedule(channel, channel->type);
+			ssh_message_free(reply);
+		}
+		break;
+	case SSH2_MSG_CHANNEL_FAILURE:
+		reply = proxy_pending_pop(channel->pending);
+		if(reply != NULL) {
+			ssh_message_reply_default(reply);
+			ssh_message_free(reply);
+		}
+		break;
+	default:
+		break;
+	}
+	session->command |= 0x80;
+}
+
+// a global request reply of the server, while the packet is read
+void session_global_reply(ssh_session_t *session, uint8_t command, uint32_t bound_port)
+{
+	ssh_message_t *reply = proxy_pending_pop(session->pending);
+
+	if(reply != NULL) {
+		if(command == SSH2_MSG_REQUEST_SUCCESS) {
+			ssh_message_global_request_reply_success(reply, bound_port);
+		} else {
+			ssh_message_reply_default(reply);
+		}
+		ssh_message_free(reply);
+	}
+	session->command |= 0x80;
+}
 
 void session_request_handler(ssh_session_t *session)
 {
@@ -1080,14 +1837,28 @@ void session_request_handler(ssh_session_t *session)
 		bClient = 1;
 	}
 	trace_out("CLIENT:%d, SERVER:%d", cli->session_state, srv->session_state);
+	if(cli->session_state == SSH_SESSION_STATE_DISCONNECTED) {
+		return;
+	}
+	if(srv->hostkey_check != NULL && srv->session_state >= SSH_SESSION_STATE_AUTHENTICATING) {
+		// once, before anything of the client reaches the server
+		int (*check)(ssh_session_t *) = srv->hostkey_check;
+		srv->hostkey_check = NULL;
+		if(check(srv) != 0) {
+			ssh_log_event(cli, API_AUDIT_AUTH, "\"hostkey: %s:%d\", not verified", srv->sip, srv->sport);
+			proxy_disconnect(cli, SSH2_DISCONNECT_HOST_KEY_NOT_VERIFIABLE, "Host key verification failed");
+			return;
+		}
+	}
+	if(cli->route != SSH_ROUTE_NONE && cli->route != SSH_ROUTE_DONE
+		&& proxy_route(cli, srv) != SSH_OK) {
+		return;
+	}
 	if(cli->session_state >= SSH_SESSION_STATE_AUTHENTICATING && 
 		srv->session_state >= SSH_SESSION_STATE_AUTHENTICATING) {
 		ssh_message_t *message = NULL;
 		trace_out("%s(%d) process......", SESSION_TYPE(session), bClient);
-		if(bClient) {
-			// client
-			
-		} else {
+		if(!bClient) {
 			// server
 			uint8_t cmd = srv->command;
 			switch(cmd) {
@@ -1107,34 +1878,11 @@ void session_request_handler(ssh_session_t *session)
 				break;
 			case SSH2_MSG_USERAUTH_SUCCESS:
 				ssh_message_auth_reply_success(srv->msg, 0);
+				ssh_shaper_attach(cli);
 				ssh_message_free(srv->msg);
 				srv->msg = NULL;
 				srv->command |= 0x80;
 				break;
-			case SSH2_MSG_CHANNEL_OPEN_CONFIRMATION:
-				//ssh_message_channel_request_open_reply_accept(srv->msg);
-				cli->chan = ssh_channel_new(cli);
-				ssh_message_channel_request_open_reply_accept_channel(srv->msg, cli->chan);
-				ssh_message_free(srv->msg);
-				srv->msg = NULL;
-				session->command |= 0x80;
-				do_assert(srv->chan != NULL);
-				proxy_channel_set_callback(srv, NULL);
-				proxy_channel_set_callback(cli, NULL);
-				break;
-			case SSH2_MSG_CHANNEL_SUCCESS:
-				srv->chan->type = ssh_message_subtype(srv->msg);
-				cli->chan->type = ssh_message_subtype(srv->msg);
-				if(srv->msg->channel_request.subsystem != NULL) {
-					// sftp from msg->channel_request.subsystem
-					SAFE_FREE(cli->chan->subsystem);
-					cli->chan->subsystem = strdup(srv->msg->channel_request.subsystem);
-				}
-				ssh_message_channel_request_reply_success(srv->msg);
-				ssh_message_free(srv->msg);
-				srv->msg = NULL;
-				session->command |= 0x80;
-				break;
 			case SSH2_MSG_USERAUTH_PK_OK:
 				trace_out("srv->auth_state = [%d]", srv->auth_state);
 				if(srv->auth_state == SSH_AUTH_STATE_INFO) {
@@ -1144,6 +1892,7 @@ void session_request_handler(ssh_session_t *session)
 				} else {
 					// publickey/GSSAPI
 					ssh_message_auth_reply_success(srv->msg, 0);
+					ssh_shaper_attach(cli);
 				}
 				ssh_message_free(srv->msg);
 				srv->msg = NULL;
@@ -1155,6 +1904,9 @@ void session_request_handler(ssh_session_t *session)
 				}
 				break;
 			}
+			while((message = ssh_message_pop_head(srv)) != NULL) {
+				proxy_response(srv, message);
+			}
 		}
 		while((message = ssh_message_pop_head(cli)) != NULL) {
 			proxy_request(cli, message);
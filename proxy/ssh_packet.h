@@ -46,10 +46,59 @@ ssh2_command_t * session_get_callback(uint8_t cmd);
 #define SESSION_TYPE(session) (session)->type == SSH_SESSION_SERVER ? "SERVER":"CLIENT"
 
 
+/*
+ * Host keys pinned per destination, "[ip]:port" entries in known_hosts
+ * format. The first key a destination shows is written, a different
+ * key later ends the session.
+ */
+#ifdef _WIN32
+#define SSH_PINNED_FILE "/runtime/etc/ssh/pinned_hosts"
+#else
+#define SSH_PINNED_FILE "/home/runtime/etc/ssh/pinned_hosts"
+#endif
+
+/*
+ * Write scheduling. A channel is interactive once it has a pty or a shell,
+ * bulk with exec, a subsystem or as a forward. A session (its client leg)
+ * is interactive, bulk, or mixed when it carries both; the proxy reads
+ * bulk sessions after interactive ones in each loop iteration and in
+ * bounded chunks, and keeps the output queue of mixed ones short so
+ * keystroke echoes do not wait behind a transfer.
+ */
+enum ssh_sched_e {
+	SSH_SCHED_NONE = 0,
+	SSH_SCHED_INTERACTIVE,
+	SSH_SCHED_BULK,
+	SSH_SCHED_MIXED
+};
+
 int knownhost_verify(ssh_session_t *session);
+int knownhost_pin(ssh_session_t *session);
 void session_request_handler(ssh_session_t *session);
+/* set as channel_reply of both legs */
+void session_channel_reply(ssh_session_t *session, uint8_t command, ssh_channel_t *channel);
+/* set as global_reply of the server leg */
+void session_global_reply(ssh_session_t *session, uint8_t command, uint32_t bound_port);
+
+/* a capture for the transfer of `longname`, direction as api_transfer_direction_e */
+int sftp_file_open(ssh_session_t *session, int direction, const char *longname);
+
+/* a command for the searchable history, kind as api_audit_type_e, action as
+ * ssh_cmdpolicy_e */
+void command_history_add(ssh_session_t *session, int kind, int action, const char *command);
+
+// an sftp packet is held until it is complete, a longer one is relayed unread
+#define SFTP_PACKET_MAX (1024 * 1024)
+
+/**
+ * Policy hook for port forwarding, asked for direct-tcpip and
+ * forwarded-tcpip channel opens and tcpip-forward/cancel-tcpip-forward
+ * global requests. `session` is the client session, `msg` the request.
+ * Return 0 to allow it, anything else to refuse it.
+ */
+typedef int (*proxy_forward_policy)(ssh_session_t *session, ssh_message_t *msg, void *userdata);
 
-int sftp_file_open(const char *username, const char *longname);
+void proxy_forward_set_policy(proxy_forward_policy fn, void *userdata);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,165 @@
+#include "ssh-includes.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fnmatch.h>
+#ifndef _WIN32
+#include <grp.h>
+#include <pwd.h>
+#endif
+
+#include "api_misc.h"
+#include "ssh_policy.h"
+
+typedef struct ssh_policy_rule_struct {
+	char user[64];
+	char group[64];
+	char target[128];
+	char kind[32];
+	int  level;
+} ssh_policy_rule_t;
+
+static ssh_policy_rule_t *policy_rules = NULL;
+static int policy_count = 0;
+
+static const char *inspect_names[] = { "full", "metadata", "none" };
+
+const char *ssh_inspect_name(int level)
+{
+	if(level < SSH_INSPECT_FULL || level > SSH_INSPECT_NONE) {
+		return "unknown";
+	}
+	return inspect_names[level];
+}
+
+static int policy_level(const char *name)
+{
+	int i;
+
+	for(i = SSH_INSPECT_FULL; i <= SSH_INSPECT_NONE; i++) {
+		if(strcmp(name, inspect_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void ssh_policy_free(void)
+{
+	SAFE_FREE(policy_rules);
+	policy_count = 0;
+}
+
+int ssh_policy_load(const char *filename)
+{
+	ssh_policy_rule_t *rules = NULL, *tmp = NULL, rule;
+	char line[512], level[16];
+	int count = 0, lineno = 0;
+	FILE *fp = NULL;
+
+	fp = fopen(filename, "r");
+	if(fp == NULL) {
+		trace_err("policy: %s: %s", filename, strerror(errno));
+		return -1;
+	}
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if(line[strspn(line, " \t")] == '#') {
+			continue;
+		}
+		memset(&rule, 0x00, sizeof(rule));
+		if(sscanf(line, "%63s %63s %127s %31s %15s",
+				rule.user, rule.group, rule.target, rule.kind, level) != 5) {
+			if(line[strspn(line, " \t\r\n")] != '\0') {
+				trace_err("policy: %s:%d: expected user group target kind inspect", filename, lineno);
+			}
+			continue;
+		}
+		rule.level = policy_level(level);
+		if(rule.level < 0) {
+			trace_err("policy: %s:%d: unknown inspect level %s", filename, lineno, level);
+			continue;
+		}
+		tmp = realloc(rules, (count + 1) * sizeof(ssh_policy_rule_t));
+		if(tmp == NULL) {
+			SAFE_FREE(rules);
+			fclose(fp);
+			return -1;
+		}
+		rules = tmp;
+		rules[count++] = rule;
+	}
+	fclose(fp);
+
+	ssh_policy_free();
+	policy_rules = rules;
+	policy_count = count;
+	do_info("policy: %d rules from %s", count, filename);
+	return count;
+}
+
+int ssh_policy_in_group(const char *user, const char *pattern)
+{
+#ifndef _WIN32
+	struct passwd *pw = NULL;
+	struct group *gr = NULL;
+	gid_t groups[64];
+	int i, n = sizeof(groups) / sizeof(groups[0]);
+
+	pw = getpwnam(user);
+	if(pw == NULL) {
+		return 0;
+	}
+	if(getgrouplist(user, pw->pw_gid, groups, &n) < 0) {
+		// more than we look at, the first ones are enough
+		n = sizeof(groups) / sizeof(groups[0]);
+	}
+	for(i = 0; i < n; i++) {
+		gr = getgrgid(groups[i]);
+		if(gr != NULL && fnmatch(pattern, gr->gr_name, 0) == 0) {
+			return 1;
+		}
+	}
+#endif
+	return 0;
+}
+
+static int policy_target(const char *pattern, const char *target, int port)
+{
+	char host[128];
+	const char *colon = strrchr(pattern, ':');
+
+	if(colon == NULL) {
+		return fnmatch(pattern, target, 0) == 0;
+	}
+	if(atoi(colon + 1) != port) {
+		return 0;
+	}
+	snprintf(host, sizeof(host), "%.*s", (int)(colon - pattern), pattern);
+	return fnmatch(host, target, 0) == 0;
+}
+
+int ssh_policy_inspect(const char *user, const char *target, int port, const char *kind)
+{
+	ssh_policy_rule_t *rule = NULL;
+	int i;
+
+	user = user != NULL ? user : "";
+	target = target != NULL ? target : "";
+	kind = kind != NULL ? kind : "";
+	for(i = 0; i < policy_count; i++) {
+		rule = &policy_rules[i];
+		if(fnmatch(rule->user, user, 0) != 0 ||
+			fnmatch(rule->kind, kind, 0) != 0 ||
+			!policy_target(rule->target, target, port)) {
+			continue;
+		}
+		if(strcmp(rule->group, "*") != 0 && !ssh_policy_in_group(user, rule->group)) {
+			continue;
+		}
+		return rule->level;
+	}
+	return SSH_INSPECT_FULL;
+}
@@ -0,0 +1,195 @@
+#include "ssh-includes.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "ssh_record.h"
+#include "ssh/priv.h"
+#include "ssh/buffer.h"
+#include "ssh/session.h"
+#include "ssh/wrapper.h"
+
+#ifdef DEBUG_CRYPTO
+
+static int record_write(ssh_session_t *session, uint8_t type, const void *data, uint32_t len)
+{
+	uint8_t hdr[SSH_RECORD_HDR_LEN];
+	uint32_t nlen = htonl(len);
+
+	hdr[0] = type;
+	hdr[1] = session->type;
+	memcpy(hdr + 2, &nlen, sizeof(nlen));
+	if(write(session->record, hdr, sizeof(hdr)) != sizeof(hdr) ||
+		write(session->record, data, len) != (ssize_t)len) {
+		trace_err("record write failed: %s", strerror(errno));
+		return SSH_ERROR;
+	}
+	return SSH_OK;
+}
+
+static int record_add_blob(ssh_buffer_t *buf, const void *data, uint32_t len)
+{
+	if(buffer_add_u32(buf, htonl(len)) < 0 ||
+		buffer_add_data(buf, data, len) < 0) {
+		return SSH_ERROR;
+	}
+	return SSH_OK;
+}
+
+int ssh_record_open(ssh_session_t *session_in, ssh_session_t *session_out)
+{
+	char name[128];
+	int fd = -1;
+
+	snprintf(name, sizeof(name), "%s_%d.rec", session_in->cip, session_in->cport);
+	fd = api_sftpfile_open("record", name);
+	if(fd == -1) {
+		return SSH_ERROR;
+	}
+	if(write(fd, SSH_RECORD_MAGIC, SSH_RECORD_MAGIC_LEN) != SSH_RECORD_MAGIC_LEN) {
+		close(fd);
+		return SSH_ERROR;
+	}
+	session_in->record = fd;
+	session_in->newkeys_notify = ssh_record_keys;
+	session_out->record = fd;
+	session_out->newkeys_notify = ssh_record_keys;
+	return SSH_OK;
+}
+
+void ssh_record_data(ssh_session_t *session, const void *data, uint32_t len)
+{
+	if(session->record != -1 && len > 0) {
+		record_write(session, SSH_RECORD_DATA, data, len);
+	}
+}
+
+void ssh_record_keys(ssh_session_t *session)
+{
+	ssh_crypto_t *crypto = session->current_crypto;
+	ssh_buffer_t *buf = NULL;
+	const char *name = NULL;
+	uint32_t keylen = 0;
+
+	if(session->record == -1 || crypto == NULL || crypto->in_cipher == NULL) {
+		return;
+	}
+	/* see generate_session_keys(): long keys are extended to 2 digests */
+	keylen = crypto->digest_len;
+	if(crypto->in_cipher->keysize > crypto->digest_len * 8) {
+		keylen *= 2;
+	}
+	name = crypto->in_cipher->name;
+	buf = ssh_buffer_new();
+	if(buf == NULL) {
+		return;
+	}
+	if(record_add_blob(buf, name, strlen(name) + 1) == SSH_OK &&
+		record_add_blob(buf, crypto->decryptkey, keylen) == SSH_OK &&
+		record_add_blob(buf, crypto->decryptIV, crypto->digest_len) == SSH_OK &&
+		record_add_blob(buf, crypto->decryptMAC, crypto->digest_len) == SSH_OK &&
+		buffer_add_u32(buf, htonl(crypto->digest_len)) == 0) {
+		record_write(session, SSH_RECORD_KEYS,
+			ssh_buffer_get_begin(buf), ssh_buffer_get_len(buf));
+	}
+	ssh_buffer_free(buf);
+}
+
+void ssh_record_close(ssh_session_t *session)
+{
+	ssh_session_t *peer = session->session_ptr;
+
+	if(session->record != -1) {
+		close(session->record);
+	}
+	session->record = -1;
+	if(peer != NULL) {
+		peer->record = -1;
+	}
+}
+
+#endif /* DEBUG_CRYPTO */
+
+static unsigned char *record_get_blob(ssh_buffer_t *buf, size_t *plen)
+{
+	ssh_string_t *str = buffer_get_ssh_string(buf);
+	unsigned char *ptr = NULL;
+	size_t len;
+
+	if(str == NULL) {
+		return NULL;
+	}
+	len = ssh_string_len(str);
+	if(len > 0) {
+		ptr = malloc(len);
+		if(ptr != NULL) {
+			memcpy(ptr, ssh_string_data(str), len);
+		}
+	}
+	ssh_string_free(str);
+	if(plen != NULL) {
+		*plen = len;
+	}
+	return ptr;
+}
+
+/**
+ * @brief Rebuild the inbound crypto of a SSH_RECORD_KEYS record.
+ *
+ * @param data   The record payload.
+ * @param len    The payload length.
+ *
+ * @return A crypto usable as session->current_crypto, NULL on error.
+ */
+ssh_crypto_t *ssh_record_keys_load(const void *data, uint32_t len)
+{
+	struct ssh_cipher_struct *tab = ssh_get_ciphertab();
+	ssh_crypto_t *crypto = NULL;
+	ssh_buffer_t *buf = NULL;
+	char *name = NULL;
+	uint32_t digest_len = 0;
+	size_t nlen = 0;
+	int i;
+
+	buf = ssh_buffer_new();
+	crypto = crypto_new();
+	if(buf == NULL || crypto == NULL || buffer_add_data(buf, data, len) < 0) {
+		goto error;
+	}
+	name = (char *)record_get_blob(buf, &nlen);
+	crypto->decryptkey = record_get_blob(buf, NULL);
+	crypto->decryptIV = record_get_blob(buf, NULL);
+	crypto->decryptMAC = record_get_blob(buf, NULL);
+	if(name == NULL || name[nlen - 1] != '\0' || crypto->decryptkey == NULL ||
+		crypto->decryptIV == NULL || crypto->decryptMAC == NULL ||
+		buffer_get_u32(buf, &digest_len) != sizeof(uint32_t)) {
+		goto error;
+	}
+	crypto->digest_len = ntohl(digest_len);
+	for(i = 0; tab[i].name != NULL; i++) {
+		if(strcmp(tab[i].name, name) == 0) {
+			break;
+		}
+	}
+	if(tab[i].name == NULL) {
+		trace_err("unknown cipher in record: %s", name);
+		goto error;
+	}
+	crypto->in_cipher = malloc(sizeof(struct ssh_cipher_struct));
+	if(crypto->in_cipher == NULL) {
+		goto error;
+	}
+	/* same as cipher_new(): the pointers are shared with the table */
+	memcpy(crypto->in_cipher, &tab[i], sizeof(struct ssh_cipher_struct));
+	SAFE_FREE(name);
+	ssh_buffer_free(buf);
+	return crypto;
+
+error:
+	SAFE_FREE(name);
+	ssh_buffer_free(buf);
+	crypto_free(crypto);
+	return NULL;
+}
@@ -0,0 +1,156 @@
+#include "ssh-includes.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <netinet/in.h>
+#endif
+
+#include <aio/util.h>
+
+#include "api_hashtable.h"
+#include "ssh_route.h"
+
+typedef struct ssh_route_struct {
+	struct sockaddr_storage addr;
+	int addrlen;
+} ssh_route_t;
+
+static api_hashtable_t route_table;
+static int route_count = 0;
+
+void ssh_route_free(void)
+{
+	if(route_count > 0) {
+		api_hashtable_destroy(&route_table);
+	}
+	route_count = 0;
+}
+
+int ssh_route_count(void)
+{
+	return route_count;
+}
+
+static int route_parse(const char *address, ssh_route_t *route)
+{
+	memset(route, 0x00, sizeof(*route));
+	route->addrlen = sizeof(route->addr);
+	if(evutil_parse_sockaddr_port(address, (struct sockaddr *)&route->addr, &route->addrlen) < 0) {
+		return -1;
+	}
+	// no port given
+	if(route->addr.ss_family == AF_INET6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&route->addr;
+		if(sin6->sin6_port == 0) {
+			sin6->sin6_port = htons(22);
+		}
+	} else {
+		struct sockaddr_in *sin = (struct sockaddr_in *)&route->addr;
+		if(sin->sin_port == 0) {
+			sin->sin_port = htons(22);
+		}
+	}
+	return 0;
+}
+
+int ssh_route_load(const char *filename)
+{
+	api_hashtable_t table;
+	ssh_route_t route;
+	char line[512], target[256], address[128];
+	int count = 0, lineno = 0;
+	FILE *fp = NULL;
+
+	fp = fopen(filename, "r");
+	if(fp == NULL) {
+		trace_err("route: %s: %s", filename, strerror(errno));
+		return -1;
+	}
+	api_hashtable_init(&table, HT_NONE, 0.05);
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if(line[strspn(line, " \t")] == '#') {
+			continue;
+		}
+		if(sscanf(line, "%255s %127s", target, address) != 2) {
+			if(line[strspn(line, " \t\r\n")] != '\0') {
+				trace_err("route: %s:%d: expected target address[:port]", filename, lineno);
+			}
+			continue;
+		}
+		if(route_parse(address, &route) != 0) {
+			trace_err("route: %s:%d: bad address %s", filename, lineno, address);
+			continue;
+		}
+		if(api_hashtable_contains(&table, target, strlen(target) + 1)) {
+			trace_err("route: %s:%d: %s routed twice, first one kept", filename, lineno, target);
+			continue;
+		}
+		api_hashtable_insert(&table, target, strlen(target) + 1, &route, sizeof(route));
+		count++;
+	}
+	fclose(fp);
+
+	ssh_route_free();
+	if(count > 0) {
+		route_table = table;
+		route_count = count;
+	} else {
+		api_hashtable_destroy(&table);
+	}
+	do_info("route: %d routes from %s", count, filename);
+	return count;
+}
+
+char *ssh_route_split(char *login)
+{
+	char *sep = NULL;
+
+	if(login == NULL) {
+		return NULL;
+	}
+	// user@target@proxy reaches us as "user@target"
+	sep = strchr(login, '@');
+	if(sep == NULL) {
+		sep = strchr(login, '%');
+	}
+	if(sep == NULL) {
+		return NULL;
+	}
+	*sep = '\0';
+	return sep + 1;
+}
+
+static ssh_route_t *route_get(const char *key)
+{
+	return api_hashtable_get(&route_table, (void *)key, strlen(key) + 1, NULL);
+}
+
+int ssh_route_lookup(const char *target, struct sockaddr_storage *addr, int *addrlen)
+{
+	ssh_route_t *route = NULL;
+	char key[258];
+	const char *dot = NULL;
+
+	if(route_count == 0 || target == NULL) {
+		return -1;
+	}
+	route = route_get(target);
+	// db1.lab.example -> *.lab.example -> *.example
+	for(dot = strchr(target, '.'); route == NULL && dot != NULL; dot = strchr(dot + 1, '.')) {
+		snprintf(key, sizeof(key), "*%s", dot);
+		route = route_get(key);
+	}
+	if(route == NULL) {
+		route = route_get("*");
+	}
+	if(route == NULL) {
+		return -1;
+	}
+	memcpy(addr, &route->addr, route->addrlen);
+	*addrlen = route->addrlen;
+	return 0;
+}
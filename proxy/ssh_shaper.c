@@ -0,0 +1,471 @@
+#include "ssh-includes.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+#include <aio/event.h>
+#include <aio/bufferevent.h>
+
+#include "api_hashtable.h"
+#include "api_misc.h"
+#include "ssh_policy.h"
+#include "ssh_shaper.h"
+#include "ssh/priv.h"
+#include "ssh/session.h"
+
+// bytes a woken leg is expected to read before it is charged again
+#define SHAPER_QUANTUM (16 * 1024)
+
+typedef struct shaper_rule_struct {
+	int      group;
+	char     name[64];
+	uint64_t rate;  // bytes/s
+	uint64_t burst; // bytes
+} shaper_rule_t;
+
+typedef struct shaper_member_struct shaper_member_t;
+
+typedef struct shaper_bucket_struct {
+	char     name[80]; // "user:bob", "group:ops"
+	uint64_t rate;     // bytes/s, 0 is unlimited
+	uint64_t burst;
+	double   tokens;
+	struct timeval stamp;
+	uint64_t bytes;
+	uint64_t throttled;
+	int      waiting;
+	shaper_member_t *head, *tail;
+	struct event *tick;
+	struct shaper_bucket_struct *parent;
+	struct shaper_bucket_struct *next;
+} shaper_bucket_t;
+
+// one leg of a shaped session
+struct shaper_member_struct {
+	ssh_session_t   *session;
+	shaper_bucket_t *bucket; // charged with its parents
+	shaper_bucket_t *queued; // waiting here, NULL while reading
+	shaper_member_t *next;
+};
+
+static struct event_base *shaper_base = NULL;
+static shaper_rule_t *shaper_rules = NULL;
+static int shaper_count = 0;
+static api_hashtable_t shaper_table;
+static shaper_bucket_t *shaper_buckets = NULL;
+
+static void shaper_tick(evutil_socket_t fd, short events, void *arg);
+
+static struct bufferevent *shaper_bev(ssh_session_t *session)
+{
+	// owner_ptr is the partner's bufferevent
+	ssh_session_t *partner = session->session_ptr;
+	return partner != NULL ? partner->owner_ptr : NULL;
+}
+
+static const shaper_rule_t *shaper_match(int group, const char *name)
+{
+	int i;
+
+	for(i = 0; i < shaper_count; i++) {
+		if(shaper_rules[i].group != group) {
+			continue;
+		}
+		if(group ? ssh_policy_in_group(name, shaper_rules[i].name) :
+				fnmatch(shaper_rules[i].name, name, 0) == 0) {
+			return &shaper_rules[i];
+		}
+	}
+	return NULL;
+}
+
+// the rule of an existing bucket, after a reload
+static const shaper_rule_t *shaper_rule_of(const shaper_bucket_t *bucket)
+{
+	int i;
+
+	if(strncmp(bucket->name, "user:", 5) == 0) {
+		return shaper_match(0, bucket->name + 5);
+	}
+	for(i = 0; i < shaper_count; i++) {
+		if(shaper_rules[i].group && strcmp(shaper_rules[i].name, bucket->name + 6) == 0) {
+			return &shaper_rules[i];
+		}
+	}
+	return NULL;
+}
+
+static void shaper_refill(shaper_bucket_t *bucket)
+{
+	struct timeval now;
+	double elapsed;
+
+	event_base_gettimeofday_cached(shaper_base, &now);
+	if(bucket->rate == 0) {
+		bucket->tokens = 0;
+	} else {
+		elapsed = (now.tv_sec - bucket->stamp.tv_sec) + (now.tv_usec - bucket->stamp.tv_usec) / 1e6;
+		bucket->tokens += elapsed * bucket->rate;
+		if(bucket->tokens > bucket->burst) {
+			bucket->tokens = bucket->burst;
+		}
+	}
+	bucket->stamp = now;
+}
+
+static shaper_bucket_t *shaper_bucket(const char *name, const shaper_rule_t *rule)
+{
+	shaper_bucket_t **found = NULL, *bucket = NULL;
+
+	found = api_hashtable_get(&shaper_table, (void *)name, strlen(name) + 1, NULL);
+	if(found != NULL) {
+		return *found;
+	}
+	bucket = calloc(1, sizeof(shaper_bucket_t));
+	if(bucket == NULL) {
+		return NULL;
+	}
+	snprintf(bucket->name, sizeof(bucket->name), "%s", name);
+	bucket->rate = rule->rate;
+	bucket->burst = rule->burst;
+	bucket->tokens = rule->burst;
+	event_base_gettimeofday_cached(shaper_base, &bucket->stamp);
+	bucket->tick = evtimer_new(shaper_base, shaper_tick, bucket);
+	api_hashtable_insert(&shaper_table, (void *)name, strlen(name) + 1, &bucket, sizeof(bucket));
+	bucket->next = shaper_buckets;
+	shaper_buckets = bucket;
+	return bucket;
+}
+
+// first bucket up from the member's that is overdrawn
+static shaper_bucket_t *shaper_overdrawn(shaper_member_t *member)
+{
+	shaper_bucket_t *bucket = NULL;
+
+	for(bucket = member->bucket; bucket != NULL; bucket = bucket->parent) {
+		shaper_refill(bucket);
+		if(bucket->rate != 0 && bucket->tokens < 0) {
+			return bucket;
+		}
+	}
+	return NULL;
+}
+
+static void shaper_arm(shaper_bucket_t *bucket)
+{
+	struct timeval tv = {0, 10 * 1000};
+	double wait;
+
+	if(bucket->rate != 0 && bucket->tokens < 0) {
+		wait = -bucket->tokens / bucket->rate;
+		if(wait > 0.01) {
+			tv.tv_sec = (long)wait;
+			tv.tv_usec = (long)((wait - tv.tv_sec) * 1e6);
+		}
+	}
+	if(bucket->tick != NULL && !evtimer_pending(bucket->tick, NULL)) {
+		evtimer_add(bucket->tick, &tv);
+	}
+}
+
+static void shaper_park(shaper_member_t *member, shaper_bucket_t *bucket)
+{
+	struct bufferevent *bev = shaper_bev(member->session);
+
+	if(bev != NULL) {
+		bufferevent_disable(bev, EV_READ);
+	}
+	member->queued = bucket;
+	member->next = NULL;
+	if(bucket->tail != NULL) {
+		bucket->tail->next = member;
+	} else {
+		bucket->head = member;
+	}
+	bucket->tail = member;
+	bucket->waiting++;
+	shaper_arm(bucket);
+}
+
+static void shaper_unqueue(shaper_member_t *member)
+{
+	shaper_bucket_t *bucket = member->queued;
+	shaper_member_t **pp = NULL;
+
+	if(bucket == NULL) {
+		return;
+	}
+	for(pp = &bucket->head; *pp != NULL; pp = &(*pp)->next) {
+		if(*pp == member) {
+			*pp = member->next;
+			break;
+		}
+	}
+	bucket->tail = NULL;
+	for(pp = &bucket->head; *pp != NULL; pp = &(*pp)->next) {
+		bucket->tail = *pp;
+	}
+	bucket->waiting--;
+	member->queued = NULL;
+	member->next = NULL;
+}
+
+// wake waiting legs in turn, a quantum of tokens each
+static void shaper_tick(evutil_socket_t fd, short events, void *arg)
+{
+	shaper_bucket_t *bucket = arg, *over = NULL;
+	shaper_member_t *member = NULL;
+	struct bufferevent *bev = NULL;
+	double budget;
+
+	shaper_refill(bucket);
+	budget = bucket->rate != 0 ? bucket->tokens : (double)SHAPER_QUANTUM * bucket->waiting;
+	while(bucket->head != NULL && budget >= 0) {
+		member = bucket->head;
+		shaper_unqueue(member);
+		over = shaper_overdrawn(member);
+		if(over != NULL) {
+			// still owes a bucket above, wait there
+			shaper_park(member, over);
+			continue;
+		}
+		bev = shaper_bev(member->session);
+		if(bev != NULL && !member->session->read_held) {
+			// a held one is enabled by what holds it
+			bufferevent_enable(bev, EV_READ);
+		}
+		budget -= SHAPER_QUANTUM;
+	}
+	if(bucket->head != NULL) {
+		shaper_arm(bucket);
+	}
+}
+
+static shaper_member_t *shaper_member(ssh_session_t *session, shaper_bucket_t *bucket)
+{
+	shaper_member_t *member = calloc(1, sizeof(shaper_member_t));
+
+	if(member != NULL) {
+		member->session = session;
+		member->bucket = bucket;
+		session->shaper = member;
+	}
+	return member;
+}
+
+void ssh_shaper_attach(ssh_session_t *session)
+{
+	const shaper_rule_t *urule = NULL, *grule = NULL;
+	shaper_bucket_t *ubucket = NULL, *gbucket = NULL, *bucket = NULL;
+	char name[80];
+
+	if(shaper_count == 0 || session->username == NULL || session->shaper != NULL) {
+		return;
+	}
+	urule = shaper_match(0, session->username);
+	grule = shaper_match(1, session->username);
+	if(grule != NULL && grule->rate != 0) {
+		snprintf(name, sizeof(name), "group:%s", grule->name);
+		gbucket = shaper_bucket(name, grule);
+	}
+	if(urule != NULL && urule->rate != 0) {
+		snprintf(name, sizeof(name), "user:%s", session->username);
+		ubucket = shaper_bucket(name, urule);
+		if(ubucket != NULL) {
+			ubucket->parent = gbucket;
+		}
+	}
+	bucket = ubucket != NULL ? ubucket : gbucket;
+	if(bucket == NULL) {
+		return;
+	}
+	shaper_member(session, bucket);
+	if(session->session_ptr != NULL) {
+		shaper_member(session->session_ptr, bucket);
+	}
+	trace_out("shaper: %s on %s", session->username, bucket->name);
+}
+
+static void shaper_leave(ssh_session_t *session)
+{
+	shaper_member_t *member = session->shaper;
+
+	if(member != NULL) {
+		shaper_unqueue(member);
+		free(member);
+		session->shaper = NULL;
+	}
+}
+
+void ssh_shaper_detach(ssh_session_t *session)
+{
+	shaper_leave(session);
+	if(session->session_ptr != NULL) {
+		shaper_leave(session->session_ptr);
+	}
+}
+
+void ssh_shaper_charge(ssh_session_t *session, uint32_t len)
+{
+	shaper_member_t *member = session->shaper;
+	shaper_bucket_t *bucket = NULL;
+
+	if(member == NULL || len == 0) {
+		return;
+	}
+	for(bucket = member->bucket; bucket != NULL; bucket = bucket->parent) {
+		shaper_refill(bucket);
+		bucket->tokens -= len;
+		bucket->bytes += len;
+	}
+	if(member->queued != NULL) {
+		return;
+	}
+	bucket = shaper_overdrawn(member);
+	if(bucket != NULL) {
+		bucket->throttled++;
+		shaper_park(member, bucket);
+	}
+}
+
+int ssh_shaper_queued(ssh_session_t *session)
+{
+	shaper_member_t *member = session->shaper;
+
+	return member != NULL && member->queued != NULL;
+}
+
+static void shaper_clear(void)
+{
+	shaper_bucket_t *bucket = NULL;
+
+	while((bucket = shaper_buckets) != NULL) {
+		shaper_buckets = bucket->next;
+		if(bucket->tick != NULL) {
+			event_free(bucket->tick);
+		}
+		free(bucket);
+	}
+	api_hashtable_destroy(&shaper_table);
+}
+
+void ssh_shaper_free(void)
+{
+	if(shaper_base != NULL) {
+		shaper_clear();
+	}
+	SAFE_FREE(shaper_rules);
+	shaper_count = 0;
+	shaper_base = NULL;
+}
+
+int ssh_shaper_load(struct event_base *base, const char *filename)
+{
+	shaper_rule_t *rules = NULL, *tmp = NULL, rule;
+	shaper_bucket_t *bucket = NULL;
+	const shaper_rule_t *match = NULL;
+	char line[512], kind[16];
+	unsigned long long rate, burst;
+	int count = 0, lineno = 0;
+	FILE *fp = NULL;
+
+	fp = fopen(filename, "r");
+	if(fp == NULL) {
+		trace_err("shaper: %s: %s", filename, strerror(errno));
+		return -1;
+	}
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if(line[strspn(line, " \t")] == '#') {
+			continue;
+		}
+		memset(&rule, 0x00, sizeof(rule));
+		if(sscanf(line, "%15s %63s %llu %llu", kind, rule.name, &rate, &burst) != 4) {
+			if(line[strspn(line, " \t\r\n")] != '\0') {
+				trace_err("shaper: %s:%d: expected kind name rate burst", filename, lineno);
+			}
+			continue;
+		}
+		if(strcmp(kind, "user") != 0 && strcmp(kind, "group") != 0) {
+			trace_err("shaper: %s:%d: unknown kind %s", filename, lineno, kind);
+			continue;
+		}
+		rule.group = strcmp(kind, "group") == 0;
+		rule.rate = rate * 1024;
+		// a burst below one quantum would park every read
+		rule.burst = burst * 1024 > SHAPER_QUANTUM ? burst * 1024 : SHAPER_QUANTUM;
+		tmp = realloc(rules, (count + 1) * sizeof(shaper_rule_t));
+		if(tmp == NULL) {
+			SAFE_FREE(rules);
+			fclose(fp);
+			return -1;
+		}
+		rules = tmp;
+		rules[count++] = rule;
+	}
+	fclose(fp);
+
+	if(shaper_base == NULL) {
+		shaper_base = base;
+		api_hashtable_init(&shaper_table, HT_NONE, 0.05);
+	}
+	SAFE_FREE(shaper_rules);
+	shaper_rules = rules;
+	shaper_count = count;
+	// buckets of attached sessions take the new rates, unmatched ones go unlimited
+	for(bucket = shaper_buckets; bucket != NULL; bucket = bucket->next) {
+		match = shaper_rule_of(bucket);
+		bucket->rate = match != NULL ? match->rate : 0;
+		bucket->burst = match != NULL ? match->burst : 0;
+		shaper_refill(bucket);
+		if(bucket->head != NULL) {
+			shaper_arm(bucket);
+		}
+	}
+	do_info("shaper: %d rules from %s", count, filename);
+	return count;
+}
+
+int ssh_shaper_dump(void)
+{
+	shaper_bucket_t *bucket = NULL;
+	char path[64], tmp[72];
+	FILE *fp = NULL;
+	int fd = -1;
+
+	if(shaper_base == NULL) {
+		return 0;
+	}
+	snprintf(path, sizeof(path), SSH_SHAPER_STAT_FILE, (int)getpid());
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	// a new file of ours only, never a link planted in /tmp
+	unlink(tmp);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+	fp = fd != -1 ? fdopen(fd, "w") : NULL;
+	if(fp == NULL) {
+		trace_err("shaper: %s: %s", tmp, strerror(errno));
+		if(fd != -1) {
+			close(fd);
+		}
+		return -1;
+	}
+	for(bucket = shaper_buckets; bucket != NULL; bucket = bucket->next) {
+		shaper_refill(bucket);
+		fprintf(fp, "%s %llu %lld %llu %llu %d\n", bucket->name,
+			(unsigned long long)bucket->rate, (long long)bucket->tokens,
+			(unsigned long long)bucket->bytes, (unsigned long long)bucket->throttled,
+			bucket->waiting);
+	}
+	fclose(fp);
+	if(rename(tmp, path) != 0) {
+		trace_err("shaper: %s: %s", path, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * taudit - query a binary audit log, see api_audit.h
+ *
+ *   taudit [-u <user>] [-i <ip>] [-s <cip:cport->sip:sport>]
+ *          [-t <type>[,<type>...]] [-f <from>] [-T <to>] <audit.bin>
+ *
+ * The index is looked for as audit.idx next to the log. Times are
+ * "YYYY-MM-DD [HH:MM:SS]" local time or seconds since the epoch. The
+ * matching events go to stdout as JSON, one per line.
+ */
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "api_audit.h"
+
+static void print_json(const char *name, const char *s)
+{
+	printf(",\"%s\":\"", name);
+	for(; *s != '\0'; s++) {
+		switch(*s) {
+		case '"':
+			fputs("\\\"", stdout);
+			break;
+		case '\\':
+			fputs("\\\\", stdout);
+			break;
+		case '\n':
+			fputs("\\n", stdout);
+			break;
+		case '\r':
+			fputs("\\r", stdout);
+			break;
+		case '\t':
+			fputs("\\t", stdout);
+			break;
+		default:
+			if((unsigned char)*s < 0x20) {
+				printf("\\u%04x", (unsigned char)*s);
+			} else {
+				putchar(*s);
+			}
+			break;
+		}
+	}
+	putchar('"');
+}
+
+static int print_event(const api_audit_event_t *e, void *arg)
+{
+	char ts[32];
+	time_t t = (time_t)(e->time / 1000000);
+
+	(void)arg;
+	strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", localtime(&t));
+	printf("{\"time\":\"%s.%06u\"", ts, (unsigned)(e->time % 1000000));
+	print_json("type", api_audit_type_name(e->type));
+	print_json("client", e->cip);
+	printf(",\"client_port\":%d", e->cport);
+	print_json("server", e->sip);
+	printf(",\"server_port\":%d", e->sport);
+	print_json("user", e->user);
+	print_json("route", e->route);
+	print_json("message", e->message);
+	printf("}\n");
+	return 0;
+}
+
+// microseconds since the epoch, 0 if `s` is no time
+static uint64_t parse_time(const char *s)
+{
+	struct tm tm;
+	const char *end = NULL;
+	char *num = NULL;
+	unsigned long long secs = 0;
+
+	memset(&tm, 0x00, sizeof(tm));
+	end = strptime(s, "%Y-%m-%d %H:%M:%S", &tm);
+	if(end == NULL) {
+		memset(&tm, 0x00, sizeof(tm));
+		end = strptime(s, "%Y-%m-%d", &tm);
+	}
+	if(end != NULL && *end == '\0') {
+		tm.tm_isdst = -1;
+		return (uint64_t)mktime(&tm) * 1000000;
+	}
+	secs = strtoull(s, &num, 10);
+	return *s != '\0' && *num == '\0' ? (uint64_t)secs * 1000000 : 0;
+}
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-u user] [-i ip] [-s session] [-t type[,type]] [-f from] [-T to] <audit.bin>\n", name);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	api_audit_filter_t filter;
+	char index[1024], *type = NULL, *slash = NULL;
+	int fd = -1, ifd = -1, n = 0, opt = 0;
+
+	memset(&filter, 0x00, sizeof(filter));
+	while((opt = getopt(argc, argv, "u:i:s:t:f:T:")) != -1) {
+		switch(opt) {
+		case 'u':
+			filter.user = optarg;
+			break;
+		case 'i':
+			filter.ip = optarg;
+			break;
+		case 's':
+			filter.session = optarg;
+			break;
+		case 't':
+			for(type = strtok(optarg, ","); type != NULL; type = strtok(NULL, ",")) {
+				if((n = api_audit_type_parse(type)) < 0) {
+					fprintf(stderr, "%s: unknown event type\n", type);
+					return 1;
+				}
+				filter.types |= 1U << n;
+			}
+			break;
+		case 'f':
+			if((filter.from = parse_time(optarg)) == 0) {
+				return usage(argv[0]);
+			}
+			break;
+		case 'T':
+			if((filter.to = parse_time(optarg)) == 0) {
+				return usage(argv[0]);
+			}
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if(optind != argc - 1) {
+		return usage(argv[0]);
+	}
+	fd = open(argv[optind], O_RDONLY);
+	if(fd < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	snprintf(index, sizeof(index), "%s", argv[optind]);
+	slash = strrchr(index, '/');
+	snprintf(slash != NULL ? slash + 1 : index, sizeof(index) - (slash != NULL ? slash + 1 - index : 0),
+		"%s", API_AUDIT_INDEX_FILE);
+	ifd = open(index, O_RDONLY);
+	n = api_audit_query(fd, ifd, &filter, print_event, NULL);
+	close(fd);
+	if(ifd >= 0) {
+		close(ifd);
+	}
+	if(n < 0) {
+		fprintf(stderr, "%s: not an audit log or damaged\n", argv[optind]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * tauditwatch - follow the audit event ring of a proxy, see api_auditshm.h
+ *
+ *   tauditwatch [-o] <port>    -o starts at the oldest event in the ring
+ *
+ * One event per line: sequence, time, type, client, server, user and
+ * message. Events the proxy overwrote before they were read are reported.
+ */
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "api_auditshm.h"
+
+int main(int argc, char *argv[])
+{
+	api_auditshm_reader_t *reader = NULL;
+	api_audit_event_t e;
+	struct timespec idle = {0, 1000000};
+	char name[64], ts[32];
+	uint64_t seq = 0, lost = 0;
+	time_t t = 0;
+	int oldest = 0, rc = 0;
+
+	if(argc > 1 && strcmp(argv[1], "-o") == 0) {
+		oldest = 1;
+		argv++;
+		argc--;
+	}
+	if(argc != 2) {
+		fprintf(stderr, "usage: %s [-o] <port>\n", argv[0]);
+		return 1;
+	}
+	snprintf(name, sizeof(name), API_AUDITSHM_NAME, atoi(argv[1]));
+	reader = malloc(sizeof(*reader));
+	if(reader == NULL) {
+		return 1;
+	}
+	while(api_auditshm_attach(reader, name, oldest) != 0) {
+		sleep(1);
+	}
+	for(;;) {
+		rc = api_auditshm_read(reader, &e, &seq);
+		if(reader->lost != lost) {
+			printf("*** %llu events lost\n", (unsigned long long)(reader->lost - lost));
+			lost = reader->lost;
+		}
+		if(rc == 1) {
+			t = (time_t)(e.time / 1000000);
+			strftime(ts, sizeof(ts), "%Y/%m/%d %H:%M:%S", localtime(&t));
+			printf("%llu %s.%06u %s %s:%d->%s:%d %s %s\n", (unsigned long long)seq, ts,
+				(unsigned)(e.time % 1000000), api_audit_type_name(e.type),
+				e.cip, e.cport, e.sip, e.sport, e.user, e.message);
+		} else if(rc == 0) {
+			fflush(stdout);
+			nanosleep(&idle, NULL);
+		} else {
+			// the proxy is gone, or handed over: the ring under the name now
+			api_auditshm_detach(reader);
+			while(api_auditshm_attach(reader, name, 1) != 0) {
+				sleep(1);
+			}
+			lost = 0;
+		}
+	}
+	return 0;
+}
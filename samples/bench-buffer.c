@@ -0,0 +1,268 @@
+/*
+ * bench-buffer.c - microbenchmarks of ssh/buffer.c and ssh/string.c on
+ * the patterns packet.c and the channel code use.
+ *
+ * Usage: tbuffer [-n iterations] [-s samples] [-f filter]
+ *
+ *   -n iterations  operations per sample (default 100000)
+ *   -s samples     timed samples after the warmup run (default 15)
+ *   -f filter      only run benchmarks whose name contains `filter`
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ssh/ssh-api.h"
+#include "ssh/buffer.h"
+#include "ssh/string.h"
+#include "ssh/ssh2.h"
+
+#include "bench.h"
+
+#define PAYLOAD_MAX 32768
+
+typedef struct bench_ctx_struct {
+	ssh_buffer_t *buffer;
+	ssh_buffer_t *packet;     /* a built SSH2_MSG_CHANNEL_DATA payload */
+	ssh_string_t *string;
+	char          payload[PAYLOAD_MAX];
+	uint32_t      size;
+} bench_ctx_t;
+
+/* SSH2_MSG_CHANNEL_DATA as channel_write_common() builds it */
+static void add_channel_data(ssh_buffer_t *buffer, const char *data, uint32_t len)
+{
+	ssh_string_t *str = ssh_string_new(len);
+
+	ssh_string_fill(str, data, len);
+	buffer_add_u8(buffer, SSH2_MSG_CHANNEL_DATA);
+	buffer_add_u32(buffer, htonl(42));
+	buffer_add_ssh_string(buffer, str);
+	ssh_string_free(str);
+}
+
+/* reused buffer, header prepended the way packet_send2() does */
+static void bm_build_reuse(void *arg, long iters)
+{
+	bench_ctx_t *ctx = arg;
+	uint8_t header[5] = {0, 0, 0, 0, 4};
+	long i;
+
+	for(i = 0; i < iters; i++) {
+		buffer_reinit(ctx->buffer);
+		add_channel_data(ctx->buffer, ctx->payload, ctx->size);
+		buffer_prepend_data(ctx->buffer, header, sizeof(header));
+		bench_use(ssh_buffer_get_begin(ctx->buffer));
+	}
+}
+
+/* a new buffer per packet, as ssh_message and kex code do */
+static void bm_build_fresh(void *arg, long iters)
+{
+	bench_ctx_t *ctx = arg;
+	ssh_buffer_t *buffer = NULL;
+	long i;
+
+	for(i = 0; i < iters; i++) {
+		buffer = ssh_buffer_new();
+		add_channel_data(buffer, ctx->payload, ctx->size);
+		bench_use(ssh_buffer_get_begin(buffer));
+		ssh_buffer_free(buffer);
+	}
+}
+
+/* refill the in_buffer and take a packet apart like channel_rcv_data() */
+static void bm_parse(void *arg, long iters)
+{
+	bench_ctx_t *ctx = arg;
+	ssh_string_t *str = NULL;
+	uint32_t channel = 0;
+	uint8_t type = 0;
+	long i;
+
+	for(i = 0; i < iters; i++) {
+		buffer_reinit(ctx->buffer);
+		buffer_add_data(ctx->buffer, ssh_buffer_get_begin(ctx->packet),
+			ssh_buffer_get_len(ctx->packet));
+		buffer_get_u8(ctx->buffer, &type);
+		buffer_get_u32(ctx->buffer, &channel);
+		str = buffer_get_ssh_string(ctx->buffer);
+		bench_use(str);
+		ssh_string_free(str);
+	}
+}
+
+/* stream buffer: append what arrived, consume in packet sized steps */
+static void bm_stream(void *arg, long iters)
+{
+	bench_ctx_t *ctx = arg;
+	long i;
+
+	for(i = 0; i < iters; i++) {
+		buffer_add_data(ctx->buffer, ctx->payload, ctx->size);
+		if(buffer_get_rest_len(ctx->buffer) >= 4 * ctx->size) {
+			buffer_pass_bytes(ctx->buffer, 3 * ctx->size);
+		}
+	}
+	buffer_reinit(ctx->buffer);
+}
+
+/* growth policy: many small appends into a new buffer */
+static void bm_grow(void *arg, long iters)
+{
+	bench_ctx_t *ctx = arg;
+	ssh_buffer_t *buffer = NULL;
+	uint32_t n;
+	long i;
+
+	for(i = 0; i < iters; i++) {
+		buffer = ssh_buffer_new();
+		for(n = 0; n < ctx->size; n += 64) {
+			buffer_add_data(buffer, ctx->payload, 64);
+		}
+		ssh_buffer_free(buffer);
+	}
+}
+
+/* prepend without room in front, forces the memmove path */
+static void bm_prepend(void *arg, long iters)
+{
+	bench_ctx_t *ctx = arg;
+	uint8_t header[5] = {0, 0, 0, 0, 4};
+	long i;
+
+	for(i = 0; i < iters; i++) {
+		buffer_reinit(ctx->buffer);
+		buffer_add_data(ctx->buffer, ctx->payload, ctx->size);
+		buffer_prepend_data(ctx->buffer, header, sizeof(header));
+	}
+}
+
+/* name-list handling of KEXINIT */
+static void bm_string_char(void *arg, long iters)
+{
+	bench_ctx_t *ctx = arg;
+	ssh_string_t *str = NULL;
+	char *s = NULL;
+	long i;
+	(void)ctx;
+
+	for(i = 0; i < iters; i++) {
+		str = ssh_string_from_char("curve25519-sha256@libssh.org,ecdh-sha2-nistp256,"
+			"diffie-hellman-group14-sha1,diffie-hellman-group1-sha1");
+		s = ssh_string_to_char(str);
+		bench_use(s);
+		ssh_string_free_char(s);
+		ssh_string_free(str);
+	}
+}
+
+static void bm_string_copy(void *arg, long iters)
+{
+	bench_ctx_t *ctx = arg;
+	ssh_string_t *str = NULL;
+	long i;
+
+	for(i = 0; i < iters; i++) {
+		str = ssh_string_copy(ctx->string);
+		bench_use(str);
+		ssh_string_free(str);
+	}
+}
+
+typedef struct bench_case_struct {
+	const char *name;
+	bench_fn    fn;
+	uint32_t    size;
+	int         bytes;    /* report throughput */
+} bench_case_t;
+
+static const bench_case_t cases[] = {
+	{ "build/reuse/64",      bm_build_reuse, 64,    1 },
+	{ "build/reuse/1024",    bm_build_reuse, 1024,  1 },
+	{ "build/reuse/32768",   bm_build_reuse, 32768, 1 },
+	{ "build/fresh/64",      bm_build_fresh, 64,    1 },
+	{ "build/fresh/1024",    bm_build_fresh, 1024,  1 },
+	{ "build/fresh/32768",   bm_build_fresh, 32768, 1 },
+	{ "parse/64",            bm_parse,       64,    1 },
+	{ "parse/1024",          bm_parse,       1024,  1 },
+	{ "parse/32768",         bm_parse,       32768, 1 },
+	{ "stream/100",          bm_stream,      100,   1 },
+	{ "stream/4096",         bm_stream,      4096,  1 },
+	{ "grow/64x16",          bm_grow,        1024,  1 },
+	{ "grow/64x512",         bm_grow,        32768, 1 },
+	{ "prepend/1024",        bm_prepend,     1024,  1 },
+	{ "prepend/32768",       bm_prepend,     32768, 1 },
+	{ "string/from-to-char", bm_string_char, 0,     0 },
+	{ "string/copy/1024",    bm_string_copy, 1024,  1 },
+	{ NULL, NULL, 0, 0 }
+};
+
+static void usage(void)
+{
+	fputs("Usage: tbuffer [-n iterations] [-s samples] [-f filter]\n", stderr);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	bench_ctx_t *ctx = NULL;
+	bench_result_t result;
+	const char *filter = NULL;
+	long iters = 100000, n;
+	int samples = 15, opt, i;
+
+	while((opt = getopt(argc, argv, "n:s:f:")) != -1) {
+		switch(opt) {
+		case 'n':
+			iters = atol(optarg);
+			break;
+		case 's':
+			samples = atoi(optarg);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if(iters < 1 || samples < 1) {
+		usage();
+	}
+	ctx = calloc(1, sizeof(bench_ctx_t));
+	if(ctx == NULL) {
+		return 1;
+	}
+	memset(ctx->payload, 'x', sizeof(ctx->payload));
+	ctx->buffer = ssh_buffer_new();
+	ctx->packet = ssh_buffer_new();
+
+	bench_print_header();
+	for(i = 0; cases[i].name != NULL; i++) {
+		if(filter != NULL && strstr(cases[i].name, filter) == NULL) {
+			continue;
+		}
+		ctx->size = cases[i].size;
+		buffer_reinit(ctx->packet);
+		add_channel_data(ctx->packet, ctx->payload, ctx->size);
+		ctx->string = ssh_string_new(ctx->size);
+		ssh_string_fill(ctx->string, ctx->payload, ctx->size);
+		buffer_reinit(ctx->buffer);
+		/* keep a sample of the large cases in the tens of milliseconds */
+		n = ctx->size > 4096 ? iters / 10 : iters;
+		bench_run(&result, cases[i].name, cases[i].fn, ctx, n, samples,
+			cases[i].bytes ? ctx->size : 0);
+		bench_print(&result);
+		ssh_string_free(ctx->string);
+		ctx->string = NULL;
+	}
+
+	ssh_buffer_free(ctx->buffer);
+	ssh_buffer_free(ctx->packet);
+	free(ctx);
+	return 0;
+}
@@ -0,0 +1,427 @@
+/*
+ * bench-crypto.c - throughput of every cipher through the real
+ * packet_encrypt()/packet_decrypt() path, host key sign/verify per key
+ * type and full handshakes per key exchange method.
+ *
+ * Usage: bench-crypto [-n iterations] [-s samples] [-k handshakes] [-f filter]
+ *
+ *   -n iterations  packets per sample at 64 B, scaled down for larger
+ *                  packets (default 20000)
+ *   -s samples     timed samples after the warmup run (default 10)
+ *   -k handshakes  handshakes per sample for each KEX method (default 4)
+ *   -f filter      only run benchmarks whose name contains `filter`
+ *
+ * Cipher rows time one packet each: "enc" is packet_encrypt() including
+ * the MAC, "dec" is packet_decrypt() followed by packet_hmac_verify() as
+ * packet_parse() does. Each cipher is checked for a correct round trip
+ * before it is timed. KEX rows are complete handshakes over the loopback
+ * pair (see loopback.h) with its RSA host key, so they include one RSA
+ * sign and verify; the sign/verify rows give that share per key type.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ssh-includes.h"
+
+#include "ssh/priv.h"
+#include "ssh/buffer.h"
+#include "ssh/crypto.h"
+#include "ssh/pki.h"
+#include "ssh/session.h"
+#include "ssh/wrapper.h"
+
+#include "bench.h"
+#include "loopback.h"
+
+#define BENCH_KEYLEN 40    /* 2 SHA1 digests, as generate_session_keys() */
+#define BENCH_MACLEN 20
+
+static const uint32_t packet_sizes[] = { 64, 1024, 16384, 32768, 0 };
+
+static const char *kex_methods[] = {
+	"diffie-hellman-group1-sha1",
+	"diffie-hellman-group14-sha1",
+#ifdef HAVE_ECDH
+	"ecdh-sha2-nistp256",
+#endif
+#ifdef HAVE_CURVE25519
+	"curve25519-sha256@libssh.org",
+#endif
+	NULL
+};
+
+typedef struct cipher_ctx_struct {
+	ssh_session_t *tx;
+	ssh_session_t *rx;
+	ssh_buffer_t  *packet;
+	uint32_t       len;
+} cipher_ctx_t;
+
+typedef struct sign_ctx_struct {
+	ssh_session_t *session;
+	ssh_key_t     *key;
+	ssh_string_t  *sig;
+	int            failed;
+} sign_ctx_t;
+
+static const char *filter = NULL;
+static long iterations = 20000;
+static int samples = 10;
+
+static int selected(const char *name)
+{
+	return filter == NULL || strstr(name, filter) != NULL;
+}
+
+static unsigned char *random_blob(int len)
+{
+	unsigned char *p = malloc(len);
+
+	if(p != NULL) {
+		ssh_get_random(p, len, 0);
+	}
+	return p;
+}
+
+static struct ssh_cipher_struct *cipher_dup(const struct ssh_cipher_struct *tab)
+{
+	struct ssh_cipher_struct *cipher = malloc(sizeof(struct ssh_cipher_struct));
+
+	/* same as cipher_new(): the pointers are shared with the table */
+	if(cipher != NULL) {
+		memcpy(cipher, tab, sizeof(*cipher));
+	}
+	return cipher;
+}
+
+/* a session whose current_crypto uses `tab` both ways, keys shared with `peer` */
+static ssh_session_t *cipher_session(const struct ssh_cipher_struct *tab, ssh_session_t *peer)
+{
+	ssh_session_t *session = ssh_new();
+	ssh_crypto_t *crypto = NULL, *other = NULL;
+
+	if(session == NULL) {
+		return NULL;
+	}
+	session->version = 2;
+	crypto = crypto_new();
+	session->current_crypto = crypto;
+	if(crypto == NULL) {
+		ssh_free(session);
+		return NULL;
+	}
+	crypto->digest_len = BENCH_MACLEN;
+	crypto->in_cipher = cipher_dup(tab);
+	crypto->out_cipher = cipher_dup(tab);
+	if(peer == NULL) {
+		crypto->encryptkey = random_blob(BENCH_KEYLEN);
+		crypto->encryptIV = random_blob(BENCH_KEYLEN);
+		crypto->encryptMAC = random_blob(BENCH_MACLEN);
+		crypto->decryptkey = random_blob(BENCH_KEYLEN);
+		crypto->decryptIV = random_blob(BENCH_KEYLEN);
+		crypto->decryptMAC = random_blob(BENCH_MACLEN);
+	} else {
+		/* receive what the peer sends */
+		other = peer->current_crypto;
+		crypto->encryptkey = random_blob(BENCH_KEYLEN);
+		crypto->encryptIV = random_blob(BENCH_KEYLEN);
+		crypto->encryptMAC = random_blob(BENCH_MACLEN);
+		crypto->decryptkey = malloc(BENCH_KEYLEN);
+		crypto->decryptIV = malloc(BENCH_KEYLEN);
+		crypto->decryptMAC = malloc(BENCH_MACLEN);
+		if(crypto->decryptkey != NULL && crypto->decryptIV != NULL && crypto->decryptMAC != NULL) {
+			memcpy(crypto->decryptkey, other->encryptkey, BENCH_KEYLEN);
+			memcpy(crypto->decryptIV, other->encryptIV, BENCH_KEYLEN);
+			memcpy(crypto->decryptMAC, other->encryptMAC, BENCH_MACLEN);
+		}
+	}
+	if(crypto->in_cipher == NULL || crypto->out_cipher == NULL ||
+		crypto->encryptkey == NULL || crypto->encryptIV == NULL || crypto->encryptMAC == NULL ||
+		crypto->decryptkey == NULL || crypto->decryptIV == NULL || crypto->decryptMAC == NULL) {
+		ssh_free(session);
+		return NULL;
+	}
+	return session;
+}
+
+static void bm_encrypt(void *arg, long iters)
+{
+	cipher_ctx_t *ctx = arg;
+	long i;
+
+	for(i = 0; i < iters; i++) {
+		bench_use(packet_encrypt(ctx->tx, buffer_get_rest(ctx->packet), ctx->len));
+		ctx->tx->send_seq++;
+	}
+}
+
+static void bm_decrypt(void *arg, long iters)
+{
+	cipher_ctx_t *ctx = arg;
+	long i;
+
+	/* the MAC won't match after the first packet, the cost is the same */
+	for(i = 0; i < iters; i++) {
+		packet_decrypt(ctx->rx, buffer_get_rest(ctx->packet), ctx->len);
+		packet_hmac_verify(ctx->rx, ctx->packet, ctx->tx->current_crypto->hmacbuf);
+		ctx->rx->recv_seq++;
+	}
+}
+
+/* encrypt with tx, decrypt and verify with rx */
+static int cipher_check(cipher_ctx_t *ctx)
+{
+	unsigned char *plain = NULL, *mac = NULL;
+	int rc = -1;
+
+	plain = random_blob(ctx->len);
+	if(plain == NULL) {
+		return -1;
+	}
+	memcpy(buffer_get_rest(ctx->packet), plain, ctx->len);
+	mac = packet_encrypt(ctx->tx, buffer_get_rest(ctx->packet), ctx->len);
+	if(mac != NULL && packet_decrypt(ctx->rx, buffer_get_rest(ctx->packet), ctx->len) == 0 &&
+		packet_hmac_verify(ctx->rx, ctx->packet, mac) == 0 &&
+		memcmp(buffer_get_rest(ctx->packet), plain, ctx->len) == 0) {
+		rc = 0;
+	}
+	SAFE_FREE(plain);
+	return rc;
+}
+
+static void bench_ciphers(void)
+{
+	struct ssh_cipher_struct *tab = ssh_get_ciphertab();
+	bench_result_t result;
+	cipher_ctx_t ctx;
+	unsigned char *zero = NULL;
+	char name[64];
+	long iters;
+	int i, j;
+
+	for(i = 0; tab[i].name != NULL; i++) {
+		for(j = 0; packet_sizes[j] != 0; j++) {
+			snprintf(name, sizeof(name), "%s/%u", tab[i].name, packet_sizes[j]);
+			if(!selected(name)) {
+				continue;
+			}
+			memset(&ctx, 0x00, sizeof(ctx));
+			ctx.len = packet_sizes[j];
+			ctx.tx = cipher_session(&tab[i], NULL);
+			ctx.rx = ctx.tx != NULL ? cipher_session(&tab[i], ctx.tx) : NULL;
+			ctx.packet = ssh_buffer_new();
+			if(ctx.rx == NULL || ctx.packet == NULL) {
+				fprintf(stderr, "%s: setup failed\n", name);
+				goto next;
+			}
+			zero = calloc(1, ctx.len);
+			if(zero == NULL || buffer_add_data(ctx.packet, zero, ctx.len) < 0) {
+				SAFE_FREE(zero);
+				goto next;
+			}
+			SAFE_FREE(zero);
+			if(cipher_check(&ctx) != 0) {
+				printf("%-32s round trip FAILED\n", name);
+				goto next;
+			}
+			iters = iterations * 64 / ctx.len;
+			if(iters < 16) {
+				iters = 16;
+			}
+			snprintf(name, sizeof(name), "enc/%s/%u", tab[i].name, ctx.len);
+			bench_print(bench_run(&result, name, bm_encrypt, &ctx, iters, samples, ctx.len));
+			snprintf(name, sizeof(name), "dec/%s/%u", tab[i].name, ctx.len);
+			bench_print(bench_run(&result, name, bm_decrypt, &ctx, iters, samples, ctx.len));
+next:
+			if(ctx.packet != NULL) {
+				ssh_buffer_free(ctx.packet);
+			}
+			if(ctx.tx != NULL) {
+				ssh_free(ctx.tx);
+			}
+			if(ctx.rx != NULL) {
+				ssh_free(ctx.rx);
+			}
+		}
+	}
+}
+
+static void bm_sign(void *arg, long iters)
+{
+	sign_ctx_t *ctx = arg;
+	ssh_string_t *sig = NULL;
+	long i;
+
+	for(i = 0; i < iters; i++) {
+		sig = ssh_srv_pki_do_sign_sessionid(ctx->session, ctx->key);
+		if(sig == NULL) {
+			ctx->failed = 1;
+			return;
+		}
+		ssh_string_free(sig);
+	}
+}
+
+static void bm_verify(void *arg, long iters)
+{
+	sign_ctx_t *ctx = arg;
+	ssh_crypto_t *crypto = ctx->session->next_crypto;
+	long i;
+
+	for(i = 0; i < iters; i++) {
+		if(ssh_pki_signature_verify_blob(ctx->session, ctx->sig, ctx->key,
+				crypto->secret_hash, crypto->digest_len) != SSH_OK) {
+			ctx->failed = 1;
+			return;
+		}
+	}
+}
+
+static void bench_hostkey(enum ssh_keytypes_e type, int bits, const char *label)
+{
+	bench_result_t result;
+	sign_ctx_t ctx;
+	char name[64];
+
+	snprintf(name, sizeof(name), "sign/%s", label);
+	if(!selected(name) && !selected(label)) {
+		return;
+	}
+	memset(&ctx, 0x00, sizeof(ctx));
+	ctx.session = ssh_new();
+	if(ctx.session == NULL || ssh_pki_generate(type, bits, &ctx.key) != SSH_OK) {
+		fprintf(stderr, "%s: key generation failed\n", label);
+		goto end;
+	}
+	/* the exchange hash the server signs in the KEX reply */
+	ctx.session->next_crypto->digest_len = SHA_DIGEST_LEN;
+	ctx.session->next_crypto->secret_hash = random_blob(SHA_DIGEST_LEN);
+	ctx.sig = ssh_srv_pki_do_sign_sessionid(ctx.session, ctx.key);
+	if(ctx.sig == NULL) {
+		fprintf(stderr, "%s: sign failed\n", label);
+		goto end;
+	}
+
+	bench_run(&result, name, bm_sign, &ctx, iterations / 200 + 1, samples, 0);
+	if(ctx.failed) {
+		printf("%-32s FAILED\n", name);
+	} else {
+		bench_print(&result);
+	}
+	snprintf(name, sizeof(name), "verify/%s", label);
+	bench_run(&result, name, bm_verify, &ctx, iterations / 20 + 1, samples, 0);
+	if(ctx.failed) {
+		printf("%-32s FAILED\n", name);
+	} else {
+		bench_print(&result);
+	}
+end:
+	if(ctx.sig != NULL) {
+		ssh_string_free(ctx.sig);
+	}
+	if(ctx.key != NULL) {
+		ssh_key_free(ctx.key);
+	}
+	if(ctx.session != NULL) {
+		ssh_free(ctx.session);
+	}
+}
+
+typedef struct kex_ctx_struct {
+	const char *method;
+	int         failed;
+} kex_ctx_t;
+
+static void bm_kex(void *arg, long iters)
+{
+	kex_ctx_t *ctx = arg;
+	loopback_t lb;
+	long i;
+
+	for(i = 0; i < iters && !ctx->failed; i++) {
+		if(loopback_init(&lb) != 0) {
+			ctx->failed = 1;
+			return;
+		}
+		ssh_options_set(lb.client, SSH_OPTIONS_KEY_EXCHANGE, ctx->method);
+		if(loopback_connect(&lb, LOOPBACK_KEX) != 0) {
+			ctx->failed = 1;
+		}
+		loopback_free(&lb);
+	}
+}
+
+static void bench_kex(int handshakes)
+{
+	bench_result_t result;
+	kex_ctx_t ctx;
+	char name[64];
+	int i;
+
+	for(i = 0; kex_methods[i] != NULL; i++) {
+		snprintf(name, sizeof(name), "kex/%s", kex_methods[i]);
+		if(!selected(name)) {
+			continue;
+		}
+		ctx.method = kex_methods[i];
+		ctx.failed = 0;
+		bench_run(&result, name, bm_kex, &ctx, handshakes, samples, 0);
+		if(ctx.failed) {
+			printf("%-32s FAILED\n", name);
+		} else {
+			bench_print(&result);
+		}
+	}
+}
+
+static void usage(void)
+{
+	fputs("Usage: bench-crypto [-n iterations] [-s samples] [-k handshakes] [-f filter]\n", stderr);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, handshakes = 4;
+
+	while((opt = getopt(argc, argv, "n:s:k:f:")) != -1) {
+		switch(opt) {
+		case 'n':
+			iterations = atol(optarg);
+			break;
+		case 's':
+			samples = atoi(optarg);
+			break;
+		case 'k':
+			handshakes = atoi(optarg);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if(iterations < 64 || samples < 1 || handshakes < 1) {
+		usage();
+	}
+	/* also runs ssh_init() */
+	if(loopback_global_init(0) != 0) {
+		return 1;
+	}
+
+	bench_print_header();
+	bench_ciphers();
+	bench_hostkey(SSH_KEYTYPE_RSA, 2048, "ssh-rsa-2048");
+	bench_hostkey(SSH_KEYTYPE_DSS, 1024, "ssh-dss-1024");
+#ifdef HAVE_ECC
+	bench_hostkey(SSH_KEYTYPE_ECDSA, 256, "ecdsa-sha2-nistp256");
+#endif
+	bench_kex(handshakes);
+
+	loopback_global_finalize();
+	return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * bench-loopback.c - handshake rate and channel throughput of libssh on
+ * an in-process session pair (see loopback.h), no sshd or network needed.
+ *
+ * Usage: tloopback [-c cipher] [-k handshakes] [-s size] [-m megabytes]
+ *
+ *   -c cipher      cipher for both directions, e.g. aes128-ctr
+ *   -k handshakes  number of full KEX runs to time (default 20)
+ *   -s size        bytes per ssh_channel_write() (default 16384)
+ *   -m megabytes   amount sent client->server over the channel (default 64)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ssh/ssh-api.h"
+
+#include "loopback.h"
+#include "timer.h"
+
+static const char *cipher = NULL;
+
+static int bench_setup(loopback_t *lb, int stage)
+{
+	if(loopback_init(lb) != 0) {
+		return -1;
+	}
+	if(cipher != NULL) {
+		ssh_options_set(lb->client, SSH_OPTIONS_CIPHERS_C_S, cipher);
+		ssh_options_set(lb->client, SSH_OPTIONS_CIPHERS_S_C, cipher);
+	}
+	if(loopback_connect(lb, stage) != 0) {
+		loopback_free(lb);
+		return -1;
+	}
+	return 0;
+}
+
+static int bench_kex(int count)
+{
+	struct timespec t1, t2;
+	loopback_t lb;
+	double elapsed = 0;
+	int i;
+
+	for(i = 0; i < count; i++) {
+		t1 = snap_time();
+		if(bench_setup(&lb, LOOPBACK_KEX) != 0) {
+			return -1;
+		}
+		t2 = snap_time();
+		elapsed += get_elapsed(t1, t2);
+		loopback_free(&lb);
+	}
+	if(count > 0) {
+		fprintf(stderr, "kex    : %d handshakes, %.3f ms each, %.1f/s\n",
+			count, elapsed * 1e3 / count, count / elapsed);
+	}
+	return 0;
+}
+
+static int bench_channel(int size, long total)
+{
+	struct timespec t1, t2;
+	loopback_t lb;
+	char *wbuf = NULL, *rbuf = NULL;
+	long sent = 0;
+	int n, got;
+
+	if(bench_setup(&lb, LOOPBACK_CHANNEL) != 0) {
+		return -1;
+	}
+	wbuf = malloc(size);
+	rbuf = malloc(size);
+	if(wbuf == NULL || rbuf == NULL) {
+		goto end;
+	}
+	memset(wbuf, 'x', size);
+	t1 = snap_time();
+	while(sent < total) {
+		if(ssh_channel_write(lb.cchan, wbuf, size) != size) {
+			fprintf(stderr, "channel write: %s\n", ssh_get_error(lb.client));
+			break;
+		}
+		/* drain before the next write, the pair is driven by one thread */
+		for(got = 0; got < size; got += n) {
+			n = ssh_channel_read(lb.schan, rbuf + got, size - got, 0);
+			if(n <= 0) {
+				fprintf(stderr, "channel read: %s\n", ssh_get_error(lb.server));
+				goto end;
+			}
+		}
+		sent += size;
+	}
+	t2 = snap_time();
+	fprintf(stderr, "channel: %ld bytes in %d byte writes, %.2f MB/s\n",
+		sent, size, sent / get_elapsed(t1, t2) / 1e6);
+end:
+	free(wbuf);
+	free(rbuf);
+	loopback_free(&lb);
+	return sent < total ? -1 : 0;
+}
+
+static void usage(void)
+{
+	fputs("Usage: tloopback [-c cipher] [-k handshakes] [-s size] [-m megabytes]\n", stderr);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, kex = 20, size = 16384, mbytes = 64, rc = 0;
+
+	while((opt = getopt(argc, argv, "c:k:s:m:")) != -1) {
+		switch(opt) {
+		case 'c':
+			cipher = optarg;
+			break;
+		case 'k':
+			kex = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'm':
+			mbytes = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if(kex < 0 || size < 1 || mbytes < 0) {
+		usage();
+	}
+	if(loopback_global_init(0) != 0) {
+		return 1;
+	}
+	rc |= bench_kex(kex);
+	if(mbytes > 0) {
+		rc |= bench_channel(size, (long)mbytes * 1024 * 1024);
+	}
+	loopback_global_finalize();
+	return rc != 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * bench.c - timing harness and allocation counter, see bench.h
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+static uint64_t bench_nallocs = 0;
+
+#ifdef __GLIBC__
+/*
+ * Interpose the allocator of the benchmark program, which also catches
+ * the calls made by the statically linked libssh and libmisc.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	__atomic_add_fetch(&bench_nallocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&bench_nallocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&bench_nallocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+uint64_t bench_allocs(void)
+{
+	return __atomic_load_n(&bench_nallocs, __ATOMIC_RELAXED);
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+bench_result_t *bench_run(bench_result_t *result, const char *name,
+		bench_fn fn, void *arg, long iters, int samples, uint64_t bytes)
+{
+	double ns[BENCH_MAX_SAMPLES], cycles[BENCH_MAX_SAMPLES];
+	double sum = 0, var = 0;
+	uint64_t t1, t2, c1, c2, a1, a2 = 0;
+	int i;
+
+	if(samples > BENCH_MAX_SAMPLES) {
+		samples = BENCH_MAX_SAMPLES;
+	}
+	if(samples < 1) {
+		samples = 1;
+	}
+	if(iters < 1) {
+		iters = 1;
+	}
+	memset(result, 0x00, sizeof(*result));
+	result->name = name;
+	result->iters = iters;
+	result->samples = samples;
+	result->bytes = bytes;
+
+	/* warmup */
+	fn(arg, iters);
+
+	a1 = bench_allocs();
+	for(i = 0; i < samples; i++) {
+		t1 = bench_ns();
+		c1 = bench_cycles();
+		fn(arg, iters);
+		c2 = bench_cycles();
+		t2 = bench_ns();
+		ns[i] = (double)(t2 - t1) / iters;
+		cycles[i] = (double)(c2 - c1) / iters;
+		sum += ns[i];
+	}
+	a2 = bench_allocs();
+
+	result->ns_mean = sum / samples;
+	for(i = 0; i < samples; i++) {
+		var += (ns[i] - result->ns_mean) * (ns[i] - result->ns_mean);
+	}
+	result->ns_stddev = sqrt(var / samples);
+	qsort(ns, samples, sizeof(double), bench_cmp);
+	qsort(cycles, samples, sizeof(double), bench_cmp);
+	result->ns_min = ns[0];
+	result->ns_median = ns[samples / 2];
+	result->cycles_median = cycles[samples / 2];
+	result->allocs = (double)(a2 - a1) / ((double)iters * samples);
+	return result;
+}
+
+void bench_print_header(void)
+{
+	printf("%-32s %10s %10s %10s %8s %10s %8s %10s %8s\n",
+		"benchmark", "min ns", "median ns", "mean ns", "stddev",
+		"cycles", "allocs", "MB/s", "cyc/B");
+}
+
+void bench_print(const bench_result_t *r)
+{
+	printf("%-32s %10.1f %10.1f %10.1f %7.1f%% %10.0f %8.2f",
+		r->name, r->ns_min, r->ns_median, r->ns_mean,
+		r->ns_mean > 0 ? r->ns_stddev * 100 / r->ns_mean : 0,
+		r->cycles_median, r->allocs);
+	if(r->bytes > 0 && r->ns_min > 0) {
+		printf(" %10.1f %8.2f", r->bytes * 1e3 / r->ns_min,
+			r->cycles_median / r->bytes);
+	}
+	printf("\n");
+	fflush(stdout);
+}
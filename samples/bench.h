@@ -0,0 +1,77 @@
+/*
+ * bench.h - timing harness shared by the benchmark programs in samples/.
+ *
+ * A benchmark is a function running `iters` operations. bench_run() calls
+ * it once to warm caches and allocator up, then `samples` more times and
+ * reports, per operation:
+ *
+ *   ns      min, median and mean wall time (CLOCK_MONOTONIC)
+ *   cycles  median TSC cycles (rdtsc on x86, 0 elsewhere)
+ *   allocs  malloc/calloc/realloc calls, counted by bench.c
+ *
+ * The minimum is the number to compare between builds, the spread between
+ * minimum and median shows how noisy the box is. Pin the process with
+ * taskset and disable frequency scaling for cycle counts that mean much.
+ */
+
+#ifndef SSH_SAMPLES_BENCH_H
+#define SSH_SAMPLES_BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define BENCH_MAX_SAMPLES 256
+
+typedef void (*bench_fn)(void *arg, long iters);
+
+typedef struct bench_result_struct {
+	const char *name;
+	long     iters;          /* operations per sample */
+	int      samples;
+	double   ns_min;         /* per operation */
+	double   ns_median;
+	double   ns_mean;
+	double   ns_stddev;
+	double   cycles_median;
+	double   allocs;         /* allocations per operation */
+	uint64_t bytes;          /* payload per operation, 0 if not meaningful */
+} bench_result_t;
+
+static inline uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint32_t lo, hi;
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+#else
+	return 0;
+#endif
+}
+
+static inline uint64_t bench_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/* allocation calls since start, stays 0 if malloc can't be interposed */
+uint64_t bench_allocs(void);
+
+/* keep the compiler from dropping a result */
+static inline void bench_use(const void *p)
+{
+	__asm__ __volatile__("" : : "r"(p) : "memory");
+}
+
+/*
+ * Run `fn` as described above. `bytes` is the payload of one operation,
+ * used to print MB/s and cycles/byte. Returns the filled `result`.
+ */
+bench_result_t *bench_run(bench_result_t *result, const char *name,
+		bench_fn fn, void *arg, long iters, int samples, uint64_t bytes);
+
+void bench_print_header(void);
+void bench_print(const bench_result_t *result);
+
+#endif /* ! SSH_SAMPLES_BENCH_H */
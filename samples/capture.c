@@ -0,0 +1,54 @@
+/*
+ * tcapture - read back a capture file, see api_capture.h
+ *
+ *   tcapture [-s <store>] <file.cap>                      all of it to stdout
+ *   tcapture [-s <store>] <file.cap> <offset> [<length>]  a byte range of it
+ *
+ * -s reads the chunks from <store> instead of API_CAPTURE_STORE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "api_capture.h"
+
+int main(int argc, char *argv[])
+{
+	uint64_t offset = 0, length = 0;
+	int64_t n = 0;
+	int fd = -1;
+
+	if(argc > 2 && strcmp(argv[1], "-s") == 0) {
+		api_capture_store(argv[2]);
+		argv[2] = argv[0];
+		argv += 2;
+		argc -= 2;
+	}
+	if(argc < 2 || argc > 4) {
+		fprintf(stderr, "usage: %s [-s <store>] <file.cap> [<offset> [<length>]]\n", argv[0]);
+		return 1;
+	}
+	if(argc > 2) {
+		offset = strtoull(argv[2], NULL, 0);
+	}
+	if(argc > 3) {
+		length = strtoull(argv[3], NULL, 0);
+		if(length == 0) {
+			return 0;
+		}
+	}
+	fd = open(argv[1], O_RDONLY);
+	if(fd < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	n = api_capture_extract(fd, offset, length, STDOUT_FILENO);
+	close(fd);
+	if(n < 0) {
+		fprintf(stderr, "%s: not a capture file or damaged\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * tcmdpolicy - shell lines against the command policy, see ssh_cmdpolicy.h
+ *
+ *   tcmdpolicy
+ *
+ * Types keystrokes as a client would and checks which of them end a line
+ * and what the policy does with that line, as the proxy does for a shell
+ * channel: a blocked command must be caught whatever ends it, CR, LF or
+ * ^D. Writes its rules to a temporary file, returns the number of
+ * failures.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "ssh_cmdpolicy.h"
+#define TEST
+#include "test.h"
+
+static const char rules[] =
+	"# action  pattern\n"
+	"block     rm -rf /\n"
+	"alert     sudo su\n";
+
+typedef struct shell_line_struct {
+	uint32_t state;
+	int      rule;
+	size_t   typed;
+} shell_line_t;
+
+// feed `keys` to `line`, returns the action of the first line they end or
+// -1 if none ends, `*at` is the key that ended it
+static int shell_type(shell_line_t *line, const char *keys, size_t len, size_t *at)
+{
+	size_t i = 0;
+	int action = -1;
+
+	for(i = 0; i < len; i++) {
+		if(ssh_cmdpolicy_enter(keys[i], line->typed > 0)) {
+			action = ssh_cmdpolicy_action(line->rule);
+			memset(line, 0x00, sizeof(*line));
+			line->rule = -1;
+			*at = i;
+			return action;
+		}
+		line->rule = ssh_cmdpolicy_feed(&line->state, line->rule, keys + i, 1);
+		line->typed++;
+	}
+	return action;
+}
+
+static void shell_expect(const char *name, const char *keys, size_t len, int action, size_t at)
+{
+	shell_line_t line;
+	size_t end = (size_t)-1;
+	int got = 0;
+
+	memset(&line, 0x00, sizeof(line));
+	line.rule = -1;
+	got = shell_type(&line, keys, len, &end);
+	test(got == action && (action == -1 || end == at), "%s: action %d at %d (want %d at %d)",
+		name, got, (int)end, action, (int)at);
+}
+
+int main(void)
+{
+	char path[] = "/tmp/tcmdpolicy.XXXXXX";
+	int fd = mkstemp(path);
+
+	if(fd == -1 || write(fd, rules, sizeof(rules) - 1) != (ssize_t)(sizeof(rules) - 1)) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+	test(ssh_cmdpolicy_load(path) == 2, "%s: 2 rules", path);
+	unlink(path);
+
+	shell_expect("CR", "rm -rf /\r", 9, SSH_CMDPOLICY_BLOCK, 8);
+	shell_expect("LF", "rm -rf /\n", 9, SSH_CMDPOLICY_BLOCK, 8);
+	shell_expect("^D", "rm -rf /\004", 9, SSH_CMDPOLICY_BLOCK, 8);
+	shell_expect("LF alert", "sudo su\n", 8, SSH_CMDPOLICY_ALERT, 7);
+	shell_expect("LF pass", "ls -l\n", 6, SSH_CMDPOLICY_PASS, 5);
+	shell_expect("CR empty", "\r", 1, SSH_CMDPOLICY_PASS, 0);
+	// the LF of a CR LF, a ^D at the prompt: no line to check
+	shell_expect("LF empty", "\n", 1, -1, 0);
+	shell_expect("^D empty", "\004", 1, -1, 0);
+	shell_expect("no end", "rm -rf /", 8, -1, 0);
+
+	ssh_cmdpolicy_free();
+	return report_results();
+}
@@ -0,0 +1,120 @@
+/*
+ * tcommands - search the command history, see api_cmdindex.h
+ *
+ *   tcommands [-d <dir>] [-u <user>] [-h <host>] [-f <from>] [-t <to>]
+ *             [-n <max>] [<word> ...]
+ *
+ * Commands holding all the words ("word*" for any word starting so, in
+ * quotes for the shell), run by the user on the host (server address or
+ * route) in [from, to). Times are "YYYY-MM-DD [HH:MM:SS]" local time or
+ * seconds since the epoch. One command per line, oldest first: time,
+ * user, session, host, route, kind and the command, tab separated.
+ */
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "api_audit.h"
+#include "api_cmdindex.h"
+
+static int print_command(const api_cmdindex_command_t *c, void *arg)
+{
+	static const char *actions[] = {"", " alert", " blocked"};
+	int *left = arg;
+	char when[32];
+	time_t t = (time_t)(c->time / 1000000);
+
+	strftime(when, sizeof(when), "%Y/%m/%d %H:%M:%S", localtime(&t));
+	printf("%s\t%s\t%s\t%s\t%s\t%s%s\t%s\n", when, c->user, c->session, c->host, c->route,
+		c->kind == API_AUDIT_EXEC ? "exec" : "shell",
+		c->action >= 0 && c->action <= API_CMDINDEX_BLOCK ? actions[c->action] : "",
+		c->command);
+	return *left > 0 && --*left == 0;
+}
+
+// microseconds since the epoch, 0 if `s` is no time
+static uint64_t parse_time(const char *s)
+{
+	struct tm tm;
+	const char *end = NULL;
+	char *num = NULL;
+	unsigned long long secs = 0;
+
+	memset(&tm, 0x00, sizeof(tm));
+	end = strptime(s, "%Y-%m-%d %H:%M:%S", &tm);
+	if(end == NULL) {
+		memset(&tm, 0x00, sizeof(tm));
+		end = strptime(s, "%Y-%m-%d", &tm);
+	}
+	if(end != NULL && *end == '\0') {
+		tm.tm_isdst = -1;
+		return (uint64_t)mktime(&tm) * 1000000;
+	}
+	secs = strtoull(s, &num, 10);
+	return *s != '\0' && *num == '\0' ? (uint64_t)secs * 1000000 : 0;
+}
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d <dir>] [-u <user>] [-h <host>] [-f <from>] [-t <to>] [-n <max>] [<word> ...]\n", name);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	api_cmdindex_filter_t filter;
+	const char *dir = API_CMDINDEX_DIR;
+	char words[4096];
+	size_t len = 0;
+	int opt = 0, left = 0, n = -1, i = 0;
+
+	memset(&filter, 0x00, sizeof(filter));
+	while((opt = getopt(argc, argv, "d:u:h:f:t:n:")) != -1) {
+		switch(opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'u':
+			filter.user = optarg;
+			break;
+		case 'h':
+			filter.host = optarg;
+			break;
+		case 'f':
+			if((filter.from = parse_time(optarg)) == 0) {
+				return usage(argv[0]);
+			}
+			break;
+		case 't':
+			if((filter.to = parse_time(optarg)) == 0) {
+				return usage(argv[0]);
+			}
+			break;
+		case 'n':
+			left = atoi(optarg);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	words[0] = '\0';
+	for(i = optind; i < argc; i++) {
+		len += snprintf(words + len, sizeof(words) - len, "%s ", argv[i]);
+		if(len >= sizeof(words)) {
+			return usage(argv[0]);
+		}
+	}
+	filter.words = words;
+	if(words[0] == '\0' && filter.user == NULL && filter.host == NULL) {
+		return usage(argv[0]);
+	}
+	n = api_cmdindex_query(dir, &filter, print_command, &left);
+	if(n < 0) {
+		fprintf(stderr, "%s: no command history\n", dir);
+		return 1;
+	}
+	return 0;
+}
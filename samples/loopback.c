@@ -0,0 +1,234 @@
+/*
+ * loopback.c - in-process client/server session pair, see loopback.h
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "ssh/ssh-api.h"
+#include "ssh/server.h"
+#include "ssh/callbacks.h"
+
+#include "loopback.h"
+
+/* socketpair buffers, large enough for one 32KB channel packet each way */
+#define LOOPBACK_SOCKBUF (256 * 1024)
+
+static char loopback_keyfile[] = "/tmp/loopback-rsa-XXXXXX";
+static int loopback_haskey = 0;
+
+int loopback_global_init(int bits)
+{
+	ssh_key_t *key = NULL;
+	int fd = -1;
+
+	/* the second ssh_disconnect() of a pair writes to a closed peer */
+	signal(SIGPIPE, SIG_IGN);
+	ssh_threads_set_callbacks(ssh_threads_get_pthread());
+	if(ssh_init() < 0) {
+		return -1;
+	}
+	if(ssh_pki_generate(SSH_KEYTYPE_RSA, bits > 0 ? bits : 2048, &key) != SSH_OK) {
+		fprintf(stderr, "loopback: can't generate host key\n");
+		return -1;
+	}
+	fd = mkstemp(loopback_keyfile);
+	if(fd == -1) {
+		perror(loopback_keyfile);
+		ssh_key_free(key);
+		return -1;
+	}
+	close(fd);
+	loopback_haskey = 1;
+	if(ssh_pki_export_privkey_file(key, NULL, NULL, NULL, loopback_keyfile) != SSH_OK) {
+		fprintf(stderr, "loopback: can't write %s\n", loopback_keyfile);
+		ssh_key_free(key);
+		return -1;
+	}
+	ssh_key_free(key);
+	return 0;
+}
+
+void loopback_global_finalize(void)
+{
+	if(loopback_haskey) {
+		unlink(loopback_keyfile);
+		loopback_haskey = 0;
+	}
+	ssh_finalize();
+}
+
+int loopback_init(loopback_t *lb)
+{
+	int i, size = LOOPBACK_SOCKBUF;
+
+	memset(lb, 0x00, sizeof(*lb));
+	lb->fd[0] = lb->fd[1] = -1;
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, lb->fd) != 0) {
+		perror("socketpair");
+		return -1;
+	}
+	for(i = 0; i < 2; i++) {
+		setsockopt(lb->fd[i], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+		setsockopt(lb->fd[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+	lb->bind = ssh_bind_new();
+	lb->client = ssh_new();
+	lb->server = ssh_new();
+	if(lb->bind == NULL || lb->client == NULL || lb->server == NULL) {
+		loopback_free(lb);
+		return -1;
+	}
+	ssh_bind_options_set(lb->bind, SSH_BIND_OPTIONS_RSAKEY, loopback_keyfile);
+	ssh_options_set(lb->client, SSH_OPTIONS_HOST, "loopback");
+	ssh_options_set(lb->client, SSH_OPTIONS_USER, LOOPBACK_USER);
+	return 0;
+}
+
+static int loopback_server_auth(loopback_t *lb)
+{
+	ssh_message_t *message = NULL;
+	int auth = 0;
+
+	do {
+		message = ssh_message_get(lb->server);
+		if(message == NULL) {
+			break;
+		}
+		if(ssh_message_type(message) == SSH_REQUEST_AUTH &&
+			ssh_message_subtype(message) == SSH_AUTH_METHOD_PASSWORD &&
+			strcmp(ssh_message_auth_user(message), LOOPBACK_USER) == 0 &&
+			strcmp(ssh_message_auth_password(message), LOOPBACK_PASSWORD) == 0) {
+			auth = 1;
+			ssh_message_auth_reply_success(message, 0);
+		} else {
+			if(ssh_message_type(message) == SSH_REQUEST_AUTH) {
+				ssh_message_auth_set_methods(message, SSH_AUTH_METHOD_PASSWORD);
+			}
+			ssh_message_reply_default(message);
+		}
+		ssh_message_free(message);
+	} while(!auth);
+	return auth ? 0 : -1;
+}
+
+static int loopback_server_channel(loopback_t *lb)
+{
+	ssh_message_t *message = NULL;
+
+	do {
+		message = ssh_message_get(lb->server);
+		if(message == NULL) {
+			break;
+		}
+		if(ssh_message_type(message) == SSH_REQUEST_CHANNEL_OPEN &&
+			ssh_message_subtype(message) == SSH_CHANNEL_SESSION) {
+			lb->schan = ssh_message_channel_request_open_reply_accept(message);
+		} else {
+			ssh_message_reply_default(message);
+		}
+		ssh_message_free(message);
+	} while(lb->schan == NULL);
+	return lb->schan != NULL ? 0 : -1;
+}
+
+static void *loopback_server(void *arg)
+{
+	loopback_t *lb = arg;
+
+	lb->server_rc = -1;
+	if(ssh_bind_accept_fd(lb->bind, lb->server, lb->fd[1]) != SSH_OK) {
+		fprintf(stderr, "loopback: accept: %s\n", ssh_get_error(lb->bind));
+		return NULL;
+	}
+	lb->fd[1] = -1;
+	if(ssh_handle_key_exchange(lb->server) != SSH_OK) {
+		fprintf(stderr, "loopback: server kex: %s\n", ssh_get_error(lb->server));
+		return NULL;
+	}
+	if(lb->stage >= LOOPBACK_AUTH && loopback_server_auth(lb) != 0) {
+		fprintf(stderr, "loopback: server auth: %s\n", ssh_get_error(lb->server));
+		return NULL;
+	}
+	if(lb->stage >= LOOPBACK_CHANNEL && loopback_server_channel(lb) != 0) {
+		fprintf(stderr, "loopback: server channel: %s\n", ssh_get_error(lb->server));
+		return NULL;
+	}
+	lb->server_rc = 0;
+	return NULL;
+}
+
+static int loopback_client(loopback_t *lb)
+{
+	ssh_options_set(lb->client, SSH_OPTIONS_FD, &lb->fd[0]);
+	if(ssh_connect(lb->client) != SSH_OK) {
+		fprintf(stderr, "loopback: client kex: %s\n", ssh_get_error(lb->client));
+		return -1;
+	}
+	lb->fd[0] = -1;
+	if(lb->stage >= LOOPBACK_AUTH &&
+		ssh_userauth_password(lb->client, NULL, LOOPBACK_PASSWORD) != SSH_AUTH_SUCCESS) {
+		fprintf(stderr, "loopback: client auth: %s\n", ssh_get_error(lb->client));
+		return -1;
+	}
+	if(lb->stage >= LOOPBACK_CHANNEL) {
+		lb->cchan = ssh_channel_new(lb->client);
+		if(lb->cchan == NULL || ssh_channel_open_session(lb->cchan) != SSH_OK) {
+			fprintf(stderr, "loopback: client channel: %s\n", ssh_get_error(lb->client));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int loopback_connect(loopback_t *lb, int stage)
+{
+	pthread_t tid;
+	int rc = 0;
+
+	lb->stage = stage;
+	if(pthread_create(&tid, NULL, loopback_server, lb) != 0) {
+		return -1;
+	}
+	rc = loopback_client(lb);
+	if(rc != 0) {
+		/* wake up the server thread if it still waits for us */
+		shutdown(lb->fd[0] != -1 ? lb->fd[0] : ssh_get_fd(lb->client), SHUT_RDWR);
+	}
+	pthread_join(tid, NULL);
+	return rc == 0 && lb->server_rc == 0 ? 0 : -1;
+}
+
+void loopback_free(loopback_t *lb)
+{
+	if(lb->cchan != NULL) {
+		ssh_channel_free(lb->cchan);
+	}
+	if(lb->schan != NULL) {
+		ssh_channel_free(lb->schan);
+	}
+	if(lb->client != NULL) {
+		ssh_disconnect(lb->client);
+		ssh_free(lb->client);
+	}
+	if(lb->server != NULL) {
+		ssh_disconnect(lb->server);
+		ssh_free(lb->server);
+	}
+	if(lb->bind != NULL) {
+		ssh_bind_free(lb->bind);
+	}
+	if(lb->fd[0] != -1) {
+		close(lb->fd[0]);
+	}
+	if(lb->fd[1] != -1) {
+		close(lb->fd[1]);
+	}
+	memset(lb, 0x00, sizeof(*lb));
+	lb->fd[0] = lb->fd[1] = -1;
+}
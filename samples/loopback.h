@@ -0,0 +1,58 @@
+/*
+ * loopback.h - a client and a server ssh_session_t wired together through
+ * a socketpair inside one process, for benchmarks of libssh internals
+ * that should not depend on the network or on an external sshd.
+ *
+ *   loopback_t lb;
+ *   loopback_init(&lb);
+ *   ssh_options_set(lb.client, SSH_OPTIONS_CIPHERS_C_S, "aes128-ctr");
+ *   loopback_connect(&lb, LOOPBACK_CHANNEL);
+ *   ssh_channel_write(lb.cchan, buf, len);
+ *   ssh_channel_read(lb.schan, buf, len, 0);
+ *   loopback_free(&lb);
+ *
+ * loopback_connect() runs the server side in a thread until the requested
+ * stage is reached, so both ends are owned by the caller afterwards and
+ * can be driven from a single thread. Keep every write below the
+ * socketpair buffer, nothing reads the other end while the caller blocks.
+ */
+
+#ifndef SSH_SAMPLES_LOOPBACK_H
+#define SSH_SAMPLES_LOOPBACK_H
+
+#include "ssh/ssh-api.h"
+#include "ssh/server.h"
+
+/* how far loopback_connect() goes */
+#define LOOPBACK_KEX     1    /* banners and key exchange */
+#define LOOPBACK_AUTH    2    /* + password authentication */
+#define LOOPBACK_CHANNEL 3    /* + a session channel on both ends */
+
+#define LOOPBACK_USER     "runtime"
+#define LOOPBACK_PASSWORD "123456"
+
+typedef struct loopback_struct {
+	ssh_bind_t     *bind;
+	ssh_session_t  *client;
+	ssh_session_t  *server;
+	ssh_channel_t  *cchan;    /* client end of the session channel */
+	ssh_channel_t  *schan;    /* server end of the session channel */
+	int             fd[2];    /* [0] client, [1] server */
+	int             stage;
+	int             server_rc;
+} loopback_t;
+
+/*
+ * Call once before anything else: installs the pthread callbacks, runs
+ * ssh_init() and creates a RSA host key of `bits` in a temporary file
+ * (0 for the default of 2048). Returns 0 on success.
+ */
+int  loopback_global_init(int bits);
+void loopback_global_finalize(void);
+
+/* new sessions and socketpair, options may be set before loopback_connect() */
+int  loopback_init(loopback_t *lb);
+int  loopback_connect(loopback_t *lb, int stage);
+void loopback_free(loopback_t *lb);
+
+#endif /* ! SSH_SAMPLES_LOOPBACK_H */
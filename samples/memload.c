@@ -0,0 +1,328 @@
+/*
+ * memload.c - memory cost per proxied connection and growth across
+ * connect/disconnect cycles of a running ssh-proxy.
+ *
+ * Usage: tmemload -P pid [-H host] [-p port] [-l user] [-w password]
+ *                 [-n sessions] [-m modes] [-d settle_ms] [-S cycles] [-L limit]
+ *
+ *   -P pid        pid of the ssh-proxy, it is sent SIGUSR1 and its
+ *                 statistics file is read back (see ssh_memstat.h)
+ *   -H host       proxy address (default 127.0.0.1)
+ *   -p port       proxy port (default 10022)
+ *   -n sessions   connections held open per mode (default 100)
+ *   -m modes      comma separated list out of
+ *                   preauth  key exchange done, not authenticated
+ *                   idle     authenticated, no channel
+ *                   shell    pty and shell on a session channel
+ *                   sftp     sftp subsystem initialized
+ *                 (default preauth,idle,shell,sftp)
+ *   -d settle_ms  wait before sampling, lets the proxy see opens and
+ *                 closes (default 500)
+ *   -S cycles     soak: open and close `sessions` connections of the first
+ *                 mode `cycles` times and fit the heap after each cycle
+ *   -L limit      soak fails if the heap grows more than `limit` bytes per
+ *                 session and cycle (default 64)
+ *
+ * For every mode the report gives RSS and heap per open connection, and
+ * the heap still held per connection after all of them were closed.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ssh/ssh-api.h"
+#include "ssh/sftp.h"
+
+#include "ssh_memstat.h"
+
+typedef struct memload_conn_struct {
+	ssh_session_t  *session;
+	ssh_channel_t  *channel;
+	sftp_session_t *sftp;
+} memload_conn_t;
+
+static const char *host = "127.0.0.1";
+static int port = 10022;
+static const char *user = "runtime";
+static const char *password = "123456";
+static pid_t proxy_pid = 0;
+static int settle_ms = 500;
+
+static int memload_snapshot(ssh_memstat_t *stat)
+{
+	ssh_memstat_t old;
+	int i;
+
+	if(ssh_memstat_load(proxy_pid, &old) != 0) {
+		old.seq = 0;
+	}
+	if(kill(proxy_pid, SIGUSR1) != 0) {
+		perror("kill");
+		return -1;
+	}
+	for(i = 0; i < 500; i++) {
+		usleep(10 * 1000);
+		if(ssh_memstat_load(proxy_pid, stat) == 0 && stat->seq > old.seq) {
+			return 0;
+		}
+	}
+	fprintf(stderr, "no statistics from pid %d\n", (int)proxy_pid);
+	return -1;
+}
+
+static void memload_close(memload_conn_t *conn)
+{
+	if(conn->sftp != NULL) {
+		sftp_free(conn->sftp);
+	}
+	if(conn->channel != NULL) {
+		ssh_channel_close(conn->channel);
+		ssh_channel_free(conn->channel);
+	}
+	if(conn->session != NULL) {
+		ssh_disconnect(conn->session);
+		ssh_free(conn->session);
+	}
+	memset(conn, 0x00, sizeof(*conn));
+}
+
+static int memload_open(memload_conn_t *conn, const char *mode)
+{
+	memset(conn, 0x00, sizeof(*conn));
+	conn->session = ssh_new();
+	if(conn->session == NULL) {
+		return -1;
+	}
+	ssh_options_set(conn->session, SSH_OPTIONS_HOST, host);
+	ssh_options_set(conn->session, SSH_OPTIONS_PORT, &port);
+	ssh_options_set(conn->session, SSH_OPTIONS_USER, user);
+	if(ssh_connect(conn->session) != SSH_OK) {
+		goto error;
+	}
+	if(strcmp(mode, "preauth") == 0) {
+		return 0;
+	}
+	if(ssh_userauth_password(conn->session, NULL, password) != SSH_AUTH_SUCCESS) {
+		goto error;
+	}
+	if(strcmp(mode, "idle") == 0) {
+		return 0;
+	}
+	if(strcmp(mode, "sftp") == 0) {
+		conn->sftp = sftp_new(conn->session);
+		if(conn->sftp == NULL || sftp_init(conn->sftp) != SSH_OK) {
+			goto error;
+		}
+		return 0;
+	}
+	conn->channel = ssh_channel_new(conn->session);
+	if(conn->channel == NULL || ssh_channel_open_session(conn->channel) != SSH_OK ||
+		ssh_channel_request_pty(conn->channel) != SSH_OK ||
+		ssh_channel_request_shell(conn->channel) != SSH_OK) {
+		goto error;
+	}
+	return 0;
+
+error:
+	fprintf(stderr, "%s: %s\n", mode, ssh_get_error(conn->session));
+	memload_close(conn);
+	return -1;
+}
+
+/* open `n` connections, returns how many succeeded */
+static int memload_open_all(memload_conn_t *conns, int n, const char *mode)
+{
+	int i, ok = 0;
+
+	for(i = 0; i < n; i++) {
+		if(memload_open(&conns[i], mode) == 0) {
+			ok++;
+		}
+	}
+	return ok;
+}
+
+static void memload_close_all(memload_conn_t *conns, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++) {
+		memload_close(&conns[i]);
+	}
+}
+
+static int memload_mode(memload_conn_t *conns, int n, const char *mode)
+{
+	ssh_memstat_t base, open, closed;
+	int ok;
+
+	if(memload_snapshot(&base) != 0) {
+		return -1;
+	}
+	ok = memload_open_all(conns, n, mode);
+	usleep(settle_ms * 1000);
+	if(memload_snapshot(&open) != 0) {
+		memload_close_all(conns, n);
+		return -1;
+	}
+	memload_close_all(conns, n);
+	usleep(settle_ms * 1000);
+	if(memload_snapshot(&closed) != 0) {
+		return -1;
+	}
+	if(ok == 0) {
+		printf("%-8s no connection succeeded\n", mode);
+		return -1;
+	}
+	printf("%-8s %6d %8llu %12.1f %12.1f %12.1f\n", mode, ok,
+		(unsigned long long)(open.sessions_live - base.sessions_live),
+		((double)open.rss_kb - base.rss_kb) / ok,
+		((double)open.heap_inuse - base.heap_inuse) / ok,
+		((double)closed.heap_inuse - base.heap_inuse) / ok);
+	return ok == n ? 0 : -1;
+}
+
+/* least squares slope of y over 0..n-1 */
+static double memload_slope(const double *y, int n)
+{
+	double sy = 0, sxy = 0;
+	long long sx = 0, sxx = 0;
+	int i;
+
+	if(n < 2) {
+		return 0;
+	}
+	for(i = 0; i < n; i++) {
+		sx += i;
+		sy += y[i];
+		sxx += (long long)i * i;
+		sxy += i * y[i];
+	}
+	/* x is 0..n-1, n * sxx - sx * sx is n^2 (n^2 - 1) / 12 > 0 */
+	return (n * sxy - sx * sy) / (double)(n * sxx - sx * sx);
+}
+
+static int memload_soak(memload_conn_t *conns, int n, const char *mode, int cycles, double limit)
+{
+	ssh_memstat_t stat;
+	double *heap = NULL, *rss = NULL, slope, rslope;
+	int c, ok, rc = 0;
+
+	heap = calloc(cycles, sizeof(double));
+	rss = calloc(cycles, sizeof(double));
+	if(heap == NULL || rss == NULL) {
+		free(heap);
+		free(rss);
+		return -1;
+	}
+	printf("soak: %d cycles of %d %s connections\n", cycles, n, mode);
+	for(c = 0; c < cycles; c++) {
+		ok = memload_open_all(conns, n, mode);
+		memload_close_all(conns, n);
+		usleep(settle_ms * 1000);
+		if(memload_snapshot(&stat) != 0) {
+			rc = -1;
+			break;
+		}
+		heap[c] = stat.heap_inuse;
+		rss[c] = stat.rss_kb;
+		printf("cycle %4d: %d ok, live %llu, rss %llu KB, heap %llu\n", c + 1, ok,
+			(unsigned long long)stat.sessions_live,
+			(unsigned long long)stat.rss_kb,
+			(unsigned long long)stat.heap_inuse);
+	}
+	if(rc == 0 && cycles > 2) {
+		/* the first cycle warms the allocator up, leave it out */
+		slope = memload_slope(heap + 1, cycles - 1) / n;
+		rslope = memload_slope(rss + 1, cycles - 1) * 1024 / n;
+		printf("growth: heap %.1f, rss %.1f bytes per session and cycle%s\n",
+			slope, rslope, slope > limit ? " -- LEAK" : "");
+		if(slope > limit) {
+			rc = 1;
+		}
+	}
+	free(heap);
+	free(rss);
+	return rc;
+}
+
+static void usage(void)
+{
+	fputs("Usage: tmemload -P pid [-H host] [-p port] [-l user] [-w password]\n"
+		"                [-n sessions] [-m modes] [-d settle_ms] [-S cycles] [-L limit]\n", stderr);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	memload_conn_t *conns = NULL;
+	char *modes = strdup("preauth,idle,shell,sftp"), *mode = NULL, *save = NULL;
+	int opt, n = 100, cycles = 0, rc = 0;
+	double limit = 64;
+
+	while((opt = getopt(argc, argv, "P:H:p:l:w:n:m:d:S:L:")) != -1) {
+		switch(opt) {
+		case 'P':
+			proxy_pid = (pid_t)atoi(optarg);
+			break;
+		case 'H':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'l':
+			user = optarg;
+			break;
+		case 'w':
+			password = optarg;
+			break;
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'm':
+			free(modes);
+			modes = strdup(optarg);
+			break;
+		case 'd':
+			settle_ms = atoi(optarg);
+			break;
+		case 'S':
+			cycles = atoi(optarg);
+			break;
+		case 'L':
+			limit = atof(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if(proxy_pid <= 0 || n < 1 || modes == NULL) {
+		usage();
+	}
+	conns = calloc(n, sizeof(memload_conn_t));
+	if(conns == NULL || ssh_init() < 0) {
+		return 1;
+	}
+
+	if(cycles > 0) {
+		mode = strtok_r(modes, ",", &save);
+		rc = memload_soak(conns, n, mode, cycles, limit);
+	} else {
+		printf("%-8s %6s %8s %12s %12s %12s\n",
+			"mode", "open", "proxied", "rss KB/conn", "heap B/conn", "kept B/conn");
+		for(mode = strtok_r(modes, ",", &save); mode != NULL; mode = strtok_r(NULL, ",", &save)) {
+			if(memload_mode(conns, n, mode) != 0) {
+				rc = 1;
+			}
+		}
+	}
+
+	free(conns);
+	free(modes);
+	ssh_finalize();
+	return rc != 0;
+}
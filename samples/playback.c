@@ -0,0 +1,140 @@
+/*
+ * tplayback - play a terminal recording from any point, see api_ttyrec.h
+ *
+ *   tplayback [-s <at>] [-x <speed>] [-l <idle>] <file.tty>   play
+ *   tplayback -t [-s <at>] <file.tty>                        the screen as text
+ *   tplayback -i <file.tty>                                  start, length, keyframes
+ *
+ * <at> is [[HH:]MM:]SS into the recording. Playing starts with the screen
+ * at that point, then the output follows in its own time, `speed` times
+ * faster (0 for no waiting) with pauses cut to `idle` seconds.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "api_ttyrec.h"
+
+// microseconds, (uint64_t)-1 if `s` is no [[HH:]MM:]SS
+static uint64_t parse_offset(const char *s)
+{
+	uint64_t secs = 0;
+	char *end = NULL;
+	int parts = 0;
+
+	do {
+		if(parts++ == 3) {
+			return (uint64_t)-1;
+		}
+		secs = secs * 60 + strtoul(s, &end, 10);
+		if(end == s) {
+			return (uint64_t)-1;
+		}
+		s = end + 1;
+	} while(*end == ':');
+	return *end == '\0' ? secs * 1000000 : (uint64_t)-1;
+}
+
+static void wait_usec(uint64_t usec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+}
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-t|-i] [-s [[HH:]MM:]SS] [-x speed] [-l idle] <file.tty>\n", name);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	api_ttyrec_reader_t reader;
+	api_ttyrec_frame_t frame;
+	const char *out = NULL;
+	uint64_t at = 0, end = 0, last = 0, gap = 0, idle = 0;
+	uint32_t keyframes = 0;
+	double speed = 1.0;
+	size_t len = 0;
+	time_t t = 0;
+	char ts[32];
+	int opt = 0, text = 0, info = 0, rc = 0;
+
+	while((opt = getopt(argc, argv, "s:x:l:ti")) != -1) {
+		switch(opt) {
+		case 's':
+			if((at = parse_offset(optarg)) == (uint64_t)-1) {
+				return usage(argv[0]);
+			}
+			break;
+		case 'x':
+			speed = atof(optarg);
+			break;
+		case 'l':
+			idle = (uint64_t)(atof(optarg) * 1000000);
+			break;
+		case 't':
+			text = 1;
+			break;
+		case 'i':
+			info = 1;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if(optind != argc - 1 || speed < 0) {
+		return usage(argv[0]);
+	}
+	if(api_ttyrec_reader_open(&reader, argv[optind]) != 0) {
+		fprintf(stderr, "%s: not a terminal recording\n", argv[optind]);
+		return 1;
+	}
+	if(info) {
+		rc = api_ttyrec_info(&reader, &end, &keyframes);
+		t = (time_t)(reader.start / 1000000);
+		strftime(ts, sizeof(ts), "%Y/%m/%d %H:%M:%S", localtime(&t));
+		printf("start %s, length %llu:%02llu:%02llu, %u keyframes%s%s\n", ts,
+			(unsigned long long)((end - reader.start) / 3600000000ULL),
+			(unsigned long long)((end - reader.start) / 60000000 % 60),
+			(unsigned long long)((end - reader.start) / 1000000 % 60),
+			keyframes, reader.index < 0 ? ", no index" : "", rc != 0 ? ", damaged" : "");
+		api_ttyrec_reader_close(&reader);
+		return rc != 0;
+	}
+	if(api_ttyrec_seek(&reader, reader.start + at) != 0) {
+		fprintf(stderr, "%s: damaged\n", argv[optind]);
+		api_ttyrec_reader_close(&reader);
+		return 1;
+	}
+	out = text ? api_vt_text(reader.vt, &len) : api_vt_snapshot(reader.vt, &len);
+	fwrite(out, 1, len, stdout);
+	fflush(stdout);
+	last = reader.start + at;
+	while(!text && (rc = api_ttyrec_next(&reader, &frame)) == 1 && frame.kind != API_TTYREC_END) {
+		if(frame.kind != API_TTYREC_OUTPUT) {
+			continue;
+		}
+		gap = frame.time > last ? frame.time - last : 0;
+		if(idle > 0 && gap > idle) {
+			gap = idle;
+		}
+		if(speed > 0 && gap > 0) {
+			wait_usec((uint64_t)(gap / speed));
+		}
+		last = frame.time;
+		fwrite(frame.data, 1, frame.len, stdout);
+		fflush(stdout);
+	}
+	api_ttyrec_reader_close(&reader);
+	if(rc < 0) {
+		fprintf(stderr, "%s: damaged\n", argv[optind]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,300 @@
+/*
+ * replay.c - feed a packet stream recorded by ssh-proxy (DEBUG_CRYPTO
+ * build, see include/ssh_record.h) through session_packet_handler and
+ * report the parser/crypto throughput of each leg.
+ *
+ * Usage: treplay [-c chunk] [-r seed] [-n loops] file.rec
+ *
+ *   -c chunk  feed the stream in reads of `chunk` bytes (default 4096,
+ *             the size session_filter_handler() uses)
+ *   -r seed   use random read sizes in [1, chunk] drawn from `seed`, which
+ *             walks every partial-packet path of packet_parse()
+ *   -n loops  replay the file `loops` times and report the average
+ *
+ * Every packet is dispatched to a catch-all callback, so the numbers cover
+ * reassembly, decryption, MAC check and dispatch, not the proxy's message
+ * handling. trace_out() writes to stdout, redirect it to /dev/null.
+ */
+
+#include "ssh-includes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ssh_adapter.h"
+#include "ssh_record.h"
+#include "ssh/priv.h"
+#include "ssh/buffer.h"
+#include "ssh/callbacks.h"
+#include "ssh/session.h"
+#include "ssh/ssh2.h"
+#include "ssh/wrapper.h"
+
+#include "timer.h"
+
+#define REPLAY_MAX_KEYS 64
+
+typedef struct replay_leg_struct {
+	const char *name;
+	uint8_t type;
+	ssh_buffer_t *stream;
+	ssh_buffer_t *keys[REPLAY_MAX_KEYS];
+	int nkeys;
+	int next_key;
+	uint64_t packets;
+	uint64_t bytes;
+	double elapsed;
+	int failed;
+} replay_leg_t;
+
+static ssh_packet_callback replay_handlers[255];
+
+static int
+replay_packet(ssh_session_t *session, uint8_t type, ssh_buffer_t *packet, void *user)
+{
+	replay_leg_t *leg = user;
+	ssh_buffer_t *keys = NULL;
+	ssh_crypto_t *crypto = NULL;
+	(void)packet;
+
+	leg->packets++;
+	if(type != SSH2_MSG_NEWKEYS) {
+		return SSH_PACKET_USED;
+	}
+	if(leg->next_key >= leg->nkeys) {
+		fprintf(stderr, "%s: SSH2_MSG_NEWKEYS without recorded keys\n", leg->name);
+		session->session_state = SSH_SESSION_STATE_ERROR;
+		return SSH_PACKET_USED;
+	}
+	keys = leg->keys[leg->next_key++];
+	crypto = ssh_record_keys_load(ssh_buffer_get_begin(keys), ssh_buffer_get_len(keys));
+	if(crypto == NULL) {
+		fprintf(stderr, "%s: bad keys record\n", leg->name);
+		session->session_state = SSH_SESSION_STATE_ERROR;
+		return SSH_PACKET_USED;
+	}
+	crypto_free(session->current_crypto);
+	session->current_crypto = crypto;
+	return SSH_PACKET_USED;
+}
+
+static int replay_data_send(ssh_session_t *session, uint8_t command, const void *data, int len)
+{
+	(void)session;
+	(void)command;
+	(void)data;
+	(void)len;
+	return 0;
+}
+
+static int replay_load(const char *filename, replay_leg_t *legs)
+{
+	FILE *fp = NULL;
+	char magic[SSH_RECORD_MAGIC_LEN];
+	uint8_t hdr[SSH_RECORD_HDR_LEN];
+	char *data = NULL;
+	uint32_t len = 0;
+	replay_leg_t *leg = NULL;
+	int rc = -1;
+
+	fp = fopen(filename, "rb");
+	if(fp == NULL) {
+		perror(filename);
+		return -1;
+	}
+	if(fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+		memcmp(magic, SSH_RECORD_MAGIC, SSH_RECORD_MAGIC_LEN) != 0) {
+		fprintf(stderr, "%s: not a packet record\n", filename);
+		goto end;
+	}
+	while(fread(hdr, 1, sizeof(hdr), fp) == sizeof(hdr)) {
+		memcpy(&len, hdr + 2, sizeof(len));
+		len = ntohl(len);
+		if(hdr[1] == SSH_SESSION_CLIENT) {
+			leg = &legs[0];
+		} else if(hdr[1] == SSH_SESSION_SERVER) {
+			leg = &legs[1];
+		} else {
+			fprintf(stderr, "%s: bad leg %d\n", filename, hdr[1]);
+			goto end;
+		}
+		data = realloc(data, len > 0 ? len : 1);
+		if(data == NULL || fread(data, 1, len, fp) != len) {
+			fprintf(stderr, "%s: truncated record\n", filename);
+			goto end;
+		}
+		if(hdr[0] == SSH_RECORD_DATA) {
+			buffer_add_data(leg->stream, data, len);
+		} else if(hdr[0] == SSH_RECORD_KEYS && leg->nkeys < REPLAY_MAX_KEYS) {
+			leg->keys[leg->nkeys] = ssh_buffer_new();
+			buffer_add_data(leg->keys[leg->nkeys], data, len);
+			leg->nkeys++;
+		}
+	}
+	rc = 0;
+end:
+	SAFE_FREE(data);
+	fclose(fp);
+	return rc;
+}
+
+/* same loop as session_filter_handler() in proxy/ssh-proxy.c */
+static int replay_feed(ssh_session_t *session, char *data, int nbytes)
+{
+	int pos = 0, rc = 0;
+
+	do {
+		rc = session_packet_handler(session, data + pos, nbytes - pos);
+		pos += rc;
+	} while(rc > 0 && pos < nbytes);
+	return pos;
+}
+
+static void replay_leg(replay_leg_t *leg, ssh_session_t *session,
+		int chunk, unsigned int *seed)
+{
+	struct ssh_packet_callbacks_struct callbacks;
+	struct timespec t1, t2;
+	uint32_t len = ssh_buffer_get_len(leg->stream);
+	char *data = NULL, *eol = NULL;
+	uint32_t pos = 0;
+	int n = 0;
+
+	data = malloc(len);
+	if(data == NULL || len == 0) {
+		SAFE_FREE(data);
+		return;
+	}
+	/* banner_parse() modifies the stream, work on a copy */
+	memcpy(data, ssh_buffer_get_begin(leg->stream), len);
+
+	callbacks.start = 1;
+	callbacks.n_callbacks = 255;
+	callbacks.callbacks = replay_handlers;
+	callbacks.user = leg;
+	ssh_packet_set_callbacks(session, &callbacks);
+	leg->next_key = 0;
+
+	t1 = snap_time();
+	/* banner_parse() can not join a split banner line, hand it over whole */
+	eol = memchr(data, '\n', len);
+	if(eol != NULL) {
+		pos = replay_feed(session, data, eol - data + 1);
+	}
+	while(pos < len && session->session_state != SSH_SESSION_STATE_ERROR) {
+		n = seed != NULL ? 1 + rand_r(seed) % chunk : chunk;
+		if((uint32_t)n > len - pos) {
+			n = len - pos;
+		}
+		if(replay_feed(session, data + pos, n) != n) {
+			break;
+		}
+		pos += n;
+	}
+	t2 = snap_time();
+
+	leg->elapsed += get_elapsed(t1, t2);
+	leg->bytes += pos;
+	if(pos < len || session->session_state == SSH_SESSION_STATE_ERROR) {
+		fprintf(stderr, "%s: stopped at byte %u of %u\n", leg->name, pos, len);
+		leg->failed = 1;
+	}
+	/* the list only holds a pointer to our stack struct */
+	ssh_list_free(session->packet_callbacks);
+	session->packet_callbacks = NULL;
+	SAFE_FREE(data);
+}
+
+static void replay_report(replay_leg_t *leg)
+{
+	if(leg->packets == 0 || leg->elapsed <= 0) {
+		fprintf(stderr, "%-6s: no packets\n", leg->name);
+		return;
+	}
+	fprintf(stderr, "%-6s: %llu packets, %llu bytes, %.1f ns/packet, %.2f MB/s%s\n",
+		leg->name,
+		(unsigned long long)leg->packets,
+		(unsigned long long)leg->bytes,
+		leg->elapsed * 1e9 / leg->packets,
+		leg->bytes / leg->elapsed / 1e6,
+		leg->failed ? " (incomplete)" : "");
+}
+
+static void usage(void)
+{
+	fputs("Usage: treplay [-c chunk] [-r seed] [-n loops] file.rec\n", stderr);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	replay_leg_t legs[2];
+	unsigned int seed = 0, *pseed = NULL;
+	int chunk = 4096, loops = 1;
+	int opt, i, l;
+
+	while((opt = getopt(argc, argv, "c:r:n:")) != -1) {
+		switch(opt) {
+		case 'c':
+			chunk = atoi(optarg);
+			break;
+		case 'r':
+			seed = (unsigned int)strtoul(optarg, NULL, 10);
+			pseed = &seed;
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if(optind >= argc || chunk < 1 || loops < 1) {
+		usage();
+	}
+	if(ssh_init() < 0) {
+		return 1;
+	}
+	for(i = 0; i < 255; i++) {
+		replay_handlers[i] = replay_packet;
+	}
+	memset(legs, 0x00, sizeof(legs));
+	legs[0].name = "client";
+	legs[0].type = SSH_SESSION_CLIENT;
+	legs[0].stream = ssh_buffer_new();
+	legs[1].name = "server";
+	legs[1].type = SSH_SESSION_SERVER;
+	legs[1].stream = ssh_buffer_new();
+	if(replay_load(argv[optind], legs) != 0) {
+		return 1;
+	}
+
+	for(l = 0; l < loops; l++) {
+		ssh_session_t *session[2];
+		for(i = 0; i < 2; i++) {
+			session[i] = ssh_new();
+			session[i]->proxy = 1;
+			session[i]->type = legs[i].type;
+			session[i]->data_send = replay_data_send;
+		}
+		session[0]->session_ptr = session[1];
+		session[1]->session_ptr = session[0];
+		for(i = 0; i < 2; i++) {
+			replay_leg(&legs[i], session[i], chunk, pseed);
+		}
+		ssh_free(session[0]);
+		ssh_free(session[1]);
+	}
+
+	for(i = 0; i < 2; i++) {
+		replay_report(&legs[i]);
+		ssh_buffer_free(legs[i].stream);
+		for(l = 0; l < legs[i].nkeys; l++) {
+			ssh_buffer_free(legs[i].keys[l]);
+		}
+	}
+	ssh_finalize();
+	return legs[0].failed || legs[1].failed;
+}
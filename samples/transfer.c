@@ -0,0 +1,118 @@
+/*
+ * ttransfer - query the transfer index, see api_transfer.h
+ *
+ *   ttransfer [-d <dir>] hash <sha256 hex>        who moved this file
+ *   ttransfer [-d <dir>] user <name>              what a user moved
+ *   ttransfer [-d <dir>] time <from> [<to>]       what ended in [from, to)
+ *
+ * Times are "YYYY-MM-DD [HH:MM:SS]" local time or seconds since the epoch.
+ * One transfer per line: start, end, direction, size, sha256, user,
+ * session, path and capture file, tab separated.
+ */
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "api_transfer.h"
+
+static int print_transfer(const api_transfer_t *t, void *arg)
+{
+	static const char *directions[] = {"-", "upload", "download"};
+	char start[32], end[32];
+	time_t s = (time_t)(t->start / 1000000), e = (time_t)(t->end / 1000000);
+	int i = 0;
+
+	(void)arg;
+	strftime(start, sizeof(start), "%Y/%m/%d %H:%M:%S", localtime(&s));
+	strftime(end, sizeof(end), "%Y/%m/%d %H:%M:%S", localtime(&e));
+	printf("%s\t%s\t%s\t%llu\t", start, end,
+		t->direction >= 0 && t->direction <= API_TRANSFER_DOWNLOAD ? directions[t->direction] : "-",
+		(unsigned long long)t->size);
+	for(i = 0; i < 32; i++) {
+		printf("%02x", t->hash[i]);
+	}
+	printf("\t%s\t%s\t%s\t%s\n", t->user, t->session, t->path, t->capture);
+	return 0;
+}
+
+// microseconds since the epoch, 0 if `s` is no time
+static uint64_t parse_time(const char *s)
+{
+	struct tm tm;
+	const char *end = NULL;
+	char *num = NULL;
+	unsigned long long secs = 0;
+
+	memset(&tm, 0x00, sizeof(tm));
+	end = strptime(s, "%Y-%m-%d %H:%M:%S", &tm);
+	if(end == NULL) {
+		memset(&tm, 0x00, sizeof(tm));
+		end = strptime(s, "%Y-%m-%d", &tm);
+	}
+	if(end != NULL && *end == '\0') {
+		tm.tm_isdst = -1;
+		return (uint64_t)mktime(&tm) * 1000000;
+	}
+	secs = strtoull(s, &num, 10);
+	return *s != '\0' && *num == '\0' ? (uint64_t)secs * 1000000 : 0;
+}
+
+static int parse_hash(const char *s, uint8_t hash[32])
+{
+	unsigned int byte = 0;
+	int i = 0;
+
+	if(strlen(s) != 64) {
+		return -1;
+	}
+	for(i = 0; i < 32; i++) {
+		if(sscanf(s + 2 * i, "%2x", &byte) != 1) {
+			return -1;
+		}
+		hash[i] = (uint8_t)byte;
+	}
+	return 0;
+}
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d <dir>] hash <sha256> | user <name> | time <from> [<to>]\n", name);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = API_TRANSFER_DIR, *name = argv[0];
+	uint8_t hash[32];
+	uint64_t from = 0, to = UINT64_MAX;
+	int n = -1;
+
+	if(argc > 2 && strcmp(argv[1], "-d") == 0) {
+		dir = argv[2];
+		argv += 2;
+		argc -= 2;
+	}
+	if(argc == 3 && strcmp(argv[1], "hash") == 0) {
+		if(parse_hash(argv[2], hash) != 0) {
+			return usage(name);
+		}
+		n = api_transfer_by_hash(dir, hash, print_transfer, NULL);
+	} else if(argc == 3 && strcmp(argv[1], "user") == 0) {
+		n = api_transfer_by_user(dir, argv[2], print_transfer, NULL);
+	} else if((argc == 3 || argc == 4) && strcmp(argv[1], "time") == 0) {
+		from = parse_time(argv[2]);
+		if(from == 0 || (argc == 4 && (to = parse_time(argv[3])) == 0)) {
+			return usage(name);
+		}
+		n = api_transfer_by_time(dir, from, to, print_transfer, NULL);
+	} else {
+		return usage(name);
+	}
+	if(n < 0) {
+		fprintf(stderr, "%s: no transfer index\n", dir);
+		return 1;
+	}
+	return 0;
+}
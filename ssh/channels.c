@@ -8,6 +8,7 @@
 #ifndef _WIN32
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <unistd.h>
 #endif
 
 #include "ssh/priv.h"
@@ -19,6 +20,9 @@
 #include "ssh/session.h"
 #include "ssh/misc.h"
 #include "ssh/messages.h"
+// WANGFENG: proxy, transfer captures
+#include "api_capture.h"
+#include "api_ttyrec.h"
 #if WITH_SERVER
 #include "ssh/server.h"
 #endif
@@ -90,6 +94,15 @@ ssh_channel_t *ssh_channel_new(ssh_session_t *session) {
     }
     ssh_list_prepend(session->channels, channel);
 	channel->subsystem = NULL;
+	// WANGFENG: proxy, per-channel audit state
+	channel->peer = NULL;
+	channel->pending = NULL;
+	channel->sftp.active = 0;
+	channel->sftp.file = -1;
+	channel->sftp.skip = 0;
+	channel->tty = NULL;
+	channel->sftp.in_buffer = ssh_buffer_new();
+	channel->sftp.pstate = PACKET_STATE_INIT;
     return channel;
 }
 
@@ -152,6 +165,9 @@ SSH_PACKET_CALLBACK(ssh_packet_channel_open_conf){
     channel->flags &= ~SSH_CHANNEL_FLAG_NOT_BOUND;
     // WANGFENG: server>proxy flag
     session->command = SSH2_MSG_CHANNEL_OPEN_CONFIRMATION;
+    if(session->channel_reply != NULL) {
+        session->channel_reply(session, SSH2_MSG_CHANNEL_OPEN_CONFIRMATION, channel);
+    }
     return SSH_PACKET_USED;
 }
 
@@ -190,6 +206,11 @@ SSH_PACKET_CALLBACK(ssh_packet_channel_open_fail)
             channel->local_channel, (long unsigned int) ntohl(code), error);
     SAFE_FREE(error);
     channel->state=SSH_CHANNEL_STATE_OPEN_DENIED;
+    // WANGFENG: server>proxy flag, the hook may free the channel
+    session->command = SSH2_MSG_CHANNEL_OPEN_FAILURE;
+    if(session->channel_reply != NULL) {
+        session->channel_reply(session, SSH2_MSG_CHANNEL_OPEN_FAILURE, channel);
+    }
     return SSH_PACKET_USED;
 }
 
@@ -1092,6 +1113,24 @@ void ssh_channel_do_free(ssh_channel_t * channel)
     }
     ssh_buffer_free(channel->stdout_buffer);
     ssh_buffer_free(channel->stderr_buffer);
+	// WANGFENG: proxy
+	if(channel->peer != NULL && channel->peer->peer == channel) {
+		channel->peer->peer = NULL;
+	}
+	if(channel->pending != NULL) {
+		ssh_message_t *msg = NULL;
+		while((msg = ssh_list_pop_head(ssh_message_t *, channel->pending)) != NULL) {
+			ssh_message_free(msg);
+		}
+		ssh_list_free(channel->pending);
+	}
+	if(channel->sftp.file != -1) {
+		api_capture_close(channel->sftp.file);
+	}
+	api_ttyrec_close(channel->tty);
+	ssh_buffer_free(channel->sftp.in_buffer);
+	SAFE_FREE(channel->sftp.filename);
+	SAFE_FREE(channel->sftp.dlp);
 
     /* debug trick to catch use after frees */
     memset(channel, 'X', sizeof(struct ssh_channel_struct));
@@ -1532,6 +1571,9 @@ SSH_PACKET_CALLBACK(ssh_packet_channel_success)
 	} else {
 		channel->request_state=SSH_CHANNEL_REQ_STATE_ACCEPTED;
 	}
+	if(session->channel_reply != NULL) {
+		session->channel_reply(session, SSH2_MSG_CHANNEL_SUCCESS, channel);
+	}
 
 	return SSH_PACKET_USED;
 }
@@ -1549,6 +1591,8 @@ SSH_PACKET_CALLBACK(ssh_packet_channel_failure)
     (void)type;
     (void)user;
 
+    // WANGFENG: proxy
+    session->command = SSH2_MSG_CHANNEL_FAILURE;
     channel = channel_from_msg(session, packet);
     if (channel == NULL) {
         SSH_INFO(SSH_LOG_FUNCTIONS, "%s", ssh_get_error(session));
@@ -1566,6 +1610,9 @@ SSH_PACKET_CALLBACK(ssh_packet_channel_failure)
     } else {
         channel->request_state=SSH_CHANNEL_REQ_STATE_DENIED;
     }
+    if(session->channel_reply != NULL) {
+        session->channel_reply(session, SSH2_MSG_CHANNEL_FAILURE, channel);
+    }
 
     return SSH_PACKET_USED;
 }
@@ -2087,11 +2134,16 @@ ssh_channel_t * ssh_channel_accept_x11(ssh_channel_t *channel, int timeout_ms)
  */
 SSH_PACKET_CALLBACK(ssh_request_success)
 {
+    uint32_t port = 0;
     (void)type;
     (void)user;
-    (void)packet;
     
     SSH_INFO(SSH_LOG_PACKET, "Received SSH_REQUEST_SUCCESS");
+    // WANGFENG: server>proxy flag, tcpip-forward to port 0 carries the bound port
+    session->command = SSH2_MSG_REQUEST_SUCCESS;
+    if(buffer_get_u32(packet, &port) != sizeof(uint32_t)) {
+        port = 0;
+    }
     if(session->global_req_state != SSH_CHANNEL_REQ_STATE_PENDING)
     {
         SSH_INFO(SSH_LOG_RARE, "SSH_REQUEST_SUCCESS received in incorrect state %d",
@@ -2099,6 +2151,9 @@ SSH_PACKET_CALLBACK(ssh_request_success)
     } else {
         session->global_req_state=SSH_CHANNEL_REQ_STATE_ACCEPTED;
     }
+    if(session->global_reply != NULL) {
+        session->global_reply(session, SSH2_MSG_REQUEST_SUCCESS, ntohl(port));
+    }
 
     return SSH_PACKET_USED;
 }
@@ -2116,12 +2171,17 @@ SSH_PACKET_CALLBACK(ssh_request_denied)
     (void)packet;
 
     SSH_INFO(SSH_LOG_PACKET, "Received SSH_REQUEST_FAILURE");
+    // WANGFENG: server>proxy flag
+    session->command = SSH2_MSG_REQUEST_FAILURE;
     if(session->global_req_state != SSH_CHANNEL_REQ_STATE_PENDING){
     SSH_INFO(SSH_LOG_RARE, "SSH_REQUEST_DENIED received in incorrect state %d",
         session->global_req_state);
     } else {
         session->global_req_state=SSH_CHANNEL_REQ_STATE_DENIED;
     }
+    if(session->global_reply != NULL) {
+        session->global_reply(session, SSH2_MSG_REQUEST_FAILURE, 0);
+    }
 
     return SSH_PACKET_USED;
 }
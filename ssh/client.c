@@ -179,6 +179,9 @@ static int dh_handshake(ssh_session_t * session) {
         case SSH_KEX_DH_GROUP14_SHA1:
           rc = ssh_client_dh_init(session);
           break;
+        case SSH_KEX_DH_GEX_SHA256:
+          rc = ssh_client_dh_gex_request(session);
+          break;
 	#ifdef HAVE_ECDH
         case SSH_KEX_ECDH_SHA2_NISTP256:
           rc = ssh_client_ecdh_init(session);
@@ -197,7 +200,11 @@ static int dh_handshake(ssh_session_t * session) {
           return SSH_ERROR;
       }
 
-      session->dh_handshake_state = DH_STATE_INIT_SENT;
+      session->dh_handshake_state =
+          session->next_crypto->kex_type == SSH_KEX_DH_GEX_SHA256 ?
+          DH_STATE_GROUP_SENT : DH_STATE_INIT_SENT;
+    case DH_STATE_GROUP_SENT:
+    	/* group exchange: ssh_packet_dh_reply takes the group first */
     case DH_STATE_INIT_SENT:
     	/* wait until ssh_packet_dh_reply is called */
     	break;
@@ -216,6 +223,57 @@ static int dh_handshake(ssh_session_t * session) {
   return rc;
 }
 
+/** @internal
+ * @brief drops the keys of a wrongly guessed kex packet before the
+ *        handshake runs the negotiated method
+ */
+static void dh_handshake_reset(ssh_session_t * session) {
+  ssh_crypto_t *crypto = session->next_crypto;
+
+  bignum_free(crypto->x);
+  crypto->x = NULL;
+  bignum_free(crypto->e);
+  crypto->e = NULL;
+#ifdef HAVE_ECDH
+  ssh_client_ecdh_reset(session);
+#endif
+  session->dh_handshake_state = DH_STATE_INIT;
+}
+
+/** @internal
+ * @brief proxy, SSH-2 only: sends the banner and the KEXINIT in one
+ * flight, before the server banner, and with a guess of the key exchange
+ * the server will run its kex packet too (first_kex_packet_follows). A
+ * right guess saves the round trip of the server KEXINIT, a wrong one is
+ * dropped by the server and costs nothing.
+ */
+static int ssh_client_send_kexinit(ssh_session_t * session) {
+  int kex_type;
+
+  session->version = 2;
+  if (ssh_send_banner(session, 0) < 0) {
+    return SSH_ERROR;
+  }
+  if (set_client_kex(session) < 0) {
+    return SSH_ERROR;
+  }
+  kex_type = ssh_kex_guess_client(session);
+  if (ssh_send_kex(session, 0) < 0) {
+    return SSH_ERROR;
+  }
+  session->flags |= SSH_SESSION_FLAG_KEXINIT_SENT;
+  if (kex_type != 0) {
+    session->next_crypto->kex_type = kex_type;
+    session->dh_handshake_state = DH_STATE_INIT;
+    if (dh_handshake(session) == SSH_ERROR) {
+      return SSH_ERROR;
+    }
+    session->next_crypto->kex_guessed = 1;
+  }
+
+  return SSH_OK;
+}
+
 static int ssh_service_request_termination(void *s){
   ssh_session_t * session = (ssh_session_t *)s;
   if(session->session_state == SSH_SESSION_STATE_ERROR ||
@@ -364,7 +422,12 @@ static void ssh_client_connection_callback(ssh_session_t * session){
 	#endif
 		  ssh_packet_set_default_callbacks(session);
 		  session->session_state = SSH_SESSION_STATE_INITIAL_KEX;
-		  ssh_send_banner(session, 0);
+		  if (session->flags & SSH_SESSION_FLAG_KEXINIT_SENT) {
+		    /* banner and KEXINIT are out, see ssh_client_send_kexinit() */
+		    ssh_kex_guess_banner(session);
+		  } else {
+		    ssh_send_banner(session, 0);
+		  }
 		  set_status(session, 0.5f);
 		  break;
 		case SSH_SESSION_STATE_INITIAL_KEX:
@@ -382,13 +445,29 @@ static void ssh_client_connection_callback(ssh_session_t * session){
 		case SSH_SESSION_STATE_KEXINIT_RECEIVED:
 			set_status(session,0.6f);
 			ssh_list_kex(&session->next_crypto->server_kex);
-			if (set_client_kex(session) < 0) {
-				goto error;
-			}
-			if (ssh_kex_select_methods(session) == SSH_ERROR)
-			    goto error;
-			if (ssh_send_kex(session, 0) < 0) {
-				goto error;
+			if (session->flags & SSH_SESSION_FLAG_KEXINIT_SENT) {
+				session->flags &= ~SSH_SESSION_FLAG_KEXINIT_SENT;
+				ssh_kex_guess_learn(session);
+				if (ssh_kex_select_methods(session) == SSH_ERROR)
+				    goto error;
+				if (session->next_crypto->kex_guessed) {
+					/* the server answers our guess, or has dropped it */
+					session->next_crypto->kex_guessed = 0;
+					if (!ssh_kex_guess_ok(session)) {
+						SSH_INFO(SSH_LOG_PROTOCOL, "Kex guess was wrong, running %s",
+							session->next_crypto->kex_methods[SSH_KEX]);
+						dh_handshake_reset(session);
+					}
+				}
+			} else {
+				if (set_client_kex(session) < 0) {
+					goto error;
+				}
+				if (ssh_kex_select_methods(session) == SSH_ERROR)
+				    goto error;
+				if (ssh_send_kex(session, 0) < 0) {
+					goto error;
+				}
 			}
 			set_status(session,0.8f);
 			session->session_state=SSH_SESSION_STATE_DH;
@@ -498,6 +577,13 @@ if(!session->proxy) {
   	session->socket_callbacks.exception = ssh_socket_exception_callback;
   	session->socket_callbacks.userdata = session;
 	
+  	// WANGFENG: proxy, no wait for the server banner
+  	if(session->proxy && !session->opts.ssh1) {
+  		if(ssh_client_send_kexinit(session) != SSH_OK) {
+  			session->session_state = SSH_SESSION_STATE_ERROR;
+  			return SSH_ERROR;
+  		}
+  	}
   	// WANGFENG: proxy
 if(!session->proxy) {
   	if (session->opts.fd != SSH_INVALID_SOCKET) {
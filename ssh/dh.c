@@ -89,12 +89,101 @@ static unsigned long g_int = 2 ;	/* G is defined as 2 by the ssh2 standards */
 static bignum g;
 static bignum p_group1;
 static bignum p_group14;
+#ifdef HAVE_LIBCRYPTO
+static BN_MONT_CTX *mont_group1;
+static BN_MONT_CTX *mont_group14;
+#endif
 static int ssh_crypto_initialized;
 
-static bignum select_p(enum ssh_key_exchange_e type) {
-    return type == SSH_KEX_DH_GROUP14_SHA1 ? p_group14 : p_group1;
+/*
+ * The groups of the moduli file by size, smallest first: a group exchange
+ * request is answered from here, not from the file. Each group has its
+ * Montgomery context, the exponentiations with it do not set one up.
+ */
+typedef struct dh_moduli_group_struct {
+  bignum p;
+  bignum g;
+#ifdef HAVE_LIBCRYPTO
+  BN_MONT_CTX *mont;
+#endif
+} dh_moduli_group_t;
+
+typedef struct dh_moduli_size_struct {
+  uint32_t bits;
+  int count;
+  dh_moduli_group_t *groups;
+} dh_moduli_size_t;
+
+static dh_moduli_size_t *dh_moduli;
+static int dh_moduli_sizes;
+
+static bignum select_p(ssh_crypto_t *crypto) {
+    if (crypto->kex_type == SSH_KEX_DH_GEX_SHA256) {
+      return crypto->gex_p;
+    }
+    return crypto->kex_type == SSH_KEX_DH_GROUP14_SHA1 ? p_group14 : p_group1;
+}
+
+static bignum select_g(ssh_crypto_t *crypto) {
+    return crypto->kex_type == SSH_KEX_DH_GEX_SHA256 ? crypto->gex_g : g;
 }
 
+/* bits of the secret exponent: twice the symmetric strength of the group
+ * (NIST SP 800-57) for group exchange, as OpenSSH does, 128 for the fixed
+ * groups */
+static int dh_secret_bits(ssh_crypto_t *crypto) {
+    int bits;
+
+    if (crypto->kex_type != SSH_KEX_DH_GEX_SHA256 || crypto->gex_p == NULL) {
+      return 128;
+    }
+    bits = bignum_num_bits(crypto->gex_p);
+    if (bits <= 2048) {
+      return 2 * 112;
+    } else if (bits <= 3072) {
+      return 2 * 128;
+    } else if (bits <= 7680) {
+      return 2 * 192;
+    }
+    return 2 * 256;
+}
+
+#ifdef HAVE_LIBCRYPTO
+/* dest = base^exp mod p of the exchange, with the precomputed Montgomery
+ * context of its group if it has one */
+static int dh_mod_exp(ssh_crypto_t *crypto, bignum dest, bignum base, bignum exp,
+    bignum_CTX ctx) {
+    BN_MONT_CTX *mont = NULL;
+
+    switch (crypto->kex_type) {
+      case SSH_KEX_DH_GROUP1_SHA1:
+        mont = mont_group1;
+        break;
+      case SSH_KEX_DH_GROUP14_SHA1:
+        mont = mont_group14;
+        break;
+      case SSH_KEX_DH_GEX_SHA256:
+        mont = crypto->gex_mont;
+        break;
+      default:
+        break;
+    }
+    return BN_mod_exp_mont(dest, base, exp, select_p(crypto), ctx, mont);
+}
+
+static BN_MONT_CTX *dh_mont_new(bignum p) {
+    BN_MONT_CTX *mont = BN_MONT_CTX_new();
+    bignum_CTX ctx = bignum_ctx_new();
+
+    if (mont == NULL || ctx == NULL || BN_MONT_CTX_set(mont, p, ctx) != 1) {
+      BN_MONT_CTX_free(mont);
+      mont = NULL;
+    }
+    bignum_ctx_free(ctx);
+    return mont;
+}
+#endif
+
 int ssh_get_random(void *where, int len, int strong){
 
 #ifdef HAVE_LIBGCRYPT
@@ -172,10 +261,14 @@ int ssh_crypto_init(void) {
     }
     bignum_bin2bn(p_group14_value, P_GROUP14_LEN, p_group14);
 
+    mont_group1 = dh_mont_new(p_group1);
+    mont_group14 = dh_mont_new(p_group14);
+
     OpenSSL_add_all_algorithms();
 
 #endif
 
+    dh_moduli_load(SSH_MODULI_FILE);
     ssh_crypto_initialized = 1;
   }
 
@@ -183,7 +276,27 @@ int ssh_crypto_init(void) {
 }
 
 void ssh_crypto_finalize(void) {
+  int i, j;
+
   if (ssh_crypto_initialized) {
+    for (i = 0; i < dh_moduli_sizes; i++) {
+      for (j = 0; j < dh_moduli[i].count; j++) {
+        bignum_free(dh_moduli[i].groups[j].p);
+        bignum_free(dh_moduli[i].groups[j].g);
+#ifdef HAVE_LIBCRYPTO
+        BN_MONT_CTX_free(dh_moduli[i].groups[j].mont);
+#endif
+      }
+      SAFE_FREE(dh_moduli[i].groups);
+    }
+    SAFE_FREE(dh_moduli);
+    dh_moduli_sizes = 0;
+#ifdef HAVE_LIBCRYPTO
+    BN_MONT_CTX_free(mont_group1);
+    mont_group1 = NULL;
+    BN_MONT_CTX_free(mont_group14);
+    mont_group14 = NULL;
+#endif
     bignum_free(g);
     g = NULL;
     bignum_free(p_group1);
@@ -200,6 +313,162 @@ void ssh_crypto_finalize(void) {
   }
 }
 
+/* the size of a group of the moduli file, created for its first group */
+static dh_moduli_size_t *dh_moduli_size(uint32_t bits) {
+  dh_moduli_size_t *sizes;
+  int i;
+
+  for (i = 0; i < dh_moduli_sizes && dh_moduli[i].bits < bits; i++)
+    ;
+  if (i < dh_moduli_sizes && dh_moduli[i].bits == bits) {
+    return &dh_moduli[i];
+  }
+  sizes = realloc(dh_moduli, (dh_moduli_sizes + 1) * sizeof(dh_moduli_size_t));
+  if (sizes == NULL) {
+    return NULL;
+  }
+  dh_moduli = sizes;
+  memmove(&dh_moduli[i + 1], &dh_moduli[i], (dh_moduli_sizes - i) * sizeof(dh_moduli_size_t));
+  dh_moduli_sizes++;
+  memset(&dh_moduli[i], 0, sizeof(dh_moduli_size_t));
+  dh_moduli[i].bits = bits;
+  return &dh_moduli[i];
+}
+
+/*
+ * Reads the safe primes of a moduli file, lines of
+ *   time type tests tries size generator modulus
+ * with size one less than the bits of the modulus and generator and
+ * modulus in hex, as ssh-keygen writes them. Returns the number of groups.
+ */
+int dh_moduli_load(const char *path) {
+  FILE *fp;
+  char line[4096];
+  char generator[16];
+  char *modulus;
+  unsigned long type, tests, tries, size;
+  dh_moduli_size_t *bucket;
+  dh_moduli_group_t group, *groups;
+  int at, n = 0;
+
+  fp = fopen(path, "r");
+  if (fp == NULL) {
+    SSH_INFO(SSH_LOG_PROTOCOL, "%s: no moduli, group exchange uses group 14", path);
+    return 0;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    at = 0;
+    if (line[0] == '#' ||
+        sscanf(line, "%*s %lu %lu %lu %lu %15s %n", &type, &tests, &tries, &size,
+            generator, &at) != 5 || at == 0) {
+      continue;
+    }
+    modulus = line + at;
+    modulus[strspn(modulus, "0123456789abcdefABCDEF")] = '\0';
+    /* safe primes, tested and not found composite */
+    if (type != 2 || (tests & 1) != 0 || (tests & ~1UL) == 0 || tries == 0) {
+      continue;
+    }
+    memset(&group, 0, sizeof(group));
+#ifdef HAVE_LIBGCRYPT
+    bignum_hex2bn(&group.p, 0, modulus);
+    bignum_hex2bn(&group.g, 0, generator);
+#elif defined HAVE_LIBCRYPTO
+    BN_hex2bn(&group.p, modulus);
+    BN_hex2bn(&group.g, generator);
+#endif
+    if (group.p == NULL || group.g == NULL ||
+        (unsigned long)bignum_num_bits(group.p) != size + 1 || bignum_num_bits(group.g) < 2) {
+      goto skip;
+    }
+#ifdef HAVE_LIBCRYPTO
+    group.mont = dh_mont_new(group.p);
+    if (group.mont == NULL) {
+      goto skip;
+    }
+#endif
+    bucket = dh_moduli_size(size + 1);
+    if (bucket == NULL) {
+      goto skip;
+    }
+    groups = realloc(bucket->groups, (bucket->count + 1) * sizeof(dh_moduli_group_t));
+    if (groups == NULL) {
+      goto skip;
+    }
+    bucket->groups = groups;
+    bucket->groups[bucket->count++] = group;
+    n++;
+    continue;
+skip:
+    bignum_free(group.p);
+    bignum_free(group.g);
+#ifdef HAVE_LIBCRYPTO
+    BN_MONT_CTX_free(group.mont);
+#endif
+  }
+  fclose(fp);
+  SSH_INFO(SSH_LOG_PROTOCOL, "%s: %d groups in %d sizes", path, n, dh_moduli_sizes);
+
+  return n;
+}
+
+/** @internal
+ * @brief picks the group answering a group exchange request: one of the
+ * smallest size of at least n bits in [min, max], else of the largest
+ * size below n, else group 14 if it fits. The group goes to the
+ * next_crypto of the session.
+ * @returns 0, or -1 if there is no such group
+ */
+int dh_gex_choose(ssh_session_t * session, uint32_t min, uint32_t n, uint32_t max) {
+  ssh_crypto_t *crypto = session->next_crypto;
+  dh_moduli_size_t *best = NULL;
+  dh_moduli_group_t *group;
+  unsigned int pick = 0;
+  int i;
+
+  for (i = 0; i < dh_moduli_sizes; i++) {
+    if (dh_moduli[i].bits < min || dh_moduli[i].bits > max) {
+      continue;
+    }
+    best = &dh_moduli[i];
+    if (best->bits >= n) {
+      break;
+    }
+  }
+
+  bignum_free(crypto->gex_p);
+  bignum_free(crypto->gex_g);
+  crypto->gex_p = crypto->gex_g = NULL;
+  if (best != NULL) {
+    ssh_get_random(&pick, sizeof(pick), 0);
+    group = &best->groups[pick % best->count];
+#ifdef HAVE_LIBGCRYPT
+    crypto->gex_p = gcry_mpi_copy(group->p);
+    crypto->gex_g = gcry_mpi_copy(group->g);
+#elif defined HAVE_LIBCRYPTO
+    crypto->gex_p = BN_dup(group->p);
+    crypto->gex_g = BN_dup(group->g);
+    crypto->gex_mont = group->mont;
+#endif
+  } else if (min <= P_GROUP14_LEN * 8 && P_GROUP14_LEN * 8 <= max) {
+#ifdef HAVE_LIBGCRYPT
+    crypto->gex_p = gcry_mpi_copy(p_group14);
+    crypto->gex_g = gcry_mpi_copy(g);
+#elif defined HAVE_LIBCRYPTO
+    crypto->gex_p = BN_dup(p_group14);
+    crypto->gex_g = BN_dup(g);
+    crypto->gex_mont = mont_group14;
+#endif
+  } else {
+    return -1;
+  }
+  if (crypto->gex_p == NULL || crypto->gex_g == NULL) {
+    return -1;
+  }
+
+  return 0;
+}
+
 /* prints the bignum on stderr */
 void ssh_print_bignum(const char *which, bignum num) {
 #ifdef HAVE_LIBGCRYPT
@@ -221,9 +490,9 @@ int dh_generate_x(ssh_session_t * session) {
   }
 
 #ifdef HAVE_LIBGCRYPT
-  bignum_rand(session->next_crypto->x, 128);
+  bignum_rand(session->next_crypto->x, dh_secret_bits(session->next_crypto));
 #elif defined HAVE_LIBCRYPTO
-  bignum_rand(session->next_crypto->x, 128, 0, -1);
+  bignum_rand(session->next_crypto->x, dh_secret_bits(session->next_crypto), 0, -1);
 #endif
 
   /* not harder than this */
@@ -242,9 +511,9 @@ int dh_generate_y(ssh_session_t * session) {
   }
 
 #ifdef HAVE_LIBGCRYPT
-  bignum_rand(session->next_crypto->y, 128);
+  bignum_rand(session->next_crypto->y, dh_secret_bits(session->next_crypto));
 #elif defined HAVE_LIBCRYPTO
-  bignum_rand(session->next_crypto->y, 128, 0, -1);
+  bignum_rand(session->next_crypto->y, dh_secret_bits(session->next_crypto), 0, -1);
 #endif
 
   /* not harder than this */
@@ -273,11 +542,11 @@ int dh_generate_e(ssh_session_t * session) {
   }
 
 #ifdef HAVE_LIBGCRYPT
-  bignum_mod_exp(session->next_crypto->e, g, session->next_crypto->x,
-      select_p(session->next_crypto->kex_type));
+  bignum_mod_exp(session->next_crypto->e, select_g(session->next_crypto),
+      session->next_crypto->x, select_p(session->next_crypto));
 #elif defined HAVE_LIBCRYPTO
-  bignum_mod_exp(session->next_crypto->e, g, session->next_crypto->x,
-      select_p(session->next_crypto->kex_type), ctx);
+  dh_mod_exp(session->next_crypto, session->next_crypto->e,
+      select_g(session->next_crypto), session->next_crypto->x, ctx);
 #endif
 
 #ifdef DEBUG_CRYPTO
@@ -308,11 +577,11 @@ int dh_generate_f(ssh_session_t * session) {
   }
 
 #ifdef HAVE_LIBGCRYPT
-  bignum_mod_exp(session->next_crypto->f, g, session->next_crypto->y,
-      select_p(session->next_crypto->kex_type));
+  bignum_mod_exp(session->next_crypto->f, select_g(session->next_crypto),
+      session->next_crypto->y, select_p(session->next_crypto));
 #elif defined HAVE_LIBCRYPTO
-  bignum_mod_exp(session->next_crypto->f, g, session->next_crypto->y,
-      select_p(session->next_crypto->kex_type), ctx);
+  dh_mod_exp(session->next_crypto, session->next_crypto->f,
+      select_g(session->next_crypto), session->next_crypto->y, ctx);
 #endif
 
 #ifdef DEBUG_CRYPTO
@@ -442,18 +711,18 @@ int dh_build_k(ssh_session_t * session) {
 #ifdef HAVE_LIBGCRYPT
   if(session->client) {
     bignum_mod_exp(session->next_crypto->k, session->next_crypto->f,
-        session->next_crypto->x, select_p(session->next_crypto->kex_type));
+        session->next_crypto->x, select_p(session->next_crypto));
   } else {
     bignum_mod_exp(session->next_crypto->k, session->next_crypto->e,
-        session->next_crypto->y, select_p(session->next_crypto->kex_type));
+        session->next_crypto->y, select_p(session->next_crypto));
   }
 #elif defined HAVE_LIBCRYPTO
   if (session->client) {
-    bignum_mod_exp(session->next_crypto->k, session->next_crypto->f,
-        session->next_crypto->x, select_p(session->next_crypto->kex_type), ctx);
+    dh_mod_exp(session->next_crypto, session->next_crypto->k,
+        session->next_crypto->f, session->next_crypto->x, ctx);
   } else {
-    bignum_mod_exp(session->next_crypto->k, session->next_crypto->e,
-        session->next_crypto->y, select_p(session->next_crypto->kex_type), ctx);
+    dh_mod_exp(session->next_crypto, session->next_crypto->k,
+        session->next_crypto->e, session->next_crypto->y, ctx);
   }
 #endif
 
@@ -479,7 +748,9 @@ int ssh_client_dh_init(ssh_session_t * session){
   ssh_string_t * e = NULL;
   int rc;
 
-  if (buffer_add_u8(session->out_buffer, SSH2_MSG_KEXDH_INIT) < 0) {
+  if (buffer_add_u8(session->out_buffer,
+        session->next_crypto->kex_type == SSH_KEX_DH_GEX_SHA256 ?
+        SSH2_MSG_KEX_DH_GEX_INIT : SSH2_MSG_KEXDH_INIT) < 0) {
     goto error;
   }
 
@@ -563,6 +834,71 @@ error:
 }
 
 
+/** @internal
+ * @brief Starts diffie-hellman-group-exchange-sha256: asks the server for
+ *        a group of DH_GEX_MIN to DH_GEX_MAX bits, DH_GEX_N preferred
+ */
+int ssh_client_dh_gex_request(ssh_session_t * session){
+  ssh_crypto_t *crypto = session->next_crypto;
+
+  crypto->gex_min = DH_GEX_MIN;
+  crypto->gex_n = DH_GEX_N;
+  crypto->gex_max = DH_GEX_MAX;
+  if (buffer_add_u8(session->out_buffer, SSH2_MSG_KEX_DH_GEX_REQUEST) < 0 ||
+      buffer_add_u32(session->out_buffer, htonl(crypto->gex_min)) < 0 ||
+      buffer_add_u32(session->out_buffer, htonl(crypto->gex_n)) < 0 ||
+      buffer_add_u32(session->out_buffer, htonl(crypto->gex_max)) < 0) {
+    buffer_reinit(session->out_buffer);
+    return SSH_ERROR;
+  }
+
+  return packet_send(session);
+}
+
+/** @internal
+ * @brief takes the group of SSH_MSG_KEX_DH_GEX_GROUP and sends e with it
+ */
+int ssh_client_dh_gex_group(ssh_session_t * session, ssh_buffer_t * packet){
+  ssh_crypto_t *crypto = session->next_crypto;
+  ssh_string_t * p = NULL;
+  ssh_string_t * g_string = NULL;
+  uint32_t bits;
+
+  p = buffer_get_ssh_string(packet);
+  g_string = buffer_get_ssh_string(packet);
+  if (p == NULL || g_string == NULL) {
+    ssh_set_error(session, SSH_FATAL, "No group in SSH_MSG_KEX_DH_GEX_GROUP");
+    goto error;
+  }
+  bignum_free(crypto->gex_p);
+  bignum_free(crypto->gex_g);
+  crypto->gex_p = make_string_bn(p);
+  crypto->gex_g = make_string_bn(g_string);
+  if (crypto->gex_p == NULL || crypto->gex_g == NULL) {
+    ssh_set_error(session, SSH_FATAL, "Cannot import the group");
+    goto error;
+  }
+  bits = bignum_num_bits(crypto->gex_p);
+  if (bits < crypto->gex_min || bits > crypto->gex_max) {
+    ssh_set_error(session, SSH_FATAL, "Group of %u bits, asked for %u to %u",
+        bits, crypto->gex_min, crypto->gex_max);
+    goto error;
+  }
+  if (bignum_num_bits(crypto->gex_g) < 2 || bignum_cmp(crypto->gex_g, crypto->gex_p) >= 0) {
+    ssh_set_error(session, SSH_FATAL, "Bad generator of the group");
+    goto error;
+  }
+  ssh_string_free(p);
+  ssh_string_free(g_string);
+
+  return ssh_client_dh_init(session);
+error:
+  ssh_string_free(p);
+  ssh_string_free(g_string);
+
+  return SSH_ERROR;
+}
+
 /*
 static void sha_add(ssh_string_t * str,SHACTX ctx){
     sha1_update(ctx,str,string_len(str)+4);
@@ -613,16 +949,17 @@ int make_sessionid(ssh_session_t * session) {
     client_hash = session->in_hashbuf;
   }
 
-  if (buffer_add_u32(server_hash, 0) < 0) {
+  /* first_kex_packet_follows and the reserved word of each KEXINIT */
+  if (buffer_add_u8(server_hash, session->next_crypto->server_kex.first_kex_follows) < 0) {
     goto error;
   }
-  if (buffer_add_u8(server_hash, 0) < 0) {
+  if (buffer_add_u32(server_hash, 0) < 0) {
     goto error;
   }
-  if (buffer_add_u32(client_hash, 0) < 0) {
+  if (buffer_add_u8(client_hash, session->next_crypto->client_kex.first_kex_follows) < 0) {
     goto error;
   }
-  if (buffer_add_u8(client_hash, 0) < 0) {
+  if (buffer_add_u32(client_hash, 0) < 0) {
     goto error;
   }
 
@@ -648,8 +985,44 @@ int make_sessionid(ssh_session_t * session) {
   if (buffer_add_data(buf, session->next_crypto->server_pubkey, len) < 0) {
     goto error;
   }
+  if(session->next_crypto->kex_type == SSH_KEX_DH_GEX_SHA256) {
+    /* the request (n only for the old one) and the group */
+    if (session->next_crypto->gex_min != 0 &&
+        buffer_add_u32(buf, htonl(session->next_crypto->gex_min)) < 0) {
+      goto error;
+    }
+    if (buffer_add_u32(buf, htonl(session->next_crypto->gex_n)) < 0) {
+      goto error;
+    }
+    if (session->next_crypto->gex_max != 0 &&
+        buffer_add_u32(buf, htonl(session->next_crypto->gex_max)) < 0) {
+      goto error;
+    }
+    num = make_bignum_string(session->next_crypto->gex_p);
+    if (num == NULL) {
+      goto error;
+    }
+    if (buffer_add_ssh_string(buf, num) < 0) {
+      ssh_string_free(num);
+      num = NULL;
+      goto error;
+    }
+    ssh_string_free(num);
+    num = make_bignum_string(session->next_crypto->gex_g);
+    if (num == NULL) {
+      goto error;
+    }
+    if (buffer_add_ssh_string(buf, num) < 0) {
+      ssh_string_free(num);
+      num = NULL;
+      goto error;
+    }
+    ssh_string_free(num);
+    num = NULL;
+  }
   if(session->next_crypto->kex_type == SSH_KEX_DH_GROUP1_SHA1 ||
-     session->next_crypto->kex_type == SSH_KEX_DH_GROUP14_SHA1) {
+     session->next_crypto->kex_type == SSH_KEX_DH_GROUP14_SHA1 ||
+     session->next_crypto->kex_type == SSH_KEX_DH_GEX_SHA256) {
 
     num = make_bignum_string(session->next_crypto->e);
     if (num == NULL) {
@@ -673,6 +1046,7 @@ int make_sessionid(ssh_session_t * session) {
     }
 
     ssh_string_free(num);
+    num = NULL;
 #ifdef HAVE_ECDH
   } else if (session->next_crypto->kex_type == SSH_KEX_ECDH_SHA2_NISTP256){
     if(session->next_crypto->ecdh_client_pubkey == NULL ||
@@ -731,6 +1105,7 @@ int make_sessionid(ssh_session_t * session) {
       break;
     case SSH_KEX_ECDH_SHA2_NISTP256:
     case SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG:
+    case SSH_KEX_DH_GEX_SHA256:
       session->next_crypto->digest_len = SHA256_DIGEST_LENGTH;
       session->next_crypto->mac_type = SSH_MAC_SHA256;
       session->next_crypto->secret_hash = malloc(session->next_crypto->digest_len);
@@ -186,6 +186,16 @@ error:
   return SSH_ERROR;
 }
 
+/** @internal
+ * @brief drops the key pair of a client exchange that will not complete
+ */
+void ssh_client_ecdh_reset(ssh_session_t * session){
+  EC_KEY_free(session->next_crypto->ecdh_privkey);
+  session->next_crypto->ecdh_privkey = NULL;
+  ssh_string_free(session->next_crypto->ecdh_client_pubkey);
+  session->next_crypto->ecdh_client_pubkey = NULL;
+}
+
 #ifdef WITH_SERVER
 
 /** @brief Parse a SSH_MSG_KEXDH_INIT packet (server) and send a
@@ -43,7 +43,7 @@
 #endif
 
 #ifdef HAVE_CURVE25519
-#define CURVE25519 "curve25519-sha256@libssh.org,"
+#define CURVE25519 "curve25519-sha256,curve25519-sha256@libssh.org,"
 #else
 #define CURVE25519 ""
 #endif
@@ -56,7 +56,7 @@
 #define ECDH ""
 #endif
 
-#define KEY_EXCHANGE CURVE25519 ECDH "diffie-hellman-group14-sha1,diffie-hellman-group1-sha1"
+#define KEY_EXCHANGE CURVE25519 ECDH "diffie-hellman-group-exchange-sha256,diffie-hellman-group14-sha1,diffie-hellman-group1-sha1"
 #define KEX_METHODS_SIZE 10
 
 /* NOTE: This is a fixed API and the index is defined by ssh_kex_types_e */
@@ -256,6 +256,8 @@ SSH_PACKET_CALLBACK(ssh_packet_kexinit){
 	int server_kex=session->server;
   ssh_string_t * str = NULL;
   char *strings[KEX_METHODS_SIZE];
+  uint8_t follows = 0;
+  uint32_t reserved = 0;
   int i;
 
   (void)type;
@@ -309,19 +311,29 @@ SSH_PACKET_CALLBACK(ssh_packet_kexinit){
     str = NULL;
   }
 
+  /* first_kex_packet_follows and the reserved word, hashed in make_sessionid() */
+  if (buffer_get_u8(packet, &follows) != 1 || buffer_get_u32(packet, &reserved) != 4) {
+    follows = 0;
+  }
+
   /* copy the server kex info into an array of strings */
   if (server_kex) {
     for (i = 0; i < SSH_KEX_METHODS; i++) {
       session->next_crypto->client_kex.methods[i] = strings[i];
     }
+    session->next_crypto->client_kex.first_kex_follows = follows ? 1 : 0;
   } else { /* client */
     for (i = 0; i < SSH_KEX_METHODS; i++) {
       session->next_crypto->server_kex.methods[i] = strings[i];
     }
+    session->next_crypto->server_kex.first_kex_follows = follows ? 1 : 0;
   }
 
   session->session_state=SSH_SESSION_STATE_KEXINIT_RECEIVED;
-  session->dh_handshake_state=DH_STATE_INIT;
+  if (!session->next_crypto->kex_guessed) {
+    /* else it is where our guess left it */
+    session->dh_handshake_state=DH_STATE_INIT;
+  }
   session->ssh_connection_callback(session);
   return SSH_PACKET_USED;
 error:
@@ -408,6 +420,7 @@ int set_client_kex(ssh_session_t * session){
     int i;
 
     ssh_get_random(client->cookie, 16, 0);
+    client->first_kex_follows = 0;
 
     memset(client->methods, 0, KEX_METHODS_SIZE * sizeof(char **));
     /* first check if we have specific host key methods */
@@ -427,6 +440,24 @@ int set_client_kex(ssh_session_t * session){
     return SSH_OK;
 }
 
+/* the kex_type of a key exchange method, 0 if not known */
+static int kex_type_from_name(const char *name){
+    if (strcmp(name, "diffie-hellman-group1-sha1") == 0) {
+      return SSH_KEX_DH_GROUP1_SHA1;
+    } else if (strcmp(name, "diffie-hellman-group14-sha1") == 0) {
+      return SSH_KEX_DH_GROUP14_SHA1;
+    } else if (strcmp(name, "ecdh-sha2-nistp256") == 0) {
+      return SSH_KEX_ECDH_SHA2_NISTP256;
+    } else if (strcmp(name, "curve25519-sha256@libssh.org") == 0 ||
+               strcmp(name, "curve25519-sha256") == 0) {
+      /* the same method under its RFC 8731 name */
+      return SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG;
+    } else if (strcmp(name, "diffie-hellman-group-exchange-sha256") == 0) {
+      return SSH_KEX_DH_GEX_SHA256;
+    }
+    return 0;
+}
+
 /** @brief Select the different methods on basis of client's and
  * server's kex messages, and watches out if a match is possible.
  */
@@ -446,14 +477,16 @@ int ssh_kex_select_methods (ssh_session_t * session){
             session->next_crypto->kex_methods[i] = strdup("");
         }
     }
-    if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "diffie-hellman-group1-sha1") == 0){
-      session->next_crypto->kex_type=SSH_KEX_DH_GROUP1_SHA1;
-    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "diffie-hellman-group14-sha1") == 0){
-      session->next_crypto->kex_type=SSH_KEX_DH_GROUP14_SHA1;
-    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "ecdh-sha2-nistp256") == 0){
-      session->next_crypto->kex_type=SSH_KEX_ECDH_SHA2_NISTP256;
-    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "curve25519-sha256@libssh.org") == 0){
-      session->next_crypto->kex_type=SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG;
+    i = kex_type_from_name(session->next_crypto->kex_methods[SSH_KEX]);
+    if (i != 0) {
+      session->next_crypto->kex_type = i;
+    }
+
+    /* a wrong guess of the peer is dropped, RFC 4253 7 */
+    if ((session->server ? client : server)->first_kex_follows &&
+        !ssh_kex_guess_ok(session)) {
+      SSH_INFO(SSH_LOG_PROTOCOL, "Peer guessed the key exchange wrong, ignoring its next kex packet");
+      session->next_crypto->kex_skip = 1;
     }
 
     return SSH_OK;
@@ -496,7 +529,7 @@ int ssh_send_kex(ssh_session_t * session, int server_kex) {
     str = NULL;
   }
 
-  if (buffer_add_u8(session->out_buffer, 0) < 0) {
+  if (buffer_add_u8(session->out_buffer, kex->first_kex_follows) < 0) {
     goto error;
   }
   if (buffer_add_u32(session->out_buffer, 0) < 0) {
@@ -516,6 +549,185 @@ error:
   return -1;
 }
 
+/* the length of the first method of a name-list */
+static size_t kex_first_len(const char *list){
+    return list == NULL ? 0 : strcspn(list, ",");
+}
+
+/** @internal
+ * @brief whether a kex packet guessed with first_kex_packet_follows is
+ * the one both sides run: the first key exchange and host key methods of
+ * the two KEXINITs are the same (RFC 4253 7)
+ */
+int ssh_kex_guess_ok(ssh_session_t * session){
+    ssh_kex_t *server = &session->next_crypto->server_kex;
+    ssh_kex_t *client = &session->next_crypto->client_kex;
+    int i;
+    size_t len;
+
+    for (i = SSH_KEX; i <= SSH_HOSTKEYS; i++) {
+      len = kex_first_len(client->methods[i]);
+      if (len == 0 || len != kex_first_len(server->methods[i]) ||
+          strncmp(client->methods[i], server->methods[i], len) != 0) {
+        return 0;
+      }
+    }
+    return 1;
+}
+
+/*
+ * What a destination put first in its KEXINIT the last time, and the
+ * banner it came with. The proxy runs all sessions on one loop, the
+ * table takes no lock; an entry is replaced by the next destination of
+ * the same hash.
+ */
+#define KEX_GUESS_CACHE 256
+
+typedef struct kex_guess_struct {
+    char dest[64];      /* "host:port", empty for none */
+    char banner[128];
+    char kex[64];
+    char hostkey[64];
+} kex_guess_t;
+
+static kex_guess_t kex_guess_cache[KEX_GUESS_CACHE];
+
+static kex_guess_t *kex_guess_entry(ssh_session_t * session, char *dest, size_t size){
+    const char *host = session->sip != NULL ? session->sip : session->opts.host;
+    unsigned int port = session->sip != NULL ? (unsigned int)session->sport : session->opts.port;
+    unsigned int hash = 5381;
+    const char *p;
+
+    if (host == NULL) {
+      return NULL;
+    }
+    snprintf(dest, size, "%s:%u", host, port);
+    for (p = dest; *p != '\0'; p++) {
+      hash = hash * 33 + (unsigned char)*p;
+    }
+    return &kex_guess_cache[hash % KEX_GUESS_CACHE];
+}
+
+/* a copy of the name-list `list` with `name`, the first len bytes of it,
+ * moved to the front, NULL if it is not in the list */
+static char *kex_move_first(const char *list, const char *name, size_t len){
+    char *moved;
+    const char *p = list;
+    size_t at;
+
+    while (*p != '\0') {
+      at = strcspn(p, ",");
+      if (at == len && strncmp(p, name, len) == 0) {
+        break;
+      }
+      p += at;
+      if (*p == ',') {
+        p++;
+      }
+    }
+    if (*p == '\0') {
+      return NULL;
+    }
+    moved = malloc(strlen(list) + 2);
+    if (moved == NULL) {
+      return NULL;
+    }
+    memcpy(moved, name, len);
+    moved[len] = '\0';
+    if (p != list) {
+      /* the methods before it, then those after it */
+      strcat(moved, ",");
+      strncat(moved, list, p - list - 1);
+    }
+    if (p[len] == ',') {
+      strcat(moved, p + len);
+    }
+    return moved;
+}
+
+/** @internal
+ * @brief client side, before the server's KEXINIT: put the methods the
+ * destination put first the last time at the front of our KEXINIT and
+ * flag the kex packet following it, the server answers both at once.
+ * @returns the kex_type to guess, 0 for no guess (nothing known, or the
+ *          methods are not ours)
+ */
+int ssh_kex_guess_client(ssh_session_t * session){
+    ssh_kex_t *client = &session->next_crypto->client_kex;
+    kex_guess_t *guess;
+    char dest[64];
+    char *kex, *hostkey;
+    int kex_type;
+
+    guess = kex_guess_entry(session, dest, sizeof(dest));
+    if (guess == NULL || strcmp(guess->dest, dest) != 0) {
+      return 0;
+    }
+    kex_type = kex_type_from_name(guess->kex);
+    if (kex_type == 0) {
+      return 0;
+    }
+    kex = kex_move_first(client->methods[SSH_KEX], guess->kex, strlen(guess->kex));
+    hostkey = kex_move_first(client->methods[SSH_HOSTKEYS], guess->hostkey, strlen(guess->hostkey));
+    if (kex == NULL || hostkey == NULL) {
+      SAFE_FREE(kex);
+      SAFE_FREE(hostkey);
+      return 0;
+    }
+    SAFE_FREE(client->methods[SSH_KEX]);
+    SAFE_FREE(client->methods[SSH_HOSTKEYS]);
+    client->methods[SSH_KEX] = kex;
+    client->methods[SSH_HOSTKEYS] = hostkey;
+    client->first_kex_follows = 1;
+    SSH_INFO(SSH_LOG_PROTOCOL, "Guessing %s with %s for %s", guess->kex, guess->hostkey, dest);
+
+    return kex_type;
+}
+
+/** @internal
+ * @brief client side, the server banner is in: a guess learned from an
+ * other server version is not made again
+ */
+void ssh_kex_guess_banner(ssh_session_t * session){
+    kex_guess_t *guess;
+    char dest[64];
+
+    guess = kex_guess_entry(session, dest, sizeof(dest));
+    if (guess == NULL || session->serverbanner == NULL || strcmp(guess->dest, dest) != 0) {
+      return;
+    }
+    if (strncmp(guess->banner, session->serverbanner, sizeof(guess->banner) - 1) != 0) {
+      SSH_INFO(SSH_LOG_PROTOCOL, "%s is now %s, forgetting its kex", dest, session->serverbanner);
+      guess->dest[0] = '\0';
+    }
+}
+
+/** @internal
+ * @brief client side, the server's KEXINIT is in: remember what it puts
+ * first for the next connection to the destination
+ */
+void ssh_kex_guess_learn(ssh_session_t * session){
+    ssh_kex_t *server = &session->next_crypto->server_kex;
+    kex_guess_t *guess;
+    char dest[64];
+    size_t kex_len, hostkey_len;
+
+    guess = kex_guess_entry(session, dest, sizeof(dest));
+    kex_len = kex_first_len(server->methods[SSH_KEX]);
+    hostkey_len = kex_first_len(server->methods[SSH_HOSTKEYS]);
+    if (guess == NULL || session->serverbanner == NULL ||
+        kex_len == 0 || kex_len >= sizeof(guess->kex) ||
+        hostkey_len == 0 || hostkey_len >= sizeof(guess->hostkey)) {
+      return;
+    }
+    snprintf(guess->dest, sizeof(guess->dest), "%s", dest);
+    snprintf(guess->banner, sizeof(guess->banner), "%s", session->serverbanner);
+    memcpy(guess->kex, server->methods[SSH_KEX], kex_len);
+    guess->kex[kex_len] = '\0';
+    memcpy(guess->hostkey, server->methods[SSH_HOSTKEYS], hostkey_len);
+    guess->hostkey[hostkey_len] = '\0';
+}
+
 /* returns 1 if at least one of the name algos is in the default algorithms table */
 int verify_existing_algo(int algo, const char *name){
     char *ptr;
@@ -12,6 +12,8 @@
 #include "ssh/misc.h"
 #include "ssh/session.h"
 #include "api_log.h"
+#include "api_audit.h"
+#include "api_auditshm.h"
 
 LIBSSH_THREAD int ssh_log_level;
 LIBSSH_THREAD ssh_logging_callback ssh_log_cb;
@@ -210,47 +212,112 @@ int ssh_set_log_userdata(void *data)
     return 0;
 }
 
-// WANGFENG: proxy
-int ssh_log(ssh_session_t *session, const char *format, ...)
+// WANGFENG: proxy, access.log, the audit log and its ring, see api_audit.h and api_auditshm.h
+void ssh_log_reset(ssh_session_t *session)
 {
-	int iRet = SSH_OK;
+	if(session != NULL) {
+		session->log_head = 0;
+		session->log_len = 0;
+	}
+}
+
+// "cip:cport->sip:sport,user," is built once, "direct," when the route changes
+static const char *ssh_log_prefix(ssh_session_t *session, const api_audit_event_t *event, size_t *len)
+{
+	size_t size = sizeof(session->log_prefix);
+	int n = 0;
+
+	if(session->log_head == 0) {
+		n = snprintf(session->log_prefix, size, "%s:%d->%s:%d,%s,", event->cip, event->cport,
+			event->sip, event->sport, event->user);
+		session->log_head = n < 0 ? 0 : (n < (int)size ? n : (int)size - 1);
+		session->log_len = 0;
+	}
+	if(session->log_len == 0 || session->log_direct != session->direct) {
+		n = snprintf(session->log_prefix + session->log_head, size - session->log_head, "%s,", event->route);
+		session->log_len = session->log_head + (n < 0 ? 0 : (n < (int)(size - session->log_head) ? n : (int)(size - session->log_head) - 1));
+		session->log_direct = session->direct;
+	}
+	*len = session->log_len;
+	return session->log_prefix;
+}
+
+static int ssh_log_va(ssh_session_t *session, int type, const char *format, va_list args) PRINTF_ATTRIBUTE(3, 0);
+
+static int ssh_log_va(ssh_session_t *session, int type, const char *format, va_list args)
+{
+	api_audit_event_t event;
+	char line[4096 + 256];
+	const char *prefix = NULL;
+	size_t off = 0, n = 0;
+	int len = 0;
+
 	if(session == NULL || session->cip == NULL || session->sip == NULL) {
-		iRet = SSH_ERROR;
+		return SSH_ERROR;
+	}
+	memset(&event, 0x00, sizeof(event));
+	event.type = type;
+	event.user = session->username != NULL ? session->username : "";
+	event.route = session->direct != NULL ? session->direct : "";
+	if(session->type == 1) {
+		event.cip = session->cip;
+		event.cport = session->cport;
+		event.sip = session->sip;
+		event.sport = session->sport;
 	} else {
-		char tmpbuf[1024] = {0};
-		char fmtbuf[1024] = {0};
-		va_list args;
-		const char *username = session->username;
-		const char *direct = session->direct;
-		if(username == NULL) {
-			username = "";
-		}
-		if(direct == NULL) {
-			direct = "";
-		}
-		if(session->type == 1) {
-			iRet = snprintf(tmpbuf, sizeof(tmpbuf), "%s:%d->%s:%d,%s,%s,", session->cip, session->cport, 
-				session->sip, session->sport,
-				username, direct);
-		} else {
-			iRet = snprintf(tmpbuf, sizeof(tmpbuf), "%s:%d->%s:%d,%s,%s,", session->sip, session->sport, 
-				session->cip, session->cport,
-				username, direct);
-		}
-		if(iRet > 0) {
-			tmpbuf[iRet] = 0x00;
-		}
-		va_start(args, format);
-		iRet = snprintf(fmtbuf, sizeof(fmtbuf), "%s%s", tmpbuf, format);
-		if(iRet > 0) {
-			fmtbuf[iRet] = 0x00;
-		}
-		iRet = api_log(LOG_LEVEL_INFO, fmtbuf, args);
-		va_end(args);
-		iRet = SSH_OK;
+		event.cip = session->sip;
+		event.cport = session->sport;
+		event.sip = session->cip;
+		event.sport = session->cport;
 	}
-	
-	return iRet;
+	// "[time] prefix message\r\n", written out once
+	line[off++] = '[';
+	off += api_clock_string(line + off, sizeof(line) - off, &event.time);
+	line[off++] = ']';
+	line[off++] = ' ';
+	prefix = ssh_log_prefix(session, &event, &n);
+	memcpy(line + off, prefix, n);
+	off += n;
+	len = vsnprintf(line + off, sizeof(line) - off - 2, format, args);
+	if(len < 0) {
+		len = 0;
+	} else if(len > (int)(sizeof(line) - off - 3)) {
+		len = (int)(sizeof(line) - off - 3);
+	}
+	while(len > 0 && strchr(" \t\r\n", line[off + len - 1]) != NULL) {
+		len--;
+	}
+	line[off + len] = '\0';
+	event.message = line + off;
+	api_audit_log(&event);
+	api_auditshm_publish(&event);
+	off += len;
+	line[off++] = '\r';
+	line[off++] = '\n';
+	api_log_access(line, off);
+	return SSH_OK;
+}
+
+int ssh_log(ssh_session_t *session, const char *format, ...)
+{
+	va_list args;
+	int rc = SSH_OK;
+
+	va_start(args, format);
+	rc = ssh_log_va(session, API_AUDIT_OTHER, format, args);
+	va_end(args);
+	return rc;
+}
+
+int ssh_log_event(ssh_session_t *session, int type, const char *format, ...)
+{
+	va_list args;
+	int rc = SSH_OK;
+
+	va_start(args, format);
+	rc = ssh_log_va(session, type, format, args);
+	va_end(args);
+	return rc;
 }
 
 /** @} */
@@ -1041,7 +1041,7 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_info_response){
       goto error;
     }
     session->kbdint->answers[i] = ssh_string_to_char(tmp);
-	trace_out("session->kbdint->answers[i] = %s", session->kbdint->answers[i]);
+	trace_out("session->kbdint->answers[%d] set", (int)i);
     ssh_string_free(tmp);
     if (session->kbdint->answers[i] == NULL) {
       ssh_set_error_oom(session);
@@ -1596,6 +1596,11 @@ SSH_PACKET_CALLBACK(ssh_packet_global_request)
         if(ssh_callbacks_exists(session->common.callbacks, global_request_function)) {
             SSH_INFO(SSH_LOG_PROTOCOL, "Calling callback for SSH_MSG_GLOBAL_REQUEST %s %d %s:%d", request, want_reply, bind_addr, bind_port);
             session->common.callbacks->global_request_function(session, msg, session->common.callbacks->userdata);
+        } else if(session->proxy) {
+            // WANGFENG: proxy, relayed to the server, msg owns bind_addr
+            ssh_message_queue(session, msg);
+            msg = NULL;
+            bind_addr = NULL;
         } else {
             ssh_message_reply_default(msg);
         }
@@ -1617,6 +1622,11 @@ SSH_PACKET_CALLBACK(ssh_packet_global_request)
 
         if(ssh_callbacks_exists(session->common.callbacks, global_request_function)) {
             session->common.callbacks->global_request_function(session, msg, session->common.callbacks->userdata);
+        } else if(session->proxy) {
+            // WANGFENG: proxy, relayed to the server, msg owns bind_addr
+            ssh_message_queue(session, msg);
+            msg = NULL;
+            bind_addr = NULL;
         } else {
             ssh_message_reply_default(msg);
         }
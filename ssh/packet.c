@@ -51,9 +51,17 @@ static ssh_packet_callback default_packet_handlers[]= {
 #endif
   ssh_packet_dh_reply,                     // SSH2_MSG_KEXDH_REPLY                31
                                            // SSH2_MSG_KEX_DH_GEX_GROUP           31
-  NULL,                                    // SSH2_MSG_KEX_DH_GEX_INIT            32
-  NULL,                                    // SSH2_MSG_KEX_DH_GEX_REPLY           33
-  NULL,                                    // SSH2_MSG_KEX_DH_GEX_REQUEST         34
+#if WITH_SERVER
+  ssh_packet_kexdh_init,                   // SSH2_MSG_KEX_DH_GEX_INIT            32
+#else
+  NULL,
+#endif
+  ssh_packet_dh_reply,                     // SSH2_MSG_KEX_DH_GEX_REPLY           33
+#if WITH_SERVER
+  ssh_packet_kexdh_init,                   // SSH2_MSG_KEX_DH_GEX_REQUEST         34
+#else
+  NULL,
+#endif
   NULL, NULL, NULL, NULL, NULL, NULL,	NULL,
   NULL, NULL, NULL, NULL, NULL, NULL, NULL,
   NULL,                                    //                                     35-49
@@ -381,6 +389,13 @@ void ssh_packet_process(ssh_session_t * session, uint8_t type, const char *name)
 	ssh_packet_callbacks cb;
 	
 	SSH_INFO(SSH_LOG_PACKET, "Dispatching handler for packet type %d[%s]", type, name);
+	/* the peer's guessed kex packet, its guess was wrong */
+	if(type >= SSH2_MSG_KEXDH_INIT && type < SSH2_MSG_USERAUTH_REQUEST &&
+		session->next_crypto != NULL && session->next_crypto->kex_skip) {
+		session->next_crypto->kex_skip = 0;
+		SSH_INFO(SSH_LOG_PROTOCOL, "Ignoring the guessed kex packet type %d", type);
+		return;
+	}
 	if(session->packet_callbacks == NULL){
 		SSH_INFO(SSH_LOG_RARE,"%s(%d), Packet callback is not initialized !", name, type);
 		return;
@@ -62,7 +62,6 @@ SSH_PACKET_CALLBACK(ssh_packet_ignore_callback){
 
 SSH_PACKET_CALLBACK(ssh_packet_dh_reply){
   int rc;
-  (void)type;
   (void)user;
   SSH_INFO(SSH_LOG_PROTOCOL,"Received SSH_KEXDH_REPLY");
   if(session->session_state!= SSH_SESSION_STATE_DH &&
@@ -71,11 +70,28 @@ SSH_PACKET_CALLBACK(ssh_packet_dh_reply){
 			session->session_state,session->dh_handshake_state);
 	goto error;
   }
+  if((type == SSH2_MSG_KEX_DH_GEX_REPLY) !=
+		(session->next_crypto->kex_type == SSH_KEX_DH_GEX_SHA256 &&
+		session->dh_handshake_state != DH_STATE_GROUP_SENT)){
+	ssh_set_error(session,SSH_FATAL,"ssh_packet_dh_reply: unexpected packet type %d", type);
+	goto error;
+  }
   switch(session->next_crypto->kex_type){
     case SSH_KEX_DH_GROUP1_SHA1:
     case SSH_KEX_DH_GROUP14_SHA1:
       rc=ssh_client_dh_reply(session, packet);
       break;
+    case SSH_KEX_DH_GEX_SHA256:
+      if(session->dh_handshake_state == DH_STATE_GROUP_SENT){
+        /* SSH_MSG_KEX_DH_GEX_GROUP */
+        if(ssh_client_dh_gex_group(session, packet) == SSH_ERROR){
+          goto error;
+        }
+        session->dh_handshake_state = DH_STATE_INIT_SENT;
+        return SSH_PACKET_USED;
+      }
+      rc=ssh_client_dh_reply(session, packet);
+      break;
 #ifdef HAVE_ECDH
     case SSH_KEX_ECDH_SHA2_NISTP256:
       rc = ssh_client_ecdh_reply(session, packet);
@@ -204,6 +220,10 @@ SSH_PACKET_CALLBACK(ssh_packet_newkeys){
   }
   session->dh_handshake_state = DH_STATE_FINISHED;
   	session->ssh_connection_callback(session);
+	// WANGFENG: current_crypto is switched, nothing decrypted with it yet
+	if(session->newkeys_notify != NULL) {
+		session->newkeys_notify(session);
+	}
 	return SSH_PACKET_USED;
 error:
 	session->session_state=SSH_SESSION_STATE_ERROR;
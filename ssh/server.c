@@ -161,13 +161,95 @@ static int ssh_server_kexdh_init(ssh_session_t * session, ssh_buffer_t * packet)
     return SSH_OK;
 }
 
+/** @internal
+ * @brief the server side of diffie-hellman-group-exchange-sha256: a
+ *        request gets a group of the moduli table, SSH_MSG_KEX_DH_GEX_INIT
+ *        completes the exchange as SSH_MSG_KEXDH_INIT does
+ **/
+static int ssh_server_dh_gex(ssh_session_t * session, uint8_t type, ssh_buffer_t * packet){
+  ssh_crypto_t *crypto = session->next_crypto;
+  ssh_string_t * p = NULL;
+  ssh_string_t * g = NULL;
+  uint32_t min = 0, n = 0, max = 0;
+  int rc = SSH_ERROR;
+
+  if (type == SSH2_MSG_KEX_DH_GEX_INIT) {
+    if (session->dh_handshake_state != DH_STATE_GROUP_SENT) {
+      ssh_set_error(session, SSH_FATAL, "SSH_MSG_KEX_DH_GEX_INIT before the group");
+      return SSH_ERROR;
+    }
+    return ssh_server_kexdh_init(session, packet);
+  }
+  if (session->dh_handshake_state != DH_STATE_INIT) {
+    ssh_set_error(session, SSH_FATAL, "Invalid state for a group exchange request");
+    return SSH_ERROR;
+  }
+  if (type == SSH2_MSG_KEX_DH_GEX_REQUEST_OLD) {
+    if (buffer_get_u32(packet, &n) != 4) {
+      ssh_set_error(session, SSH_FATAL, "No size in the group exchange request");
+      return SSH_ERROR;
+    }
+    crypto->gex_min = crypto->gex_max = 0;
+    crypto->gex_n = ntohl(n);
+  } else {
+    if (buffer_get_u32(packet, &min) != 4 || buffer_get_u32(packet, &n) != 4 ||
+        buffer_get_u32(packet, &max) != 4) {
+      ssh_set_error(session, SSH_FATAL, "No sizes in the group exchange request");
+      return SSH_ERROR;
+    }
+    crypto->gex_min = ntohl(min);
+    crypto->gex_n = ntohl(n);
+    crypto->gex_max = ntohl(max);
+    if (crypto->gex_min > crypto->gex_n || crypto->gex_n > crypto->gex_max) {
+      ssh_set_error(session, SSH_FATAL, "Bad group exchange request %u, %u, %u",
+          crypto->gex_min, crypto->gex_n, crypto->gex_max);
+      return SSH_ERROR;
+    }
+  }
+  /* nothing below DH_GEX_MIN bits, nor above DH_GEX_MAX */
+  min = crypto->gex_min > DH_GEX_MIN ? crypto->gex_min : DH_GEX_MIN;
+  max = crypto->gex_max != 0 && crypto->gex_max < DH_GEX_MAX ? crypto->gex_max : DH_GEX_MAX;
+  if (dh_gex_choose(session, min, crypto->gex_n, max) < 0) {
+    ssh_set_error(session, SSH_FATAL, "No group of %u to %u bits", min, max);
+    return SSH_ERROR;
+  }
+  SSH_INFO(SSH_LOG_PACKET, "Group exchange: %u bits asked, %d given",
+      crypto->gex_n, bignum_num_bits(crypto->gex_p));
+
+  p = make_bignum_string(crypto->gex_p);
+  g = make_bignum_string(crypto->gex_g);
+  if (p == NULL || g == NULL ||
+      buffer_add_u8(session->out_buffer, SSH2_MSG_KEX_DH_GEX_GROUP) < 0 ||
+      buffer_add_ssh_string(session->out_buffer, p) < 0 ||
+      buffer_add_ssh_string(session->out_buffer, g) < 0) {
+    buffer_reinit(session->out_buffer);
+    goto end;
+  }
+  if (packet_send(session) == SSH_ERROR) {
+    goto end;
+  }
+  session->dh_handshake_state = DH_STATE_GROUP_SENT;
+  rc = SSH_OK;
+end:
+  ssh_string_free(p);
+  ssh_string_free(g);
+
+  return rc;
+}
+
 SSH_PACKET_CALLBACK(ssh_packet_kexdh_init){
   int rc;
-  (void)type;
   (void)user;
 
   SSH_INFO(SSH_LOG_PACKET,"Received SSH_MSG_KEXDH_INIT");
-  if(session->dh_handshake_state != DH_STATE_INIT){
+  if(session->next_crypto->kex_type == SSH_KEX_DH_GEX_SHA256){
+    /* SSH_MSG_KEX_DH_GEX_REQUEST(_OLD) and SSH_MSG_KEX_DH_GEX_INIT */
+    if (ssh_server_dh_gex(session, type, packet) == SSH_ERROR) {
+      session->session_state = SSH_SESSION_STATE_ERROR;
+    }
+    return SSH_PACKET_USED;
+  }
+  if(session->dh_handshake_state != DH_STATE_INIT || type != SSH2_MSG_KEXDH_INIT){
     SSH_INFO(SSH_LOG_RARE,"Invalid state for SSH_MSG_KEXDH_INIT");
     goto error;
   }
@@ -282,7 +364,9 @@ static int dh_handshake_server(ssh_session_t * session) {
     return -1;
   }
   
-  if (buffer_add_u8(session->out_buffer, SSH2_MSG_KEXDH_REPLY) < 0 ||
+  if (buffer_add_u8(session->out_buffer,
+          session->next_crypto->kex_type == SSH_KEX_DH_GEX_SHA256 ?
+          SSH2_MSG_KEX_DH_GEX_REPLY : SSH2_MSG_KEXDH_REPLY) < 0 ||
       buffer_add_ssh_string(session->out_buffer,
               session->next_crypto->server_pubkey) < 0 ||
       buffer_add_ssh_string(session->out_buffer, f) < 0 ||
@@ -371,7 +455,10 @@ static void ssh_server_connection_callback(ssh_session_t * session)
 		  		ssh_packet_set_default_callbacks(session);
 			set_status(session, 0.5f);
 		  	session->session_state = SSH_SESSION_STATE_INITIAL_KEX;
-          	if (ssh_send_kex(session, 1) < 0) {
+		  	if (session->flags & SSH_SESSION_FLAG_KEXINIT_SENT) {
+		  		/* sent with the banner, see ssh_handle_key_exchange() */
+		  		session->flags &= ~SSH_SESSION_FLAG_KEXINIT_SENT;
+		  	} else if (ssh_send_kex(session, 1) < 0) {
 				goto error;
 		  	}
 		  	break;
@@ -556,6 +643,17 @@ int ssh_handle_key_exchange(ssh_session_t * session) {
     if (rc < 0) {
         return SSH_ERROR;
     }
+    /*
+     * SSH-2 only: the KEXINIT goes in the same flight as the banner, the
+     * client has it with our banner instead of one round trip later
+     */
+    if (!session->opts.ssh1) {
+        session->version = 2;
+        if (ssh_send_kex(session, 1) < 0) {
+            return SSH_ERROR;
+        }
+        session->flags |= SSH_SESSION_FLAG_KEXINIT_SENT;
+    }
     pending:
 if(!session->proxy) {
     rc = ssh_handle_packets_termination(session, SSH_TIMEOUT_USER,
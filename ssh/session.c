@@ -144,17 +144,24 @@ ssh_session_t *ssh_new(void) {
 	session->datafellows = 0;
 	session->username = NULL;
 	session->data_send = NULL;
-	memset(session->bash, 0x00, sizeof(session->bash));
-	session->chan = NULL;
+	session->record = -1;
+	session->newkeys_notify = NULL;
+	session->channel_reply = NULL;
 	session->msg = NULL;
-	
-	session->sftp.file = -1;
-	session->sftp.filename = NULL;
-	session->sftp.version = 0;
-	session->sftp.fsize = 0;
-	session->sftp.expect_data = 0;
-	session->sftp.in_buffer = ssh_buffer_new();
-	session->sftp.pstate = PACKET_STATE_INIT;
+	session->pending = NULL;
+	session->global_reply = NULL;
+	session->route = 0;
+	session->route_connect = NULL;
+	session->hostkey_check = NULL;
+	session->shaper = NULL;
+	session->read_held = 0;
+	session->capture_full = 0;
+	session->capture_tick = NULL;
+	session->sched = 0;
+	session->sched_update = NULL;
+	session->log_head = 0;
+	session->log_len = 0;
+	session->log_direct = NULL;
     return session;
 
 err:
@@ -273,21 +280,18 @@ void ssh_free(ssh_session_t * session) {
 	  SAFE_FREE(session->cip);
 	  SAFE_FREE(session->sip);
 	  SAFE_FREE(session->username);
-	  if(session->chan != NULL) {
-	  	ssh_channel_free(session->chan);
-		session->chan = NULL;
+	  if(session->msg != NULL) {
+	  	ssh_message_free(session->msg);
+		session->msg = NULL;
 	  }
-	  if(session->sftp.file != -1 ) {
-	  	close(session->sftp.file);
-		session->sftp.file = -1;
+	  if(session->pending != NULL) {
+	  	ssh_message_t *msg = NULL;
+		while((msg = ssh_list_pop_head(ssh_message_t *, session->pending)) != NULL) {
+			ssh_message_free(msg);
+		}
+		ssh_list_free(session->pending);
+		session->pending = NULL;
 	  }
-	  session->sftp.fsize = 0;
-	  session->sftp.offset = 0;
-	  session->sftp.expect_data = 0;
-	  ssh_buffer_free(session->sftp.in_buffer);
-	  session->sftp.in_buffer = NULL;
-	  SAFE_FREE(session->sftp.filename);
-	  session->sftp.filename = NULL;
   }
 
   /* burn connection, it could hang sensitive datas */
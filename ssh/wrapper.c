@@ -90,6 +90,8 @@ void crypto_free(ssh_crypto_t *crypto){
   bignum_free(crypto->x);
   bignum_free(crypto->y);
   bignum_free(crypto->k);
+  bignum_free(crypto->gex_p);
+  bignum_free(crypto->gex_g);
 #ifdef HAVE_ECDH
   SAFE_FREE(crypto->ecdh_client_pubkey);
   SAFE_FREE(crypto->ecdh_server_pubkey);